@@ -0,0 +1,122 @@
+#pragma once
+
+#include <alsa/asoundlib.h>
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dragonfruit_engine/audio_engine.hpp"
+#include "dragonfruit_engine/convert.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief Engine playing straight into an ALSA device, without a sound server in between.
+ *
+ * An audio thread of the engine's own keeps the device's ring buffer filled. It sleeps in poll() until the device has
+ * room for another period, then renders the song straight into the ring through snd_pcm_mmap_begin/commit, converting
+ * to the device's sample format on the way if it does not take float. Devices without mmap access are written with
+ * snd_pcm_writei instead. Underruns and suspends are recovered from and counted.
+ *
+ * The device is opened for every song, at the song's sample rate, with the period length and period count from the
+ * options. Volume is applied in software when converting.
+ *
+ * While a song plays the audio thread owns the device and the song's state and never takes a lock. Seeks, pauses and
+ * speed changes are posted to it through a lock-free command slot and the wake eventfd, and it applies them between
+ * fills. The position and pause state are published back through atomics after every fill. Only opening and closing
+ * the device, when a song starts or stops, parks the audio thread on the mutex.
+ *
+ */
+class AlsaEngine final : public AudioEngine {
+   public:
+    /**
+     * @brief Construct a new engine and start its audio thread. The device is only opened once a song is played.
+     *
+     * @param options Options for the engine, including the ALSA device and its buffer sizing.
+     */
+    explicit AlsaEngine(const AudioEngineOptions& options = {});
+    ~AlsaEngine() override;
+
+    void PlayAsync(std::shared_ptr<Sound> sound) override;
+    void Stop() override;
+    void Pause(bool pause) override;
+    double GetTotalSongTime() override;
+    double GetCurrentSongTime() override;
+    void Seek(double seconds) override;
+    void SetVolume(double volume) override;
+    void SetSpeed(double speed) override;
+    bool IsPaused() override;
+
+   private:
+    // How long to wait before retrying a write when the sound has not loaded the requested data yet
+    static constexpr int STARVED_RETRY_MS = 5;
+
+    // Bits of m_commands, one per kind of control change waiting for the audio thread
+    static constexpr uint32_t COMMAND_SEEK = 1 << 0;
+    static constexpr uint32_t COMMAND_PAUSE = 1 << 1;
+    static constexpr uint32_t COMMAND_SPEED = 1 << 2;
+
+    void AudioLoop();
+    bool Park();
+    void ApplyCommands();
+    void ApplyPause(bool pause);
+    void Publish();
+    bool Fill();
+    size_t Write(size_t frames, int& error);
+    size_t Render(uint8_t* dst, size_t frames);
+    void Recover(int error);
+    void StartIfPrepared();
+
+    std::unique_lock<std::mutex> LockIdle();
+    void Post(uint32_t commands);
+    void Wake();
+    ChannelLayout OpenDevice(const Sound& sound);
+    void CloseDevice();
+    int64_t Delay();
+    void RestartAt(size_t frame);
+
+    // The device. Only opened and closed with the audio thread parked.
+    snd_pcm_t* m_pcm = nullptr;
+    SampleFormat m_format = SampleFormat::F32;
+    bool m_mmap = true;
+    bool m_can_pause = false;
+    snd_pcm_uframes_t m_period_frames = 0;
+    snd_pcm_uframes_t m_buffer_frames = 0;
+    std::vector<float> m_render;  // Holds rendered frames before they are converted to the device's format
+    std::vector<uint8_t> m_converted;  // Holds converted frames for devices written with snd_pcm_writei
+
+    // Amplitude applied when converting, the cube of the volume like PulseAudio's volume curve
+    std::atomic<float> m_amplitude = 1.0f;
+
+    // Playback state, owned by the audio thread while it runs and by callers of LockIdle while it is parked
+    bool m_paused = false;
+    bool m_draining = false;  // The whole song has been written and is playing out
+
+    // The command slot. Posting stores the change, sets its bit and wakes the audio thread. Pauses and speeds are
+    // latest wins, seeks add up until they are applied.
+    std::atomic<uint32_t> m_commands = 0;
+    std::atomic<double> m_seek_seconds = 0.0;
+    std::atomic<bool> m_wanted_pause = false;
+    std::atomic<double> m_wanted_speed = 1.0;
+
+    // Published by the audio thread after every fill, and by PlayAsync and Stop
+    std::atomic<double> m_position = 0.0;  // Seconds into the song of what is being heard
+    std::atomic<double> m_duration = 0.0;  // Length of the song in seconds
+    std::atomic<bool> m_published_paused = false;
+
+    // Parks the audio thread so the device can be opened or closed
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<int> m_interrupts = 0;  // Callers waiting for the audio thread to park
+    bool m_parked = false;              // The audio thread is waiting on m_cv, guarded by m_mutex
+    bool m_quit = false;
+    int m_wake_fd = -1;  // Written to wake the audio thread from poll()
+
+    std::thread m_thread;
+};
+
+}  // namespace dragonfruit
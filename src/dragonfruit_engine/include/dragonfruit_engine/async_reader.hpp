@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace dragonfruit {
+
+/**
+ * @brief A single positional read from a file descriptor.
+ *
+ */
+struct ReadRequest {
+    int fd = -1;
+    uint64_t offset = 0;
+    uint8_t* buffer = nullptr;
+    size_t length = 0;
+    uint64_t tag = 0;  // Groups requests together so they can be cancelled at once
+
+    // Called from a reader thread once the request has completed. The argument is the number of bytes read (which may
+    // be short at the end of a file) or a negative errno value. Cancelled requests complete with -ECANCELED.
+    std::function<void(ssize_t)> on_complete;
+};
+
+/**
+ * @brief Reads file ranges in the background and keeps several requests in flight at once. Uses io_uring where the
+ * kernel allows it and otherwise falls back to a small pool of threads issuing pread calls.
+ *
+ */
+class AsyncReader {
+   public:
+    // Reads are split into pieces of this size, aligned so they can be used with O_DIRECT
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+    static constexpr size_t ALIGNMENT = 4096;
+
+    virtual ~AsyncReader() = default;
+
+    /**
+     * @brief Queue a read. This never blocks on I/O, completion is reported through the request's callback.
+     *
+     * @param request The read to perform.
+     */
+    virtual void Submit(ReadRequest request) = 0;
+
+    /**
+     * @brief Cancel every queued request with the given tag which has not been handed to the kernel yet. Requests
+     * already in flight will still complete normally.
+     *
+     * @param tag The tag passed with the requests.
+     */
+    virtual void Cancel(uint64_t tag) = 0;
+
+    /**
+     * @brief Returns the name of the backend in use.
+     *
+     * @return Backend name.
+     */
+    virtual std::string Backend() const = 0;
+
+    /**
+     * @brief Creates a reader, preferring io_uring and falling back to a pread thread pool.
+     *
+     * @param queue_depth Maximum number of requests in flight at once.
+     * @return A new reader.
+     */
+    static std::unique_ptr<AsyncReader> Create(unsigned queue_depth = 8);
+
+    /**
+     * @brief Returns a process wide reader shared by every Sound.
+     *
+     * @return The shared reader.
+     */
+    static AsyncReader& Shared();
+
+    /**
+     * @brief Returns a new unique tag for grouping requests.
+     *
+     * @return A unique tag.
+     */
+    static uint64_t NewTag();
+};
+
+}  // namespace dragonfruit
@@ -1,48 +1,279 @@
 #pragma once
 
-#include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
-
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
+#include "dragonfruit_engine/audio_tap.hpp"
+#include "dragonfruit_engine/channel_layout.hpp"
+#include "dragonfruit_engine/convolver.hpp"
+#include "dragonfruit_engine/dsp_graph.hpp"
 #include "dragonfruit_engine/sound.hpp"
+#include "dragonfruit_engine/time_stretch.hpp"
 
 namespace dragonfruit {
 
+/**
+ * @brief Where an AudioEngine sends its samples.
+ *
+ */
+enum class AudioBackend {
+    PULSE,  // A stream on the PulseAudio (or PipeWire) server, which mixes it with everything else playing
+    ALSA,   // Straight into an ALSA device's ring buffer, bypassing any sound server
+};
+
+/**
+ * @brief Options for configuring an AudioEngine.
+ *
+ */
+struct AudioEngineOptions {
+    bool realtime = false;       // Run the audio thread with real-time priority and measure its page faults and jitter
+    int realtime_priority = 10;  // SCHED_FIFO priority to ask for
+    AudioBackend backend = AudioBackend::PULSE;
+    std::string alsa_device = "default";  // ALSA PCM to play on, such as hw:0, plughw:0 or null
+    unsigned alsa_period_us = 10000;      // Length of an ALSA period, how much is written each time the device wakes us
+    unsigned alsa_periods = 4;            // Periods in the ALSA ring buffer, which is the output latency
+
+    // Filter every song is convolved with, such as a room correction filter. None if empty.
+    std::shared_ptr<const ImpulseResponse> impulse_response;
+    size_t convolution_partition = 512;  // Frames per convolution partition, which is the latency it adds
+    size_t dsp_workers = 2;              // Threads which help the audio thread run the DSP graph's channels
+};
+
+/**
+ * @brief Measurements of the audio thread's write callback, collected in real-time mode.
+ *
+ */
+struct EngineStats {
+    bool realtime = false;  // Whether the audio thread got SCHED_FIFO scheduling
+    int priority = 0;       // Its SCHED_FIFO priority, or its nice value without real-time scheduling
+    uint64_t callbacks = 0;
+    uint64_t minor_faults = 0;  // Page faults taken inside the write callback
+    uint64_t major_faults = 0;  // Page faults inside the write callback which had to wait on I/O
+    double max_callback_us = 0.0;
+    double mean_interval_ms = 0.0;  // Mean time between consecutive callbacks
+    double jitter_ms = 0.0;         // Standard deviation of the time between consecutive callbacks
+    uint64_t underruns = 0;         // Times the output ran dry while playing, counted in every mode
+};
+
+/**
+ * @brief How far control changes have made it to the output, for measuring control latency. A change has taken effect
+ * once its counter goes up, at the time recorded next to it.
+ *
+ */
+struct ControlProgress {
+    uint64_t stream_changes = 0;                             // Song starts and seeks whose first samples were written
+    std::chrono::steady_clock::time_point stream_changed{};  // When the latest of them was first written
+    uint64_t cork_changes = 0;                               // Pauses and resumes the output has applied
+    std::chrono::steady_clock::time_point cork_changed{};    // When the latest of them was applied
+};
+
+// Written only by the audio thread, read by anyone
+struct CallbackTiming {
+    std::atomic<uint64_t> callbacks = 0;
+    std::atomic<uint64_t> minor_faults = 0;
+    std::atomic<uint64_t> major_faults = 0;
+    std::atomic<uint64_t> max_duration_ns = 0;
+    std::atomic<uint64_t> intervals = 0;
+    std::atomic<double> interval_sum_ms = 0.0;
+    std::atomic<double> interval_square_sum_ms = 0.0;
+    uint64_t last_start_ns = 0;  // Reset whenever playback is interrupted so pauses and seeks do not count as jitter
+};
+
+/**
+ * @brief Measures one write callback into a CallbackTiming for as long as it is alive. Does nothing without timing.
+ *
+ */
+class CallbackScope {
+   public:
+    explicit CallbackScope(CallbackTiming* timing);
+    ~CallbackScope();
+
+    CallbackScope(const CallbackScope&) = delete;
+    CallbackScope& operator=(const CallbackScope&) = delete;
+
+   private:
+    CallbackTiming* m_timing;
+    uint64_t m_start_ns = 0;
+    long m_minor_faults = 0;
+    long m_major_faults = 0;
+};
+
+/**
+ * @brief Scheduling a thread ended up with after asking for real-time priority.
+ *
+ */
+struct ThreadScheduling {
+    bool realtime = false;  // Whether SCHED_FIFO was granted
+    int priority = 0;       // The SCHED_FIFO priority, or the nice value the thread fell back to
+};
+
+/**
+ * @brief Ask for SCHED_FIFO scheduling for the calling thread, which should be the audio thread. Falls back to the
+ * highest nice value the limits allow when that is refused.
+ *
+ * @param priority SCHED_FIFO priority to ask for.
+ * @return The scheduling the thread got.
+ */
+ThreadScheduling PromoteCurrentThread(int priority);
+
 struct EngineState {
-    size_t offset = 0;        // Offset in bytes from the sample data to begin writing at
-    bool is_finished = true;  // Whether the current stream has been finished or not.
+    size_t frame = 0;                      // Frame of the sample data to begin writing at
+    std::atomic<bool> is_finished = true;  // Whether the current stream has been finished or not.
+    std::atomic<float> gain = 1.0f;        // Linear gain applied to every sample, used for loudness normalization
     std::shared_ptr<Sound> sound;
+    std::vector<uint8_t> scratch;       // Holds decoded PCM before it is converted to float into the output buffer
+    std::optional<ChannelMixer> mixer;  // Set when the song's channel layout differs from the output's
+    std::vector<float> unmixed;         // Holds samples in the song's layout before they are mixed to the output's
+    uint16_t out_channels = 0;          // Channels of the output
+    AudioTap* tap = nullptr;            // Receives a copy of every sample written to the output
+    CallbackTiming* timing = nullptr;   // Set in real-time mode to measure every write callback
+
+    // Set when playing at a speed other than 1, in which case frame is only where the stretcher was last restarted
+    std::optional<TimeStretcher> stretcher;
+
+    // Processes the output before it is written. What its nodes hold back is played out once the song has ended,
+    // graph_tail is how much of it is left.
+    DspGraph* graph = nullptr;
+    size_t graph_tail = 0;
+
+    // When samples were first written to a stream, zero until then
+    std::atomic<std::chrono::steady_clock::rep> first_write = 0;
+
+    // Every song start and seek is a new stream epoch, the first samples written for one record when they were
+    std::atomic<uint64_t> stream_epoch = 0;
+    std::atomic<uint64_t> written_epoch = 0;
+    std::atomic<std::chrono::steady_clock::rep> epoch_written = 0;
+    std::atomic<uint64_t> cork_acks = 0;
+    std::atomic<std::chrono::steady_clock::rep> cork_acked = 0;
+
+    std::atomic<uint64_t> underruns = 0;
 };
 
 /**
- * @brief Engine for playing sounds. Uses the PulseAudio API as a backend.
+ * @brief Render the next frames of the current song the way every backend plays them: decoded, stretched, mixed to
+ * the output's layout, with gain applied and run through the DSP graph. The frames are also copied to the
+ * tap, and the song's position is moved past them. Must only be called by the thread writing to the output.
+ *
+ * @param audio State of the current song.
+ * @param out Destination for frames * out_channels interleaved samples.
+ * @param frames Number of frames wanted.
+ * @return Number of frames written. Fewer than asked for if the song has not loaded far enough yet, or has ended.
+ */
+size_t RenderOutput(EngineState& audio, float* out, size_t frames);
+
+/**
+ * @brief Engine for playing sounds. Implemented by one class per audio backend, created with Create().
  *
  */
 class AudioEngine {
    public:
-    AudioEngine();
-    ~AudioEngine();
+    /**
+     * @brief Create an engine for the backend chosen in the options. Throws an exception if the backend could not be
+     * started.
+     *
+     * @param options Options for the engine.
+     * @return The engine.
+     */
+    static std::unique_ptr<AudioEngine> Create(const AudioEngineOptions& options = {});
+
+    virtual ~AudioEngine() = default;
+
+    AudioEngine(const AudioEngine&) = delete;
+    AudioEngine& operator=(const AudioEngine&) = delete;
+
+    virtual void PlayAsync(std::shared_ptr<Sound> sound) = 0;
 
-    void PlayAsync(std::shared_ptr<Sound> sound);
-    void Pause(bool pause);
+    /**
+     * @brief Stops playback and releases the engine's reference to the current sound.
+     *
+     */
+    virtual void Stop() = 0;
+    virtual void Pause(bool pause) = 0;
     bool IsFinished();
-    double GetTotalSongTime();
-    double GetCurrentSongTime();
-    void Seek(double seconds);
-    void SetVolume(double volume);
-    bool IsPaused();
+    virtual double GetTotalSongTime() = 0;
+    virtual double GetCurrentSongTime() = 0;
+    virtual void Seek(double seconds) = 0;
+    virtual void SetVolume(double volume) = 0;
 
-   private:
-    // PulseAudio state variables
-    pa_threaded_mainloop* m_mainloop = nullptr;
-    pa_mainloop_api* m_mainloop_api = nullptr;
-    pa_context* m_context = nullptr;
-    pa_stream* m_stream = nullptr;
-    pa_sample_spec m_sample_spec;
-    uint32_t m_sink_idx = 0;
+    /**
+     * @brief Sets the playback speed without changing the pitch. Takes effect immediately, and applies to every song
+     * played afterwards. Song times and seeks stay in the song's own time.
+     *
+     * @param speed Playback speed, clamped to [TimeStretcher::MIN_SPEED, TimeStretcher::MAX_SPEED].
+     */
+    virtual void SetSpeed(double speed) = 0;
+
+    /**
+     * @brief Sets a gain applied to the samples before they reach the output, independently of the volume. Samples
+     * are clamped to full scale after the gain is applied.
+     *
+     * @param gain Linear gain.
+     */
+    void SetGain(double gain);
+    virtual bool IsPaused() = 0;
+
+    /**
+     * @brief Returns the tap receiving a copy of the samples sent to the output, after gain has been applied.
+     *
+     * @return The engine's audio tap.
+     */
+    inline const AudioTap& Tap() const { return m_tap; }
+
+    /**
+     * @brief Returns the scheduling of the audio thread and measurements of its write callback. Callbacks are only
+     * measured in real-time mode.
+     *
+     * @return Audio thread statistics.
+     */
+    EngineStats Stats() const;
+
+    /**
+     * @brief Returns when the engine first handed samples to the output.
+     *
+     * @return Time of the first write, or nothing if no samples have been written yet.
+     */
+    std::optional<std::chrono::steady_clock::time_point> FirstWriteTime() const;
+
+    /**
+     * @brief Returns how far song starts, seeks, pauses and resumes have made it to the output.
+     *
+     * @return Control progress counters.
+     */
+    ControlProgress Progress() const;
+
+    /**
+     * @brief Returns the graph of processing nodes every song is run through before reaching the output, such as the
+     * room correction convolver. Nodes can be inserted and removed while playing.
+     *
+     * @return The engine's DSP graph.
+     */
+    inline DspGraph& Graph() { return m_graph; }
+    inline const DspGraph& Graph() const { return m_graph; }
+
+   protected:
+    explicit AudioEngine(const AudioEngineOptions& options);
+
+    // Helpers for the backends. Must be called while the audio thread is kept out of the engine state.
+    void SetupSong(std::shared_ptr<Sound> sound, const ChannelLayout& output);
+    void ResetStretcher();
+    void SetFrame(size_t frame);
+    double PlayedFrame(int64_t buffered_frames) const;
+
+    AudioEngineOptions m_options;
+    double m_speed = 1.0;
 
     // Keeps track of the state of the currently playing song
     EngineState m_engine_state;
+    AudioTap m_tap;
+    DspGraph m_graph;
+
+    CallbackTiming m_timing;
+    std::atomic<bool> m_realtime = false;
+    std::atomic<int> m_priority = 0;
 };
-}  // namespace dragonfruit
\ No newline at end of file
+
+}  // namespace dragonfruit
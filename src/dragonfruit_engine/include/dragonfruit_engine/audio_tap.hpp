@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace dragonfruit {
+
+/**
+ * @brief Lock-free ring holding the most recent samples handed to the output, for visualizations. The audio thread
+ * only ever does a bounded copy into the ring and never waits on readers. Readers take a snapshot of the latest samples
+ * and detect when the writer overwrote them mid-copy, in which case they simply try again on their next frame.
+ *
+ * Like a seqlock, the writer publishes the range it is about to overwrite before copying into it, and the samples as
+ * written once the copy is done. A reader copies from what was written, then checks the claimed range did not reach
+ * the samples it copied.
+ *
+ * There must only be a single writer. Any number of readers may read concurrently.
+ *
+ */
+class AudioTap {
+   public:
+    static constexpr size_t CAPACITY = 1 << 16;  // In samples, must be a power of two
+
+    AudioTap();
+
+    /**
+     * @brief Sets the layout of samples written from now on. Must be called from the writer's thread.
+     *
+     * @param channels Number of interleaved channels.
+     * @param sample_rate Sample rate in Hz.
+     */
+    void SetFormat(uint16_t channels, uint32_t sample_rate);
+
+    /**
+     * @brief Append interleaved samples to the ring. Only the last CAPACITY samples are kept.
+     *
+     * @param samples Samples to append.
+     * @param count Number of samples, a multiple of the channel count.
+     */
+    void Write(const float* samples, size_t count);
+
+    /**
+     * @brief Copy the most recently written frames.
+     *
+     * @param[out] dst Destination buffer, receives interleaved samples.
+     * @param frames Number of frames to copy.
+     * @param[out] channels Channel count of the copied samples.
+     * @param[out] sample_rate Sample rate of the copied samples.
+     * @return true if the frames were copied, false if not enough samples of the current format have been written yet
+     * or the writer overwrote them while they were being copied.
+     */
+    bool ReadLatest(float* dst, size_t frames, uint16_t& channels, uint32_t& sample_rate) const;
+
+    /**
+     * @brief Returns the total number of samples written so far. Stops advancing while nothing is playing.
+     *
+     * @return Number of samples written.
+     */
+    inline uint64_t WritePosition() const { return m_write_pos.load(std::memory_order_acquire); }
+
+   private:
+    std::unique_ptr<float[]> m_ring;
+    std::atomic<uint64_t> m_format = 0;      // Channels in the upper 32 bits, sample rate in the lower
+    std::atomic<uint64_t> m_format_pos = 0;  // Write position at which the current format started
+    alignas(64) std::atomic<uint64_t> m_claim_pos = 0;  // Samples written or being written, published before copying
+    std::atomic<uint64_t> m_write_pos = 0;              // Samples written, published after copying
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace dragonfruit {
+
+enum class HugePageMode { NONE, TRANSPARENT, EXPLICIT };
+
+/**
+ * @brief Options for configuring a BufferPool.
+ *
+ */
+struct BufferPoolOptions {
+    HugePageMode huge_pages = HugePageMode::NONE;
+    bool prefault = true;                 // Fault in freshly mapped buffers in the background, needs Linux 5.14
+    size_t max_cached_bytes = 64u << 20;  // Released buffers beyond this are returned to the kernel, about one song
+    size_t max_locked_bytes = 512u << 20;  // Buffers are not locked into RAM beyond this
+};
+
+/**
+ * @brief Usage statistics of a BufferPool.
+ *
+ */
+struct BufferPoolStats {
+    size_t hits = 0;          // Acquisitions served from a recycled buffer
+    size_t misses = 0;        // Acquisitions which had to map new memory
+    size_t cached_bytes = 0;  // Bytes held by released buffers waiting to be reused
+    size_t mapped_bytes = 0;  // Bytes currently mapped by the pool, in use or cached
+    size_t locked_bytes = 0;  // Bytes of buffers in use which are locked into RAM
+    size_t lock_failures = 0;  // Lock requests refused by the pool's budget or RLIMIT_MEMLOCK
+};
+
+class BufferPool;
+
+/**
+ * @brief A sample buffer borrowed from a BufferPool. The memory is returned to the pool when the buffer is destroyed.
+ * The contents of a buffer are not initialized.
+ *
+ */
+class PooledBuffer {
+   public:
+    PooledBuffer() = default;
+    ~PooledBuffer();
+
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    /**
+     * @brief Returns a pointer to the buffer. The pointer is always page aligned.
+     *
+     * @return Pointer to the buffer.
+     */
+    inline uint8_t* Data() const { return m_data; }
+
+    /**
+     * @brief Returns the size in bytes which was requested for this buffer.
+     *
+     * @return Size in bytes.
+     */
+    inline size_t Size() const { return m_size; }
+
+    /**
+     * @brief Returns the size in bytes of the underlying mapping, which is at least Size().
+     *
+     * @return Capacity in bytes.
+     */
+    inline size_t Capacity() const { return m_capacity; }
+
+    inline explicit operator bool() const { return m_data != nullptr; }
+
+    /**
+     * @brief Lock the buffer into RAM, faulting in every page now, so that reading it can never stall on a page fault.
+     * The buffer is unlocked again when it is returned to the pool.
+     *
+     * @return true if the buffer is locked, false if the pool's budget or RLIMIT_MEMLOCK does not allow it.
+     */
+    bool Lock();
+
+    /**
+     * @brief Returns whether the buffer is locked into RAM.
+     *
+     * @return true if the buffer is locked.
+     */
+    inline bool IsLocked() const { return m_locked; }
+
+   private:
+    friend class BufferPool;
+    PooledBuffer(BufferPool* pool, uint8_t* data, size_t size, size_t capacity)
+        : m_pool(pool), m_data(data), m_size(size), m_capacity(capacity) {}
+
+    void Release();
+
+    BufferPool* m_pool = nullptr;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+    bool m_locked = false;
+};
+
+/**
+ * @brief Recycles large sample buffers between songs. Buffers are anonymous mappings which can optionally be backed by
+ * transparent or explicit huge pages. Reusing an already faulted in buffer avoids both zero filling and the page fault
+ * storm of touching hundreds of MB of fresh memory every time a song is loaded.
+ *
+ * Only a small cache of released buffers is kept, enough to hand the buffer of the song just skipped to the next one.
+ * Freshly mapped buffers are prefaulted by a background thread of the pool while they are being filled, so neither
+ * Acquire nor the reads filling the buffer wait for the faults.
+ *
+ */
+class BufferPool {
+   public:
+    explicit BufferPool(const BufferPoolOptions& options = {});
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /**
+     * @brief Borrow a buffer of at least the given size. The smallest cached buffer that fits is reused if there is
+     * one, otherwise new memory is mapped and, if enabled, queued to be prefaulted in the background.
+     *
+     * @param size Size in bytes.
+     * @return A buffer which returns itself to the pool when destroyed.
+     */
+    PooledBuffer Acquire(size_t size);
+
+    /**
+     * @brief Return all cached buffers to the kernel.
+     *
+     */
+    void Trim();
+
+    /**
+     * @brief Returns the usage statistics of the pool.
+     *
+     * @return Usage statistics.
+     */
+    BufferPoolStats Stats() const;
+
+    /**
+     * @brief Returns a process wide pool used by sounds which are not given one explicitly.
+     *
+     * @return The shared pool.
+     */
+    static BufferPool& Shared();
+
+   private:
+    friend class PooledBuffer;
+    void Release(uint8_t* data, size_t capacity, bool locked);
+    bool Lock(uint8_t* data, size_t capacity);
+    uint8_t* Map(size_t capacity);
+    void Unmap(uint8_t* data, size_t capacity);
+    size_t RoundCapacity(size_t size) const;
+    void QueuePrefault(uint8_t* data, size_t capacity);
+    void CancelPrefault(uint8_t* data, std::unique_lock<std::mutex>& lock);
+    void PrefaultLoop();
+
+    BufferPoolOptions m_options;
+
+    mutable std::mutex m_mutex;
+    std::multimap<size_t, uint8_t*> m_free;  // Cached buffers keyed by capacity
+    BufferPoolStats m_stats;
+
+    // Freshly mapped buffers waiting for the prefault thread, which is started on first use. A buffer is only unmapped
+    // once the thread is done with it.
+    std::deque<std::pair<uint8_t*, size_t>> m_prefault_queue;
+    uint8_t* m_prefaulting = nullptr;
+    std::condition_variable m_prefault_cv;
+    bool m_stopping = false;
+    std::thread m_prefault_thread;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "dragonfruit_engine/thread_pool.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief Identifies a version of a file, used to invalidate cached data derived from it.
+ *
+ */
+struct FileStamp {
+    int64_t mtime = 0;
+    uintmax_t size = 0;
+
+    bool operator==(const FileStamp& other) const = default;
+};
+
+/**
+ * @brief Get the current stamp of a file.
+ *
+ * @param path Filepath.
+ * @return The file's stamp, or nothing if it could not be read.
+ */
+std::optional<FileStamp> GetFileStamp(const std::filesystem::path& path);
+
+/**
+ * @brief Returns the key cached data about a file is stored under: its absolute, normalized path.
+ *
+ * @param path Filepath.
+ * @return Cache key.
+ */
+std::string CacheKey(const std::filesystem::path& path);
+
+/**
+ * @brief Returns the directory Dragonfruit keeps its caches in, $XDG_CACHE_HOME/dragonfruit (or ~/.cache/dragonfruit).
+ * The directory is not created.
+ *
+ * @return Cache directory.
+ */
+std::filesystem::path CacheDirectory();
+
+/**
+ * @brief Replace a file with new contents. The contents are written to a temporary file next to it first, so a crash
+ * never leaves a truncated file behind.
+ *
+ * @param filepath File to replace. Missing parent directories are created.
+ * @param write Writes the new contents.
+ * @throws Exception If the file could not be written.
+ */
+void ReplaceFile(const std::filesystem::path& filepath, const std::function<void(std::ostream&)>& write);
+
+/**
+ * @brief Returns the indices of songs ordered from the largest file to the smallest. Songs which can not be read are
+ * put last.
+ *
+ * @param song_paths Filepaths of the songs.
+ * @return Indices into song_paths.
+ */
+std::vector<size_t> LargestFirst(const std::vector<std::filesystem::path>& song_paths);
+
+/**
+ * @brief Analyse every song on a thread pool, starting with the largest files so that no single long song is left
+ * running on its own at the end.
+ *
+ * @param song_paths Songs to analyse.
+ * @param pool Thread pool to run the analysis on.
+ * @param analyze Analyses one song, returning a std::optional which is empty if the song could not be analysed.
+ * Called from the pool's threads.
+ * @param on_progress Called after each song with the number of songs done so far. May be called from any thread.
+ * @return The result of every song, in the order of song_paths.
+ */
+template <typename Analyze>
+auto AnalyzeSongs(const std::vector<std::filesystem::path>& song_paths, ThreadPool& pool, const Analyze& analyze,
+                  const std::function<void(size_t)>& on_progress) {
+    // Every job owns its own result slot, so the workers never contend with each other
+    std::vector<std::invoke_result_t<const Analyze&, const std::filesystem::path&>> results(song_paths.size());
+    std::atomic<size_t> done = 0;
+    for (size_t i : LargestFirst(song_paths)) {
+        pool.Submit([&, i] {
+            results[i] = analyze(song_paths[i]);
+            size_t finished = done.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (on_progress) on_progress(finished);
+        });
+    }
+    pool.Wait();
+    return results;
+}
+
+/**
+ * @brief Measurements of songs, kept on disk as lines of tab separated values. Every entry is stamped with the version
+ * of the song it was measured from, so a song which has changed since is treated as not measured. Safe to use from
+ * multiple threads.
+ *
+ * Info is written with operator<< as tab separated fields and read back with operator>>.
+ *
+ * @tparam Info Measurements of a song.
+ */
+template <typename Info>
+class StampedStore {
+   public:
+    /**
+     * @brief Construct a new store backed by the given file. Existing entries are loaded if the file exists.
+     *
+     * @param filepath Filepath of the store.
+     */
+    explicit StampedStore(const std::filesystem::path& filepath) : m_filepath(filepath) {
+        std::ifstream file(m_filepath);
+        if (!file.is_open()) return;
+
+        // Each line is: mtime, size, the measurements, path. The path comes last so it may contain tabs.
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            Entry entry;
+            fields >> entry.stamp.mtime >> entry.stamp.size >> entry.info;
+            if (!fields || fields.get() != '\t') continue;
+
+            std::string key;
+            std::getline(fields, key);
+            if (!key.empty()) m_entries[key] = entry;
+        }
+    }
+
+    /**
+     * @brief Look up the measurements of a song.
+     *
+     * @param song_path Filepath of the song.
+     * @return The measurements, or nothing if the song has not been analysed or has changed since.
+     */
+    std::optional<Info> Find(const std::filesystem::path& song_path) const {
+        std::optional<FileStamp> stamp = GetFileStamp(song_path);
+        if (!stamp) return std::nullopt;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(CacheKey(song_path));
+        if (it == m_entries.end() || it->second.stamp != *stamp) return std::nullopt;
+        return it->second.info;
+    }
+
+    /**
+     * @brief Store the measurements of a song. Call Save() to write them to disk.
+     *
+     * @param song_path Filepath of the song.
+     * @param info The measurements.
+     */
+    void Store(const std::filesystem::path& song_path, const Info& info) {
+        std::optional<FileStamp> stamp = GetFileStamp(song_path);
+        if (!stamp) return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries[CacheKey(song_path)] = Entry{.stamp = *stamp, .info = info};
+    }
+
+    /**
+     * @brief Write the store to disk.
+     *
+     * @throws Exception If the store could not be written.
+     */
+    void Save() const {
+        ReplaceFile(m_filepath, [&](std::ostream& file) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            file.precision(17);
+            for (const auto& [key, entry] : m_entries) {
+                file << entry.stamp.mtime << '\t' << entry.stamp.size << '\t' << entry.info << '\t' << key << '\n';
+            }
+        });
+    }
+
+   private:
+    struct Entry {
+        FileStamp stamp;
+        Info info;
+    };
+
+    std::filesystem::path m_filepath;
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace dragonfruit {
+
+/**
+ * @brief Speaker positions, numbered like the bits of a WAVE_FORMAT_EXTENSIBLE channel mask.
+ *
+ */
+enum class Speaker : uint8_t {
+    FRONT_LEFT,
+    FRONT_RIGHT,
+    FRONT_CENTER,
+    LOW_FREQUENCY,
+    BACK_LEFT,
+    BACK_RIGHT,
+    FRONT_LEFT_OF_CENTER,
+    FRONT_RIGHT_OF_CENTER,
+    BACK_CENTER,
+    SIDE_LEFT,
+    SIDE_RIGHT,
+    TOP_CENTER,
+    TOP_FRONT_LEFT,
+    TOP_FRONT_CENTER,
+    TOP_FRONT_RIGHT,
+    TOP_BACK_LEFT,
+    TOP_BACK_CENTER,
+    TOP_BACK_RIGHT,
+    NONE,  // A channel without a speaker position
+};
+
+/**
+ * @brief Assignment of the channels of interleaved audio to speakers. Channels are ordered by speaker position, as in
+ * a WAV file's channel mask.
+ *
+ */
+class ChannelLayout {
+   public:
+    static constexpr uint32_t MONO = 0x4;
+    static constexpr uint32_t STEREO = 0x3;
+    static constexpr uint32_t QUAD = 0x33;
+    static constexpr uint32_t SURROUND_5_1 = 0x3F;
+    static constexpr uint32_t SURROUND_5_1_SIDE = 0x60F;
+    static constexpr uint32_t SURROUND_7_1 = 0x63F;
+
+    ChannelLayout() = default;
+
+    /**
+     * @brief Construct a layout from a WAV channel mask. Channels beyond those named by the mask have no position. An
+     * empty mask gives the default layout for the channel count.
+     *
+     * @param mask WAVE_FORMAT_EXTENSIBLE channel mask.
+     * @param channels Number of channels.
+     */
+    ChannelLayout(uint32_t mask, uint16_t channels);
+
+    /**
+     * @brief Construct a layout from the speaker of each channel.
+     *
+     * @param speakers Speaker of each channel, in channel order.
+     */
+    explicit ChannelLayout(const std::vector<Speaker>& speakers);
+
+    /**
+     * @brief Returns the usual layout of a file without a channel mask: mono, stereo, 2.1, quad, 5.0, 5.1, 6.1 and 7.1
+     * for 1 to 8 channels. Other channel counts have no positions.
+     *
+     * @param channels Number of channels.
+     * @return The default layout.
+     */
+    static ChannelLayout Default(uint16_t channels);
+
+    inline uint16_t Channels() const { return static_cast<uint16_t>(m_speakers.size()); }
+    inline uint32_t Mask() const { return m_mask; }
+    inline Speaker At(size_t channel) const { return m_speakers[channel]; }
+
+    /**
+     * @brief Returns the channel carrying a speaker.
+     *
+     * @param speaker Speaker position.
+     * @return Index of the channel, or -1 if the layout has no such speaker.
+     */
+    int IndexOf(Speaker speaker) const;
+
+    inline bool operator==(const ChannelLayout& other) const { return m_speakers == other.m_speakers; }
+
+   private:
+    uint32_t m_mask = 0;
+    std::vector<Speaker> m_speakers;
+};
+
+/**
+ * @brief Converts interleaved float audio between channel layouts with a mixing matrix.
+ *
+ * Speakers missing from the output are folded into their nearest neighbours using the ITU-R BS.775 downmix
+ * coefficients (centre and surrounds at -3 dB into the fronts, LFE dropped), so 7.1 goes to 5.1 and either goes to
+ * stereo. Upmixing only routes the speakers both layouts share, mono goes to both fronts at -3 dB. Downmix matrices
+ * are then scaled down as a whole so that full scale inputs can not overflow any output, mixed samples are only
+ * clamped as a safety net.
+ *
+ * Each output frame is computed as a sum of matrix columns scaled by the input samples, in vector registers.
+ * Kernels for the common channel counts are instantiated with the counts as template arguments so their loops are
+ * fully unrolled.
+ *
+ */
+class ChannelMixer {
+   public:
+    ChannelMixer(const ChannelLayout& input, const ChannelLayout& output);
+
+    /**
+     * @brief Mix frames from the input layout to the output layout.
+     *
+     * @param in Input samples, frames * input channels.
+     * @param out Output samples, frames * output channels. Must not overlap the input.
+     * @param frames Number of frames.
+     */
+    void Process(const float* in, float* out, size_t frames) const;
+
+    /**
+     * @brief Returns the gain from an input channel to an output channel.
+     *
+     * @param out Output channel.
+     * @param in Input channel.
+     * @return Linear gain.
+     */
+    inline float Coefficient(size_t out, size_t in) const { return m_matrix[out * m_in_channels + in]; }
+
+    /**
+     * @brief Returns whether mixing leaves the samples unchanged, in which case there is no need to mix at all.
+     *
+     * @return true if the layouts are the same.
+     */
+    inline bool IsIdentity() const { return m_identity; }
+
+   private:
+    using Kernel = void (*)(const float* columns, size_t in_channels, size_t out_channels, const float* in, float* out,
+                            size_t frames);
+
+    size_t m_in_channels;
+    size_t m_out_channels;
+    bool m_identity;
+    std::vector<float> m_matrix;   // Row major, out_channels x in_channels
+    std::vector<float> m_columns;  // Column per input channel, padded to the kernel's vector width
+    Kernel m_kernel;
+};
+
+}  // namespace dragonfruit
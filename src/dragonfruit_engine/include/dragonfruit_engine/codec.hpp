@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+namespace dragonfruit {
+
+enum class WavFormatCode;
+
+// Maximum number of interleaved channels supported by the compressed format decoders
+static constexpr size_t MAX_DECODER_CHANNELS = 8;
+
+/**
+ * @brief Parameters from the fmt chunk that are required to build a decoder for a compressed WAV format.
+ *
+ */
+struct DecoderParams {
+    uint16_t channels = 0;
+    uint16_t block_align = 0;
+    uint16_t bits_per_sample = 0;
+    std::vector<uint8_t> fmt_extension;  // Format specific bytes following cbSize in the fmt chunk
+};
+
+/**
+ * @brief Decodes blocks of a compressed WAV format into interleaved signed 16-bit PCM. Blocks are independent of each
+ * other, which allows the sample data to be decoded lazily in any order (for example after a seek).
+ *
+ */
+class Decoder {
+   public:
+    virtual ~Decoder() = default;
+
+    /**
+     * @brief Returns the size in bytes of a single encoded block.
+     *
+     * @return Size in bytes of an encoded block.
+     */
+    virtual size_t BlockSize() const = 0;
+
+    /**
+     * @brief Returns the number of frames contained in an encoded block of a given size. Only the final block of the
+     * data chunk may be smaller than BlockSize().
+     *
+     * @param block_size Size in bytes of the encoded block.
+     * @return Number of decoded frames.
+     */
+    virtual size_t FramesInBlock(size_t block_size) const = 0;
+
+    /**
+     * @brief Decode a single block into interleaved 16-bit PCM.
+     *
+     * @param[in] src Pointer to the encoded block.
+     * @param[in] src_size Size in bytes of the encoded block.
+     * @param[out] dst Destination buffer, must hold at least FramesInBlock(src_size) frames.
+     */
+    virtual void DecodeBlock(const uint8_t* src, size_t src_size, int16_t* dst) const = 0;
+};
+
+/**
+ * @brief Creates a decoder for a compressed WAV format.
+ *
+ * @param format The WAV format code.
+ * @param params Parameters read from the fmt chunk.
+ * @return A decoder, or an empty pointer if the format is not compressed.
+ */
+std::unique_ptr<Decoder> CreateDecoder(WavFormatCode format, const DecoderParams& params);
+
+/**
+ * @brief Decode a run of G.711 mu-law bytes into 16-bit PCM.
+ *
+ */
+void DecodeMuLaw(const uint8_t* src, int16_t* dst, size_t count);
+
+/**
+ * @brief Decode a run of G.711 A-law bytes into 16-bit PCM.
+ *
+ */
+void DecodeALaw(const uint8_t* src, int16_t* dst, size_t count);
+
+}  // namespace dragonfruit
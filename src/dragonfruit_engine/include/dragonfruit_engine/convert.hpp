@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+
+namespace dragonfruit {
+
+enum class WavFormatCode;
+
+/**
+ * @brief In-memory layout of decoded PCM samples.
+ *
+ */
+enum class SampleFormat { U8, S16, S24, S32, F32, F64, INVALID };
+
+/**
+ * @brief Get the sample format of decoded PCM data based on a given wav format and bit depth. Compressed formats are
+ * always decoded to 16-bit PCM.
+ *
+ * @param fmt_code Wav format code.
+ * @param bit_depth The bit depth of the sample data.
+ * @return The sample format, or SampleFormat::INVALID if it is not supported.
+ */
+SampleFormat GetSampleFormat(WavFormatCode fmt_code, int bit_depth);
+
+/**
+ * @brief Returns the size in bytes of a single sample.
+ *
+ * @param format The sample format.
+ * @return Size in bytes of one sample.
+ */
+size_t SampleSize(SampleFormat format);
+
+/**
+ * @brief Convert interleaved PCM samples to 32-bit float in the range [-1.0, 1.0].
+ *
+ * @param format Format of the source samples.
+ * @param[in] src Source samples.
+ * @param[out] dst Destination buffer.
+ * @param count Number of samples (not frames) to convert.
+ */
+void ConvertToFloat(SampleFormat format, const uint8_t* src, float* dst, size_t count);
+
+/**
+ * @brief Convert 32-bit float samples in the range [-1.0, 1.0] to interleaved PCM, scaling them on the way. Only the
+ * formats output devices take are supported: S16, S32 and F32.
+ *
+ * @param format Format of the destination samples.
+ * @param[in] src Source samples.
+ * @param[out] dst Destination buffer.
+ * @param count Number of samples (not frames) to convert.
+ * @param gain Linear gain, at most 1.0 so samples stay in range.
+ */
+void ConvertFromFloat(SampleFormat format, const float* src, uint8_t* dst, size_t count, float gain);
+
+/**
+ * @brief Multiply samples by a gain in place and clamp the result to [-1.0, 1.0].
+ *
+ * @param[in,out] samples Samples to scale.
+ * @param count Number of samples.
+ * @param gain Linear gain.
+ */
+void ApplyGain(float* samples, size_t count, float gain);
+
+}  // namespace dragonfruit
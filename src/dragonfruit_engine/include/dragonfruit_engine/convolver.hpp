@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <complex>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dragonfruit_engine/dsp_graph.hpp"
+#include "dragonfruit_engine/fft.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief An impulse response, such as a measured room correction filter, at the sample rate it was recorded at.
+ *
+ */
+class ImpulseResponse {
+   public:
+    // Longest impulse response accepted, in frames. About 22 seconds at 48 kHz.
+    static constexpr size_t MAX_FRAMES = size_t(1) << 20;
+
+    /**
+     * @brief Read an impulse response from a WAV file of any format the player supports. Silence trailing the response
+     * is trimmed. Throws an exception if the file cannot be read or is longer than MAX_FRAMES.
+     *
+     * @param path Filepath of the WAV file.
+     * @return The impulse response.
+     */
+    static ImpulseResponse Load(const std::filesystem::path& path);
+
+    /**
+     * @brief Construct an impulse response from samples.
+     *
+     * @param channels One filter per channel.
+     * @param sample_rate Sample rate the filters were recorded at.
+     */
+    ImpulseResponse(std::vector<std::vector<float>> channels, uint32_t sample_rate);
+
+    /**
+     * @brief Get one channel's filter at another sample rate, resampled with a windowed sinc.
+     *
+     * @param channel Channel of the filter.
+     * @param sample_rate Sample rate to resample to.
+     * @return The filter's taps at that rate.
+     */
+    std::vector<float> Resampled(size_t channel, uint32_t sample_rate) const;
+
+    /**
+     * @brief Get a single channel of the impulse response.
+     *
+     * @param channel The channel.
+     * @return An impulse response of just that channel.
+     */
+    ImpulseResponse Channel(size_t channel) const;
+
+    inline uint16_t Channels() const { return static_cast<uint16_t>(m_channels.size()); }
+    inline uint32_t SampleRate() const { return m_sample_rate; }
+    inline size_t Frames() const { return m_channels.empty() ? 0 : m_channels[0].size(); }
+
+   private:
+    std::vector<std::vector<float>> m_channels;
+    uint32_t m_sample_rate;
+};
+
+/**
+ * @brief Convolves interleaved audio with an impulse response, using uniformly partitioned overlap-save FFT
+ * convolution.
+ *
+ * The filter is split into partitions of a fixed number of frames and each is transformed once up front. Every time a
+ * partition's worth of input has been collected, it is transformed, the spectra of the latest inputs are multiplied
+ * with the spectra of the partitions they line up with and summed (vectorized four bins at a time), and a single
+ * inverse transform yields the next partition's worth of output. Processing therefore delays the audio by exactly one
+ * partition, while the cost per frame grows only with the number of partitions, so filters of 64k taps and more run
+ * in real time.
+ *
+ * A single channel impulse response is applied to every channel. Otherwise output channel c gets filter channel c
+ * modulo the number of filter channels.
+ *
+ * Every buffer is allocated up front, so processing never allocates and can run on the audio thread.
+ *
+ */
+class Convolver {
+   public:
+    static constexpr size_t MIN_PARTITION = 32;
+    static constexpr size_t MAX_PARTITION = 16384;
+
+    /**
+     * @brief Construct a convolver, resampling the impulse response to the audio's sample rate.
+     *
+     * @param response The impulse response.
+     * @param channels Channels of the audio.
+     * @param sample_rate Sample rate of the audio.
+     * @param partition Frames per partition, which is the added latency. Rounded up to a power of two in
+     * [MIN_PARTITION, MAX_PARTITION].
+     */
+    Convolver(const ImpulseResponse& response, uint16_t channels, uint32_t sample_rate, size_t partition);
+
+    /**
+     * @brief Convolve audio in place. The output lags the input by Latency() frames.
+     *
+     * @param samples frames * Channels() interleaved samples.
+     * @param frames Number of frames.
+     */
+    void Process(float* samples, size_t frames);
+
+    /**
+     * @brief Forget all audio processed so far, such as after a seek.
+     *
+     */
+    void Reset();
+
+    inline size_t Latency() const { return m_partition; }
+    inline size_t Partitions() const { return m_partitions; }
+    inline uint16_t Channels() const { return m_channels; }
+    inline uint32_t SampleRate() const { return m_sample_rate; }
+
+   private:
+    void ProcessPartition();
+
+    size_t m_partition;   // Frames per partition, half the transform size
+    size_t m_bins;        // Bins stored per spectrum, partition + 1 rounded up to a multiple of four
+    size_t m_partitions;  // Partitions of the filter
+    uint16_t m_channels;
+    uint32_t m_sample_rate;
+    RealFft m_fft;
+
+    // Spectra are stored with the real and imaginary parts split, so they can be multiplied four bins at a time
+    std::vector<float> m_filter_re;  // [filter][partition][bin]
+    std::vector<float> m_filter_im;
+    size_t m_filters = 0;
+    std::vector<float> m_input_re;  // [channel][partition][bin], a ring of the spectra of the latest inputs
+    std::vector<float> m_input_im;
+    size_t m_newest = 0;  // Ring slot of the latest input spectrum
+
+    std::vector<float> m_input;   // [channel][2 * partition], the previous partition of input followed by the current
+    std::vector<float> m_output;  // [channel][partition], output of the last partition
+    size_t m_fill = 0;            // Frames of the current partition collected so far
+
+    std::vector<std::complex<float>> m_spectrum;
+    std::vector<float> m_sum_re;
+    std::vector<float> m_sum_im;
+    std::vector<float> m_time;
+};
+
+/**
+ * @brief Runs a Convolver in a DspGraph, with a convolver of its own for every channel so that the graph can convolve
+ * them in parallel. Channel c gets filter channel c modulo the number of filter channels, as with Convolver.
+ *
+ */
+class ConvolverNode final : public DspNode {
+   public:
+    /**
+     * @brief Construct a node convolving with an impulse response.
+     *
+     * @param response The impulse response.
+     * @param partition Frames per partition, see Convolver.
+     */
+    ConvolverNode(std::shared_ptr<const ImpulseResponse> response, size_t partition);
+
+    inline std::string Name() const override { return "convolver"; }
+    void Prepare(uint16_t channels, uint32_t sample_rate, size_t max_frames) override;
+    void Reset() override;
+    size_t Latency() const override;
+    inline bool PerChannel() const override { return true; }
+    void ProcessChannel(size_t channel, float* samples, size_t frames) override;
+
+   private:
+    std::shared_ptr<const ImpulseResponse> m_response;
+    size_t m_partition;
+    uint32_t m_sample_rate = 0;
+    std::vector<Convolver> m_convolvers;  // One per channel
+};
+
+}  // namespace dragonfruit
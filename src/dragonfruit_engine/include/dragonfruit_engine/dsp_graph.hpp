@@ -0,0 +1,269 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dragonfruit {
+
+/**
+ * @brief A processing stage of a DspGraph. Audio is handed to nodes one block at a time, as one buffer per channel.
+ *
+ * Nodes whose channels are independent of each other (filters, convolution, ...) override PerChannel and
+ * ProcessChannel, which lets the graph run their channels in parallel. Every other node overrides Process and sees all
+ * channels at once.
+ *
+ */
+class DspNode {
+   public:
+    virtual ~DspNode() = default;
+
+    /**
+     * @brief Returns the name the node's timing is reported under.
+     *
+     * @return Name of the node.
+     */
+    virtual std::string Name() const = 0;
+
+    /**
+     * @brief Allocate everything processing needs for a format. Called off the audio thread, before the node is first
+     * processed and whenever the format changes.
+     *
+     * @param channels Channels of the audio.
+     * @param sample_rate Sample rate of the audio.
+     * @param max_frames Most frames a single call will process.
+     */
+    virtual void Prepare(uint16_t channels, uint32_t sample_rate, size_t max_frames) = 0;
+
+    /**
+     * @brief Forget all audio processed so far, such as after a seek. Called by the audio thread before the next block
+     * it processes, so like processing it must not allocate, lock or block.
+     *
+     */
+    virtual void Reset() {}
+
+    /**
+     * @brief Returns how many frames the node delays the audio by.
+     *
+     * @return Latency in frames.
+     */
+    virtual size_t Latency() const { return 0; }
+
+    /**
+     * @brief Returns whether every channel is processed on its own, in which case ProcessChannel is called instead of
+     * Process, concurrently for different channels.
+     *
+     * @return true if channels are independent.
+     */
+    virtual bool PerChannel() const { return false; }
+
+    /**
+     * @brief Process a block in place. Must not allocate, lock or block. The default processes each channel in turn
+     * with ProcessChannel.
+     *
+     * @param channels One buffer of samples per channel.
+     * @param channel_count Number of channels.
+     * @param frames Frames in each buffer.
+     */
+    virtual void Process(float* const* channels, uint16_t channel_count, size_t frames);
+
+    /**
+     * @brief Process one channel of a block in place. Must not allocate, lock or block.
+     *
+     * @param channel Index of the channel.
+     * @param samples Samples of the channel.
+     * @param frames Number of samples.
+     */
+    virtual void ProcessChannel(size_t channel, float* samples, size_t frames);
+};
+
+/**
+ * @brief Options for configuring a DspGraph.
+ *
+ */
+struct DspGraphOptions {
+    size_t workers = 2;          // Threads besides the audio thread which run independent channels in parallel
+    bool realtime = false;       // Give the workers the audio thread's real-time priority
+    int realtime_priority = 10;  // SCHED_FIFO priority to ask for
+};
+
+/**
+ * @brief CPU time spent in a node of a DspGraph.
+ *
+ */
+struct DspNodeStats {
+    std::string name;
+    uint64_t blocks = 0;       // Blocks processed
+    double cpu_ms = 0.0;       // CPU time spent processing, summed over every channel and thread
+    double load = 0.0;         // CPU time as a share of the audio's duration, 1.0 being a whole core
+    double max_call_us = 0.0;  // Longest single call to the node
+};
+
+/**
+ * @brief A chain of processing nodes between decoding and the output, run on every block the engine writes.
+ *
+ * The graph deinterleaves the audio into per channel block buffers allocated up front, runs the nodes in order and
+ * interleaves the result again, so processing never allocates. Runs of consecutive per channel nodes form one branch
+ * per channel. When a branch has recently cost more than PARALLEL_MIN_NS per block, its channels are spread over a
+ * small pool of worker threads, which the audio thread joins in on; cheaper branches run on the audio thread alone,
+ * where waking the workers would cost more than it saves.
+ *
+ * Nodes can be inserted and removed at any time without the audio thread ever taking a lock: the control thread
+ * prepares a new immutable list of nodes and swaps it in atomically, then waits for the audio thread to finish any
+ * block still using the old list before freeing it. Every call to a node is timed, see Stats.
+ *
+ */
+class DspGraph {
+   public:
+    // Frames processed per block. Longer writes are processed as several blocks.
+    static constexpr size_t BLOCK_FRAMES = 1024;
+
+    // Branches cheaper than this per block are not worth waking the workers for
+    static constexpr uint64_t PARALLEL_MIN_NS = 50000;
+
+    /**
+     * @brief Construct an empty graph. Its workers are started along with the first node.
+     *
+     * @param options Options for the graph.
+     */
+    explicit DspGraph(const DspGraphOptions& options = {});
+    ~DspGraph();
+
+    DspGraph(const DspGraph&) = delete;
+    DspGraph& operator=(const DspGraph&) = delete;
+
+    /**
+     * @brief Insert a node, preparing it for the current format first. Safe to call while audio is being processed.
+     *
+     * @param node The node.
+     * @param position Index in the chain to insert it at, the end by default.
+     */
+    void Insert(std::shared_ptr<DspNode> node, size_t position = SIZE_MAX);
+
+    /**
+     * @brief Remove a node. Safe to call while audio is being processed, the node is released once the audio thread
+     * no longer uses it.
+     *
+     * @param node The node.
+     * @return false if the node is not in the graph.
+     */
+    bool Remove(const std::shared_ptr<DspNode>& node);
+
+    /**
+     * @brief Set the format of the audio, preparing every node for it if it changed and resetting them otherwise. Must
+     * be called while the audio thread is kept out of the graph.
+     *
+     * @param channels Channels of the audio.
+     * @param sample_rate Sample rate of the audio.
+     */
+    void SetFormat(uint16_t channels, uint32_t sample_rate);
+
+    /**
+     * @brief Reset every node before the next block is processed, such as after a seek. Only sets a flag the audio
+     * thread checks, so it is safe to call from the audio thread itself.
+     *
+     */
+    void Reset();
+
+    /**
+     * @brief Process interleaved audio in place. Only for the audio thread.
+     *
+     * @param samples frames * channels interleaved samples, in the format last set.
+     * @param frames Number of frames.
+     */
+    void Process(float* samples, size_t frames);
+
+    /**
+     * @brief Returns how many frames the graph delays the audio by, the sum of its nodes' latencies.
+     *
+     * @return Latency in frames.
+     */
+    inline size_t Latency() const { return m_latency.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns whether the graph has no nodes.
+     *
+     * @return true if the graph is empty.
+     */
+    inline bool Empty() const { return m_empty.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the CPU time spent in each node, in chain order.
+     *
+     * @return Stats of every node.
+     */
+    std::vector<DspNodeStats> Stats() const;
+
+   private:
+    struct NodeTiming {
+        std::atomic<uint64_t> blocks = 0;
+        std::atomic<uint64_t> cpu_ns = 0;
+        std::atomic<uint64_t> audio_ns = 0;
+        std::atomic<uint64_t> max_call_ns = 0;
+    };
+
+    struct Slot {
+        std::shared_ptr<DspNode> node;
+        NodeTiming timing;
+    };
+
+    // Consecutive nodes run the same way: either all channels at once, or as one branch per channel
+    struct Stage {
+        bool per_channel = false;
+        std::vector<Slot*> slots;
+        uint64_t cost_ns = 0;  // CPU time the stage took for its last block, summed over its branches
+    };
+
+    struct Chain {
+        std::vector<Stage> stages;
+    };
+
+    // A run of per channel nodes handed to the workers. Written before a job is published, stable until it is done.
+    struct Job {
+        Stage* stage = nullptr;
+        size_t frames = 0;
+    };
+
+    void Publish();
+    void RunStage(Stage& stage, size_t frames);
+    uint64_t RunBranch(Stage& stage, size_t channel, size_t frames);
+    uint64_t RunBranches();
+    void WorkerLoop();
+    static void Record(NodeTiming& timing, uint64_t ns);
+
+    DspGraphOptions m_options;
+
+    // Control side, guarded by the mutex. The audio thread never takes it.
+    mutable std::mutex m_mutex;
+    std::vector<std::shared_ptr<Slot>> m_slots;
+    uint16_t m_channels = 0;
+    uint32_t m_sample_rate = 0;
+
+    // The chain the audio thread runs, and an odd count while the audio thread is running a block
+    std::atomic<Chain*> m_chain = nullptr;
+    std::atomic<uint64_t> m_process_count = 0;
+    std::atomic<size_t> m_latency = 0;
+    std::atomic<bool> m_empty = true;
+    std::atomic<bool> m_reset = false;  // Nodes are reset before the next block, see Reset
+
+    // Per channel block buffers, allocated by SetFormat
+    std::vector<float> m_buffers;
+    std::vector<float*> m_channel_buffers;
+
+    // Job sequence << 32 | channel count << 16 | next channel to claim. Workers wait for it to change.
+    std::atomic<uint64_t> m_claim = 0;
+    std::atomic<uint32_t> m_done = 0;       // Channels of the current job processed
+    std::atomic<uint64_t> m_branch_ns = 0;  // CPU time the current job's branches took
+    std::atomic<bool> m_quit = false;
+    Job m_job;
+    std::vector<std::thread> m_workers;  // Started with the first node
+    std::atomic<bool> m_workers_started = false;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace dragonfruit {
+
+/**
+ * @brief Fast Fourier transform of real signals with a fixed power of two size. The real input is packed into a complex
+ * transform of half the size, which runs a radix-4 first pass followed by radix-2 passes vectorized four butterflies
+ * at a time.
+ *
+ */
+class RealFft {
+   public:
+    /**
+     * @brief Construct a new transform, precomputing its twiddle factors.
+     *
+     * @param size Number of real input samples. Must be a power of two and at least 16.
+     */
+    explicit RealFft(size_t size);
+
+    /**
+     * @brief Compute the spectrum of a real signal.
+     *
+     * @param[in] input Size() real samples.
+     * @param[out] output Size() / 2 + 1 complex bins, from DC up to and including Nyquist.
+     */
+    void Forward(const float* input, std::complex<float>* output);
+
+    /**
+     * @brief Compute a real signal from its spectrum, the exact inverse of Forward.
+     *
+     * @param[in] input Size() / 2 + 1 complex bins, from DC up to and including Nyquist.
+     * @param[out] output Size() real samples.
+     */
+    void Inverse(const std::complex<float>* input, float* output);
+
+    /**
+     * @brief Returns the number of real samples the transform operates on.
+     *
+     * @return Transform size.
+     */
+    inline size_t Size() const { return m_size; }
+
+   private:
+    void ComplexTransform();
+
+    size_t m_size;
+    size_t m_half;  // Size of the complex transform
+
+    std::vector<size_t> m_bit_reverse;
+    std::vector<float> m_twiddle_re;  // Twiddles of the complex transform, -sin/cos(2*pi*k/half)
+    std::vector<float> m_twiddle_im;
+    std::vector<std::complex<float>> m_real_twiddles;  // Twiddles for splitting the packed result, e^(-2*pi*i*k/size)
+
+    // Split real/imaginary working buffers
+    std::vector<float> m_re;
+    std::vector<float> m_im;
+};
+
+}  // namespace dragonfruit
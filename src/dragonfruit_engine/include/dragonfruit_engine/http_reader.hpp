@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace dragonfruit {
+
+/**
+ * @brief Returns whether a song location is an HTTP URL rather than a filepath.
+ *
+ * @param location Filepath or URL.
+ * @return true if the location starts with http:// or https://.
+ */
+bool IsHttpUrl(std::string_view location);
+
+/**
+ * @brief Streams a file from an HTTP server with byte range requests, over a single kept alive connection.
+ *
+ * The start of the file is fetched on construction so its headers can be parsed. Start then downloads a range of the
+ * file into a buffer in the background, tracking which blocks of it have arrived so reads never wait on the network.
+ * Every request is sized from the throughput measured so far to take about WINDOW_SECONDS: on slow or jittery links
+ * data arrives in small steps and a seek is never stuck behind a long request, on fast links requests grow until
+ * round trips no longer limit the throughput. A read of data which has not arrived yet moves the download there, and
+ * whatever it skipped is filled in once the rest of the range is done. Dropped connections are retried.
+ *
+ * Only plain HTTP is supported.
+ *
+ */
+class HttpReader {
+   public:
+    static constexpr size_t HEAD_SIZE = 64 << 10;   // Bytes fetched on construction, for the file's headers
+    static constexpr size_t BLOCK_SIZE = 64 << 10;  // Arrival of the data is tracked in blocks of this size
+    static constexpr size_t MIN_WINDOW = BLOCK_SIZE;
+    static constexpr size_t MAX_WINDOW = 16 << 20;
+    static constexpr double WINDOW_SECONDS = 0.5;  // How long a request should take at the measured throughput
+    static constexpr int MAX_ATTEMPTS = 5;         // Tries of a request before the download is given up
+    static constexpr std::chrono::milliseconds RETRY_DELAY{250};
+
+    /**
+     * @brief Connect to the server and fetch the start of the file.
+     *
+     * @param url http:// URL of the file.
+     */
+    explicit HttpReader(const std::string& url);
+    ~HttpReader();
+
+    HttpReader(const HttpReader&) = delete;
+    HttpReader& operator=(const HttpReader&) = delete;
+
+    /**
+     * @brief Returns the first HEAD_SIZE bytes of the file, or all of it if it is shorter.
+     *
+     * @return Start of the file.
+     */
+    inline const std::string& Head() const { return m_head; }
+
+    /**
+     * @brief Returns the size of the whole file as reported by the server.
+     *
+     * @return Size in bytes.
+     */
+    inline uint64_t Size() const { return m_size; }
+
+    /**
+     * @brief Start downloading a range of the file in the background. May only be called once.
+     *
+     * @param offset Offset of the range in the file.
+     * @param buffer Buffer receiving the range, which has to outlive the reader.
+     * @param length Length of the range. Bytes past the end of the file are zeroed.
+     * @param on_finished Called from the download thread once nothing more will arrive, with true if the download
+     * failed part way.
+     */
+    void Start(uint64_t offset, uint8_t* buffer, size_t length, std::function<void(bool)> on_finished);
+
+    /**
+     * @brief Returns how many bytes from an offset into the range have arrived, without waiting. Safe to call from
+     * any thread, including the audio thread.
+     *
+     * @param offset Offset into the range.
+     * @param length Most bytes wanted.
+     * @return Bytes which can be read from offset, 0 if the data at offset has not arrived yet.
+     */
+    size_t Readable(size_t offset, size_t length) const;
+
+    /**
+     * @brief Ask for the data at an offset into the range to be downloaded next. Never blocks.
+     *
+     * @param offset Offset into the range.
+     */
+    void Want(size_t offset);
+
+   private:
+    class Connection;
+
+    size_t Fetch(uint64_t offset, size_t length, uint8_t* dst, uint64_t& file_size);
+    size_t NextMissing(size_t block) const;
+    void LoadLoop();
+
+    std::unique_ptr<Connection> m_connection;
+    std::string m_head;
+    uint64_t m_size = 0;
+
+    // The range being downloaded, fixed by Start
+    uint64_t m_offset = 0;
+    uint8_t* m_buffer = nullptr;
+    size_t m_length = 0;
+    size_t m_blocks = 0;
+    std::unique_ptr<std::atomic<bool>[]> m_ready;
+    size_t m_from_head = 0;  // Bytes at the start of the range copied from the head, readable from the start
+    std::function<void(bool)> m_on_finished;
+
+    std::atomic<uint64_t> m_wanted = UINT64_MAX;  // Offset asked for by Want, UINT64_MAX if none
+    std::atomic<bool> m_stop = false;
+    std::thread m_thread;
+};
+
+}  // namespace dragonfruit
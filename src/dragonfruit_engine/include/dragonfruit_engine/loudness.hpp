@@ -0,0 +1,202 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <filesystem>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "dragonfruit_engine/cache.hpp"
+
+namespace dragonfruit {
+
+class ThreadPool;
+
+enum class GainMode { NONE, TRACK, ALBUM };
+
+/**
+ * @brief Histogram of gating block loudness in 0.1 LU steps from -70 to +5 LUFS. Histograms of several songs can be
+ * merged to compute the gated loudness of a whole album without keeping every block around.
+ *
+ */
+struct LoudnessHistogram {
+    static constexpr double MIN_LUFS = -70.0;
+    static constexpr double MAX_LUFS = 5.0;
+    static constexpr double STEP = 0.1;
+    static constexpr size_t BINS = static_cast<size_t>((MAX_LUFS - MIN_LUFS) / STEP);
+
+    std::vector<uint32_t> counts = std::vector<uint32_t>(BINS, 0);
+
+    void Add(double block_lufs);
+    void Merge(const LoudnessHistogram& other);
+
+    /**
+     * @brief Returns the gated (absolute and -10 LU relative gate) loudness of every block in the histogram.
+     *
+     * @return Integrated loudness in LUFS, or -infinity if every block was below the absolute gate.
+     */
+    double GatedLoudness() const;
+};
+
+/**
+ * @brief Measures the loudness of a song as described by ITU-R BS.1770 / EBU R128: K-weighted, gated integrated
+ * loudness and the true peak measured with 4x oversampling.
+ *
+ */
+class LoudnessAnalyzer {
+   public:
+    LoudnessAnalyzer(uint16_t channels, uint32_t sample_rate);
+
+    /**
+     * @brief Feed interleaved samples into the analyzer.
+     *
+     * @param frames Interleaved float samples.
+     * @param count Number of frames.
+     */
+    void Process(const float* frames, size_t count);
+
+    /**
+     * @brief Returns the gated integrated loudness of everything processed so far.
+     *
+     * @return Integrated loudness in LUFS, or -infinity for silence.
+     */
+    double IntegratedLoudness() const;
+
+    /**
+     * @brief Returns the highest true peak of any channel.
+     *
+     * @return Linear true peak, 1.0 being full scale.
+     */
+    inline double TruePeak() const { return m_true_peak; }
+
+    /**
+     * @brief Returns the histogram of gating block loudness, for combining songs into an album measurement.
+     *
+     * @return The block histogram.
+     */
+    inline const LoudnessHistogram& Histogram() const { return m_histogram; }
+
+   private:
+    // Two channels are filtered at once with SSE2 sized vectors of doubles
+    typedef double v2d __attribute__((vector_size(16)));
+    typedef float v4sf __attribute__((vector_size(16)));
+
+    struct Biquad {
+        v2d b0, b1, b2, a1, a2;
+        v2d z1 = {0, 0};
+        v2d z2 = {0, 0};
+
+        inline v2d Process(v2d x) {
+            v2d y = b0 * x + z1;
+            z1 = b1 * x - a1 * y + z2;
+            z2 = b2 * x - a2 * y;
+            return y;
+        }
+    };
+
+    struct ChannelPair {
+        Biquad pre_filter;  // High shelf modelling the acoustic effect of the head
+        Biquad rlb_filter;  // Revised low-frequency B-weighting high pass
+        v2d sum = {0, 0};   // Sum of squares over the current 100ms sub-block
+    };
+
+    static constexpr size_t TRUE_PEAK_TAPS = 12;
+    static constexpr size_t TRUE_PEAK_PHASES = 4;
+
+    struct PeakState {
+        float history[TRUE_PEAK_TAPS * 2] = {};  // Doubled so the newest TAPS samples are always contiguous
+        size_t pos = 0;
+    };
+
+    void FinishSubBlock();
+    float OversampledPeak(PeakState& state, float sample);
+
+    uint16_t m_channels;
+    bool m_oversample;
+    std::vector<ChannelPair> m_pairs;
+    std::vector<double> m_weights;
+    std::vector<PeakState> m_peak_states;
+
+    size_t m_sub_block_len;
+    size_t m_sub_block_pos = 0;
+    double m_sub_blocks[4] = {};  // Channel weighted mean square of the last four sub-blocks
+    size_t m_sub_block_count = 0;
+
+    std::vector<double> m_block_powers;
+    LoudnessHistogram m_histogram;
+    double m_true_peak = 0.0;
+};
+
+/**
+ * @brief Stored loudness measurements of a song.
+ *
+ */
+struct LoudnessInfo {
+    double track_lufs = 0.0;
+    double track_peak = 0.0;  // Linear true peak
+    double album_lufs = 0.0;
+    double album_peak = 0.0;  // Linear true peak of the loudest song in the album
+};
+
+/**
+ * @brief Returns the linear gain to apply to a song to bring it to the ReplayGain 2.0 reference level of -18 LUFS. The
+ * gain is limited so that the song's true peak does not clip.
+ *
+ * @param info Loudness measurements of the song.
+ * @param mode Whether to use the track or album measurement.
+ * @return Linear gain, 1.0 for GainMode::NONE.
+ */
+double ReplayGain(const LoudnessInfo& info, GainMode mode);
+
+/**
+ * @brief Write the measurements of a song as tab separated fields: track lufs, track peak, album lufs, album peak.
+ *
+ */
+std::ostream& operator<<(std::ostream& out, const LoudnessInfo& info);
+
+/**
+ * @brief Read the measurements of a song written by operator<<.
+ *
+ */
+std::istream& operator>>(std::istream& in, LoudnessInfo& info);
+
+/**
+ * @brief Persistent store of loudness measurements, keyed by path. Entries are invalidated when a file's size or
+ * modification time changes.
+ *
+ */
+class LoudnessStore : public StampedStore<LoudnessInfo> {
+   public:
+    /**
+     * @brief Construct a new store backed by the given file. Existing entries are loaded if the file exists.
+     *
+     * @param filepath Filepath of the store.
+     */
+    explicit LoudnessStore(const std::filesystem::path& filepath = DefaultPath()) : StampedStore(filepath) {}
+
+    /**
+     * @brief Returns the default location of the store, inside $XDG_CACHE_HOME (or ~/.cache).
+     *
+     * @return Default filepath.
+     */
+    static std::filesystem::path DefaultPath();
+};
+
+/**
+ * @brief Analyse the loudness of every song in parallel and record the results in a store. Songs are grouped into
+ * albums by directory and album tag for the album measurements. The longest songs are started first.
+ *
+ * @param song_paths Songs to analyse.
+ * @param store Store receiving the measurements.
+ * @param pool Thread pool to run the analysis on.
+ * @param on_progress Called after each song with the number of songs done so far. May be called from any thread.
+ * @return Number of songs which were analysed successfully.
+ */
+size_t AnalyzeLoudness(const std::vector<std::filesystem::path>& song_paths, LoudnessStore& store, ThreadPool& pool,
+                       const std::function<void(size_t)>& on_progress = nullptr);
+
+}  // namespace dragonfruit
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "dragonfruit_engine/exception.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief Unbounded multi-producer single-consumer queue. Pushing is lock-free and never blocks, so it is safe to call
+ * from UI or input handling threads. The consumer can sleep until something is pushed.
+ *
+ * Based on Dmitry Vyukov's intrusive MPSC node queue: producers swap themselves in at the head, the single consumer
+ * walks the list from the tail. Nodes come from a preallocated pool, kept as a lock-free stack whose top carries a
+ * version tag against ABA, and only a burst of more than POOL_SIZE queued values falls back to the heap. The consumer
+ * is only woken (an eventfd write) when the queue goes from empty to non-empty, so pushes into a queue the consumer
+ * has yet to drain make no system call.
+ *
+ * A producer preempted between swapping the head and linking its node hides every node pushed after it, and the push
+ * which found the queue empty may well be one of those. Wait therefore never sleeps while values are counted as
+ * pending, it yields instead until the stalled producer has linked its node and TryPop can reach them.
+ *
+ * @tparam T Type of the queued values, must be default constructible.
+ */
+template <typename T>
+class MpscQueue {
+   public:
+    // Nodes allocated up front
+    static constexpr uint32_t POOL_SIZE = 256;
+
+    MpscQueue() : m_pool(new Node[POOL_SIZE]) {
+        // The pool is stacked in reverse, so that the first nodes handed out are the first in memory
+        for (uint32_t i = POOL_SIZE; i-- > 0;) {
+            m_pool[i].index = i;
+            Release(&m_pool[i]);
+        }
+        m_tail = Acquire();
+        m_head.store(m_tail, std::memory_order_relaxed);
+
+        m_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_event_fd < 0) throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to create queue eventfd");
+    }
+
+    ~MpscQueue() {
+        T value;
+        while (TryPop(value));
+        Release(m_tail);
+        close(m_event_fd);
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /**
+     * @brief Push a value onto the queue and wake the consumer. Can be called from any thread.
+     *
+     * @param value The value to push.
+     */
+    void Push(T value) {
+        Node* node = Acquire();
+        node->value = std::move(value);
+
+        Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+
+        // Counted only once the node is linked, the push taking the count off zero wakes the consumer
+        if (m_pending.fetch_add(1, std::memory_order_seq_cst) == 0) {
+            uint64_t one = 1;
+            (void)!write(m_event_fd, &one, sizeof(one));
+        }
+    }
+
+    /**
+     * @brief Pop the oldest value off the queue. Must only be called from the consumer thread. After a Wait, values
+     * should be popped until this returns false, later pushes only wake the consumer once the queue was empty.
+     *
+     * @param[out] value Receives the popped value.
+     * @return true if a value was popped, false if the queue was empty or the oldest push has not been linked yet.
+     */
+    bool TryPop(T& value) {
+        Node* tail = m_tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) return false;
+
+        value = std::move(next->value);
+        m_tail = next;
+        Release(tail);
+        m_pending.fetch_sub(1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    /**
+     * @brief Sleep until a value has been pushed or the timeout expires. Must only be called from the consumer thread.
+     * May return early, callers should always try popping afterwards. Returns straight away, after yielding, while
+     * pushed values are left which TryPop could not reach yet.
+     *
+     * @param timeout_ms Timeout in milliseconds, or -1 to wait indefinitely.
+     */
+    void Wait(int timeout_ms) {
+        // The wake for these may already have been consumed by a Wait which then found nothing to pop
+        if (m_pending.load(std::memory_order_seq_cst) > 0) {
+            std::this_thread::yield();
+            return;
+        }
+
+        pollfd fd = {.fd = m_event_fd, .events = POLLIN, .revents = 0};
+        if (poll(&fd, 1, timeout_ms) > 0) {
+            uint64_t count;
+            (void)!read(m_event_fd, &count, sizeof(count));
+        }
+    }
+
+   private:
+    static constexpr uint32_t HEAP_NODE = UINT32_MAX;
+    static constexpr uint64_t FREE_INDEX_MASK = 0xFFFFFFFF;  // Index + 1 of the top free node, 0 if none
+    static constexpr uint64_t FREE_TAG = uint64_t(1) << 32;  // Bumped on every change of the top
+
+    struct Node {
+        std::atomic<Node*> next = nullptr;
+        T value;
+        uint32_t index = HEAP_NODE;              // Position in the pool, HEAP_NODE if allocated on its own
+        std::atomic<uint32_t> free_next = 0;     // Index + 1 of the next free node while on the free stack
+    };
+
+    Node* Acquire() {
+        uint64_t top = m_free.load(std::memory_order_acquire);
+        while (top & FREE_INDEX_MASK) {
+            // A stale free_next read by a producer which lost the race is harmless, the tag makes its CAS fail
+            Node* node = &m_pool[(top & FREE_INDEX_MASK) - 1];
+            uint64_t next = ((top & ~FREE_INDEX_MASK) + FREE_TAG) | node->free_next.load(std::memory_order_relaxed);
+            if (m_free.compare_exchange_weak(top, next, std::memory_order_acquire, std::memory_order_acquire)) {
+                node->next.store(nullptr, std::memory_order_relaxed);
+                return node;
+            }
+        }
+        return new Node();
+    }
+
+    void Release(Node* node) {
+        if (node->index == HEAP_NODE) {
+            delete node;
+            return;
+        }
+
+        node->value = T();
+        uint64_t top = m_free.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            node->free_next.store(top & FREE_INDEX_MASK, std::memory_order_relaxed);
+            next = ((top & ~FREE_INDEX_MASK) + FREE_TAG) | (node->index + 1);
+        } while (!m_free.compare_exchange_weak(top, next, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    std::unique_ptr<Node[]> m_pool;
+    std::atomic<uint64_t> m_free = 0;     // Tag << 32 | index + 1 of the top of the free stack
+    std::atomic<Node*> m_head = nullptr;  // Most recently pushed node, written by producers
+    Node* m_tail = nullptr;               // Stub node preceding the oldest value, only touched by the consumer
+    std::atomic<int64_t> m_pending = 0;   // Values pushed and not yet popped, briefly negative while a push links
+    int m_event_fd = -1;
+};
+
+}  // namespace dragonfruit
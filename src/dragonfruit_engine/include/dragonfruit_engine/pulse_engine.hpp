@@ -0,0 +1,63 @@
+#pragma once
+
+#include <pulse/pulseaudio.h>
+
+#include <optional>
+
+#include "dragonfruit_engine/audio_engine.hpp"
+
+namespace dragonfruit {
+
+// Used by the stream callbacks to retry writing when the sound has not finished loading the data the stream asked for
+struct PulseWriteState {
+    EngineState* audio = nullptr;
+    pa_stream* stream = nullptr;
+    pa_mainloop_api* mainloop_api = nullptr;
+    pa_time_event* retry_event = nullptr;
+};
+
+/**
+ * @brief Engine playing through a PulseAudio (or PipeWire) server. Every song is played on a stream of its own, which
+ * the server mixes with the rest of the system's audio.
+ *
+ */
+class PulseEngine final : public AudioEngine {
+   public:
+    /**
+     * @brief Construct a new engine and start connecting to the PulseAudio server. The connection completes in the
+     * background, PlayAsync waits for it if it is still in progress. Throws an exception if the connection could not
+     * be started.
+     *
+     * @param options Options for the engine.
+     */
+    explicit PulseEngine(const AudioEngineOptions& options = {});
+    ~PulseEngine() override;
+
+    void PlayAsync(std::shared_ptr<Sound> sound) override;
+    void Stop() override;
+    void Pause(bool pause) override;
+    double GetTotalSongTime() override;
+    double GetCurrentSongTime() override;
+    void Seek(double seconds) override;
+    void SetVolume(double volume) override;
+    void SetSpeed(double speed) override;
+    bool IsPaused() override;
+
+   private:
+    void PromoteAudioThread();
+    bool AwaitContextReady();
+    std::optional<ChannelLayout> QueryDeviceLayout();
+    std::optional<double> PlayedFrame();
+    void RestartAt(size_t frame, bool resume);
+
+    // PulseAudio state variables
+    pa_threaded_mainloop* m_mainloop = nullptr;
+    pa_mainloop_api* m_mainloop_api = nullptr;
+    pa_context* m_context = nullptr;
+    pa_stream* m_stream = nullptr;
+    pa_sample_spec m_sample_spec;
+    uint32_t m_sink_idx = 0;
+    PulseWriteState m_write_state;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <memory>
+#include <vector>
+
+#include "dragonfruit_engine/convolver.hpp"
+#include "dragonfruit_engine/sound.hpp"
+#include "dragonfruit_engine/thread_pool.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief Decode a run of frames of a song to float and apply gain. This is the processing the AudioEngine runs on
+ * everything it plays, shared so that offline renders produce exactly what would have been played.
+ *
+ * @param sound The song to read from.
+ * @param frame First frame to read.
+ * @param out Destination for frames * channels interleaved samples.
+ * @param frames Number of frames to read.
+ * @param gain Linear gain, samples are clamped to full scale afterwards.
+ * @param scratch Holds the decoded PCM, grown as needed.
+ * @return Number of frames written, 0 if the data at frame has not been loaded yet or the song has ended.
+ */
+size_t RenderPcm(Sound& sound, size_t frame, float* out, size_t frames, float gain, std::vector<uint8_t>& scratch);
+
+/**
+ * @brief A song to render and where to write it.
+ *
+ */
+struct RenderJob {
+    std::filesystem::path song_path;
+    std::filesystem::path output_path;
+    double gain = 1.0;
+    std::shared_ptr<const ImpulseResponse> impulse_response{};  // Filter to convolve with, as in playback
+    size_t convolution_partition = 512;                         // Frames per convolution partition
+};
+
+/**
+ * @brief Outcome of rendering a song.
+ *
+ */
+struct RenderResult {
+    size_t frames = 0;
+    uint32_t sample_rate = 0;
+    double elapsed = 0.0;  // Wall clock time the render took, in seconds
+
+    inline double Duration() const { return sample_rate ? static_cast<double>(frames) / sample_rate : 0.0; }
+};
+
+/**
+ * @brief Render a song through the playback chain as fast as possible, writing the result to a 32-bit float WAV file.
+ * A job with an impulse response is run through a DspGraph holding the same ConvolverNode as playback, with the delay
+ * the graph adds compensated for so the output lines up with the song. INFO tags are carried over. Throws an
+ * exception if the song cannot be read or the output cannot be written.
+ *
+ * @param job The song to render.
+ * @return Result of the render.
+ */
+RenderResult RenderToWav(const RenderJob& job);
+
+/**
+ * @brief Render songs in parallel, one song per job.
+ *
+ * @param jobs Songs to render.
+ * @param pool Thread pool to render on.
+ * @param on_progress Called after each song with the number of songs done so far. May be called from any thread.
+ * @return The result of each job, empty for songs which failed to render.
+ */
+std::vector<std::optional<RenderResult>> RenderSongs(const std::vector<RenderJob>& jobs, ThreadPool& pool,
+                                                     const std::function<void(size_t)>& on_progress = {});
+
+}  // namespace dragonfruit
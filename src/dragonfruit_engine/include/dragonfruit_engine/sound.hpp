@@ -2,14 +2,27 @@
 
 #include <stdint.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "dragonfruit_engine/async_reader.hpp"
+#include "dragonfruit_engine/buffer_pool.hpp"
+#include "dragonfruit_engine/channel_layout.hpp"
+#include "dragonfruit_engine/codec.hpp"
+#include "dragonfruit_engine/convert.hpp"
+#include "dragonfruit_engine/http_reader.hpp"
+
 namespace dragonfruit {
 
-enum class WavFormatCode { PCM, IEEE_FLOAT, EXTENSIBLE, UNKNOWN };
+enum class WavFormatCode { PCM, IEEE_FLOAT, EXTENSIBLE, MS_ADPCM, IMA_ADPCM, MULAW, ALAW, UNKNOWN };
 
 enum class ChunkCode { FMT, LIST, DATA, UNKNOWN };
 
@@ -42,20 +55,55 @@ struct InfoChunk {
     char info_id[4];
 };
 
+/**
+ * @brief Options controlling how the sample data of a Sound is read from disk.
+ *
+ */
+struct SoundLoadOptions {
+    bool direct_io = false;          // Open the file with O_DIRECT, bypassing the page cache
+    AsyncReader* reader = nullptr;  // Reader to load the sample data with, defaults to AsyncReader::Shared()
+    BufferPool* pool = nullptr;     // Pool to borrow the sample buffer from, defaults to BufferPool::Shared()
+    bool lock_memory = false;       // Lock the sample buffer into RAM so reading it never waits on a page fault
+    bool headers_only = false;      // Load nothing up front, reads go straight to the file. Ignored for http:// URLs
+};
+
+/**
+ * @brief The most recently decoded block of a compressed song, kept so that reads which do not line up with block
+ * boundaries do not decode the same block twice.
+ *
+ */
+struct PcmBlockCache {
+    std::vector<int16_t> samples;
+    size_t block = SIZE_MAX;
+    std::vector<uint8_t> raw;  // Encoded bytes of the block, for songs opened with headers_only
+};
+
 /**
  * @brief Parses, stores and manages the lifetime of a WAV file.
  *
+ * Only the chunk headers are parsed on construction. The sample data is streamed in through an AsyncReader in the
+ * background, and becomes readable from the start of the data chunk onwards as reads complete. Songs given as http://
+ * URLs are downloaded by an HttpReader instead, which fetches whatever is read next first, so seeking ahead does not
+ * wait for the data before it. Only the chunks within the first HttpReader::HEAD_SIZE bytes of those are parsed.
+ *
+ * Songs opened with SoundLoadOptions::headers_only hold no sample data at all. They count as loaded straight away and
+ * ReadPcm reads them from the file as it goes, which keeps memory bounded when a song is read through only once.
+ *
  */
 class Sound {
    public:
     /**
      * @brief Construct a new Sound using a filepath to a WAV file to load.
      *
-     * @param[in] filepath Filepath pointing to a valid WAV file.
+     * @param[in] filepath Filepath pointing to a valid WAV file, or its http:// URL.
+     * @param[in] options Options controlling how the sample data is read.
      */
-    Sound(const std::string& filepath);
+    Sound(const std::string& filepath, const SoundLoadOptions& options = {});
     ~Sound();
 
+    Sound(const Sound&) = delete;
+    Sound& operator=(const Sound&) = delete;
+
     /**
      * @brief Returns the number of channels.
      *
@@ -63,6 +111,14 @@ class Sound {
      */
     inline uint16_t Channels() const { return m_channels; }
 
+    /**
+     * @brief Returns the speaker each channel is meant for, from the channel mask of WAVE_FORMAT_EXTENSIBLE files or
+     * the usual layout for the channel count otherwise.
+     *
+     * @return The channel layout.
+     */
+    inline ChannelLayout Layout() const { return ChannelLayout(m_channel_mask, m_channels); }
+
     /**
      * @brief Returns the bit depth of a sample.
      *
@@ -78,18 +134,126 @@ class Sound {
     inline uint32_t SampleRate() const { return m_sample_rate; }
 
     /**
-     * @brief Returns a pointer to the sample data.
+     * @brief Returns the size in bytes of a block of encoded sample data.
+     *
+     * @return Size in bytes of a block.
+     */
+    inline uint16_t BlockAlign() const { return m_block_align; }
+
+    /**
+     * @brief Returns whether the sample data is stored in a compressed format which has to be decoded before playback.
+     *
+     * @return true if the sample data is compressed.
+     */
+    inline bool IsCompressed() const { return m_decoder != nullptr; }
+
+    /**
+     * @brief Returns a pointer to the raw (possibly compressed) sample data.
      *
      * @return Pointer to sample data.
      */
-    inline const uint8_t* SampleData() const { return m_sample_data.data(); }
+    inline const uint8_t* SampleData() const { return m_sample_data; }
 
     /**
-     * @brief Returns the size in bytes of the sample data.
+     * @brief Returns the size in bytes of the raw (possibly compressed) sample data.
      *
      * @return Size in bytes of the sample data.
      */
-    inline uint32_t SampleDataSize() const { return m_sample_data.size(); }
+    inline uint32_t SampleDataSize() const { return m_sample_data_size; }
+
+    /**
+     * @brief Returns the layout of the decoded PCM samples returned by ReadPcm.
+     *
+     * @return The decoded sample format.
+     */
+    inline SampleFormat PcmFormat() const { return GetSampleFormat(m_format, m_bit_depth); }
+
+    /**
+     * @brief Returns the size in bytes of one frame (one sample for every channel) of decoded PCM data.
+     *
+     * @return Size in bytes of a decoded frame.
+     */
+    inline size_t FrameSize() const { return SampleSize(PcmFormat()) * m_channels; }
+
+    /**
+     * @brief Returns the number of frames in the song.
+     *
+     * @return Number of frames.
+     */
+    inline size_t TotalFrames() const { return FrameSize() ? m_pcm_data_size / FrameSize() : 0; }
+
+    /**
+     * @brief Block until the background load of the sample data has finished.
+     *
+     */
+    void WaitForLoad() const;
+
+    /**
+     * @brief Returns whether the background load of the sample data has finished, successfully or not.
+     *
+     * @return true if no more sample data will arrive.
+     */
+    inline bool IsLoaded() const { return m_load_finished.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Returns whether the background load of the sample data failed. Only the data read before the failure is
+     * playable.
+     *
+     * @return true if loading failed.
+     */
+    bool LoadFailed() const;
+
+    /**
+     * @brief Returns the size in bytes of decoded PCM data which can currently be read without waiting on I/O.
+     *
+     * @return Size in bytes of the readable decoded sample data.
+     */
+    size_t AvailablePcmSize() const;
+
+    /**
+     * @brief Returns the size in bytes of the sample data once decoded to PCM. For uncompressed formats this is the
+     * same as SampleDataSize().
+     *
+     * @return Size in bytes of the decoded sample data.
+     */
+    inline size_t PcmDataSize() const { return m_pcm_data_size; }
+
+    /**
+     * @brief Copies decoded PCM sample data into a buffer. Compressed formats are decoded block by block on demand, so
+     * only the blocks covering the requested range are ever expanded. Reads stop short at data which has not been
+     * loaded yet. Not thread safe, a Sound should only be read from a single thread at a time.
+     *
+     * @param[in] offset Offset in bytes into the decoded sample data.
+     * @param[out] dst Destination buffer.
+     * @param[in] length Number of bytes to read.
+     * @return Number of bytes written into dst, 0 if the data at offset has not been loaded yet.
+     */
+    size_t ReadPcm(size_t offset, uint8_t* dst, size_t length);
+
+    /**
+     * @brief Copies decoded PCM sample data into a buffer like ReadPcm, but decodes compressed blocks into a cache of
+     * the caller's rather than the Sound's. Safe to call from any thread while the song is being played, such as to
+     * analyse a song shared through a TrackCache. Never moves the download of a streamed song.
+     *
+     * @param[in] offset Offset in bytes into the decoded sample data.
+     * @param[out] dst Destination buffer.
+     * @param[in] length Number of bytes to read.
+     * @param[in,out] cache Holds the most recently decoded block between calls, owned by the calling thread.
+     * @return Number of bytes written into dst, 0 if the data at offset has not been loaded yet.
+     * @throws Exception If reading the file of a song opened with headers_only fails.
+     */
+    size_t ReadPcm(size_t offset, uint8_t* dst, size_t length, PcmBlockCache& cache) const;
+
+    /**
+     * @brief Read the whole song once from start to end as blocks of float samples, for offline analysis. Songs opened
+     * with headers_only are read from disk a block at a time and songs given as URLs as they download, so memory stays
+     * bounded by the block size. Returns once the end of the song was read or no more data will arrive.
+     *
+     * @param block_frames Most frames passed to process at a time.
+     * @param process Called with the interleaved samples of each block and its number of frames.
+     * @throws Exception If reading the file of a song opened with headers_only fails.
+     */
+    void ReadAllAsFloat(size_t block_frames, const std::function<void(const float*, size_t)>& process);
 
     /**
      * @brief Returns the value of an INFO metadata tag if it exists. If it does not exist, returns an empty string.
@@ -141,6 +305,15 @@ class Sound {
      */
     inline std::string Genre() const { return Metadata("IGNR"); }
 
+    /**
+     * @brief Read only the INFO metadata tags of a WAV file, skipping over everything else. Much cheaper than
+     * constructing a Sound, for listing large numbers of songs.
+     *
+     * @param filepath Filepath of the WAV file.
+     * @return Tags by ID. Empty if the file has none or cannot be read.
+     */
+    static std::unordered_map<std::string, std::string> ReadInfoTags(const std::string& filepath);
+
     /**
      * @brief Returns the track number.
      *
@@ -151,12 +324,26 @@ class Sound {
     inline WavFormatCode Format() const { return m_format; }
 
    private:
-    bool ReadChunk(std::ifstream& file);
-    void ParseChunk(ChunkHeader header, std::ifstream& file);
-    void HandleFmtChunk(std::ifstream& file, size_t size);
-    void HandleDataChunk(std::ifstream& file, size_t size);
-    void HandleListChunk(std::ifstream& file, size_t size);
-    void HandleUnknownChunk(std::ifstream& file, size_t size);
+    void ParseHeaders(std::istream& file);
+    bool ReadChunk(std::istream& file);
+    void ParseChunk(ChunkHeader header, std::istream& file);
+    void HandleFmtChunk(std::istream& file, size_t size);
+    void HandleDataChunk(std::istream& file, size_t size);
+    void HandleListChunk(std::istream& file, size_t size);
+    void HandleUnknownChunk(std::istream& file, size_t size);
+    void SetupDecoder();
+    void StartLoading(const std::string& filepath, const SoundLoadOptions& options);
+    void StartStreaming(const SoundLoadOptions& options);
+    void SubmitChunkRead(size_t chunk_idx, size_t filled);
+    void OnChunkRead(size_t chunk_idx, size_t filled, ssize_t result);
+    size_t PcmSizeForRawSize(size_t raw_size) const;
+    size_t StreamedPcmSize(size_t offset, size_t length) const;
+    size_t RawOffsetForPcmOffset(size_t offset) const;
+    size_t CopyPcm(size_t offset, uint8_t* dst, size_t length, PcmBlockCache& cache) const;
+    const int16_t* DecodeBlock(size_t block_idx, PcmBlockCache& cache) const;
+    void OpenHeadersOnly(const std::string& filepath);
+    size_t ReadFile(size_t offset, uint8_t* dst, size_t length) const;
+    const uint8_t* RawBlock(size_t src_offset, size_t src_size, PcmBlockCache& cache) const;
 
     std::unordered_map<std::string, std::string> m_info_tags;
 
@@ -164,8 +351,40 @@ class Sound {
     unsigned int m_sample_rate;
     uint16_t m_channels;
     uint16_t m_bit_depth;
+    uint16_t m_block_align = 0;
+    uint32_t m_channel_mask = 0;  // Zero unless the file specified one
     WavFormatCode m_format;
+    std::vector<uint8_t> m_fmt_extension;
+
+    // The sample buffer covers the data chunk expanded to AsyncReader::ALIGNMENT boundaries in the file, so reads land
+    // directly in it even with O_DIRECT. m_sample_data points at the first byte of the data chunk inside it.
+    PooledBuffer m_sample_buffer;
+    uint8_t* m_sample_data = nullptr;
+    size_t m_sample_data_size = 0;
+    uint64_t m_data_offset = 0;    // Offset of the data chunk in the file
+    uint64_t m_buffer_offset = 0;  // Offset in the file of the first byte of m_sample_buffer
+    size_t m_buffer_size = 0;
+    size_t m_pcm_data_size = 0;
+
+    // Background load state. Chunks may complete out of order, m_loaded_bytes only covers the contiguous prefix of the
+    // data chunk which has arrived.
+    AsyncReader* m_reader = nullptr;
+    int m_fd = -1;
+    uint64_t m_file_size = UINT64_MAX;
+    uint64_t m_read_tag = 0;
+    std::atomic<size_t> m_loaded_bytes = 0;
+    std::atomic<bool> m_load_finished = false;
+    mutable std::mutex m_load_mutex;
+    mutable std::condition_variable m_load_cv;
+    std::vector<bool> m_chunk_done;
+    size_t m_chunk_prefix = 0;
+    size_t m_outstanding_reads = 0;
+    bool m_load_failed = false;
+    std::unique_ptr<HttpReader> m_http;  // Downloads the sample data of songs given as URLs
 
-    std::vector<uint8_t> m_sample_data;
+    // Decoder state for compressed formats. The most recently decoded block is cached so that reads which do not line
+    // up with block boundaries do not decode the same block twice.
+    std::unique_ptr<Decoder> m_decoder;
+    PcmBlockCache m_block_cache;
 };
 }  // namespace dragonfruit
\ No newline at end of file
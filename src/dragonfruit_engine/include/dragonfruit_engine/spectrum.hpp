@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <complex>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dragonfruit_engine/audio_tap.hpp"
+#include "dragonfruit_engine/fft.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief A smoothed snapshot of the spectrum and levels of the audio being played. Values are normalized to [0.0, 1.0]
+ * over a 72dB range.
+ *
+ */
+struct SpectrumFrame {
+    std::vector<float> bands;  // Log spaced frequency bands from low to high
+    float level[2] = {};       // RMS level of the left and right channel
+    float peak[2] = {};        // Decaying peak level of the left and right channel
+    double analysis_ms = 0.0;  // Average time spent analysing one frame
+    double load = 0.0;         // Fraction of the analysis thread's time spent analysing
+};
+
+/**
+ * @brief Computes the spectrum of the audio passing through an AudioTap on its own low priority thread. Analysis only
+ * runs while someone is polling for frames, so it costs nothing while no visualization is on screen.
+ *
+ */
+class SpectrumAnalyzer {
+   public:
+    static constexpr size_t FFT_SIZE = 2048;
+    static constexpr std::chrono::milliseconds INTERVAL{33};
+
+    /**
+     * @brief Construct a new analyzer and start its thread.
+     *
+     * @param tap Tap providing the samples. Must outlive the analyzer.
+     * @param num_bands Number of frequency bands to group the spectrum into.
+     */
+    SpectrumAnalyzer(const AudioTap& tap, size_t num_bands = 32);
+    ~SpectrumAnalyzer();
+
+    SpectrumAnalyzer(const SpectrumAnalyzer&) = delete;
+    SpectrumAnalyzer& operator=(const SpectrumAnalyzer&) = delete;
+
+    /**
+     * @brief Returns the latest analysed frame and keeps the analysis running for a while.
+     *
+     * @return The latest frame.
+     */
+    SpectrumFrame Snapshot();
+
+   private:
+    // Analysis stops when no snapshot was requested for this long
+    static constexpr std::chrono::milliseconds IDLE_TIMEOUT{500};
+
+    void AnalysisLoop();
+    void Analyze();
+
+    const AudioTap& m_tap;
+    size_t m_num_bands;
+    RealFft m_fft;
+    std::vector<float> m_window;
+    std::vector<float> m_samples;  // Interleaved samples copied out of the tap
+    std::vector<float> m_mono;
+    std::vector<std::complex<float>> m_spectrum;
+    uint64_t m_last_write_pos = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    SpectrumFrame m_frame;
+    std::chrono::steady_clock::time_point m_last_request;
+    bool m_shutdown = false;
+    std::thread m_thread;
+};
+
+}  // namespace dragonfruit
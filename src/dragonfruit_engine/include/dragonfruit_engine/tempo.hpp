@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <complex>
+#include <filesystem>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "dragonfruit_engine/cache.hpp"
+#include "dragonfruit_engine/fft.hpp"
+
+namespace dragonfruit {
+
+class ThreadPool;
+
+/**
+ * @brief Tempo and key of a song.
+ *
+ */
+struct TempoInfo {
+    double bpm = 0.0;               // Beats per minute, 0 if no tempo could be found
+    double tempo_confidence = 0.0;  // How strongly the onsets repeat at that tempo, from 0 to 1
+    int key = -1;                   // 0-11 for C to B major, 12-23 for C to B minor, -1 if unknown
+    double key_confidence = 0.0;    // Correlation of the song's pitch classes with the key's profile, from -1 to 1
+};
+
+/**
+ * @brief Returns the short name of a key, such as "F#" or "Am".
+ *
+ * @param key Key index as stored in TempoInfo.
+ * @return Name of the key, or an empty string if it is unknown.
+ */
+std::string KeyName(int key);
+
+/**
+ * @brief Estimates the tempo and key of a song from its samples, which are fed in as they are read.
+ *
+ * The channels are mixed to mono and transformed in short overlapping frames. The onset strength of every frame is its
+ * spectral flux, the sum of how much each log compressed bin grew since the previous frame, computed four bins at a
+ * time. The tempo is the lag at which the onset envelope best correlates with itself, weighted towards moderate tempos
+ * so that the beat rather than the bar or half beat is picked. The key comes from a histogram of pitch classes taken
+ * from longer frames, correlated with the Krumhansl-Kessler profile of every major and minor key.
+ *
+ * Only the onset envelope, about a hundred values per second of audio, is kept. Everything else is bounded by the
+ * frame sizes.
+ *
+ */
+class TempoAnalyzer {
+   public:
+    static constexpr double MIN_BPM = 60.0;
+    static constexpr double MAX_BPM = 200.0;
+
+    TempoAnalyzer(uint16_t channels, uint32_t sample_rate);
+
+    /**
+     * @brief Feed interleaved samples into the analyzer.
+     *
+     * @param frames Interleaved float samples.
+     * @param count Number of frames.
+     */
+    void Process(const float* frames, size_t count);
+
+    /**
+     * @brief Returns the tempo and key of everything processed so far.
+     *
+     * @return The estimate. Tempo and key are left unknown for songs too short or quiet to tell.
+     */
+    TempoInfo Estimate() const;
+
+   private:
+    void ProcessHop();
+    void ProcessChroma();
+    double EstimateBpm(double& confidence) const;
+    int EstimateKey(double& confidence) const;
+
+    uint16_t m_channels;
+    uint32_t m_sample_rate;
+    size_t m_hop;           // Samples between onset frames
+    size_t m_window;        // Samples per onset frame
+    size_t m_chroma_size;   // Samples per chroma frame
+    size_t m_chroma_every;  // Onset hops between chroma frames
+
+    std::vector<float> m_history;  // The last m_chroma_size mono samples
+    std::vector<float> m_pending;  // Samples of the hop being collected
+    size_t m_pending_fill = 0;
+    size_t m_hops = 0;
+
+    RealFft m_onset_fft;
+    std::vector<float> m_onset_hann;
+    std::vector<float> m_frame;
+    std::vector<std::complex<float>> m_spectrum;
+    std::vector<float> m_magnitudes;  // Log compressed, padded to a multiple of four bins
+    std::vector<float> m_previous;
+    std::vector<float> m_envelope;  // Onset strength of every hop
+
+    RealFft m_chroma_fft;
+    std::vector<float> m_chroma_hann;
+    std::vector<float> m_chroma_frame;
+    std::vector<std::complex<float>> m_chroma_spectrum;
+    std::vector<uint8_t> m_pitch_classes;  // Pitch class of every chroma bin, 12 for bins outside the analysed range
+    double m_chroma[12] = {};
+};
+
+/**
+ * @brief Write the measurements of a song as tab separated fields: bpm, tempo confidence, key, key confidence.
+ *
+ */
+std::ostream& operator<<(std::ostream& out, const TempoInfo& info);
+
+/**
+ * @brief Read the measurements of a song written by operator<<.
+ *
+ */
+std::istream& operator>>(std::istream& in, TempoInfo& info);
+
+/**
+ * @brief Persistent store of tempo and key measurements, keyed by path. Entries are invalidated when a file's size or
+ * modification time changes.
+ *
+ */
+class TempoStore : public StampedStore<TempoInfo> {
+   public:
+    /**
+     * @brief Construct a new store backed by the given file. Existing entries are loaded if the file exists.
+     *
+     * @param filepath Filepath of the store.
+     */
+    explicit TempoStore(const std::filesystem::path& filepath = DefaultPath()) : StampedStore(filepath) {}
+
+    /**
+     * @brief Returns the default location of the store, inside $XDG_CACHE_HOME (or ~/.cache).
+     *
+     * @return Default filepath.
+     */
+    static std::filesystem::path DefaultPath();
+};
+
+/**
+ * @brief Analyse the tempo and key of every song in parallel and record the results in a store. The longest songs are
+ * started first, so that no single long song is left running on its own at the end.
+ *
+ * @param song_paths Songs to analyse.
+ * @param store Store receiving the measurements.
+ * @param pool Thread pool to run the analysis on.
+ * @param on_progress Called after each song with the number of songs done so far. May be called from any thread.
+ * @return Number of songs which were analysed successfully.
+ */
+size_t AnalyzeTempo(const std::vector<std::filesystem::path>& song_paths, TempoStore& store, ThreadPool& pool,
+                    const std::function<void(size_t)>& on_progress = nullptr);
+
+}  // namespace dragonfruit
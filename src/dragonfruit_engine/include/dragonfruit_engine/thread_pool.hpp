@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dragonfruit {
+
+/**
+ * @brief Fixed size pool of worker threads for running independent jobs in parallel, such as analysing every song in
+ * a library.
+ *
+ */
+class ThreadPool {
+   public:
+    /**
+     * @brief Construct a new thread pool.
+     *
+     * @param num_threads Number of worker threads. Defaults to the number of hardware threads.
+     */
+    explicit ThreadPool(unsigned num_threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Queue a job to be run on one of the worker threads.
+     *
+     * @param job The job to run.
+     */
+    void Submit(std::function<void()> job);
+
+    /**
+     * @brief Block until every submitted job has finished.
+     *
+     */
+    void Wait();
+
+    /**
+     * @brief Returns the number of worker threads.
+     *
+     * @return Number of worker threads.
+     */
+    inline size_t Size() const { return m_workers.size(); }
+
+   private:
+    void WorkerLoop();
+
+    std::mutex m_mutex;
+    std::condition_variable m_job_cv;
+    std::condition_variable m_idle_cv;
+    std::deque<std::function<void()>> m_jobs;
+    size_t m_running = 0;
+    bool m_shutdown = false;
+    std::vector<std::thread> m_workers;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "dragonfruit_engine/sound.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief Changes the playback speed of a song without changing its pitch, using WSOLA (waveform similarity overlap
+ * add).
+ *
+ * Output is built from Hann windowed segments of the song, overlapped by half a window. Segments are taken from the
+ * song at the playback speed, each nudged by up to a few milliseconds to where it best lines up with the previous one
+ * (the highest normalized cross-correlation), so the waveform continues smoothly across the overlap and no pitch shift
+ * or phasing is heard.
+ *
+ * Every buffer is allocated up front, so processing never allocates and can run on the audio thread.
+ *
+ */
+class TimeStretcher {
+   public:
+    static constexpr double MIN_SPEED = 0.5;
+    static constexpr double MAX_SPEED = 3.0;
+
+    /**
+     * @brief Construct a stretcher for a song, starting at its beginning.
+     *
+     * @param channels Channels of the song.
+     * @param sample_rate Sample rate of the song.
+     * @param speed Playback speed, clamped to [MIN_SPEED, MAX_SPEED].
+     */
+    TimeStretcher(uint16_t channels, uint32_t sample_rate, double speed);
+
+    /**
+     * @brief Returns the most frames of the song a stretcher reads in one go, at any speed. Process never renders more
+     * than this many frames into its scratch buffer at once.
+     *
+     * @param sample_rate Sample rate of the song.
+     * @return Frames.
+     */
+    static size_t MaxInputFrames(uint32_t sample_rate);
+
+    /**
+     * @brief Continue from another position in the song, for seeking. Output frames are counted from here.
+     *
+     * @param frame Frame of the song to continue from.
+     */
+    void Reset(size_t frame);
+
+    /**
+     * @brief Produce stretched frames from a song, decoded and with gain applied like RenderPcm.
+     *
+     * @param sound The song, the same one for every call until Reset.
+     * @param out Destination for frames * channels interleaved samples.
+     * @param frames Number of frames wanted.
+     * @param gain Linear gain.
+     * @param scratch Holds decoded PCM, as for RenderPcm.
+     * @return Number of frames written. Fewer than asked for if the song has not loaded far enough yet, or has ended.
+     */
+    size_t Process(Sound& sound, float* out, size_t frames, float gain, std::vector<uint8_t>& scratch);
+
+    /**
+     * @brief Returns the frame of the song an output frame was taken from.
+     *
+     * @param output_frame Output frame, counted since the last Reset.
+     * @return Frame of the song.
+     */
+    inline double SourceFrameAt(int64_t output_frame) const {
+        return m_start + static_cast<double>(output_frame > 0 ? output_frame : 0) * m_speed;
+    }
+
+    /**
+     * @brief Returns the number of frames produced since the last Reset.
+     *
+     * @return Output frames.
+     */
+    inline uint64_t OutputFrames() const { return m_output_frames; }
+
+    inline double Speed() const { return m_speed; }
+
+   private:
+    bool ComputeHop(Sound& sound, float gain, std::vector<uint8_t>& scratch);
+    bool FillInput(Sound& sound, size_t keep_from, size_t end, float gain, std::vector<uint8_t>& scratch);
+    size_t FindBestSegment(size_t lo, size_t hi) const;
+
+    inline float* InputAt(size_t frame) { return m_input.data() + (frame - m_input_start) * m_channels; }
+    inline const float* InputAt(size_t frame) const {
+        return m_input.data() + (frame - m_input_start) * m_channels;
+    }
+
+    uint16_t m_channels;
+    double m_speed;
+    size_t m_window;  // Length of a segment in frames, twice the hop
+    size_t m_hop;     // Output frames per segment
+    size_t m_search;  // Segments may be moved by up to this many frames either way
+    std::vector<float> m_window_fn;
+
+    // Frames of the song from m_input_start onwards, decoded but not stretched yet
+    std::vector<float> m_input;
+    size_t m_input_start = 0;
+    size_t m_input_frames = 0;
+
+    std::vector<float> m_overlap;  // Second half of the previous segment, windowed, to be added to the next one
+    std::vector<float> m_hop_out;  // Finished output of the last segment
+    size_t m_hop_pos = 0;          // Frames of m_hop_out already returned
+
+    double m_start = 0.0;       // Frame of the song output started from
+    uint64_t m_hops = 0;        // Segments produced since output started
+    size_t m_prev_segment = 0;  // Where the previous segment was taken from
+    uint64_t m_output_frames = 0;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+
+namespace dragonfruit {
+
+/**
+ * @brief Process wide recorder of timed spans, exported as Chrome trace-event JSON which chrome://tracing and
+ * ui.perfetto.dev can open.
+ *
+ * Every thread records into its own ring of the most recent spans, so recording never takes a lock and never waits on
+ * other threads. A thread's ring is allocated the first time it records a span. While tracing is disabled, recording a
+ * span costs a single branch on a flag that never changes.
+ *
+ */
+class Trace {
+   public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;  // In spans per thread
+
+    /**
+     * @brief Start recording spans. Should be called once at startup, before the threads to be traced are busy.
+     *
+     * @param capacity Number of spans kept per thread, older spans are overwritten.
+     */
+    static void Enable(size_t capacity = DEFAULT_CAPACITY);
+
+    static inline bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Record a finished span on the calling thread's ring.
+     *
+     * @param name Name of the span. Must outlive the trace, in practice a string literal.
+     * @param start_ns Start of the span, from Trace::Now().
+     * @param end_ns End of the span, from Trace::Now().
+     */
+    static void Record(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+    /**
+     * @brief Returns the monotonic clock spans are timed with.
+     *
+     * @return Nanoseconds since an arbitrary point.
+     */
+    static uint64_t Now();
+
+    /**
+     * @brief Write every recorded span as Chrome trace-event JSON. Threads may keep recording while this runs, spans
+     * they overwrite during the write are left out.
+     *
+     * @param path File to write.
+     */
+    static void WriteChromeJson(const std::filesystem::path& path);
+
+   private:
+    static std::atomic<bool> s_enabled;
+};
+
+/**
+ * @brief Records a span covering its own lifetime.
+ *
+ */
+class TraceScope {
+   public:
+    /**
+     * @brief Start the span if tracing is enabled.
+     *
+     * @param name Name of the span. Must outlive the trace, in practice a string literal.
+     */
+    explicit inline TraceScope(const char* name) : m_name(name) {
+        if (Trace::IsEnabled()) [[unlikely]] m_start_ns = Trace::Now();
+    }
+
+    inline ~TraceScope() {
+        if (m_start_ns != 0) [[unlikely]] Trace::Record(m_name, m_start_ns, Trace::Now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+   private:
+    const char* m_name;
+    uint64_t m_start_ns = 0;
+};
+
+}  // namespace dragonfruit
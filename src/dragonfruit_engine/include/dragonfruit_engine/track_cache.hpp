@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "dragonfruit_engine/cache.hpp"
+#include "dragonfruit_engine/sound.hpp"
+
+namespace dragonfruit {
+
+/**
+ * @brief Options for configuring a TrackCache.
+ *
+ */
+struct TrackCacheOptions {
+    size_t budget_bytes = 256 << 20;  // Sample data the cache may keep resident, zero disables caching
+    SoundLoadOptions load{};          // How songs are loaded on a miss
+};
+
+/**
+ * @brief Usage statistics of a TrackCache.
+ *
+ */
+struct TrackCacheStats {
+    size_t hits = 0;        // Gets served from the cache
+    size_t misses = 0;      // Gets which had to load the song
+    size_t evictions = 0;   // Songs dropped to stay within the budget, or because their file changed
+    size_t prefetches = 0;  // Songs loaded ahead of being asked for
+    size_t tracks = 0;      // Songs currently cached
+    size_t bytes = 0;       // Sample data of the cached songs
+};
+
+/**
+ * @brief Keeps recently played songs loaded so that skipping back and forth between them starts instantly, without
+ * reading them from disk again.
+ *
+ * Songs are keyed by their path and only reused while their file's modification time and size are unchanged. The
+ * least recently used songs are dropped once their sample data exceeds the budget. Dropping a song only releases the
+ * cache's reference, a song still being played stays alive until its player lets go of it.
+ *
+ * A cached song is handed out to every caller asking for it, and a Sound may only be read by one thread at a time, so
+ * a song should be released before the same song is asked for again elsewhere.
+ *
+ */
+class TrackCache {
+   public:
+    explicit TrackCache(const TrackCacheOptions& options = {});
+
+    TrackCache(const TrackCache&) = delete;
+    TrackCache& operator=(const TrackCache&) = delete;
+
+    /**
+     * @brief Get a song, loading it if it is not cached. Throws an exception if the song could not be loaded.
+     *
+     * @param path Filepath of the song.
+     * @return The song, which may still be loading in the background.
+     */
+    std::shared_ptr<Sound> Get(const std::filesystem::path& path);
+
+    /**
+     * @brief Load a song into the cache if it is not cached yet, so a later Get is a hit. Songs which cannot be loaded
+     * are ignored.
+     *
+     * @param path Filepath of the song.
+     */
+    void Prefetch(const std::filesystem::path& path);
+
+    /**
+     * @brief Drop a song from the cache, such as one whose file was replaced or deleted. Changed files are reloaded by
+     * Get anyway, this frees their memory right away.
+     *
+     * @param path Filepath of the song.
+     */
+    void Forget(const std::filesystem::path& path);
+
+    /**
+     * @brief Drop every cached song.
+     *
+     */
+    void Clear();
+
+    /**
+     * @brief Returns the usage statistics of the cache.
+     *
+     * @return Cache statistics.
+     */
+    TrackCacheStats Stats() const;
+
+   private:
+    struct Entry {
+        std::string key;
+        FileStamp stamp;
+        std::shared_ptr<Sound> sound;
+        size_t bytes;
+    };
+    using EntryList = std::list<Entry>;
+
+    std::shared_ptr<Sound> Insert(Entry entry);
+
+    // Returns the dropped song so it can be released after the lock is, its destructor may wait on I/O
+    std::shared_ptr<Sound> Erase(EntryList::iterator it);
+
+    TrackCacheOptions m_options;
+
+    mutable std::mutex m_mutex;
+    EntryList m_entries;  // Most recently used first
+    std::unordered_map<std::string, EntryList::iterator> m_index;
+    TrackCacheStats m_stats;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace dragonfruit {
+
+class Sound;
+
+/**
+ * @brief Summary of the samples in a span of a song. Values are in [-1.0, 1.0], taken across all channels.
+ *
+ */
+struct WaveformBucket {
+    float min = 0.0f;
+    float max = 0.0f;
+    float rms = 0.0f;
+};
+
+/**
+ * @brief Overview of a song's waveform as a pyramid of min/max/RMS buckets. The finest level has a bucket per
+ * BASE_FRAMES frames and every level above it halves the resolution, so any display width can be drawn from a level
+ * of roughly the right size.
+ *
+ */
+class Waveform {
+   public:
+    static constexpr size_t BASE_FRAMES = 1024;
+
+    /**
+     * @brief Compute the waveform of a song in a single pass over its samples, following its background load as the
+     * samples arrive. The song may be playing at the same time, such as the shared Sound of a TrackCache.
+     *
+     * @param sound The song.
+     * @param cancelled Polled between reads, computing stops early once it returns true.
+     * @return The song's waveform, or nothing if it was cancelled.
+     */
+    static std::optional<Waveform> Compute(const Sound& sound, const std::function<bool()>& cancelled = {});
+
+    /**
+     * @brief Load the cached waveform of a song.
+     *
+     * @param song_path Filepath of the song.
+     * @return The waveform, or nothing if it is not cached or the song has changed since.
+     */
+    static std::optional<Waveform> LoadCached(const std::filesystem::path& song_path);
+
+    /**
+     * @brief Write the waveform to the cache. Failures are ignored, the waveform will just be computed again next
+     * time.
+     *
+     * @param song_path Filepath of the song the waveform was computed from.
+     */
+    void SaveCached(const std::filesystem::path& song_path) const;
+
+    /**
+     * @brief Summarize the waveform into a given number of buckets, such as one per terminal column.
+     *
+     * @param width Number of buckets.
+     * @return width buckets spanning the whole song, or none if the song is empty.
+     */
+    std::vector<WaveformBucket> Resample(size_t width) const;
+
+    /**
+     * @brief Returns a level of the pyramid, 0 being the finest.
+     *
+     * @param level Level index, less than Levels().
+     * @return Buckets of the level.
+     */
+    inline const std::vector<WaveformBucket>& Level(size_t level) const { return m_levels[level]; }
+
+    /**
+     * @brief Returns the number of levels in the pyramid.
+     *
+     * @return Number of levels.
+     */
+    inline size_t Levels() const { return m_levels.size(); }
+
+   private:
+    // Levels stop halving once they are this small
+    static constexpr size_t MIN_LEVEL_SIZE = 64;
+
+    void BuildLevels();
+    static std::filesystem::path CachePath(const std::filesystem::path& song_path);
+
+    std::vector<std::vector<WaveformBucket>> m_levels;
+};
+
+}  // namespace dragonfruit
@@ -0,0 +1,489 @@
+#include "dragonfruit_engine/alsa_engine.hpp"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <iterator>
+#include <string>
+
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/trace.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+// ALSA's position for each speaker, indexed by Speaker
+constexpr snd_pcm_chmap_position ALSA_POSITIONS[] = {
+    SND_CHMAP_FL,  SND_CHMAP_FR,  SND_CHMAP_FC,  SND_CHMAP_LFE, SND_CHMAP_RL,  SND_CHMAP_RR,
+    SND_CHMAP_FLC, SND_CHMAP_FRC, SND_CHMAP_RC,  SND_CHMAP_SL,  SND_CHMAP_SR,  SND_CHMAP_TC,
+    SND_CHMAP_TFL, SND_CHMAP_TFC, SND_CHMAP_TFR, SND_CHMAP_TRL, SND_CHMAP_TRC, SND_CHMAP_TRR,
+};
+
+// Formats asked of the device, best first. Float needs no conversion at all.
+constexpr std::pair<snd_pcm_format_t, SampleFormat> DEVICE_FORMATS[] = {
+    {SND_PCM_FORMAT_FLOAT_LE, SampleFormat::F32},
+    {SND_PCM_FORMAT_S32_LE, SampleFormat::S32},
+    {SND_PCM_FORMAT_S16_LE, SampleFormat::S16},
+};
+
+// Returns the speaker layout the device reports, or nothing if it does not report one
+std::optional<ChannelLayout> QueryChannelMap(snd_pcm_t* pcm) {
+    snd_pcm_chmap_t* map = snd_pcm_get_chmap(pcm);
+    if (!map) return std::nullopt;
+
+    std::vector<Speaker> speakers(map->channels, Speaker::NONE);
+    for (size_t c = 0; c < map->channels; c++) {
+        if (map->pos[c] == SND_CHMAP_MONO) {
+            speakers[c] = Speaker::FRONT_CENTER;
+            continue;
+        }
+
+        auto it = std::find(std::begin(ALSA_POSITIONS), std::end(ALSA_POSITIONS), map->pos[c]);
+        if (it != std::end(ALSA_POSITIONS)) speakers[c] = static_cast<Speaker>(it - std::begin(ALSA_POSITIONS));
+    }
+    free(map);
+    return ChannelLayout(speakers);
+}
+
+}  // namespace
+
+AlsaEngine::AlsaEngine(const AudioEngineOptions& options) : AudioEngine(options) {
+    m_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wake_fd < 0) {
+        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to create the ALSA audio thread's wake event");
+    }
+
+    if (m_options.realtime) m_engine_state.timing = &m_timing;
+    m_thread = std::thread(&AlsaEngine::AudioLoop, this);
+}
+
+AlsaEngine::~AlsaEngine() {
+    {
+        std::unique_lock<std::mutex> lock = LockIdle();
+        CloseDevice();
+        m_quit = true;
+        m_cv.notify_all();
+    }
+    m_thread.join();
+    close(m_wake_fd);
+}
+
+void AlsaEngine::AudioLoop() {
+    if (m_options.realtime) {
+        ThreadScheduling scheduling = PromoteCurrentThread(m_options.realtime_priority);
+        m_realtime = scheduling.realtime;
+        m_priority = scheduling.priority;
+    }
+
+    std::vector<pollfd> fds;
+    while (Park()) {
+        // Until a caller needs the engine to itself, nothing on this path takes a lock
+        while (m_interrupts.load(std::memory_order_acquire) == 0) {
+            ApplyCommands();
+
+            int timeout_ms = -1;
+            if (!m_paused && !m_engine_state.is_finished) {
+                TraceScope trace("AlsaEngine::Fill");
+                CallbackScope scope(m_engine_state.timing);
+                if (!Fill()) timeout_ms = STARVED_RETRY_MS;
+            }
+            Publish();
+
+            // Sleep until the device has room for another period, or there is a command or a caller for the audio
+            // thread. A paused or finished song only waits for the latter.
+            bool playing = !m_paused && !m_engine_state.is_finished;
+            int count = playing ? std::max(snd_pcm_poll_descriptors_count(m_pcm), 0) : 0;
+            fds.resize(count + 1);
+            if (count > 0) snd_pcm_poll_descriptors(m_pcm, fds.data(), count);
+            fds[count] = {.fd = m_wake_fd, .events = POLLIN, .revents = 0};
+            poll(fds.data(), fds.size(), timeout_ms);
+
+            if (fds[count].revents & POLLIN) {
+                uint64_t wakes;
+                if (read(m_wake_fd, &wakes, sizeof(wakes)) < 0) wakes = 0;
+            }
+
+            // Some plugins need their events translated to clear them, what is writable is checked by Fill itself
+            unsigned short revents;
+            if (count > 0) snd_pcm_poll_descriptors_revents(m_pcm, fds.data(), count, &revents);
+        }
+    }
+}
+
+// Waits until there is a device to play and no caller needs the engine to itself. Returns false once the engine is
+// being destroyed.
+bool AlsaEngine::Park() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_parked = true;
+    m_cv.notify_all();
+    m_cv.wait(lock, [&] { return m_quit || (m_interrupts.load(std::memory_order_relaxed) == 0 && m_pcm); });
+    m_parked = false;
+    return !m_quit;
+}
+
+// Applies the control changes posted since the last fill. Speed changes go first so that a seek posted with one lands
+// where it was asked for, and pauses last since seeks resume playback.
+void AlsaEngine::ApplyCommands() {
+    uint32_t commands = m_commands.exchange(0, std::memory_order_acquire);
+    if (commands == 0) return;
+
+    if (commands & COMMAND_SPEED) {
+        double speed = m_wanted_speed.load(std::memory_order_relaxed);
+        if (speed != m_speed) {
+            // Restart from what is playing right now, rather than letting what is already buffered play out at the
+            // old speed. A paused song stays paused.
+            double played_frame = PlayedFrame(Delay());
+            m_speed = speed;
+            ResetStretcher();
+            RestartAt(static_cast<size_t>(played_frame));
+        }
+    }
+
+    if (commands & COMMAND_SEEK) {
+        // Seeks are in the song's own time, whatever the playback speed
+        double seconds = m_seek_seconds.exchange(0.0, std::memory_order_relaxed);
+        double frames_to_seek = seconds * m_engine_state.sound->SampleRate();
+        RestartAt(static_cast<size_t>(std::max(PlayedFrame(Delay()) + frames_to_seek, 0.0)));
+    }
+
+    if (commands & COMMAND_PAUSE) ApplyPause(m_wanted_pause.load(std::memory_order_relaxed));
+}
+
+void AlsaEngine::ApplyPause(bool pause) {
+    if (pause == m_paused) return;
+
+    if (pause) {
+        // Devices which cannot pause are stopped, and restarted from where they were when resumed
+        if (!m_can_pause || snd_pcm_state(m_pcm) != SND_PCM_STATE_RUNNING || snd_pcm_pause(m_pcm, 1) < 0) {
+            RestartAt(static_cast<size_t>(PlayedFrame(Delay())));
+        }
+    } else if (snd_pcm_state(m_pcm) == SND_PCM_STATE_PAUSED) {
+        snd_pcm_pause(m_pcm, 0);
+    }
+    m_paused = pause;
+    m_timing.last_start_ns = 0;
+
+    m_engine_state.cork_acked.store(std::chrono::steady_clock::now().time_since_epoch().count(),
+                                    std::memory_order_relaxed);
+    m_engine_state.cork_acks.fetch_add(1, std::memory_order_release);
+}
+
+// Makes the position and pause state visible to other threads
+void AlsaEngine::Publish() {
+    m_position.store(PlayedFrame(Delay()) / m_engine_state.sound->SampleRate(), std::memory_order_relaxed);
+    m_published_paused.store(m_paused, std::memory_order_relaxed);
+}
+
+// Writes as much as the device has room for. Returns false if the song has not loaded far enough to fill it, in
+// which case the caller should try again shortly.
+bool AlsaEngine::Fill() {
+    if (!m_draining) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(m_pcm);
+        if (avail < 0) {
+            Recover(static_cast<int>(avail));
+            return true;
+        }
+
+        // Writing at most a buffer at a time keeps devices which never fill up (such as null) from starving commands
+        size_t frames = std::min<size_t>(avail, m_buffer_frames);
+        int error = 0;
+        size_t written = frames > 0 ? Write(frames, error) : 0;
+        if (error < 0) {
+            Recover(error);
+            return true;
+        }
+        if (written == frames) return true;
+
+        // The song ran out of loaded data. Start playing what is buffered so far, unless nothing more will load.
+        StartIfPrepared();
+        if (!m_engine_state.sound->IsLoaded()) return false;
+        m_draining = true;
+    }
+
+    // Everything has been written, the song is finished once the device has played it
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_state(m_pcm) != SND_PCM_STATE_RUNNING || snd_pcm_delay(m_pcm, &delay) < 0 || delay <= 0) {
+        m_engine_state.is_finished = true;
+    }
+    return true;
+}
+
+// Renders up to frames frames into the device. Returns how many were written, which is fewer when the song runs out of
+// loaded data. Errors from the device are returned in error.
+size_t AlsaEngine::Write(size_t frames, int& error) {
+    size_t frame_size = m_engine_state.out_channels * SampleSize(m_format);
+    if (!m_mmap) {
+        size_t rendered = Render(m_converted.data(), std::min(frames, m_converted.size() / frame_size));
+        if (rendered == 0) return 0;
+
+        snd_pcm_sframes_t written = snd_pcm_writei(m_pcm, m_converted.data(), rendered);
+        if (written < 0) error = static_cast<int>(written);
+        return written < 0 ? 0 : written;
+    }
+
+    size_t total = 0;
+    while (total < frames) {
+        const snd_pcm_channel_area_t* areas = nullptr;
+        snd_pcm_uframes_t offset = 0;
+        snd_pcm_uframes_t count = frames - total;
+        if (int result = snd_pcm_mmap_begin(m_pcm, &areas, &offset, &count); result < 0) {
+            error = result;
+            break;
+        }
+
+        // Interleaved, so every channel's area points into the same buffer
+        uint8_t* dst = static_cast<uint8_t*>(areas[0].addr) + (areas[0].first + offset * areas[0].step) / 8;
+        size_t rendered = Render(dst, count);
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(m_pcm, offset, rendered);
+        if (committed < 0 || static_cast<size_t>(committed) != rendered) {
+            error = committed < 0 ? static_cast<int>(committed) : -EPIPE;
+            break;
+        }
+
+        total += rendered;
+        if (rendered < count) break;
+    }
+    return total;
+}
+
+// Renders frames into dst in the device's format
+size_t AlsaEngine::Render(uint8_t* dst, size_t frames) {
+    size_t samples_per_frame = m_engine_state.out_channels;
+    float amplitude = m_amplitude.load(std::memory_order_relaxed);
+
+    // Float devices are rendered into directly, anything else goes through the render buffer to be converted
+    float* rendered = m_format == SampleFormat::F32 ? reinterpret_cast<float*>(dst) : m_render.data();
+    if (m_format != SampleFormat::F32) frames = std::min(frames, m_render.size() / samples_per_frame);
+
+    size_t read = RenderOutput(m_engine_state, rendered, frames);
+    if (m_format != SampleFormat::F32 || amplitude != 1.0f) {
+        ConvertFromFloat(m_format, rendered, dst, read * samples_per_frame, amplitude);
+    }
+    return read;
+}
+
+// Restarts the device after an underrun or a suspend. Finishes the song if it cannot be restarted.
+void AlsaEngine::Recover(int error) {
+    if (error == -EPIPE) m_engine_state.underruns.fetch_add(1, std::memory_order_relaxed);
+    if (snd_pcm_recover(m_pcm, error, 1) < 0) m_engine_state.is_finished = true;
+    m_timing.last_start_ns = 0;
+}
+
+// Short songs, and songs still loading, may not fill the buffer far enough for the device to start by itself
+void AlsaEngine::StartIfPrepared() {
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_state(m_pcm) == SND_PCM_STATE_PREPARED && snd_pcm_delay(m_pcm, &delay) == 0 && delay > 0) {
+        snd_pcm_start(m_pcm);
+    }
+}
+
+// Locks the engine with the audio thread parked, so the device can be opened or closed
+std::unique_lock<std::mutex> AlsaEngine::LockIdle() {
+    m_interrupts.fetch_add(1, std::memory_order_acq_rel);
+    Wake();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&] { return m_parked; });
+    m_interrupts.fetch_sub(1, std::memory_order_acq_rel);
+
+    // The audio thread only sees this once the lock is released
+    m_cv.notify_all();
+    return lock;
+}
+
+void AlsaEngine::Post(uint32_t commands) {
+    m_commands.fetch_or(commands, std::memory_order_release);
+    Wake();
+}
+
+void AlsaEngine::Wake() {
+    uint64_t one = 1;
+    if (write(m_wake_fd, &one, sizeof(one)) < 0) return;
+}
+
+ChannelLayout AlsaEngine::OpenDevice(const Sound& sound) {
+    TraceScope trace("AlsaEngine::OpenDevice");
+    const std::string& device = m_options.alsa_device;
+    int result = snd_pcm_open(&m_pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if (result < 0) {
+        m_pcm = nullptr;
+        throw Exception(ErrorCode::IO_ERROR, "Unable to open ALSA device " + device + ": " + snd_strerror(result));
+    }
+
+    auto fail = [&](const std::string& message, int error) {
+        CloseDevice();
+        throw Exception(ErrorCode::IO_ERROR, "ALSA device " + device + " " + message + ": " + snd_strerror(error));
+    };
+
+    snd_pcm_hw_params_t* hw_params;
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_hw_params_any(m_pcm, hw_params);
+
+    m_mmap = snd_pcm_hw_params_set_access(m_pcm, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+    if (!m_mmap) {
+        result = snd_pcm_hw_params_set_access(m_pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+        if (result < 0) fail("does not support interleaved access", result);
+    }
+
+    result = -EINVAL;
+    for (auto [alsa_format, format] : DEVICE_FORMATS) {
+        result = snd_pcm_hw_params_set_format(m_pcm, hw_params, alsa_format);
+        if (result == 0) {
+            m_format = format;
+            break;
+        }
+    }
+    if (result < 0) fail("does not support float, 32-bit or 16-bit samples", result);
+
+    // Devices which cannot play the song's channel count get the song mixed to their own
+    unsigned channels = sound.Channels();
+    result = snd_pcm_hw_params_set_channels_near(m_pcm, hw_params, &channels);
+    if (result < 0) fail("does not support " + std::to_string(sound.Channels()) + " channels", result);
+
+    // Resampling is left to plugins such as plughw, a hardware device must play the song's own rate
+    snd_pcm_hw_params_set_rate_resample(m_pcm, hw_params, 1);
+    result = snd_pcm_hw_params_set_rate(m_pcm, hw_params, sound.SampleRate(), 0);
+    if (result < 0) fail("does not support " + std::to_string(sound.SampleRate()) + " Hz", result);
+
+    unsigned period_us = m_options.alsa_period_us;
+    unsigned periods = std::max(m_options.alsa_periods, 2u);
+    int dir = 0;
+    snd_pcm_hw_params_set_period_time_near(m_pcm, hw_params, &period_us, &dir);
+    snd_pcm_hw_params_set_periods_near(m_pcm, hw_params, &periods, &dir);
+    result = snd_pcm_hw_params(m_pcm, hw_params);
+    if (result < 0) fail("could not be configured", result);
+
+    snd_pcm_hw_params_get_period_size(hw_params, &m_period_frames, &dir);
+    snd_pcm_hw_params_get_buffer_size(hw_params, &m_buffer_frames);
+    m_can_pause = snd_pcm_hw_params_can_pause(hw_params) == 1;
+
+    // Wake up once a period has been played, and start once the buffer has been filled
+    snd_pcm_sw_params_t* sw_params;
+    snd_pcm_sw_params_alloca(&sw_params);
+    snd_pcm_sw_params_current(m_pcm, sw_params);
+    snd_pcm_sw_params_set_avail_min(m_pcm, sw_params, m_period_frames);
+    snd_pcm_sw_params_set_start_threshold(m_pcm, sw_params, m_buffer_frames);
+    result = snd_pcm_sw_params(m_pcm, sw_params);
+    if (result < 0) fail("could not be configured", result);
+
+    result = snd_pcm_prepare(m_pcm);
+    if (result < 0) fail("could not be prepared", result);
+
+    // Every buffer the audio thread needs is allocated here, so writing never allocates
+    size_t samples = m_buffer_frames * channels;
+    if (m_render.size() < samples) m_render.resize(samples);
+    if (!m_mmap && m_converted.size() < samples * SampleSize(m_format)) {
+        m_converted.resize(samples * SampleSize(m_format));
+    }
+    if (m_options.realtime) {
+        mlock(m_render.data(), m_render.size() * sizeof(float));
+        if (!m_converted.empty()) mlock(m_converted.data(), m_converted.size());
+    }
+
+    // Songs with speaker positions are mixed to the device's layout, if it reports one. Songs without any are passed
+    // through as they are when the channel counts match.
+    ChannelLayout layout = sound.Layout();
+    if (channels != sound.Channels()) return ChannelLayout::Default(channels);
+    if (layout.Mask() != 0) {
+        std::optional<ChannelLayout> device_layout = QueryChannelMap(m_pcm);
+        if (device_layout && device_layout->Channels() == channels && device_layout->Mask() != 0) {
+            return *device_layout;
+        }
+    }
+    return layout;
+}
+
+void AlsaEngine::CloseDevice() {
+    if (!m_pcm) return;
+    snd_pcm_drop(m_pcm);
+    snd_pcm_close(m_pcm);
+    m_pcm = nullptr;
+}
+
+// Frames written to the device which have not been played yet
+int64_t AlsaEngine::Delay() {
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(m_pcm, &delay) < 0) return 0;
+    return std::max<snd_pcm_sframes_t>(delay, 0);
+}
+
+// Drops what is buffered and continues writing from a frame of the song
+void AlsaEngine::RestartAt(size_t frame) {
+    snd_pcm_drop(m_pcm);
+    snd_pcm_prepare(m_pcm);
+    SetFrame(frame);
+    m_draining = false;
+}
+
+void AlsaEngine::PlayAsync(std::shared_ptr<Sound> sound) {
+    TraceScope trace("AlsaEngine::PlayAsync");
+    if (sound->PcmFormat() == SampleFormat::INVALID) {
+        throw Exception(ErrorCode::INVALID_FORMAT, "Invalid WAV format");
+    }
+
+    std::unique_lock<std::mutex> lock = LockIdle();
+    CloseDevice();
+    ChannelLayout output = OpenDevice(*sound);
+
+    // Controls posted for the previous song no longer apply, only the speed carries over to the new one
+    m_commands.store(0, std::memory_order_relaxed);
+    m_seek_seconds.store(0.0, std::memory_order_relaxed);
+    m_speed = m_wanted_speed.load(std::memory_order_relaxed);
+
+    SetupSong(sound, output);
+    m_paused = false;
+    m_draining = false;
+    m_position.store(0.0, std::memory_order_relaxed);
+    m_duration.store(static_cast<double>(sound->TotalFrames()) / sound->SampleRate(), std::memory_order_relaxed);
+    m_published_paused.store(false, std::memory_order_relaxed);
+    m_cv.notify_all();
+}
+
+void AlsaEngine::Stop() {
+    std::unique_lock<std::mutex> lock = LockIdle();
+    CloseDevice();
+
+    m_engine_state.sound.reset();
+    m_engine_state.frame = 0;
+    m_engine_state.is_finished = true;
+    m_position.store(0.0, std::memory_order_relaxed);
+    m_duration.store(0.0, std::memory_order_relaxed);
+    m_published_paused.store(false, std::memory_order_relaxed);
+}
+
+void AlsaEngine::Pause(bool pause) {
+    m_wanted_pause.store(pause, std::memory_order_relaxed);
+    Post(COMMAND_PAUSE);
+}
+
+double AlsaEngine::GetCurrentSongTime() { return m_position.load(std::memory_order_relaxed); }
+
+double AlsaEngine::GetTotalSongTime() { return m_duration.load(std::memory_order_relaxed); }
+
+void AlsaEngine::Seek(double seconds) {
+    // Like a PulseAudio seek, this resumes playback
+    m_seek_seconds.fetch_add(seconds, std::memory_order_relaxed);
+    m_wanted_pause.store(false, std::memory_order_relaxed);
+    Post(COMMAND_SEEK | COMMAND_PAUSE);
+}
+
+void AlsaEngine::SetSpeed(double speed) {
+    m_wanted_speed.store(std::clamp(speed, TimeStretcher::MIN_SPEED, TimeStretcher::MAX_SPEED),
+                         std::memory_order_relaxed);
+    Post(COMMAND_SPEED);
+}
+
+void AlsaEngine::SetVolume(double volume) {
+    double volume_clamped = std::clamp(volume, 0.0, 1.0);
+    m_amplitude.store(static_cast<float>(volume_clamped * volume_clamped * volume_clamped), std::memory_order_relaxed);
+}
+
+bool AlsaEngine::IsPaused() { return m_published_paused.load(std::memory_order_relaxed); }
+
+}  // namespace dragonfruit
@@ -0,0 +1,365 @@
+#include "dragonfruit_engine/async_reader.hpp"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dragonfruit_engine/exception.hpp"
+
+namespace dragonfruit {
+
+// Completes every request in a list with -ECANCELED. Called without any reader locks held.
+static void CompleteCancelled(std::vector<ReadRequest>& requests) {
+    for (auto& request : requests) {
+        if (request.on_complete) request.on_complete(-ECANCELED);
+    }
+}
+
+// Removes every request with the given tag from a queue.
+static std::vector<ReadRequest> ExtractTagged(std::deque<ReadRequest>& queue, uint64_t tag) {
+    std::vector<ReadRequest> removed;
+    for (auto it = queue.begin(); it != queue.end();) {
+        if (it->tag == tag) {
+            removed.push_back(std::move(*it));
+            it = queue.erase(it);
+        } else {
+            it++;
+        }
+    }
+    return removed;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// io_uring backend
+// ---------------------------------------------------------------------------------------------------------------------
+
+// liburing is not a dependency, so the ring is driven through the raw system calls.
+static int IoUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int IoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+class IoUringReader : public AsyncReader {
+   public:
+    explicit IoUringReader(unsigned queue_depth) : m_queue_depth(queue_depth) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        // Leave room in the completion queue for the shutdown NOP on top of a full set of reads
+        m_ring_fd = IoUringSetup(queue_depth * 2, &params);
+        if (m_ring_fd < 0) {
+            throw Exception(ErrorCode::IO_ERROR, std::string("io_uring unavailable: ") + std::strerror(errno));
+        }
+
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+
+        m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                         IORING_OFF_SQ_RING);
+        m_cq_ring = single_mmap ? m_sq_ring
+                                : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       m_ring_fd, IORING_OFF_CQ_RING);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes_map = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                          IORING_OFF_SQES);
+
+        if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || m_sqes_map == MAP_FAILED) {
+            Unmap();
+            close(m_ring_fd);
+            throw Exception(ErrorCode::IO_ERROR, "Failed to map io_uring");
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>(m_sq_ring);
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        m_sqes = static_cast<io_uring_sqe*>(m_sqes_map);
+
+        uint8_t* cq = static_cast<uint8_t*>(m_cq_ring);
+        m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        m_in_flight.resize(queue_depth);
+        for (unsigned i = 0; i < queue_depth; i++) m_free_slots.push_back(i);
+
+        m_reaper = std::thread(&IoUringReader::ReapLoop, this);
+    }
+
+    ~IoUringReader() override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+
+            // A NOP tagged with the shutdown marker wakes the reaper thread out of io_uring_enter
+            io_uring_sqe* sqe = NextSqe();
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = SHUTDOWN_MARKER;
+            CommitSqe();
+        }
+
+        m_reaper.join();
+
+        std::vector<ReadRequest> pending(std::make_move_iterator(m_pending.begin()),
+                                         std::make_move_iterator(m_pending.end()));
+        m_pending.clear();
+        CompleteCancelled(pending);
+
+        Unmap();
+        close(m_ring_fd);
+    }
+
+    void Submit(ReadRequest request) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(std::move(request));
+        SubmitPending();
+    }
+
+    void Cancel(uint64_t tag) override {
+        std::vector<ReadRequest> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            cancelled = ExtractTagged(m_pending, tag);
+        }
+        CompleteCancelled(cancelled);
+    }
+
+    std::string Backend() const override { return "io_uring"; }
+
+   private:
+    static constexpr uint64_t SHUTDOWN_MARKER = UINT64_MAX;
+
+    struct InFlight {
+        ReadRequest request;
+        iovec iov;
+    };
+
+    void Unmap() {
+        if (m_sqes_map != MAP_FAILED) munmap(m_sqes_map, m_sqes_size);
+        if (m_cq_ring != m_sq_ring && m_cq_ring != MAP_FAILED) munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring != MAP_FAILED) munmap(m_sq_ring, m_sq_ring_size);
+    }
+
+    // Must be called with m_mutex held. The submission queue tail is only ever written by us.
+    io_uring_sqe* NextSqe() {
+        unsigned idx = *m_sq_tail & m_sq_mask;
+        io_uring_sqe* sqe = &m_sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[idx] = idx;
+        return sqe;
+    }
+
+    void CommitSqe() {
+        __atomic_store_n(m_sq_tail, *m_sq_tail + 1, __ATOMIC_RELEASE);
+        while (IoUringEnter(m_ring_fd, 1, 0, 0) < 0 && errno == EINTR);
+    }
+
+    // Must be called with m_mutex held. Moves queued requests into the ring until the queue depth is reached.
+    void SubmitPending() {
+        while (!m_pending.empty() && !m_free_slots.empty() && !m_shutdown) {
+            unsigned slot = m_free_slots.back();
+            m_free_slots.pop_back();
+
+            InFlight& in_flight = m_in_flight[slot];
+            in_flight.request = std::move(m_pending.front());
+            m_pending.pop_front();
+            in_flight.iov.iov_base = in_flight.request.buffer;
+            in_flight.iov.iov_len = in_flight.request.length;
+
+            // READV rather than READ keeps this working on kernels older than 5.6
+            io_uring_sqe* sqe = NextSqe();
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = in_flight.request.fd;
+            sqe->off = in_flight.request.offset;
+            sqe->addr = reinterpret_cast<uint64_t>(&in_flight.iov);
+            sqe->len = 1;
+            sqe->user_data = slot;
+            CommitSqe();
+        }
+    }
+
+    void ReapLoop() {
+        // After shutdown has been requested keep reaping until every read in flight has completed, otherwise their
+        // owners would wait on callbacks that never arrive.
+        bool shutdown_seen = false;
+        bool running = true;
+        while (running) {
+            if (IoUringEnter(m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                break;
+            }
+
+            unsigned head = *m_cq_head;
+            unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+            while (head != tail) {
+                io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+                head++;
+
+                if (cqe.user_data == SHUTDOWN_MARKER) {
+                    shutdown_seen = true;
+                    continue;
+                }
+
+                ReadRequest request;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    request = std::move(m_in_flight[cqe.user_data].request);
+                    m_free_slots.push_back(static_cast<unsigned>(cqe.user_data));
+                }
+
+                if (request.on_complete) request.on_complete(cqe.res);
+            }
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            SubmitPending();
+            if (shutdown_seen && m_free_slots.size() == m_queue_depth) running = false;
+        }
+    }
+
+    unsigned m_queue_depth;
+    int m_ring_fd = -1;
+
+    void* m_sq_ring = MAP_FAILED;
+    void* m_cq_ring = MAP_FAILED;
+    void* m_sqes_map = MAP_FAILED;
+    size_t m_sq_ring_size = 0;
+    size_t m_cq_ring_size = 0;
+    size_t m_sqes_size = 0;
+
+    unsigned* m_sq_tail = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned* m_sq_array = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+
+    unsigned* m_cq_head = nullptr;
+    unsigned* m_cq_tail = nullptr;
+    unsigned m_cq_mask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    std::mutex m_mutex;
+    std::deque<ReadRequest> m_pending;
+    std::vector<InFlight> m_in_flight;
+    std::vector<unsigned> m_free_slots;
+    bool m_shutdown = false;
+    std::thread m_reaper;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// pread thread pool backend
+// ---------------------------------------------------------------------------------------------------------------------
+
+class ThreadPoolReader : public AsyncReader {
+   public:
+    explicit ThreadPoolReader(unsigned num_threads) {
+        for (unsigned i = 0; i < num_threads; i++) {
+            m_workers.emplace_back(&ThreadPoolReader::WorkerLoop, this);
+        }
+    }
+
+    ~ThreadPoolReader() override {
+        std::vector<ReadRequest> pending;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+            pending.assign(std::make_move_iterator(m_pending.begin()), std::make_move_iterator(m_pending.end()));
+            m_pending.clear();
+        }
+        m_cv.notify_all();
+
+        for (auto& worker : m_workers) worker.join();
+        CompleteCancelled(pending);
+    }
+
+    void Submit(ReadRequest request) override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.push_back(std::move(request));
+        }
+        m_cv.notify_one();
+    }
+
+    void Cancel(uint64_t tag) override {
+        std::vector<ReadRequest> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            cancelled = ExtractTagged(m_pending, tag);
+        }
+        CompleteCancelled(cancelled);
+    }
+
+    std::string Backend() const override { return "pread"; }
+
+   private:
+    void WorkerLoop() {
+        while (true) {
+            ReadRequest request;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [&] { return m_shutdown || !m_pending.empty(); });
+                if (m_shutdown) return;
+
+                request = std::move(m_pending.front());
+                m_pending.pop_front();
+            }
+
+            // pread may return short reads, keep going until the range is filled or the end of the file is reached
+            ssize_t total = 0;
+            while (static_cast<size_t>(total) < request.length) {
+                ssize_t n = pread(request.fd, request.buffer + total, request.length - total, request.offset + total);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    total = -errno;
+                    break;
+                }
+                if (n == 0) break;
+                total += n;
+            }
+
+            if (request.on_complete) request.on_complete(total);
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<ReadRequest> m_pending;
+    std::vector<std::thread> m_workers;
+    bool m_shutdown = false;
+};
+
+std::unique_ptr<AsyncReader> AsyncReader::Create(unsigned queue_depth) {
+    try {
+        return std::make_unique<IoUringReader>(queue_depth);
+    } catch (const Exception&) {
+        // io_uring is commonly disabled by seccomp filters in containers or by kernel.io_uring_disabled
+        return std::make_unique<ThreadPoolReader>(queue_depth);
+    }
+}
+
+AsyncReader& AsyncReader::Shared() {
+    static std::unique_ptr<AsyncReader> reader = Create();
+    return *reader;
+}
+
+uint64_t AsyncReader::NewTag() {
+    static std::atomic<uint64_t> next_tag = 1;
+    return next_tag.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace dragonfruit
@@ -1,275 +1,278 @@
 #include "dragonfruit_engine/audio_engine.hpp"
 
-#include <pulse/error.h>
-#include <pulse/volume.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
 
 #include <algorithm>
 #include <cmath>
-#include <iostream>
-#include <thread>
 
-#include "dragonfruit_engine/exception.hpp"
-#include "dragonfruit_engine/utils.hpp"
+#include "dragonfruit_engine/alsa_engine.hpp"
+#include "dragonfruit_engine/pulse_engine.hpp"
+#include "dragonfruit_engine/render.hpp"
 
 namespace dragonfruit {
 
-// Callback for context state changes
-void ContextStateCallback(pa_context* context, void* userdata) {
-    (void)context;  // Suppress unused warning
-    pa_threaded_mainloop_signal(reinterpret_cast<pa_threaded_mainloop*>(userdata), 0);
-}
-
-// Callback for stream state changes
-void StreamStateCallback(pa_stream* stream, void* userdata) {
-    (void)stream;  // Suppress unused warning
-    pa_threaded_mainloop_signal(static_cast<pa_threaded_mainloop*>(userdata), 0);
-}
+namespace {
 
-// Stream write callback
-void StreamWriteCallback(pa_stream* stream, size_t length, void* userData) {
-    EngineState* audio = static_cast<EngineState*>(userData);
-    size_t remaining = audio->sound->SampleDataSize() - audio->offset;
-    size_t bytesToWrite = std::min(length, remaining);
+// The scratch buffers are allocated up front for requests of up to this long, the default target length of a
+// PulseAudio stream buffer
+constexpr size_t REALTIME_SCRATCH_SECONDS = 2;
 
-    if (bytesToWrite > 0) {
-        pa_stream_write(stream, audio->sound->SampleData() + audio->offset, bytesToWrite, nullptr, 0, PA_SEEK_RELATIVE);
-        audio->offset += bytesToWrite;
-    } else {
-        audio->is_finished = true;
-        pa_stream_cork(stream, true, nullptr, nullptr);
-    }
+uint64_t MonotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
 }
 
-// Blocking call to wait for a stream to disconnect since pa_stream_disconnect is an async call.
-void AwaitStreamDisconnect(pa_threaded_mainloop* mainloop, pa_stream* stream) {
-    if (stream) {
-        pa_stream_disconnect(stream);
+}  // namespace
 
-        while (true) {
-            pa_stream_state_t state = pa_stream_get_state(stream);
-            if (state == PA_STREAM_TERMINATED || state == PA_STREAM_FAILED) {
-                break;
-            }
+CallbackScope::CallbackScope(CallbackTiming* timing) : m_timing(timing) {
+    if (!m_timing) return;
 
-            pa_threaded_mainloop_wait(mainloop);
-        }
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    m_minor_faults = usage.ru_minflt;
+    m_major_faults = usage.ru_majflt;
+    m_start_ns = MonotonicNs();
+}
 
-        pa_stream_unref(stream);
+CallbackScope::~CallbackScope() {
+    if (!m_timing) return;
+
+    uint64_t end = MonotonicNs();
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+
+    // Only the audio thread writes the timing, so plain loads and stores are enough
+    CallbackTiming& timing = *m_timing;
+    auto relaxed = std::memory_order_relaxed;
+    timing.callbacks.store(timing.callbacks.load(relaxed) + 1, relaxed);
+    timing.minor_faults.store(timing.minor_faults.load(relaxed) + usage.ru_minflt - m_minor_faults, relaxed);
+    timing.major_faults.store(timing.major_faults.load(relaxed) + usage.ru_majflt - m_major_faults, relaxed);
+    timing.max_duration_ns.store(std::max(timing.max_duration_ns.load(relaxed), end - m_start_ns), relaxed);
+
+    if (timing.last_start_ns != 0) {
+        double interval_ms = (m_start_ns - timing.last_start_ns) / 1e6;
+        timing.intervals.store(timing.intervals.load(relaxed) + 1, relaxed);
+        timing.interval_sum_ms.store(timing.interval_sum_ms.load(relaxed) + interval_ms, relaxed);
+        timing.interval_square_sum_ms.store(timing.interval_square_sum_ms.load(relaxed) + interval_ms * interval_ms,
+                                            relaxed);
     }
+    timing.last_start_ns = m_start_ns;
 }
 
-AudioEngine::AudioEngine() {
-    // Initialize threaded mainloop
-    m_mainloop = pa_threaded_mainloop_new();
-    if (!m_mainloop) {
-        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to inqitialize pulse main loop");
+ThreadScheduling PromoteCurrentThread(int priority) {
+    // Unprivileged processes can use SCHED_FIFO up to RLIMIT_RTPRIO, whose soft limit can be raised to the hard one.
+    // If the limit can not be read the requested priority is simply tried, sched_setscheduler has the final say.
+    rlim_t allowed = static_cast<rlim_t>(std::max(priority, 1));
+    rlimit limit{};
+    if (getrlimit(RLIMIT_RTPRIO, &limit) == 0) {
+        if (limit.rlim_cur < allowed) {
+            limit.rlim_cur = std::min(limit.rlim_max, allowed);
+            setrlimit(RLIMIT_RTPRIO, &limit);
+            getrlimit(RLIMIT_RTPRIO, &limit);
+        }
+        allowed = std::min(allowed, limit.rlim_cur);
     }
 
-    // Create context for threaded mainloop
-    m_mainloop_api = pa_threaded_mainloop_get_api(m_mainloop);
-    m_context = pa_context_new(m_mainloop_api, "Dragonfruit");
-    if (!m_context) {
-        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to create pulse context");
+    ThreadScheduling result;
+    sched_param param{};
+    param.sched_priority = static_cast<int>(std::clamp<rlim_t>(allowed, 1, 99));
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) == 0) {
+        result.realtime = true;
+        result.priority = param.sched_priority;
+    } else {
+        // -11 is what PulseAudio itself falls back to. On Linux these calls only affect the calling thread.
+        int nice = -11;
+        while (nice < 0 && setpriority(PRIO_PROCESS, 0, nice) != 0) nice++;
+        result.priority = getpriority(PRIO_PROCESS, 0);
     }
+    return result;
+}
 
-    pa_context_set_state_callback(m_context, ContextStateCallback, m_mainloop);
+size_t RenderOutput(EngineState& audio, float* out, size_t frames) {
+    Sound& sound = *audio.sound;
 
-    // Start the main loop
-    if (pa_threaded_mainloop_start(m_mainloop) < 0) {
-        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to start pulse main loop thread");
-    }
+    // Stretched output has no fixed length, the stretcher stops by itself at the end of the song
+    size_t remaining = audio.stretcher ? SIZE_MAX : sound.TotalFrames() - audio.frame;
+    size_t wanted = std::min(frames, remaining);
 
-    pa_threaded_mainloop_lock(m_mainloop);
+    size_t read = 0;
+    if (wanted > 0) {
+        // Songs in a layout other than the output's are rendered aside and then mixed into the output
+        float* rendered = out;
+        if (audio.mixer) {
+            if (audio.unmixed.size() < wanted * sound.Channels()) audio.unmixed.resize(wanted * sound.Channels());
+            rendered = audio.unmixed.data();
+        }
 
-    // Connect PulseAudio context to threaded mainloop
-    if (pa_context_connect(m_context, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
-        pa_threaded_mainloop_unlock(m_mainloop);
-        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to connect pulse context");
+        float gain = audio.gain.load(std::memory_order_relaxed);
+        read = audio.stretcher ? audio.stretcher->Process(sound, rendered, wanted, gain, audio.scratch)
+                               : RenderPcm(sound, audio.frame, rendered, wanted, gain, audio.scratch);
     }
 
-    // Wait until context is ready or failed in a blocking manner. The context state change call back should signal to
-    // the mainloop once it has been called.
-    while (true) {
-        pa_context_state_t state = pa_context_get_state(m_context);
-        if (state == PA_CONTEXT_READY) {
-            break;
+    if (read > 0) {
+        uint64_t epoch = audio.stream_epoch.load(std::memory_order_relaxed);
+        if (audio.written_epoch.load(std::memory_order_relaxed) != epoch) {
+            std::chrono::steady_clock::rep now = std::chrono::steady_clock::now().time_since_epoch().count();
+            if (audio.first_write.load(std::memory_order_relaxed) == 0) {
+                audio.first_write.store(now, std::memory_order_relaxed);
+            }
+            audio.epoch_written.store(now, std::memory_order_relaxed);
+            audio.written_epoch.store(epoch, std::memory_order_release);
         }
+        if (audio.mixer) audio.mixer->Process(audio.unmixed.data(), out, read);
+        if (!audio.stretcher) audio.frame += read;
+    }
 
-        if (state == PA_CONTEXT_FAILED || state == PA_CONTEXT_TERMINATED) {
-            pa_threaded_mainloop_unlock(m_mainloop);
-            throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to connect pulse context");
-        }
+    size_t written = read;
 
-        pa_threaded_mainloop_wait(m_mainloop);
+    // A short read of a fully loaded song is its end, what the graph holds back is flushed with silence
+    if (written < frames && sound.IsLoaded() && audio.graph_tail > 0) {
+        size_t tail = std::min(frames - written, audio.graph_tail);
+        std::fill_n(out + written * audio.out_channels, tail * audio.out_channels, 0.0f);
+        audio.graph_tail -= tail;
+        written += tail;
     }
 
-    pa_threaded_mainloop_unlock(m_mainloop);
+    if (written > 0) {
+        audio.graph->Process(out, written);
+        audio.tap->Write(out, written * audio.out_channels);
+    }
+    return written;
 }
 
-AudioEngine::~AudioEngine() {
-    pa_threaded_mainloop_lock(m_mainloop);
-
-    // Destroy stream
-    AwaitStreamDisconnect(m_mainloop, m_stream);
-
-    // Destroy the context (this is a blocking call, no awaiting required)
-    pa_context_disconnect(m_context);
-    pa_context_unref(m_context);
-    pa_threaded_mainloop_unlock(m_mainloop);
-
-    // Destroy the threaded mainloop
-    pa_threaded_mainloop_stop(m_mainloop);
-    pa_threaded_mainloop_free(m_mainloop);
+std::unique_ptr<AudioEngine> AudioEngine::Create(const AudioEngineOptions& options) {
+    switch (options.backend) {
+        case AudioBackend::ALSA:
+            return std::make_unique<AlsaEngine>(options);
+        case AudioBackend::PULSE:
+            break;
+    }
+    return std::make_unique<PulseEngine>(options);
 }
 
-void AudioEngine::PlayAsync(std::shared_ptr<Sound> sound) {
-    pa_threaded_mainloop_lock(m_mainloop);
-
-    // If there is already a stream setup, we will have to disconnect and create a new one
-
-    AwaitStreamDisconnect(m_mainloop, m_stream);
-    m_stream = nullptr;
-
-    // Setup stream
-    m_sample_spec.channels = sound->Channels();
-    m_sample_spec.format = utils::GetPulseFormat(sound->Format(), sound->BitDepth());
-    m_sample_spec.rate = sound->SampleRate();
-
-    if (m_sample_spec.format == pa_sample_format::PA_SAMPLE_INVALID) {
-        throw Exception(ErrorCode::INVALID_FORMAT, "Invalid WAV format");
+AudioEngine::AudioEngine(const AudioEngineOptions& options)
+    : m_options(options),
+      m_graph({.workers = options.dsp_workers,
+               .realtime = options.realtime,
+               .realtime_priority = options.realtime_priority}) {
+    m_engine_state.graph = &m_graph;
+    if (options.impulse_response) {
+        m_graph.Insert(std::make_shared<ConvolverNode>(options.impulse_response, options.convolution_partition));
     }
+}
+
+void AudioEngine::SetupSong(std::shared_ptr<Sound> sound, const ChannelLayout& output) {
+    ChannelLayout layout = sound->Layout();
+    m_engine_state.mixer.reset();
+    if (!(output == layout)) m_engine_state.mixer.emplace(layout, output);
+    m_engine_state.out_channels = output.Channels();
 
-    // Setup internal engine state
-    m_engine_state.offset = 0;
+    m_engine_state.stream_epoch.fetch_add(1, std::memory_order_relaxed);
+    m_engine_state.frame = 0;
     m_engine_state.is_finished = false;
     m_engine_state.sound = sound;
-
-    // Create a new stream connect to the context and hook the state change and write callbacks for async functionality
-    m_stream = pa_stream_new(m_context, "Playback", &m_sample_spec, nullptr);
-    pa_stream_set_write_callback(m_stream, StreamWriteCallback, &m_engine_state);
-    pa_stream_set_state_callback(m_stream, StreamStateCallback, m_mainloop);
-
-    // Connect the stream to the pulse server in playback mode
-    if (pa_stream_connect_playback(
-            m_stream, nullptr, nullptr,
-            static_cast<pa_stream_flags_t>(PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE |
-                                           PA_STREAM_ADJUST_LATENCY),
-            nullptr, nullptr) < 0) {
-        throw Exception(ErrorCode::INTERNAL_ERROR, "Unable to connect pulse stream");
+    ResetStretcher();
+    m_graph.SetFormat(output.Channels(), sound->SampleRate());
+    m_engine_state.graph_tail = m_graph.Latency();
+    m_engine_state.tap = &m_tap;
+    m_tap.SetFormat(output.Channels(), sound->SampleRate());
+    m_timing.last_start_ns = 0;
+
+    // Allocate the scratch buffers here rather than having the audio thread grow them, large enough for the longest
+    // request and for the window a stretcher reads at any speed the song may be switched to. Locked in real-time mode.
+    size_t request_frames = sound->SampleRate() * REALTIME_SCRATCH_SECONDS;
+    size_t read_frames = std::max(request_frames, TimeStretcher::MaxInputFrames(sound->SampleRate()));
+    size_t scratch_size = read_frames * sound->FrameSize();
+    if (m_engine_state.scratch.size() < scratch_size) {
+        m_engine_state.scratch.resize(scratch_size);
+        if (m_options.realtime) mlock(m_engine_state.scratch.data(), m_engine_state.scratch.size());
     }
-
-    // Wait for stream to be ready
-    while (true) {
-        pa_stream_state_t state = pa_stream_get_state(m_stream);
-        if (state == PA_STREAM_READY) {
-            break;
-        }
-
-        if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED) {
-            pa_threaded_mainloop_unlock(m_mainloop);
-            throw Exception(ErrorCode::INTERNAL_ERROR, "Stream failed to start");
-        }
-
-        pa_threaded_mainloop_wait(m_mainloop);
+    size_t unmixed_size = request_frames * sound->Channels();
+    if (m_engine_state.mixer && m_engine_state.unmixed.size() < unmixed_size) {
+        m_engine_state.unmixed.resize(unmixed_size);
+        if (m_options.realtime) mlock(m_engine_state.unmixed.data(), m_engine_state.unmixed.size() * sizeof(float));
     }
-
-    m_sink_idx = pa_stream_get_index(m_stream);
-
-    pa_threaded_mainloop_unlock(m_mainloop);
-}
-
-void AudioEngine::Pause(bool pause) {
-    pa_threaded_mainloop_lock(m_mainloop);
-    pa_stream_cork(m_stream, pause, nullptr, nullptr);
-    pa_threaded_mainloop_unlock(m_mainloop);
 }
 
-bool AudioEngine::IsFinished() { return m_engine_state.is_finished; }
-
-double AudioEngine::GetCurrentSongTime() {
-    pa_threaded_mainloop_lock(m_mainloop);
-
-    pa_stream_update_timing_info(m_stream, nullptr, nullptr);
-    const pa_timing_info* timing_info = pa_stream_get_timing_info(m_stream);
-
-    // If we haven't received an update from the server yet, it's possible that the timing info is not yet valid. In
-    // this case return 0.0, subsequent calls should work properly.
-    if (!timing_info) {
-        pa_threaded_mainloop_unlock(m_mainloop);
-        return 0.0;
+void AudioEngine::ResetStretcher() {
+    m_engine_state.stretcher.reset();
+    if (m_speed != 1.0 && m_engine_state.sound) {
+        const Sound& sound = *m_engine_state.sound;
+        m_engine_state.stretcher.emplace(sound.Channels(), sound.SampleRate(), m_speed);
     }
-
-    int64_t played_offset = static_cast<int64_t>(m_engine_state.offset) -
-                            static_cast<int64_t>(timing_info->write_index - timing_info->read_index);
-
-    played_offset = std::clamp(played_offset, int64_t(0), static_cast<int64_t>(m_engine_state.sound->SampleDataSize()));
-
-    pa_threaded_mainloop_unlock(m_mainloop);
-
-    return static_cast<double>(played_offset) / pa_bytes_per_second(&m_sample_spec);
 }
 
-double AudioEngine::GetTotalSongTime() {
-    pa_threaded_mainloop_lock(m_mainloop);
-    double total_song_time =
-        static_cast<double>(pa_bytes_to_usec(m_engine_state.sound->SampleDataSize(), &m_sample_spec)) / 1000000.0;
-    pa_threaded_mainloop_unlock(m_mainloop);
-    return total_song_time;
+// Continues writing from another frame of the song, as a new stream epoch
+void AudioEngine::SetFrame(size_t frame) {
+    // The new frame should be clamped between 0 (the start of the audio data) and the end of the audio data to ensure
+    // we do not accidentally read unloaded/uninitialized memory regions.
+    m_engine_state.frame = std::min(frame, m_engine_state.sound->TotalFrames());
+    if (m_engine_state.stretcher) m_engine_state.stretcher->Reset(m_engine_state.frame);
+    m_graph.Reset();
+    m_engine_state.graph_tail = m_graph.Latency();
+
+    m_engine_state.stream_epoch.fetch_add(1, std::memory_order_relaxed);
+    m_timing.last_start_ns = 0;
 }
 
-void AudioEngine::Seek(double seconds) {
-    // Convert seconds into the amount of bytes to seek back
-    size_t bytes_per_second = pa_bytes_per_second(&m_sample_spec);
-
-    pa_threaded_mainloop_lock(m_mainloop);
-    pa_stream_cork(m_stream, true, nullptr, nullptr);
-    const pa_timing_info* timing_info = pa_stream_get_timing_info(m_stream);
-
-    // We haven't received a timing update from the server yet, therefore we cannot accurately seek. In this case, we
-    // return early. It is most likely this only occurs during edge cases, but we should check just in case.
-    if (!timing_info) {
-        pa_threaded_mainloop_unlock(m_mainloop);
-        return;
+// Frame of the song being heard right now, given how many of the frames written are still buffered
+double AudioEngine::PlayedFrame(int64_t buffered_frames) const {
+    // Frames held back by the graph have been rendered but not written yet
+    buffered_frames += m_graph.Latency();
+    double played_frame = static_cast<double>(m_engine_state.frame) - buffered_frames;
+    if (const std::optional<TimeStretcher>& stretcher = m_engine_state.stretcher) {
+        played_frame = stretcher->SourceFrameAt(static_cast<int64_t>(stretcher->OutputFrames()) - buffered_frames);
     }
-    int64_t still_in_buffer = timing_info->write_index - timing_info->read_index;
-
-    double bytes_to_seek = seconds * bytes_per_second;
-    double current_offset = m_engine_state.offset - still_in_buffer;
-
-    // The new offset should be clamped between 0 (the start of the audio data) and the end of the audio data to ensure
-    // we do not accidentally set the offset to unreadable/uninitialized memory regions.
-    size_t new_offset = static_cast<size_t>(
-        std::clamp(current_offset + bytes_to_seek, 0.0, static_cast<double>(m_engine_state.sound->SampleDataSize())));
-
-    // Ensure the new offset is aligned to the frame size
-    new_offset = new_offset - (new_offset % pa_frame_size(&m_sample_spec));
-    m_engine_state.offset = new_offset;
-
-    // Flush the current buffer so that we start at our new offset
-    pa_stream_flush(m_stream, nullptr, nullptr);
-    pa_stream_cork(m_stream, false, nullptr, nullptr);
-    pa_stream_update_timing_info(m_stream, nullptr, nullptr);
-    pa_threaded_mainloop_unlock(m_mainloop);
+    return std::clamp(played_frame, 0.0, static_cast<double>(m_engine_state.sound->TotalFrames()));
 }
 
-void AudioEngine::SetVolume(double volume) {
-    double volume_clamped = std::clamp(volume, 0.0, 1.0);
+bool AudioEngine::IsFinished() { return m_engine_state.is_finished; }
 
-    pa_volume_t pa_volume = PA_VOLUME_NORM * volume_clamped;
-    pa_cvolume cvol;
+void AudioEngine::SetGain(double gain) {
+    m_engine_state.gain.store(static_cast<float>(std::max(gain, 0.0)), std::memory_order_relaxed);
+}
 
-    pa_threaded_mainloop_lock(m_mainloop);
-    pa_cvolume_set(&cvol, m_sample_spec.channels, pa_volume);
-    pa_context_set_sink_input_volume(m_context, m_sink_idx, &cvol, nullptr, nullptr);
-    pa_threaded_mainloop_unlock(m_mainloop);
+EngineStats AudioEngine::Stats() const {
+    auto relaxed = std::memory_order_relaxed;
+    EngineStats stats{.realtime = m_realtime.load(relaxed),
+                      .priority = m_priority.load(relaxed),
+                      .callbacks = m_timing.callbacks.load(relaxed),
+                      .minor_faults = m_timing.minor_faults.load(relaxed),
+                      .major_faults = m_timing.major_faults.load(relaxed),
+                      .max_callback_us = m_timing.max_duration_ns.load(relaxed) / 1e3,
+                      .underruns = m_engine_state.underruns.load(relaxed)};
+
+    uint64_t intervals = m_timing.intervals.load(relaxed);
+    if (intervals > 0) {
+        stats.mean_interval_ms = m_timing.interval_sum_ms.load(relaxed) / intervals;
+        double variance = m_timing.interval_square_sum_ms.load(relaxed) / intervals -
+                          stats.mean_interval_ms * stats.mean_interval_ms;
+        stats.jitter_ms = std::sqrt(std::max(variance, 0.0));
+    }
+    return stats;
 }
 
-bool AudioEngine::IsPaused() {
-    pa_threaded_mainloop_lock(m_mainloop);
-    int paused = pa_stream_is_corked(m_stream);
-    pa_threaded_mainloop_unlock(m_mainloop);
+std::optional<std::chrono::steady_clock::time_point> AudioEngine::FirstWriteTime() const {
+    std::chrono::steady_clock::rep first_write = m_engine_state.first_write.load(std::memory_order_relaxed);
+    if (first_write == 0) return std::nullopt;
+    return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(first_write));
+}
 
-    return paused < 1 ? false : true;
+ControlProgress AudioEngine::Progress() const {
+    using std::chrono::steady_clock;
+    auto at = [](steady_clock::rep time) { return steady_clock::time_point(steady_clock::duration(time)); };
+
+    // Times are stored before their counters are published, so they are at least as recent as the counters read
+    ControlProgress progress;
+    progress.stream_changes = m_engine_state.written_epoch.load(std::memory_order_acquire);
+    progress.stream_changed = at(m_engine_state.epoch_written.load(std::memory_order_relaxed));
+    progress.cork_changes = m_engine_state.cork_acks.load(std::memory_order_acquire);
+    progress.cork_changed = at(m_engine_state.cork_acked.load(std::memory_order_relaxed));
+    return progress;
 }
 
-}  // namespace dragonfruit
\ No newline at end of file
+}  // namespace dragonfruit
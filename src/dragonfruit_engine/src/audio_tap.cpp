@@ -0,0 +1,62 @@
+#include "dragonfruit_engine/audio_tap.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace dragonfruit {
+
+AudioTap::AudioTap() : m_ring(new float[CAPACITY]()) {}
+
+void AudioTap::SetFormat(uint16_t channels, uint32_t sample_rate) {
+    // The start position is published before the format, so a reader which sees the new format also sees where it
+    // begins
+    m_format_pos.store(m_write_pos.load(std::memory_order_relaxed), std::memory_order_release);
+    m_format.store((static_cast<uint64_t>(channels) << 32) | sample_rate, std::memory_order_release);
+}
+
+void AudioTap::Write(const float* samples, size_t count) {
+    uint64_t pos = m_write_pos.load(std::memory_order_relaxed);
+
+    // Anything beyond the capacity would be overwritten straight away
+    if (count > CAPACITY) {
+        pos += count - CAPACITY;
+        samples += count - CAPACITY;
+        count = CAPACITY;
+    }
+
+    // Readers which see any of the samples copied below also see the claim, see ReadLatest
+    m_claim_pos.store(pos + count, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t start = pos & (CAPACITY - 1);
+    size_t first = std::min(count, CAPACITY - start);
+    std::memcpy(&m_ring[start], samples, first * sizeof(float));
+    std::memcpy(&m_ring[0], samples + first, (count - first) * sizeof(float));
+
+    m_write_pos.store(pos + count, std::memory_order_release);
+}
+
+bool AudioTap::ReadLatest(float* dst, size_t frames, uint16_t& channels, uint32_t& sample_rate) const {
+    uint64_t format = m_format.load(std::memory_order_acquire);
+    uint64_t format_pos = m_format_pos.load(std::memory_order_acquire);
+    uint64_t end = m_write_pos.load(std::memory_order_acquire);
+
+    channels = static_cast<uint16_t>(format >> 32);
+    sample_rate = static_cast<uint32_t>(format);
+    size_t count = frames * channels;
+    if (channels == 0 || count > CAPACITY || end - format_pos < count) return false;
+
+    uint64_t begin = end - count;
+    size_t start = begin & (CAPACITY - 1);
+    size_t first = std::min(count, CAPACITY - start);
+    std::memcpy(dst, &m_ring[start], first * sizeof(float));
+    std::memcpy(dst + first, &m_ring[0], (count - first) * sizeof(float));
+
+    // If the writer claimed the start of the copied range for a newer write, which it may have been partly copied
+    // into already, or switched formats, the copy may be torn
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t claimed = m_claim_pos.load(std::memory_order_relaxed);
+    return claimed - begin <= CAPACITY && m_format.load(std::memory_order_relaxed) == format;
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,229 @@
+#include "dragonfruit_engine/buffer_pool.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "dragonfruit_engine/exception.hpp"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+namespace dragonfruit {
+
+static constexpr size_t HUGE_PAGE_SIZE = 2u << 20;
+
+PooledBuffer::~PooledBuffer() { Release(); }
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : m_pool(std::exchange(other.m_pool, nullptr)),
+      m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_capacity(std::exchange(other.m_capacity, 0)),
+      m_locked(std::exchange(other.m_locked, false)) {}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        Release();
+        m_pool = std::exchange(other.m_pool, nullptr);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_capacity = std::exchange(other.m_capacity, 0);
+        m_locked = std::exchange(other.m_locked, false);
+    }
+    return *this;
+}
+
+bool PooledBuffer::Lock() {
+    if (!m_locked && m_pool && m_data) m_locked = m_pool->Lock(m_data, m_capacity);
+    return m_locked;
+}
+
+void PooledBuffer::Release() {
+    if (m_pool && m_data) m_pool->Release(m_data, m_capacity, m_locked);
+    m_pool = nullptr;
+    m_data = nullptr;
+    m_locked = false;
+}
+
+BufferPool::BufferPool(const BufferPoolOptions& options) : m_options(options) {}
+
+BufferPool::~BufferPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_prefault_cv.notify_all();
+    if (m_prefault_thread.joinable()) m_prefault_thread.join();
+
+    Trim();
+}
+
+size_t BufferPool::RoundCapacity(size_t size) const {
+    // Huge page backed buffers have to cover whole huge pages, and rounding regular buffers up to the same granularity
+    // makes songs of similar length share buffers more often.
+    size_t granularity = HUGE_PAGE_SIZE;
+    return (std::max<size_t>(size, 1) + granularity - 1) / granularity * granularity;
+}
+
+uint8_t* BufferPool::Map(size_t capacity) {
+    void* data = MAP_FAILED;
+
+    if (m_options.huge_pages == HugePageMode::EXPLICIT) {
+        // Explicit huge pages need a reserved hugetlbfs pool (vm.nr_hugepages), fall back to regular pages without one
+        data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+
+    if (data == MAP_FAILED) {
+        data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to map sample buffer");
+        }
+
+        if (m_options.huge_pages != HugePageMode::NONE) madvise(data, capacity, MADV_HUGEPAGE);
+    }
+
+    return static_cast<uint8_t*>(data);
+}
+
+void BufferPool::QueuePrefault(uint8_t* data, size_t capacity) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_prefault_queue.emplace_back(data, capacity);
+    if (!m_prefault_thread.joinable()) m_prefault_thread = std::thread(&BufferPool::PrefaultLoop, this);
+    m_prefault_cv.notify_all();
+}
+
+void BufferPool::CancelPrefault(uint8_t* data, std::unique_lock<std::mutex>& lock) {
+    std::erase_if(m_prefault_queue, [&](const auto& entry) { return entry.first == data; });
+    m_prefault_cv.wait(lock, [&] { return m_prefaulting != data; });
+}
+
+void BufferPool::PrefaultLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_prefault_cv.wait(lock, [&] { return m_stopping || !m_prefault_queue.empty(); });
+        if (m_stopping) return;
+
+        auto [data, capacity] = m_prefault_queue.front();
+        m_prefault_queue.pop_front();
+        m_prefaulting = data;
+        lock.unlock();
+
+        // Faults the pages in without touching their contents, so it can race the reads filling the buffer. Older
+        // kernels refuse it, their pages are faulted in by the reads instead.
+        madvise(data, capacity, MADV_POPULATE_WRITE);
+
+        lock.lock();
+        m_prefaulting = nullptr;
+        m_prefault_cv.notify_all();
+    }
+}
+
+void BufferPool::Unmap(uint8_t* data, size_t capacity) { munmap(data, capacity); }
+
+PooledBuffer BufferPool::Acquire(size_t size) {
+    size_t capacity = RoundCapacity(size);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Best fit, but do not hand out a buffer more than twice the size that was asked for
+        auto it = m_free.lower_bound(capacity);
+        if (it != m_free.end() && it->first <= capacity * 2) {
+            PooledBuffer buffer(this, it->second, size, it->first);
+            m_stats.cached_bytes -= it->first;
+            m_stats.hits++;
+            m_free.erase(it);
+            return buffer;
+        }
+
+        m_stats.misses++;
+        m_stats.mapped_bytes += capacity;
+    }
+
+    // Mapping can take a while for large buffers, do it without holding the lock
+    uint8_t* data;
+    try {
+        data = Map(capacity);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.mapped_bytes -= capacity;
+        throw;
+    }
+
+    if (m_options.prefault) QueuePrefault(data, capacity);
+    return PooledBuffer(this, data, size, capacity);
+}
+
+bool BufferPool::Lock(uint8_t* data, size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stats.locked_bytes + capacity > m_options.max_locked_bytes) {
+            m_stats.lock_failures++;
+            return false;
+        }
+        m_stats.locked_bytes += capacity;
+    }
+
+    // mlock faults every page in before it returns, which can take a while for large buffers
+    if (mlock(data, capacity) != 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.locked_bytes -= capacity;
+        m_stats.lock_failures++;
+        return false;
+    }
+    return true;
+}
+
+void BufferPool::Release(uint8_t* data, size_t capacity, bool locked) {
+    // Cached buffers are not locked, only the ones in use need to stay resident
+    if (locked) munlock(data, capacity);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (locked) m_stats.locked_bytes -= capacity;
+    m_free.emplace(capacity, data);
+    m_stats.cached_bytes += capacity;
+
+    // Evict the largest buffers first until the cache fits in its budget again
+    std::multimap<size_t, uint8_t*> evicted;
+    while (m_stats.cached_bytes > m_options.max_cached_bytes && !m_free.empty()) {
+        auto largest = std::prev(m_free.end());
+        m_stats.cached_bytes -= largest->first;
+        m_stats.mapped_bytes -= largest->first;
+        evicted.insert(*largest);
+        m_free.erase(largest);
+    }
+
+    // Taken out of the cache first, waiting for the prefault thread lets go of the lock
+    for (auto& [size, ptr] : evicted) CancelPrefault(ptr, lock);
+    lock.unlock();
+
+    for (auto& [size, ptr] : evicted) Unmap(ptr, size);
+}
+
+void BufferPool::Trim() {
+    std::multimap<size_t, uint8_t*> evicted;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        evicted.swap(m_free);
+        m_stats.mapped_bytes -= m_stats.cached_bytes;
+        m_stats.cached_bytes = 0;
+        for (auto& [size, ptr] : evicted) CancelPrefault(ptr, lock);
+    }
+
+    for (auto& [size, ptr] : evicted) Unmap(ptr, size);
+}
+
+BufferPoolStats BufferPool::Stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+BufferPool& BufferPool::Shared() {
+    static BufferPool pool;
+    return pool;
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,71 @@
+#include "dragonfruit_engine/cache.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <format>
+#include <numeric>
+
+#include "dragonfruit_engine/exception.hpp"
+
+namespace dragonfruit {
+
+std::optional<FileStamp> GetFileStamp(const std::filesystem::path& path) {
+    std::error_code ec;
+    auto write_time = std::filesystem::last_write_time(path, ec);
+    if (ec) return std::nullopt;
+    uintmax_t size = std::filesystem::file_size(path, ec);
+    if (ec) return std::nullopt;
+
+    return FileStamp{.mtime = write_time.time_since_epoch().count(), .size = size};
+}
+
+std::string CacheKey(const std::filesystem::path& path) {
+    std::error_code ec;
+    std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+    return (ec ? path : absolute).lexically_normal().string();
+}
+
+std::filesystem::path CacheDirectory() {
+    std::filesystem::path cache_dir;
+    if (const char* xdg_cache = std::getenv("XDG_CACHE_HOME"); xdg_cache && *xdg_cache) {
+        cache_dir = xdg_cache;
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        cache_dir = std::filesystem::path(home) / ".cache";
+    } else {
+        cache_dir = std::filesystem::temp_directory_path();
+    }
+    return cache_dir / "dragonfruit";
+}
+
+void ReplaceFile(const std::filesystem::path& filepath, const std::function<void(std::ostream&)>& write) {
+    std::error_code ec;
+    std::filesystem::create_directories(filepath.parent_path(), ec);
+
+    std::filesystem::path tmp_path = filepath;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file.is_open()) throw Exception(ErrorCode::IO_ERROR, std::format("Could not write {}", tmp_path.string()));
+        write(file);
+        if (!file.flush()) throw Exception(ErrorCode::IO_ERROR, std::format("Could not write {}", tmp_path.string()));
+    }
+
+    std::filesystem::rename(tmp_path, filepath, ec);
+    if (ec) throw Exception(ErrorCode::IO_ERROR, std::format("Could not write {}", filepath.string()));
+}
+
+std::vector<size_t> LargestFirst(const std::vector<std::filesystem::path>& song_paths) {
+    std::vector<uintmax_t> sizes(song_paths.size(), 0);
+    for (size_t i = 0; i < song_paths.size(); i++) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(song_paths[i], ec);
+        if (!ec) sizes[i] = size;
+    }
+
+    std::vector<size_t> order(song_paths.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+    return order;
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,246 @@
+#include "dragonfruit_engine/channel_layout.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+namespace dragonfruit {
+
+namespace {
+
+typedef float v8sf __attribute__((vector_size(32)));
+
+constexpr size_t VECTOR_WIDTH = 8;
+constexpr size_t SPEAKER_COUNT = static_cast<size_t>(Speaker::NONE);
+constexpr float MINUS_3DB = 0.70710678f;
+
+// One way of carrying a speaker on other speakers: to one speaker, or split between a pair
+struct Fold {
+    Speaker first;
+    Speaker second;
+    float gain;
+};
+
+// Ways of carrying each speaker, best first. The first fold whose speakers are all present in the output is used.
+std::vector<Fold> FoldsFor(Speaker speaker) {
+    using S = Speaker;
+    switch (speaker) {
+        case S::FRONT_CENTER:
+        case S::TOP_CENTER:
+            return {{S::FRONT_CENTER, S::NONE, 1.0f}, {S::FRONT_LEFT, S::FRONT_RIGHT, MINUS_3DB}};
+        case S::LOW_FREQUENCY:
+            return {};
+        case S::BACK_LEFT:
+            return {{S::SIDE_LEFT, S::NONE, 1.0f}, {S::FRONT_LEFT, S::NONE, MINUS_3DB}};
+        case S::BACK_RIGHT:
+            return {{S::SIDE_RIGHT, S::NONE, 1.0f}, {S::FRONT_RIGHT, S::NONE, MINUS_3DB}};
+        case S::SIDE_LEFT:
+            return {{S::BACK_LEFT, S::NONE, 1.0f}, {S::FRONT_LEFT, S::NONE, MINUS_3DB}};
+        case S::SIDE_RIGHT:
+            return {{S::BACK_RIGHT, S::NONE, 1.0f}, {S::FRONT_RIGHT, S::NONE, MINUS_3DB}};
+        case S::FRONT_LEFT_OF_CENTER:
+        case S::TOP_FRONT_LEFT:
+            return {{S::FRONT_LEFT, S::NONE, 1.0f}};
+        case S::FRONT_RIGHT_OF_CENTER:
+        case S::TOP_FRONT_RIGHT:
+            return {{S::FRONT_RIGHT, S::NONE, 1.0f}};
+        case S::TOP_FRONT_CENTER:
+            return {{S::FRONT_CENTER, S::NONE, 1.0f}, {S::FRONT_LEFT, S::FRONT_RIGHT, MINUS_3DB}};
+        case S::BACK_CENTER:
+        case S::TOP_BACK_CENTER:
+            return {{S::BACK_CENTER, S::NONE, 1.0f},
+                    {S::BACK_LEFT, S::BACK_RIGHT, MINUS_3DB},
+                    {S::SIDE_LEFT, S::SIDE_RIGHT, MINUS_3DB},
+                    {S::FRONT_LEFT, S::FRONT_RIGHT, 0.5f}};
+        case S::TOP_BACK_LEFT:
+            return {{S::BACK_LEFT, S::NONE, 1.0f}, {S::SIDE_LEFT, S::NONE, 1.0f}, {S::FRONT_LEFT, S::NONE, MINUS_3DB}};
+        case S::TOP_BACK_RIGHT:
+            return {
+                {S::BACK_RIGHT, S::NONE, 1.0f}, {S::SIDE_RIGHT, S::NONE, 1.0f}, {S::FRONT_RIGHT, S::NONE, MINUS_3DB}};
+        default:
+            return {};
+    }
+}
+
+// Builds the row major out x in matrix, folding every input speaker the output lacks
+std::vector<float> BuildMatrix(const ChannelLayout& input, const ChannelLayout& output) {
+    size_t in_channels = input.Channels();
+    std::vector<float> matrix(output.Channels() * in_channels, 0.0f);
+
+    // A mono output is mixed as stereo first and then summed, so it keeps the stereo balance of every speaker
+    if (output.IndexOf(Speaker::FRONT_LEFT) < 0 && output.IndexOf(Speaker::FRONT_RIGHT) < 0 &&
+        output.IndexOf(Speaker::FRONT_CENTER) >= 0) {
+        std::vector<float> stereo = BuildMatrix(input, ChannelLayout(ChannelLayout::STEREO, 2));
+        size_t center = output.IndexOf(Speaker::FRONT_CENTER);
+        for (size_t i = 0; i < in_channels; i++) {
+            matrix[center * in_channels + i] = MINUS_3DB * (stereo[i] + stereo[in_channels + i]);
+        }
+        return matrix;
+    }
+
+    for (size_t i = 0; i < in_channels; i++) {
+        Speaker speaker = input.At(i);
+        if (speaker == Speaker::NONE) continue;
+
+        int direct = output.IndexOf(speaker);
+        if (direct >= 0) {
+            matrix[direct * in_channels + i] = 1.0f;
+            continue;
+        }
+
+        for (const Fold& fold : FoldsFor(speaker)) {
+            int first = output.IndexOf(fold.first);
+            int second = fold.second == Speaker::NONE ? -2 : output.IndexOf(fold.second);
+            if (first < 0 || second == -1) continue;
+
+            matrix[first * in_channels + i] += fold.gain;
+            if (second >= 0) matrix[second * in_channels + i] += fold.gain;
+            break;
+        }
+    }
+    return matrix;
+}
+
+// Scales the whole matrix down so that no output channel can exceed full scale when every input is at full scale, the
+// largest row sum of absolute coefficients becoming one. One factor for every row keeps the balance between outputs.
+void NormalizeMatrix(std::vector<float>& matrix, size_t in_channels) {
+    if (in_channels == 0) return;
+    float largest = 0.0f;
+    for (size_t row = 0; row < matrix.size(); row += in_channels) {
+        float sum = 0.0f;
+        for (size_t i = 0; i < in_channels; i++) sum += std::abs(matrix[row + i]);
+        largest = std::max(largest, sum);
+    }
+    if (largest <= 1.0f) return;
+
+    for (float& coefficient : matrix) coefficient /= largest;
+}
+
+// Every output frame is the sum of the matrix columns scaled by the input samples. With the channel counts known at
+// compile time the loops unroll completely and the columns stay in registers.
+template <size_t IN, size_t OUT>
+void MixFixed(const float* columns, size_t, size_t, const float* in, float* out, size_t frames) {
+    const v8sf one = v8sf{} + 1.0f;
+    v8sf cols[IN];
+    for (size_t i = 0; i < IN; i++) std::memcpy(&cols[i], columns + i * VECTOR_WIDTH, sizeof(v8sf));
+
+    for (size_t f = 0; f < frames; f++, in += IN, out += OUT) {
+        v8sf acc = cols[0] * in[0];
+        for (size_t i = 1; i < IN; i++) acc += cols[i] * in[i];
+
+        // The matrix is normalized, this only catches inputs which were already past full scale
+        acc = acc > one ? one : acc;
+        acc = acc < -one ? -one : acc;
+        std::memcpy(out, &acc, OUT * sizeof(float));
+    }
+}
+
+// Any layout with at most VECTOR_WIDTH output channels
+void MixVector(const float* columns, size_t in_channels, size_t out_channels, const float* in, float* out,
+               size_t frames) {
+    const v8sf one = v8sf{} + 1.0f;
+    for (size_t f = 0; f < frames; f++, in += in_channels, out += out_channels) {
+        v8sf acc = {};
+        for (size_t i = 0; i < in_channels; i++) {
+            v8sf col;
+            std::memcpy(&col, columns + i * VECTOR_WIDTH, sizeof(col));
+            acc += col * in[i];
+        }
+        acc = acc > one ? one : acc;
+        acc = acc < -one ? -one : acc;
+        std::memcpy(out, &acc, out_channels * sizeof(float));
+    }
+}
+
+// Layouts too wide for a vector register, with columns packed at out_channels floats each
+void MixScalar(const float* columns, size_t in_channels, size_t out_channels, const float* in, float* out,
+               size_t frames) {
+    for (size_t f = 0; f < frames; f++, in += in_channels, out += out_channels) {
+        for (size_t o = 0; o < out_channels; o++) {
+            float sum = 0.0f;
+            for (size_t i = 0; i < in_channels; i++) sum += columns[i * out_channels + o] * in[i];
+            out[o] = std::clamp(sum, -1.0f, 1.0f);
+        }
+    }
+}
+
+struct FixedKernel {
+    size_t in_channels;
+    size_t out_channels;
+    void (*kernel)(const float*, size_t, size_t, const float*, float*, size_t);
+};
+
+// Downmixes of 7.1, 5.1 and quad, upmixes of mono and stereo
+constexpr FixedKernel FIXED_KERNELS[] = {
+    {8, 6, MixFixed<8, 6>}, {8, 2, MixFixed<8, 2>}, {6, 2, MixFixed<6, 2>}, {4, 2, MixFixed<4, 2>},
+    {2, 1, MixFixed<2, 1>}, {6, 1, MixFixed<6, 1>}, {1, 2, MixFixed<1, 2>}, {2, 6, MixFixed<2, 6>},
+    {2, 8, MixFixed<2, 8>}, {6, 8, MixFixed<6, 8>},
+};
+
+}  // namespace
+
+ChannelLayout::ChannelLayout(uint32_t mask, uint16_t channels) {
+    if (mask == 0) {
+        *this = Default(channels);
+        return;
+    }
+
+    // Channels are assigned to the speakers of the mask in bit order, surplus speakers are ignored
+    m_speakers.reserve(channels);
+    for (size_t bit = 0; bit < SPEAKER_COUNT && m_speakers.size() < channels; bit++) {
+        if (mask & (1u << bit)) {
+            m_speakers.push_back(static_cast<Speaker>(bit));
+            m_mask |= 1u << bit;
+        }
+    }
+    m_speakers.resize(channels, Speaker::NONE);
+}
+
+ChannelLayout::ChannelLayout(const std::vector<Speaker>& speakers) : m_speakers(speakers) {
+    for (Speaker speaker : speakers) {
+        if (speaker != Speaker::NONE) m_mask |= 1u << static_cast<uint32_t>(speaker);
+    }
+}
+
+ChannelLayout ChannelLayout::Default(uint16_t channels) {
+    static constexpr uint32_t DEFAULT_MASKS[] = {0, MONO, STEREO, 0xB, QUAD, 0x37, SURROUND_5_1, 0x13F, SURROUND_7_1};
+
+    if (channels < std::size(DEFAULT_MASKS) && channels > 0) return ChannelLayout(DEFAULT_MASKS[channels], channels);
+
+    ChannelLayout layout;
+    layout.m_speakers.assign(channels, Speaker::NONE);
+    return layout;
+}
+
+int ChannelLayout::IndexOf(Speaker speaker) const {
+    auto it = std::find(m_speakers.begin(), m_speakers.end(), speaker);
+    return it == m_speakers.end() ? -1 : static_cast<int>(it - m_speakers.begin());
+}
+
+ChannelMixer::ChannelMixer(const ChannelLayout& input, const ChannelLayout& output)
+    : m_in_channels(input.Channels()),
+      m_out_channels(output.Channels()),
+      m_identity(input == output),
+      m_matrix(BuildMatrix(input, output)) {
+    NormalizeMatrix(m_matrix, m_in_channels);
+
+    // Transpose into columns. Vector kernels need every column padded to a full register.
+    size_t stride = m_out_channels <= VECTOR_WIDTH ? VECTOR_WIDTH : m_out_channels;
+    m_columns.assign(m_in_channels * stride, 0.0f);
+    for (size_t i = 0; i < m_in_channels; i++) {
+        for (size_t o = 0; o < m_out_channels; o++) m_columns[i * stride + o] = Coefficient(o, i);
+    }
+
+    m_kernel = m_out_channels <= VECTOR_WIDTH ? MixVector : MixScalar;
+    for (const FixedKernel& fixed : FIXED_KERNELS) {
+        if (fixed.in_channels == m_in_channels && fixed.out_channels == m_out_channels) m_kernel = fixed.kernel;
+    }
+}
+
+void ChannelMixer::Process(const float* in, float* out, size_t frames) const {
+    if (m_in_channels == 0 || m_out_channels == 0) return;
+    m_kernel(m_columns.data(), m_in_channels, m_out_channels, in, out, frames);
+}
+
+}  // namespace dragonfruit
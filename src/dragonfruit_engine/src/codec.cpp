@@ -0,0 +1,355 @@
+#include "dragonfruit_engine/codec.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DRAGONFRUIT_X86 1
+#endif
+
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/sound.hpp"
+
+namespace dragonfruit {
+
+// ---------------------------------------------------------------------------------------------------------------------
+// G.711 mu-law/A-law
+// ---------------------------------------------------------------------------------------------------------------------
+
+static constexpr int16_t MuLawToLinear(uint8_t value) {
+    value = ~value;
+    int magnitude = (((value & 0x0F) << 3) + 0x84) << ((value & 0x70) >> 4);
+    return static_cast<int16_t>((value & 0x80) ? (0x84 - magnitude) : (magnitude - 0x84));
+}
+
+static constexpr int16_t ALawToLinear(uint8_t value) {
+    value ^= 0x55;
+    int magnitude = (value & 0x0F) << 4;
+    int segment = (value & 0x70) >> 4;
+    if (segment == 0) {
+        magnitude += 8;
+    } else {
+        magnitude = (magnitude + 0x108) << (segment - 1);
+    }
+    return static_cast<int16_t>((value & 0x80) ? magnitude : -magnitude);
+}
+
+template <int16_t (*Fn)(uint8_t)>
+static constexpr std::array<int16_t, 256> MakeG711Table() {
+    std::array<int16_t, 256> table{};
+    for (int i = 0; i < 256; i++) table[i] = Fn(static_cast<uint8_t>(i));
+    return table;
+}
+
+static constexpr std::array<int16_t, 256> MULAW_TABLE = MakeG711Table<MuLawToLinear>();
+static constexpr std::array<int16_t, 256> ALAW_TABLE = MakeG711Table<ALawToLinear>();
+
+#ifdef DRAGONFRUIT_X86
+// Decodes 16 samples per iteration. The segment (exponent) of each byte indexes a small table through pshufb, which
+// yields the power of two the mantissa has to be scaled by, so the whole expansion is done with shifts, a shuffle and a
+// 16-bit multiply. Returns the number of samples decoded, the caller decodes the remainder.
+template <bool kALaw>
+__attribute__((target("ssse3"))) static size_t DecodeG711Ssse3(const uint8_t* src, int16_t* dst, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    const __m128i segment_mask = _mm_set1_epi8(0x07);
+    const __m128i flip = kALaw ? _mm_set1_epi8(0x55) : _mm_set1_epi8(static_cast<char>(0xFF));
+    const __m128i multipliers = kALaw ? _mm_setr_epi8(1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0)
+                                      : _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, static_cast<char>(128), 0, 0, 0, 0, 0, 0,
+                                                      0, 0);
+    // A-law only: segments above zero carry an implicit leading one (0x100) before being shifted
+    const __m128i leading_one = _mm_setr_epi8(0, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), flip);
+        __m128i mantissa = _mm_and_si128(v, low_nibble);
+        __m128i segment = _mm_and_si128(_mm_srli_epi16(v, 4), segment_mask);
+        __m128i multiplier = _mm_shuffle_epi8(multipliers, segment);
+
+        // Lanes which have to be negated. mu-law is negative when the sign bit is set, A-law when it is clear.
+        __m128i negative = _mm_cmplt_epi8(v, zero);
+        if (kALaw) negative = _mm_xor_si128(negative, _mm_set1_epi8(static_cast<char>(0xFF)));
+
+        __m128i hi_bits = kALaw ? _mm_shuffle_epi8(leading_one, segment) : zero;
+
+        for (int half = 0; half < 2; half++) {
+            __m128i mant16 = half ? _mm_unpackhi_epi8(mantissa, zero) : _mm_unpacklo_epi8(mantissa, zero);
+            __m128i mult16 = half ? _mm_unpackhi_epi8(multiplier, zero) : _mm_unpacklo_epi8(multiplier, zero);
+            __m128i sign16 = half ? _mm_unpackhi_epi8(negative, negative) : _mm_unpacklo_epi8(negative, negative);
+
+            __m128i magnitude;
+            if (kALaw) {
+                __m128i one16 = half ? _mm_unpackhi_epi8(hi_bits, zero) : _mm_unpacklo_epi8(hi_bits, zero);
+                __m128i base = _mm_add_epi16(_mm_slli_epi16(mant16, 4), _mm_set1_epi16(8));
+                base = _mm_add_epi16(base, _mm_slli_epi16(one16, 8));
+                magnitude = _mm_mullo_epi16(base, mult16);
+            } else {
+                __m128i base = _mm_add_epi16(_mm_slli_epi16(mant16, 3), _mm_set1_epi16(0x84));
+                magnitude = _mm_sub_epi16(_mm_mullo_epi16(base, mult16), _mm_set1_epi16(0x84));
+            }
+
+            // Conditional negation: (x ^ mask) - mask
+            __m128i result = _mm_sub_epi16(_mm_xor_si128(magnitude, sign16), sign16);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + half * 8), result);
+        }
+    }
+
+    return i;
+}
+
+static bool HasSsse3() {
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    return has_ssse3;
+}
+#endif
+
+void DecodeMuLaw(const uint8_t* src, int16_t* dst, size_t count) {
+    size_t i = 0;
+#ifdef DRAGONFRUIT_X86
+    if (HasSsse3()) i = DecodeG711Ssse3<false>(src, dst, count);
+#endif
+    for (; i < count; i++) dst[i] = MULAW_TABLE[src[i]];
+}
+
+void DecodeALaw(const uint8_t* src, int16_t* dst, size_t count) {
+    size_t i = 0;
+#ifdef DRAGONFRUIT_X86
+    if (HasSsse3()) i = DecodeG711Ssse3<true>(src, dst, count);
+#endif
+    for (; i < count; i++) dst[i] = ALAW_TABLE[src[i]];
+}
+
+// G.711 has no block structure, every byte is one sample. Blocks are still used so that decoding happens in fixed
+// size pieces that line up with the rest of the engine.
+class G711Decoder : public Decoder {
+   public:
+    G711Decoder(uint16_t channels, bool alaw) : m_channels(channels), m_alaw(alaw) {}
+
+    size_t BlockSize() const override { return FRAMES_PER_BLOCK * m_channels; }
+    size_t FramesInBlock(size_t block_size) const override { return block_size / m_channels; }
+
+    void DecodeBlock(const uint8_t* src, size_t src_size, int16_t* dst) const override {
+        size_t count = FramesInBlock(src_size) * m_channels;
+        if (m_alaw) {
+            DecodeALaw(src, dst, count);
+        } else {
+            DecodeMuLaw(src, dst, count);
+        }
+    }
+
+   private:
+    static constexpr size_t FRAMES_PER_BLOCK = 1024;
+    uint16_t m_channels;
+    bool m_alaw;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// IMA ADPCM
+// ---------------------------------------------------------------------------------------------------------------------
+
+static constexpr std::array<int8_t, 16> IMA_INDEX_TABLE = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+static constexpr std::array<int16_t, 89> IMA_STEP_TABLE = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,    25,    28,
+    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,   337,   371,   408,   449,   494,
+    544,   598,   658,   724,   796,   876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,
+    9493,  10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+struct ImaChannelState {
+    int predictor;
+    int step_index;
+
+    inline int16_t Decode(uint8_t nibble) {
+        int step = IMA_STEP_TABLE[step_index];
+        int diff = step >> 3;
+        if (nibble & 4) diff += step;
+        if (nibble & 2) diff += step >> 1;
+        if (nibble & 1) diff += step >> 2;
+
+        predictor += (nibble & 8) ? -diff : diff;
+        predictor = std::clamp(predictor, -32768, 32767);
+        step_index = std::clamp(step_index + IMA_INDEX_TABLE[nibble], 0, 88);
+        return static_cast<int16_t>(predictor);
+    }
+};
+
+// IMA ADPCM as used in WAV files (format 0x0011). Each block starts with a 4 byte header per channel holding the first
+// sample and the step index. The rest of the block interleaves 4 bytes (8 samples) per channel.
+class ImaAdpcmDecoder : public Decoder {
+   public:
+    ImaAdpcmDecoder(uint16_t channels, uint16_t block_align) : m_channels(channels), m_block_align(block_align) {
+        if (m_block_align <= HEADER_SIZE * m_channels) {
+            throw Exception(ErrorCode::INVALID_FORMAT, "Invalid IMA ADPCM block size");
+        }
+    }
+
+    size_t BlockSize() const override { return m_block_align; }
+
+    size_t FramesInBlock(size_t block_size) const override {
+        if (block_size < HEADER_SIZE * m_channels) return 0;
+        return (block_size - HEADER_SIZE * m_channels) / (4 * m_channels) * 8 + 1;
+    }
+
+    void DecodeBlock(const uint8_t* src, size_t src_size, int16_t* dst) const override {
+        size_t frames = FramesInBlock(src_size);
+        if (frames == 0) return;
+
+        ImaChannelState state[MAX_DECODER_CHANNELS];
+        for (uint16_t ch = 0; ch < m_channels; ch++) {
+            const uint8_t* header = src + ch * HEADER_SIZE;
+            state[ch].predictor = static_cast<int16_t>(header[0] | (header[1] << 8));
+            state[ch].step_index = std::clamp<int>(header[2], 0, 88);
+            dst[ch] = static_cast<int16_t>(state[ch].predictor);
+        }
+
+        const uint8_t* data = src + HEADER_SIZE * m_channels;
+        size_t groups = (frames - 1) / 8;
+        for (size_t group = 0; group < groups; group++) {
+            int16_t* out = dst + (1 + group * 8) * m_channels;
+            for (uint16_t ch = 0; ch < m_channels; ch++) {
+                for (int byte = 0; byte < 4; byte++) {
+                    uint8_t value = *data++;
+                    out[(byte * 2) * m_channels + ch] = state[ch].Decode(value & 0x0F);
+                    out[(byte * 2 + 1) * m_channels + ch] = state[ch].Decode(value >> 4);
+                }
+            }
+        }
+    }
+
+   private:
+    static constexpr size_t HEADER_SIZE = 4;
+    uint16_t m_channels;
+    uint16_t m_block_align;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Microsoft ADPCM
+// ---------------------------------------------------------------------------------------------------------------------
+
+static constexpr std::array<int, 16> MS_ADAPTATION_TABLE = {230, 230, 230, 230, 307, 409, 512, 614,
+                                                            768, 614, 512, 409, 307, 230, 230, 230};
+
+static constexpr std::array<int16_t, 7> MS_DEFAULT_COEF1 = {256, 512, 0, 192, 240, 460, 392};
+static constexpr std::array<int16_t, 7> MS_DEFAULT_COEF2 = {0, -256, 0, 64, 0, -208, -232};
+
+struct MsChannelState {
+    int coef1;
+    int coef2;
+    int delta;
+    int sample1;
+    int sample2;
+
+    inline int16_t Decode(uint8_t nibble) {
+        int signed_nibble = (nibble & 0x08) ? static_cast<int>(nibble) - 16 : nibble;
+        int predictor = ((sample1 * coef1) + (sample2 * coef2)) >> 8;
+        predictor = std::clamp(predictor + signed_nibble * delta, -32768, 32767);
+
+        sample2 = sample1;
+        sample1 = predictor;
+        delta = std::max((MS_ADAPTATION_TABLE[nibble] * delta) >> 8, 16);
+        return static_cast<int16_t>(predictor);
+    }
+};
+
+// Microsoft ADPCM (format 0x0002). Each block starts with a 7 byte header per channel (predictor index, delta and the
+// first two samples). The remaining nibbles are interleaved per channel, high nibble first.
+class MsAdpcmDecoder : public Decoder {
+   public:
+    MsAdpcmDecoder(uint16_t channels, uint16_t block_align, const std::vector<uint8_t>& fmt_extension)
+        : m_channels(channels), m_block_align(block_align) {
+        if (m_block_align <= HEADER_SIZE * m_channels) {
+            throw Exception(ErrorCode::INVALID_FORMAT, "Invalid MS ADPCM block size");
+        }
+
+        // The fmt extension holds wSamplesPerBlock, wNumCoef and the coefficient pairs. Files are allowed to append
+        // their own coefficients after the 7 standard ones.
+        m_coef1.assign(MS_DEFAULT_COEF1.begin(), MS_DEFAULT_COEF1.end());
+        m_coef2.assign(MS_DEFAULT_COEF2.begin(), MS_DEFAULT_COEF2.end());
+        if (fmt_extension.size() >= 4) {
+            size_t num_coef = fmt_extension[2] | (fmt_extension[3] << 8);
+            num_coef = std::min(num_coef, (fmt_extension.size() - 4) / 4);
+            if (num_coef > 0) {
+                m_coef1.resize(num_coef);
+                m_coef2.resize(num_coef);
+                for (size_t i = 0; i < num_coef; i++) {
+                    const uint8_t* pair = fmt_extension.data() + 4 + i * 4;
+                    m_coef1[i] = static_cast<int16_t>(pair[0] | (pair[1] << 8));
+                    m_coef2[i] = static_cast<int16_t>(pair[2] | (pair[3] << 8));
+                }
+            }
+        }
+    }
+
+    size_t BlockSize() const override { return m_block_align; }
+
+    size_t FramesInBlock(size_t block_size) const override {
+        if (block_size < HEADER_SIZE * m_channels) return 0;
+        return (block_size - HEADER_SIZE * m_channels) * 2 / m_channels + 2;
+    }
+
+    void DecodeBlock(const uint8_t* src, size_t src_size, int16_t* dst) const override {
+        size_t frames = FramesInBlock(src_size);
+        if (frames == 0) return;
+
+        auto read_s16 = [](const uint8_t* p) { return static_cast<int16_t>(p[0] | (p[1] << 8)); };
+
+        MsChannelState state[MAX_DECODER_CHANNELS];
+        for (uint16_t ch = 0; ch < m_channels; ch++) {
+            size_t predictor = std::min<size_t>(src[ch], m_coef1.size() - 1);
+            state[ch].coef1 = m_coef1[predictor];
+            state[ch].coef2 = m_coef2[predictor];
+            state[ch].delta = read_s16(src + m_channels + ch * 2);
+            state[ch].sample1 = read_s16(src + m_channels * 3 + ch * 2);
+            state[ch].sample2 = read_s16(src + m_channels * 5 + ch * 2);
+
+            // The header samples are stored newest first
+            dst[ch] = static_cast<int16_t>(state[ch].sample2);
+            dst[m_channels + ch] = static_cast<int16_t>(state[ch].sample1);
+        }
+
+        const uint8_t* data = src + HEADER_SIZE * m_channels;
+        size_t total_nibbles = (frames - 2) * m_channels;
+        int16_t* out = dst + 2 * m_channels;
+        for (size_t i = 0; i < total_nibbles; i++) {
+            uint8_t byte = data[i / 2];
+            uint8_t nibble = (i % 2 == 0) ? (byte >> 4) : (byte & 0x0F);
+            out[i] = state[i % m_channels].Decode(nibble);
+        }
+    }
+
+   private:
+    static constexpr size_t HEADER_SIZE = 7;
+    uint16_t m_channels;
+    uint16_t m_block_align;
+    std::vector<int16_t> m_coef1;
+    std::vector<int16_t> m_coef2;
+};
+
+std::unique_ptr<Decoder> CreateDecoder(WavFormatCode format, const DecoderParams& params) {
+    if (params.channels == 0 || params.channels > MAX_DECODER_CHANNELS) {
+        throw Exception(ErrorCode::INVALID_FORMAT, "Unsupported channel count for compressed WAV");
+    }
+
+    switch (format) {
+        case WavFormatCode::MULAW:
+            return std::make_unique<G711Decoder>(params.channels, false);
+        case WavFormatCode::ALAW:
+            return std::make_unique<G711Decoder>(params.channels, true);
+        case WavFormatCode::IMA_ADPCM:
+            if (params.bits_per_sample != 4) {
+                throw Exception(ErrorCode::INVALID_FORMAT, "Only 4-bit IMA ADPCM is supported");
+            }
+            return std::make_unique<ImaAdpcmDecoder>(params.channels, params.block_align);
+        case WavFormatCode::MS_ADPCM:
+            return std::make_unique<MsAdpcmDecoder>(params.channels, params.block_align, params.fmt_extension);
+        default:
+            return nullptr;
+    }
+}
+
+}  // namespace dragonfruit
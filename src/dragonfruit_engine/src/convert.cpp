@@ -0,0 +1,170 @@
+#include "dragonfruit_engine/convert.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "dragonfruit_engine/sound.hpp"
+
+namespace dragonfruit {
+
+SampleFormat GetSampleFormat(WavFormatCode fmt_code, int bit_depth) {
+    switch (fmt_code) {
+        case WavFormatCode::PCM: {
+            switch (bit_depth) {
+                case 8:
+                    return SampleFormat::U8;
+                case 16:
+                    return SampleFormat::S16;
+                case 24:
+                    return SampleFormat::S24;
+                case 32:
+                    return SampleFormat::S32;
+                default:
+                    return SampleFormat::INVALID;
+            }
+        }
+
+        case WavFormatCode::IEEE_FLOAT: {
+            switch (bit_depth) {
+                case 32:
+                    return SampleFormat::F32;
+                case 64:
+                    return SampleFormat::F64;
+                default:
+                    return SampleFormat::INVALID;
+            }
+        }
+
+        // Compressed formats are decoded to 16-bit PCM by the Sound before they reach the engine
+        case WavFormatCode::MS_ADPCM:
+        case WavFormatCode::IMA_ADPCM:
+        case WavFormatCode::MULAW:
+        case WavFormatCode::ALAW: {
+            return SampleFormat::S16;
+        }
+
+        default: {
+            return SampleFormat::INVALID;
+        }
+    }
+}
+
+size_t SampleSize(SampleFormat format) {
+    switch (format) {
+        case SampleFormat::U8:
+            return 1;
+        case SampleFormat::S16:
+            return 2;
+        case SampleFormat::S24:
+            return 3;
+        case SampleFormat::S32:
+        case SampleFormat::F32:
+            return 4;
+        case SampleFormat::F64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// The loops below are kept simple enough for the compiler to vectorize. Samples are read through memcpy since the
+// source buffer carries no alignment guarantees.
+void ConvertToFloat(SampleFormat format, const uint8_t* src, float* dst, size_t count) {
+    switch (format) {
+        case SampleFormat::U8: {
+            for (size_t i = 0; i < count; i++) dst[i] = (static_cast<float>(src[i]) - 128.0f) * (1.0f / 128.0f);
+            break;
+        }
+
+        case SampleFormat::S16: {
+            for (size_t i = 0; i < count; i++) {
+                int16_t sample;
+                std::memcpy(&sample, src + i * 2, sizeof(sample));
+                dst[i] = static_cast<float>(sample) * (1.0f / 32768.0f);
+            }
+            break;
+        }
+
+        case SampleFormat::S24: {
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t* p = src + i * 3;
+                int32_t sample = static_cast<int32_t>((p[0] << 8) | (p[1] << 16) | (p[2] << 24)) >> 8;
+                dst[i] = static_cast<float>(sample) * (1.0f / 8388608.0f);
+            }
+            break;
+        }
+
+        case SampleFormat::S32: {
+            for (size_t i = 0; i < count; i++) {
+                int32_t sample;
+                std::memcpy(&sample, src + i * 4, sizeof(sample));
+                dst[i] = static_cast<float>(sample) * (1.0f / 2147483648.0f);
+            }
+            break;
+        }
+
+        case SampleFormat::F32: {
+            std::memcpy(dst, src, count * sizeof(float));
+            break;
+        }
+
+        case SampleFormat::F64: {
+            for (size_t i = 0; i < count; i++) {
+                double sample;
+                std::memcpy(&sample, src + i * 8, sizeof(sample));
+                dst[i] = static_cast<float>(sample);
+            }
+            break;
+        }
+
+        default: {
+            std::memset(dst, 0, count * sizeof(float));
+            break;
+        }
+    }
+}
+
+void ConvertFromFloat(SampleFormat format, const float* src, uint8_t* dst, size_t count, float gain) {
+    switch (format) {
+        case SampleFormat::S16: {
+            for (size_t i = 0; i < count; i++) {
+                int16_t sample = static_cast<int16_t>(std::lrint(src[i] * gain * 32767.0f));
+                std::memcpy(dst + i * 2, &sample, sizeof(sample));
+            }
+            break;
+        }
+
+        case SampleFormat::S32: {
+            // Full scale does not fit in a float's mantissa, so the scaling is done in double
+            for (size_t i = 0; i < count; i++) {
+                int32_t sample = static_cast<int32_t>(std::lrint(static_cast<double>(src[i] * gain) * 2147483647.0));
+                std::memcpy(dst + i * 4, &sample, sizeof(sample));
+            }
+            break;
+        }
+
+        case SampleFormat::F32: {
+            if (gain == 1.0f) {
+                std::memmove(dst, src, count * sizeof(float));
+                break;
+            }
+            for (size_t i = 0; i < count; i++) {
+                float sample = src[i] * gain;
+                std::memcpy(dst + i * 4, &sample, sizeof(sample));
+            }
+            break;
+        }
+
+        default: {
+            std::memset(dst, 0, count * SampleSize(format));
+            break;
+        }
+    }
+}
+
+void ApplyGain(float* samples, size_t count, float gain) {
+    for (size_t i = 0; i < count; i++) samples[i] = std::clamp(samples[i] * gain, -1.0f, 1.0f);
+}
+
+}  // namespace dragonfruit
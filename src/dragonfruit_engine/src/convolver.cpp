@@ -0,0 +1,266 @@
+#include "dragonfruit_engine/convolver.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#include "dragonfruit_engine/convert.hpp"
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/sound.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+inline v4sf Load(const float* src) {
+    v4sf v;
+    std::memcpy(&v, src, sizeof(v));
+    return v;
+}
+
+inline void Store(float* dst, v4sf v) { std::memcpy(dst, &v, sizeof(v)); }
+
+// Samples quieter than this, relative to the loudest, are trimmed off the end of an impulse response (-120 dB)
+constexpr float TRIM_THRESHOLD = 1e-6f;
+
+// Zero crossings of the resampling kernel on each side of its center
+constexpr int SINC_ZEROS = 16;
+
+double Sinc(double x) { return x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x); }
+
+// Blackman window over [-1, 1]
+double Window(double x) { return 0.42 + 0.5 * std::cos(M_PI * x) + 0.08 * std::cos(2.0 * M_PI * x); }
+
+// Adds the products of a run of spectra with another run, four bins at a time: sum += a * b
+void MultiplyAccumulate(const float* a_re, const float* a_im, const float* b_re, const float* b_im, float* sum_re,
+                        float* sum_im, size_t bins) {
+    for (size_t k = 0; k < bins; k += 4) {
+        v4sf ar = Load(a_re + k);
+        v4sf ai = Load(a_im + k);
+        v4sf br = Load(b_re + k);
+        v4sf bi = Load(b_im + k);
+        Store(sum_re + k, Load(sum_re + k) + ar * br - ai * bi);
+        Store(sum_im + k, Load(sum_im + k) + ar * bi + ai * br);
+    }
+}
+
+}  // namespace
+
+ImpulseResponse ImpulseResponse::Load(const std::filesystem::path& path) {
+    Sound sound(path.string());
+    sound.WaitForLoad();
+    if (sound.PcmFormat() == SampleFormat::INVALID || sound.LoadFailed()) {
+        throw Exception(ErrorCode::INVALID_FORMAT, std::format("Unable to read impulse response {}", path.string()));
+    }
+    if (sound.TotalFrames() > MAX_FRAMES) {
+        throw Exception(ErrorCode::INVALID_FORMAT,
+                        std::format("Impulse response {} is longer than {} frames", path.string(), MAX_FRAMES));
+    }
+
+    size_t frame_size = sound.FrameSize();
+    size_t channels = sound.Channels();
+    std::vector<uint8_t> pcm(sound.TotalFrames() * frame_size);
+    std::vector<float> samples(sound.TotalFrames() * channels);
+    size_t frames = sound.ReadPcm(0, pcm.data(), pcm.size()) / frame_size;
+    ConvertToFloat(sound.PcmFormat(), pcm.data(), samples.data(), frames * channels);
+
+    // Measured responses are often padded with silence, which would only cost partitions
+    float peak = 0.0f;
+    for (size_t i = 0; i < frames * channels; i++) peak = std::max(peak, std::fabs(samples[i]));
+    size_t length = frames;
+    while (length > 1) {
+        const float* frame = &samples[(length - 1) * channels];
+        if (std::any_of(frame, frame + channels, [&](float s) { return std::fabs(s) > peak * TRIM_THRESHOLD; })) break;
+        length--;
+    }
+
+    std::vector<std::vector<float>> filters(channels, std::vector<float>(length));
+    for (size_t i = 0; i < length; i++) {
+        for (size_t c = 0; c < channels; c++) filters[c][i] = samples[i * channels + c];
+    }
+    return ImpulseResponse(std::move(filters), sound.SampleRate());
+}
+
+ImpulseResponse::ImpulseResponse(std::vector<std::vector<float>> channels, uint32_t sample_rate)
+    : m_channels(std::move(channels)), m_sample_rate(sample_rate) {}
+
+std::vector<float> ImpulseResponse::Resampled(size_t channel, uint32_t sample_rate) const {
+    const std::vector<float>& taps = m_channels[channel];
+    if (sample_rate == m_sample_rate || taps.empty()) return taps;
+
+    // When downsampling the kernel is widened to cut off at the new Nyquist frequency. The filter's gain depends on
+    // how many taps it has, so it is scaled by the change in rate to keep its frequency response.
+    double ratio = static_cast<double>(sample_rate) / m_sample_rate;
+    double cutoff = std::min(1.0, ratio);
+    double half_width = SINC_ZEROS / cutoff;
+    double scale = cutoff / ratio;
+
+    std::vector<float> resampled(static_cast<size_t>(std::ceil(taps.size() * ratio)));
+    for (size_t n = 0; n < resampled.size(); n++) {
+        double center = n / ratio;
+        int64_t first = std::max<int64_t>(0, static_cast<int64_t>(std::ceil(center - half_width)));
+        int64_t last = std::min<int64_t>(taps.size() - 1, static_cast<int64_t>(std::floor(center + half_width)));
+
+        double sum = 0.0;
+        for (int64_t i = first; i <= last; i++) {
+            double offset = center - i;
+            sum += taps[i] * Sinc(offset * cutoff) * Window(offset / half_width);
+        }
+        resampled[n] = static_cast<float>(sum * scale);
+    }
+    return resampled;
+}
+
+ImpulseResponse ImpulseResponse::Channel(size_t channel) const {
+    return ImpulseResponse({m_channels[channel]}, m_sample_rate);
+}
+
+Convolver::Convolver(const ImpulseResponse& response, uint16_t channels, uint32_t sample_rate, size_t partition)
+    : m_partition(std::bit_ceil(std::clamp(partition, MIN_PARTITION, MAX_PARTITION))),
+      m_bins(m_partition + 4),
+      m_channels(channels),
+      m_sample_rate(sample_rate),
+      m_fft(m_partition * 2) {
+    m_filters = std::min<size_t>(response.Channels(), channels);
+
+    // Every filter is split into the same number of partitions, padded with zeros to twice their length before being
+    // transformed so that each block's circular convolution holds a full partition of valid output
+    std::vector<std::vector<float>> filters;
+    size_t longest = 1;
+    for (size_t f = 0; f < m_filters; f++) {
+        filters.push_back(response.Resampled(f, sample_rate));
+        longest = std::max(longest, filters.back().size());
+    }
+    m_partitions = (longest + m_partition - 1) / m_partition;
+
+    m_filter_re.assign(m_filters * m_partitions * m_bins, 0.0f);
+    m_filter_im.assign(m_filters * m_partitions * m_bins, 0.0f);
+    m_spectrum.resize(m_partition + 1);
+    m_time.resize(m_partition * 2);
+    for (size_t f = 0; f < m_filters; f++) {
+        for (size_t p = 0; p < m_partitions; p++) {
+            std::fill(m_time.begin(), m_time.end(), 0.0f);
+            size_t begin = std::min(p * m_partition, filters[f].size());
+            size_t end = std::min(begin + m_partition, filters[f].size());
+            std::copy(filters[f].begin() + begin, filters[f].begin() + end, m_time.begin());
+            m_fft.Forward(m_time.data(), m_spectrum.data());
+
+            size_t offset = (f * m_partitions + p) * m_bins;
+            for (size_t k = 0; k <= m_partition; k++) {
+                m_filter_re[offset + k] = m_spectrum[k].real();
+                m_filter_im[offset + k] = m_spectrum[k].imag();
+            }
+        }
+    }
+
+    m_input_re.resize(channels * m_partitions * m_bins);
+    m_input_im.resize(channels * m_partitions * m_bins);
+    m_input.resize(channels * m_partition * 2);
+    m_output.resize(channels * m_partition);
+    m_sum_re.resize(m_bins);
+    m_sum_im.resize(m_bins);
+    Reset();
+}
+
+void Convolver::Reset() {
+    std::fill(m_input_re.begin(), m_input_re.end(), 0.0f);
+    std::fill(m_input_im.begin(), m_input_im.end(), 0.0f);
+    std::fill(m_input.begin(), m_input.end(), 0.0f);
+    std::fill(m_output.begin(), m_output.end(), 0.0f);
+    m_newest = 0;
+    m_fill = 0;
+}
+
+void Convolver::Process(float* samples, size_t frames) {
+    while (frames > 0) {
+        // Frames go into the current partition and come out of the last one's output, one partition later
+        size_t count = std::min(frames, m_partition - m_fill);
+        for (size_t c = 0; c < m_channels; c++) {
+            float* input = &m_input[c * m_partition * 2 + m_partition + m_fill];
+            const float* output = &m_output[c * m_partition + m_fill];
+            for (size_t i = 0; i < count; i++) {
+                input[i] = samples[i * m_channels + c];
+                samples[i * m_channels + c] = output[i];
+            }
+        }
+
+        samples += count * m_channels;
+        frames -= count;
+        m_fill += count;
+        if (m_fill == m_partition) {
+            ProcessPartition();
+            m_fill = 0;
+        }
+    }
+}
+
+void Convolver::ProcessPartition() {
+    m_newest = (m_newest + 1) % m_partitions;
+    for (size_t c = 0; c < m_channels; c++) {
+        float* input = &m_input[c * m_partition * 2];
+        m_fft.Forward(input, m_spectrum.data());
+
+        // The previous partition of input is kept for the next transform's overlap
+        std::memmove(input, input + m_partition, m_partition * sizeof(float));
+
+        size_t channel_offset = c * m_partitions * m_bins;
+        float* newest_re = &m_input_re[channel_offset + m_newest * m_bins];
+        float* newest_im = &m_input_im[channel_offset + m_newest * m_bins];
+        for (size_t k = 0; k <= m_partition; k++) {
+            newest_re[k] = m_spectrum[k].real();
+            newest_im[k] = m_spectrum[k].imag();
+        }
+
+        // The input from p partitions ago lines up with partition p of the filter
+        std::fill(m_sum_re.begin(), m_sum_re.end(), 0.0f);
+        std::fill(m_sum_im.begin(), m_sum_im.end(), 0.0f);
+        size_t filter_offset = (c % m_filters) * m_partitions * m_bins;
+        for (size_t p = 0; p < m_partitions; p++) {
+            size_t slot = (m_newest + m_partitions - p) % m_partitions;
+            MultiplyAccumulate(&m_input_re[channel_offset + slot * m_bins], &m_input_im[channel_offset + slot * m_bins],
+                               &m_filter_re[filter_offset + p * m_bins], &m_filter_im[filter_offset + p * m_bins],
+                               m_sum_re.data(), m_sum_im.data(), m_bins);
+        }
+
+        for (size_t k = 0; k <= m_partition; k++) m_spectrum[k] = std::complex<float>(m_sum_re[k], m_sum_im[k]);
+        m_fft.Inverse(m_spectrum.data(), m_time.data());
+
+        // The first half of the result wrapped around the circular convolution, only the second half is valid
+        std::memcpy(&m_output[c * m_partition], &m_time[m_partition], m_partition * sizeof(float));
+    }
+}
+
+ConvolverNode::ConvolverNode(std::shared_ptr<const ImpulseResponse> response, size_t partition)
+    : m_response(std::move(response)), m_partition(partition) {}
+
+void ConvolverNode::Prepare(uint16_t channels, uint32_t sample_rate, size_t) {
+    // The filter only has to be resampled and transformed again when the format changes
+    if (sample_rate == m_sample_rate && channels == m_convolvers.size()) {
+        Reset();
+        return;
+    }
+
+    m_convolvers.clear();
+    m_convolvers.reserve(channels);
+    for (size_t c = 0; c < channels; c++) {
+        m_convolvers.emplace_back(m_response->Channel(c % m_response->Channels()), 1, sample_rate, m_partition);
+    }
+    m_sample_rate = sample_rate;
+}
+
+void ConvolverNode::Reset() {
+    for (Convolver& convolver : m_convolvers) convolver.Reset();
+}
+
+size_t ConvolverNode::Latency() const {
+    return std::bit_ceil(std::clamp(m_partition, Convolver::MIN_PARTITION, Convolver::MAX_PARTITION));
+}
+
+void ConvolverNode::ProcessChannel(size_t channel, float* samples, size_t frames) {
+    m_convolvers[channel].Process(samples, frames);
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,260 @@
+#include "dragonfruit_engine/dsp_graph.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "dragonfruit_engine/audio_engine.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+constexpr uint64_t CLAIM_NEXT_MASK = 0xFFFF;
+constexpr int CLAIM_COUNT_SHIFT = 16;
+constexpr int CLAIM_SEQUENCE_SHIFT = 32;
+
+// How long the control thread sleeps between checks for the audio thread leaving a retired chain
+constexpr std::chrono::microseconds RETIRE_POLL{200};
+
+uint64_t MonotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+}  // namespace
+
+void DspNode::Process(float* const* channels, uint16_t channel_count, size_t frames) {
+    for (size_t c = 0; c < channel_count; c++) ProcessChannel(c, channels[c], frames);
+}
+
+void DspNode::ProcessChannel(size_t, float*, size_t) {}
+
+DspGraph::DspGraph(const DspGraphOptions& options) : m_options(options) {}
+
+DspGraph::~DspGraph() {
+    m_quit.store(true, std::memory_order_release);
+    m_claim.fetch_add(uint64_t(1) << CLAIM_SEQUENCE_SHIFT, std::memory_order_release);
+    m_claim.notify_all();
+    for (std::thread& worker : m_workers) worker.join();
+    delete m_chain.load();
+}
+
+void DspGraph::Insert(std::shared_ptr<DspNode> node, size_t position) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Nodes inserted before the first song are prepared once its format is known
+    if (m_channels > 0) node->Prepare(m_channels, m_sample_rate, BLOCK_FRAMES);
+
+    auto slot = std::make_shared<Slot>();
+    slot->node = std::move(node);
+    m_slots.insert(m_slots.begin() + std::min(position, m_slots.size()), std::move(slot));
+
+    // Workers are only started once there is something to run, an engine without nodes has no threads to spare
+    if (!m_workers_started.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < m_options.workers; i++) m_workers.emplace_back(&DspGraph::WorkerLoop, this);
+        m_workers_started.store(!m_workers.empty(), std::memory_order_release);
+    }
+    Publish();
+}
+
+bool DspGraph::Remove(const std::shared_ptr<DspNode>& node) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find_if(m_slots.begin(), m_slots.end(), [&](const auto& slot) { return slot->node == node; });
+    if (it == m_slots.end()) return false;
+
+    // The slot outlives the chain which still points at it
+    std::shared_ptr<Slot> removed = *it;
+    m_slots.erase(it);
+    Publish();
+    return true;
+}
+
+void DspGraph::SetFormat(uint16_t channels, uint32_t sample_rate) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (channels == m_channels && sample_rate == m_sample_rate) {
+        for (const auto& slot : m_slots) slot->node->Reset();
+        return;
+    }
+
+    m_channels = channels;
+    m_sample_rate = sample_rate;
+    m_buffers.assign(channels * BLOCK_FRAMES, 0.0f);
+    m_channel_buffers.resize(channels);
+    for (size_t c = 0; c < channels; c++) m_channel_buffers[c] = &m_buffers[c * BLOCK_FRAMES];
+    for (const auto& slot : m_slots) slot->node->Prepare(channels, sample_rate, BLOCK_FRAMES);
+
+    // Latencies can depend on the format
+    Publish();
+}
+
+void DspGraph::Reset() { m_reset.store(true, std::memory_order_release); }
+
+std::vector<DspNodeStats> DspGraph::Stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<DspNodeStats> stats;
+    for (const auto& slot : m_slots) {
+        const NodeTiming& timing = slot->timing;
+        uint64_t cpu_ns = timing.cpu_ns.load(std::memory_order_relaxed);
+        uint64_t audio_ns = timing.audio_ns.load(std::memory_order_relaxed);
+        stats.push_back({
+            .name = slot->node->Name(),
+            .blocks = timing.blocks.load(std::memory_order_relaxed),
+            .cpu_ms = cpu_ns / 1e6,
+            .load = audio_ns > 0 ? static_cast<double>(cpu_ns) / audio_ns : 0.0,
+            .max_call_us = timing.max_call_ns.load(std::memory_order_relaxed) / 1e3,
+        });
+    }
+    return stats;
+}
+
+void DspGraph::Publish() {
+    auto chain = new Chain();
+    size_t latency = 0;
+    for (const auto& slot : m_slots) {
+        bool per_channel = slot->node->PerChannel();
+        if (chain->stages.empty() || chain->stages.back().per_channel != per_channel) {
+            chain->stages.emplace_back().per_channel = per_channel;
+        }
+        chain->stages.back().slots.push_back(slot.get());
+        latency += slot->node->Latency();
+    }
+    m_latency.store(latency, std::memory_order_relaxed);
+    m_empty.store(m_slots.empty(), std::memory_order_relaxed);
+
+    // A block the audio thread started before the swap may still be running the old chain. Any block started after it
+    // loads the new one, so the old chain is free once the count moved past the block seen running.
+    Chain* old = m_chain.exchange(chain);
+    uint64_t count = m_process_count.load();
+    if (count & 1) {
+        while (m_process_count.load(std::memory_order_acquire) == count) std::this_thread::sleep_for(RETIRE_POLL);
+    }
+    delete old;
+}
+
+void DspGraph::Process(float* samples, size_t frames) {
+    // Marks a block as running before the chain is loaded, see Publish
+    m_process_count.fetch_add(1);
+    Chain* chain = m_chain.load();
+
+    // Nodes inserted since are freshly prepared, so resetting the loaded chain covers every node a seek affects
+    if (m_reset.exchange(false, std::memory_order_acquire) && chain) {
+        for (Stage& stage : chain->stages) {
+            for (Slot* slot : stage.slots) slot->node->Reset();
+        }
+    }
+
+    uint16_t channels = m_channels;
+    if (chain && !chain->stages.empty() && channels > 0) {
+        for (size_t offset = 0; offset < frames; offset += BLOCK_FRAMES) {
+            size_t block = std::min(BLOCK_FRAMES, frames - offset);
+            float* interleaved = samples + offset * channels;
+            for (size_t i = 0; i < block; i++) {
+                for (size_t c = 0; c < channels; c++) m_channel_buffers[c][i] = interleaved[i * channels + c];
+            }
+
+            for (Stage& stage : chain->stages) RunStage(stage, block);
+
+            for (size_t i = 0; i < block; i++) {
+                for (size_t c = 0; c < channels; c++) interleaved[i * channels + c] = m_channel_buffers[c][i];
+            }
+
+            // Only the audio thread counts blocks, so plain loads and stores are enough
+            auto relaxed = std::memory_order_relaxed;
+            uint64_t audio_ns = block * 1000000000u / m_sample_rate;
+            for (Stage& stage : chain->stages) {
+                for (Slot* slot : stage.slots) {
+                    slot->timing.blocks.store(slot->timing.blocks.load(relaxed) + 1, relaxed);
+                    slot->timing.audio_ns.store(slot->timing.audio_ns.load(relaxed) + audio_ns, relaxed);
+                }
+            }
+        }
+    }
+
+    m_process_count.fetch_add(1, std::memory_order_release);
+}
+
+void DspGraph::RunStage(Stage& stage, size_t frames) {
+    if (!stage.per_channel) {
+        for (Slot* slot : stage.slots) {
+            uint64_t start = MonotonicNs();
+            slot->node->Process(m_channel_buffers.data(), m_channels, frames);
+            Record(slot->timing, MonotonicNs() - start);
+        }
+        return;
+    }
+
+    bool parallel = m_channels > 1 && stage.cost_ns >= PARALLEL_MIN_NS &&
+                    m_workers_started.load(std::memory_order_acquire);
+    if (!parallel) {
+        uint64_t cost = 0;
+        for (size_t c = 0; c < m_channels; c++) cost += RunBranch(stage, c, frames);
+        stage.cost_ns = cost;
+        return;
+    }
+
+    // The job is written before the claim is published, and stays untouched until every channel is done
+    m_job = {.stage = &stage, .frames = frames};
+    m_done.store(0, std::memory_order_relaxed);
+    m_branch_ns.store(0, std::memory_order_relaxed);
+    uint64_t sequence = (m_claim.load(std::memory_order_relaxed) >> CLAIM_SEQUENCE_SHIFT) + 1;
+    m_claim.store(sequence << CLAIM_SEQUENCE_SHIFT | uint64_t(m_channels) << CLAIM_COUNT_SHIFT,
+                  std::memory_order_release);
+    m_claim.notify_all();
+
+    // The audio thread takes channels too, and only spins for the branches still running on workers
+    RunBranches();
+    while (m_done.load(std::memory_order_acquire) < m_channels) std::this_thread::yield();
+    stage.cost_ns = m_branch_ns.load(std::memory_order_relaxed);
+}
+
+uint64_t DspGraph::RunBranch(Stage& stage, size_t channel, size_t frames) {
+    uint64_t total = 0;
+    for (Slot* slot : stage.slots) {
+        uint64_t start = MonotonicNs();
+        slot->node->ProcessChannel(channel, m_channel_buffers[channel], frames);
+        uint64_t elapsed = MonotonicNs() - start;
+        Record(slot->timing, elapsed);
+        total += elapsed;
+    }
+    return total;
+}
+
+uint64_t DspGraph::RunBranches() {
+    uint64_t claim = m_claim.load(std::memory_order_acquire);
+    while (true) {
+        uint64_t next = claim & CLAIM_NEXT_MASK;
+        uint64_t count = (claim >> CLAIM_COUNT_SHIFT) & CLAIM_NEXT_MASK;
+        if (next >= count) return claim;
+
+        // A successful claim keeps the job from completing, so it can be read until the channel is marked done
+        if (!m_claim.compare_exchange_weak(claim, claim + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            continue;
+        }
+        m_branch_ns.fetch_add(RunBranch(*m_job.stage, next, m_job.frames), std::memory_order_relaxed);
+        m_done.fetch_add(1, std::memory_order_release);
+        claim = m_claim.load(std::memory_order_acquire);
+    }
+}
+
+void DspGraph::WorkerLoop() {
+    if (m_options.realtime) PromoteCurrentThread(m_options.realtime_priority);
+
+    uint64_t seen = m_claim.load(std::memory_order_acquire);
+    while (true) {
+        m_claim.wait(seen, std::memory_order_acquire);
+        if (m_quit.load(std::memory_order_acquire)) return;
+        seen = RunBranches();
+    }
+}
+
+void DspGraph::Record(NodeTiming& timing, uint64_t ns) {
+    timing.cpu_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t longest = timing.max_call_ns.load(std::memory_order_relaxed);
+    while (ns > longest && !timing.max_call_ns.compare_exchange_weak(longest, ns, std::memory_order_relaxed)) {
+    }
+}
+
+}  // namespace dragonfruit
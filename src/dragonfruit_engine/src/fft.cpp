@@ -0,0 +1,153 @@
+#include "dragonfruit_engine/fft.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include "dragonfruit_engine/exception.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+inline v4sf Load(const float* src) {
+    v4sf v;
+    std::memcpy(&v, src, sizeof(v));
+    return v;
+}
+
+inline void Store(float* dst, v4sf v) { std::memcpy(dst, &v, sizeof(v)); }
+
+}  // namespace
+
+RealFft::RealFft(size_t size) : m_size(size), m_half(size / 2) {
+    if (size < 16 || (size & (size - 1)) != 0) {
+        throw Exception(ErrorCode::INTERNAL_ERROR, std::format("FFT size {} is not a power of two >= 16", size));
+    }
+
+    size_t bits = 0;
+    while ((size_t(1) << bits) < m_half) bits++;
+
+    m_bit_reverse.resize(m_half);
+    for (size_t i = 0; i < m_half; i++) {
+        size_t reversed = 0;
+        for (size_t b = 0; b < bits; b++) reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        m_bit_reverse[i] = reversed;
+    }
+
+    // The twiddles of the pass with butterfly span `half` are stored contiguously at [half, 2 * half), so every pass
+    // can load four consecutive twiddles at once
+    m_twiddle_re.resize(m_half);
+    m_twiddle_im.resize(m_half);
+    for (size_t half = 4; half < m_half; half *= 2) {
+        for (size_t j = 0; j < half; j++) {
+            double angle = -M_PI * j / half;
+            m_twiddle_re[half + j] = static_cast<float>(std::cos(angle));
+            m_twiddle_im[half + j] = static_cast<float>(std::sin(angle));
+        }
+    }
+
+    m_real_twiddles.resize(m_half + 1);
+    for (size_t k = 0; k <= m_half; k++) {
+        double angle = -2.0 * M_PI * k / m_size;
+        m_real_twiddles[k] = std::complex<float>(std::cos(angle), std::sin(angle));
+    }
+
+    m_re.resize(m_half);
+    m_im.resize(m_half);
+}
+
+void RealFft::Forward(const float* input, std::complex<float>* output) {
+    // Pack even samples into the real part and odd samples into the imaginary part of a half size complex signal,
+    // in bit reversed order ready for the in-place transform
+    for (size_t n = 0; n < m_half; n++) {
+        m_re[m_bit_reverse[n]] = input[2 * n];
+        m_im[m_bit_reverse[n]] = input[2 * n + 1];
+    }
+
+    ComplexTransform();
+
+    // Separate the spectra of the even and odd samples and combine them into the spectrum of the real signal
+    for (size_t k = 0; k <= m_half; k++) {
+        size_t idx = k == m_half ? 0 : k;
+        size_t mirror = k == 0 ? 0 : m_half - k;
+        std::complex<float> z(m_re[idx], m_im[idx]);
+        std::complex<float> z_mirror(m_re[mirror], -m_im[mirror]);
+
+        std::complex<float> even = 0.5f * (z + z_mirror);
+        std::complex<float> odd = std::complex<float>(0.0f, -0.5f) * (z - z_mirror);
+        output[k] = even + m_real_twiddles[k] * odd;
+    }
+}
+
+void RealFft::Inverse(const std::complex<float>* input, float* output) {
+    // Undo the split of Forward, recombining the spectra of the even and odd samples into the spectrum of the packed
+    // half size signal. It is conjugated on the way in and out so the forward complex transform computes the inverse.
+    for (size_t k = 0; k < m_half; k++) {
+        std::complex<float> x = input[k];
+        std::complex<float> x_mirror = std::conj(input[m_half - k]);
+
+        std::complex<float> even = 0.5f * (x + x_mirror);
+        std::complex<float> odd = 0.5f * (x - x_mirror) * std::conj(m_real_twiddles[k]);
+        std::complex<float> z = even + std::complex<float>(0.0f, 1.0f) * odd;
+        m_re[m_bit_reverse[k]] = z.real();
+        m_im[m_bit_reverse[k]] = -z.imag();
+    }
+
+    ComplexTransform();
+
+    float scale = 1.0f / m_half;
+    for (size_t n = 0; n < m_half; n++) {
+        output[2 * n] = m_re[n] * scale;
+        output[2 * n + 1] = -m_im[n] * scale;
+    }
+}
+
+void RealFft::ComplexTransform() {
+    float* re = m_re.data();
+    float* im = m_im.data();
+
+    // The first two radix-2 passes only use the trivial twiddles 1 and -i, so they are merged into one radix-4 pass
+    for (size_t i = 0; i < m_half; i += 4) {
+        float r0 = re[i] + re[i + 1], i0 = im[i] + im[i + 1];
+        float r1 = re[i] - re[i + 1], i1 = im[i] - im[i + 1];
+        float r2 = re[i + 2] + re[i + 3], i2 = im[i + 2] + im[i + 3];
+        float r3 = re[i + 2] - re[i + 3], i3 = im[i + 2] - im[i + 3];
+
+        re[i] = r0 + r2;
+        im[i] = i0 + i2;
+        re[i + 2] = r0 - r2;
+        im[i + 2] = i0 - i2;
+        re[i + 1] = r1 + i3;
+        im[i + 1] = i1 - r3;
+        re[i + 3] = r1 - i3;
+        im[i + 3] = i1 + r3;
+    }
+
+    // Remaining passes have at least four butterflies per group, which are computed together
+    for (size_t half = 4; half < m_half; half *= 2) {
+        for (size_t start = 0; start < m_half; start += half * 2) {
+            for (size_t j = 0; j < half; j += 4) {
+                size_t a = start + j;
+                size_t b = a + half;
+
+                v4sf w_re = Load(&m_twiddle_re[half + j]);
+                v4sf w_im = Load(&m_twiddle_im[half + j]);
+                v4sf b_re = Load(re + b);
+                v4sf b_im = Load(im + b);
+                v4sf t_re = w_re * b_re - w_im * b_im;
+                v4sf t_im = w_re * b_im + w_im * b_re;
+
+                v4sf a_re = Load(re + a);
+                v4sf a_im = Load(im + a);
+                Store(re + a, a_re + t_re);
+                Store(im + a, a_im + t_im);
+                Store(re + b, a_re - t_re);
+                Store(im + b, a_im - t_im);
+            }
+        }
+    }
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,425 @@
+#include "dragonfruit_engine/http_reader.hpp"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <optional>
+
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/trace.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+constexpr std::string_view HTTP_SCHEME = "http://";
+constexpr std::string_view HTTPS_SCHEME = "https://";
+
+// Longest the server may keep us waiting before the connection is considered dead
+constexpr int IO_TIMEOUT_MS = 10000;
+
+// How often a connection waiting on the server checks whether it should give up
+constexpr int POLL_INTERVAL_MS = 100;
+
+// Response heads longer than this are not from a server we can talk to
+constexpr size_t MAX_RESPONSE_HEAD = 16 << 10;
+
+// Weight of the newest request in the throughput estimate, lower values ride out jitter better
+constexpr double THROUGHPUT_SMOOTHING = 0.3;
+
+struct Url {
+    std::string authority;  // host[:port], as sent in the Host header
+    std::string host;
+    std::string port = "80";
+    std::string target;  // Path and query
+};
+
+Url ParseUrl(const std::string& url) {
+    if (url.starts_with(HTTPS_SCHEME)) {
+        throw Exception(ErrorCode::IO_ERROR, std::format("Unable to open {}: HTTPS is not supported", url));
+    }
+
+    std::string_view rest = std::string_view(url).substr(HTTP_SCHEME.size());
+    rest = rest.substr(0, rest.find('#'));
+    size_t slash = rest.find_first_of("/?");
+    std::string_view authority = rest.substr(0, slash);
+    authority = authority.substr(authority.find('@') + 1);
+    Url parsed;
+    parsed.authority = authority;
+    parsed.target = slash == std::string_view::npos ? "/" : std::string(rest.substr(slash));
+    if (parsed.target[0] == '?') parsed.target.insert(0, "/");
+
+    // IPv6 addresses are written in brackets, as their colons would otherwise be mistaken for the port
+    size_t host_end = authority.starts_with('[') ? authority.find(']') : authority.rfind(':');
+    if (authority.starts_with('[')) {
+        if (host_end == std::string_view::npos) host_end = authority.size();
+        parsed.host = authority.substr(1, host_end - 1);
+        host_end = authority.find(':', host_end);
+    } else {
+        parsed.host = authority.substr(0, host_end);
+    }
+    if (host_end != std::string_view::npos && host_end + 1 < authority.size()) {
+        parsed.port = authority.substr(host_end + 1);
+    }
+
+    if (parsed.host.empty()) throw Exception(ErrorCode::IO_ERROR, std::format("Unable to open {}: no host", url));
+    return parsed;
+}
+
+std::string Lowercase(std::string_view text) {
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    return lower;
+}
+
+bool ParseNumber(std::string_view text, uint64_t& value) {
+    while (!text.empty() && text.front() == ' ') text.remove_prefix(1);
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc() && end != text.data();
+}
+
+}  // namespace
+
+bool IsHttpUrl(std::string_view location) {
+    return location.starts_with(HTTP_SCHEME) || location.starts_with(HTTPS_SCHEME);
+}
+
+/**
+ * @brief A kept alive connection to the server, reconnected on demand. Sockets are non-blocking so that every wait
+ * can be given up on, either on a timeout or when the reader is stopped.
+ *
+ */
+class HttpReader::Connection {
+   public:
+    Connection(Url url, const std::atomic<bool>& stop) : m_url(std::move(url)), m_stop(stop) {}
+    ~Connection() { Close(); }
+
+    // Fetches a range of the file into dst and records the size of the whole file. Returns the bytes received, which
+    // is short at the end of the file. Transport failures throw IO_ERROR, responses we can not use INVALID_FORMAT.
+    size_t Fetch(uint64_t offset, size_t length, uint8_t* dst, uint64_t& file_size) {
+        try {
+            if (m_fd < 0) Connect();
+            Send(std::format("GET {} HTTP/1.1\r\nHost: {}\r\nRange: bytes={}-{}\r\nUser-Agent: dragonfruit\r\n\r\n",
+                             m_url.target, m_url.authority, offset, offset + length - 1));
+            return ReadResponse(offset, length, dst, file_size);
+        } catch (const Exception&) {
+            // Whatever is left of the response would be mistaken for the next one
+            Close();
+            throw;
+        }
+    }
+
+   private:
+    void Connect() {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        int result = getaddrinfo(m_url.host.c_str(), m_url.port.c_str(), &hints, &addresses);
+        if (result != 0) {
+            throw Exception(ErrorCode::IO_ERROR,
+                            std::format("Unable to resolve {}: {}", m_url.host, gai_strerror(result)));
+        }
+
+        std::string error = "no addresses";
+        for (addrinfo* address = addresses; address && m_fd < 0; address = address->ai_next) {
+            m_fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          address->ai_protocol);
+            if (m_fd < 0) continue;
+            if (connect(m_fd, address->ai_addr, address->ai_addrlen) == 0 || errno == EINPROGRESS) {
+                try {
+                    Wait(POLLOUT);
+                    int socket_error = 0;
+                    socklen_t size = sizeof(socket_error);
+                    getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &socket_error, &size);
+                    if (socket_error == 0) break;
+                    error = std::strerror(socket_error);
+                } catch (const Exception& e) {
+                    error = e.what();
+                }
+            } else {
+                error = std::strerror(errno);
+            }
+            Close();
+        }
+        freeaddrinfo(addresses);
+
+        if (m_fd < 0) {
+            throw Exception(ErrorCode::IO_ERROR, std::format("Unable to connect to {}: {}", m_url.authority, error));
+        }
+    }
+
+    void Close() {
+        if (m_fd >= 0) close(m_fd);
+        m_fd = -1;
+        m_pending.clear();
+    }
+
+    void Wait(short events) {
+        for (int waited = 0; waited < IO_TIMEOUT_MS; waited += POLL_INTERVAL_MS) {
+            if (m_stop.load(std::memory_order_relaxed)) throw Exception(ErrorCode::IO_ERROR, "Download stopped");
+
+            pollfd fd{.fd = m_fd, .events = events, .revents = 0};
+            int ready = poll(&fd, 1, POLL_INTERVAL_MS);
+            if (ready > 0) return;
+            if (ready < 0 && errno != EINTR) {
+                throw Exception(ErrorCode::IO_ERROR, std::format("poll failed: {}", std::strerror(errno)));
+            }
+        }
+        throw Exception(ErrorCode::IO_ERROR, std::format("Timed out waiting for {}", m_url.authority));
+    }
+
+    void Send(std::string_view data) {
+        while (!data.empty()) {
+            ssize_t sent = send(m_fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent >= 0) {
+                data.remove_prefix(sent);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                Wait(POLLOUT);
+            } else if (errno != EINTR) {
+                throw Exception(ErrorCode::IO_ERROR,
+                                std::format("Lost connection to {}: {}", m_url.authority, std::strerror(errno)));
+            }
+        }
+    }
+
+    // Receives at least one byte into dst, leftovers from reading the response head first
+    size_t Receive(uint8_t* dst, size_t length) {
+        if (!m_pending.empty()) {
+            size_t count = std::min(length, m_pending.size());
+            std::memcpy(dst, m_pending.data(), count);
+            m_pending.erase(0, count);
+            return count;
+        }
+
+        while (true) {
+            ssize_t received = recv(m_fd, dst, length, 0);
+            if (received > 0) return received;
+            if (received == 0) {
+                throw Exception(ErrorCode::IO_ERROR, std::format("{} closed the connection", m_url.authority));
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                Wait(POLLIN);
+            } else if (errno != EINTR) {
+                throw Exception(ErrorCode::IO_ERROR,
+                                std::format("Lost connection to {}: {}", m_url.authority, std::strerror(errno)));
+            }
+        }
+    }
+
+    size_t ReadResponse(uint64_t offset, size_t length, uint8_t* dst, uint64_t& file_size) {
+        // The head is read in pieces, and whatever of the body came with it is kept for the body
+        std::string head;
+        size_t head_end;
+        while ((head_end = head.find("\r\n\r\n")) == std::string::npos) {
+            if (head.size() > MAX_RESPONSE_HEAD) {
+                throw Exception(ErrorCode::INVALID_FORMAT,
+                                std::format("Response from {} is malformed", m_url.authority));
+            }
+            uint8_t piece[4096];
+            size_t received = Receive(piece, sizeof(piece));
+            head.append(reinterpret_cast<const char*>(piece), received);
+        }
+        m_pending = head.substr(head_end + 4);
+        head.resize(head_end);
+
+        // Status line, such as "HTTP/1.1 206 Partial Content"
+        uint64_t status = 0;
+        size_t space = head.find(' ');
+        if (!head.starts_with("HTTP/") || space == std::string::npos || !ParseNumber(head.substr(space), status)) {
+            throw Exception(ErrorCode::INVALID_FORMAT, std::format("Response from {} is malformed", m_url.authority));
+        }
+
+        std::optional<uint64_t> content_length;
+        std::string content_range;
+        bool close_after = false;
+        for (size_t line = head.find("\r\n"); line != std::string::npos;) {
+            size_t next = head.find("\r\n", line + 2);
+            std::string_view header = std::string_view(head).substr(line + 2, next - line - 2);
+            line = next;
+
+            size_t colon = header.find(':');
+            if (colon == std::string_view::npos) continue;
+            std::string name = Lowercase(header.substr(0, colon));
+            std::string_view value = header.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+
+            uint64_t number = 0;
+            if (name == "content-length" && ParseNumber(value, number)) {
+                content_length = number;
+            } else if (name == "content-range") {
+                content_range = value;
+            } else if (name == "connection") {
+                close_after = Lowercase(value) == "close";
+            } else if (name == "transfer-encoding") {
+                throw Exception(ErrorCode::INVALID_FORMAT,
+                                std::format("{} sent a {} encoded range", m_url.authority, value));
+            }
+        }
+
+        // Content-Range is "bytes <first>-<last>/<size>", or "bytes */<size>" when the range starts past the end
+        size_t slash = content_range.find('/');
+        if (slash == std::string::npos || !ParseNumber(std::string_view(content_range).substr(slash + 1), file_size)) {
+            if (status == 200) {
+                throw Exception(ErrorCode::INVALID_FORMAT,
+                                std::format("{} does not support range requests", m_url.authority));
+            }
+            throw Exception(ErrorCode::INVALID_FORMAT,
+                            std::format("{}{} returned HTTP {}", m_url.authority, m_url.target, status));
+        }
+        if (status == 416) {
+            if (content_length) Discard(*content_length);
+            if (close_after) Close();
+            return 0;
+        }
+
+        uint64_t first = 0;
+        size_t dash = content_range.find('-');
+        bool matches = status == 206 && content_range.starts_with("bytes ") && dash != std::string::npos &&
+                       ParseNumber(std::string_view(content_range).substr(6, dash - 6), first) && first == offset;
+        uint64_t body = content_length.value_or(0);
+        if (!matches || !content_length || body > length) {
+            throw Exception(ErrorCode::INVALID_FORMAT,
+                            std::format("{} answered a range request with another range", m_url.authority));
+        }
+
+        for (size_t received = 0; received < body;) received += Receive(dst + received, body - received);
+        if (close_after) Close();
+        return body;
+    }
+
+    void Discard(uint64_t length) {
+        uint8_t scratch[4096];
+        while (length > 0) length -= Receive(scratch, std::min<uint64_t>(length, sizeof(scratch)));
+    }
+
+    Url m_url;
+    const std::atomic<bool>& m_stop;
+    int m_fd = -1;
+    std::string m_pending;  // Bytes received past the end of the last response head
+};
+
+HttpReader::HttpReader(const std::string& url)
+    : m_connection(std::make_unique<Connection>(ParseUrl(url), m_stop)) {
+    TraceScope trace("HttpReader::HttpReader");
+    m_head.resize(HEAD_SIZE);
+    m_head.resize(Fetch(0, HEAD_SIZE, reinterpret_cast<uint8_t*>(m_head.data()), m_size));
+}
+
+HttpReader::~HttpReader() {
+    m_stop.store(true, std::memory_order_relaxed);
+    if (m_thread.joinable()) m_thread.join();
+}
+
+void HttpReader::Start(uint64_t offset, uint8_t* buffer, size_t length, std::function<void(bool)> on_finished) {
+    m_offset = offset;
+    m_buffer = buffer;
+    m_length = length;
+    m_blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    m_ready = std::make_unique<std::atomic<bool>[]>(m_blocks);
+    m_on_finished = std::move(on_finished);
+
+    // The head usually holds the start of the range already, so playback can start without waiting for a request
+    if (offset < m_head.size()) {
+        m_from_head = std::min<size_t>(m_head.size() - offset, length);
+        std::memcpy(buffer, m_head.data() + offset, m_from_head);
+        size_t complete = m_from_head == length ? m_blocks : m_from_head / BLOCK_SIZE;
+        for (size_t i = 0; i < complete; i++) m_ready[i].store(true, std::memory_order_relaxed);
+    }
+
+    m_thread = std::thread(&HttpReader::LoadLoop, this);
+}
+
+size_t HttpReader::Readable(size_t offset, size_t length) const {
+    if (!m_ready || offset >= m_length) return 0;
+    size_t end = std::min(m_length - offset, length) + offset;
+    size_t start = std::max(offset, m_from_head);
+    for (size_t block = start / BLOCK_SIZE; block * BLOCK_SIZE < end; block++) {
+        if (!m_ready[block].load(std::memory_order_acquire)) return std::max(block * BLOCK_SIZE, start) - offset;
+    }
+    return end - offset;
+}
+
+void HttpReader::Want(size_t offset) { m_wanted.store(offset, std::memory_order_relaxed); }
+
+size_t HttpReader::Fetch(uint64_t offset, size_t length, uint8_t* dst, uint64_t& file_size) {
+    for (int attempt = 1;; attempt++) {
+        try {
+            return m_connection->Fetch(offset, length, dst, file_size);
+        } catch (const Exception& e) {
+            // Only the transport is worth retrying, a server refusing the request will keep refusing it
+            if (e.GetErrorCode() != ErrorCode::IO_ERROR || attempt == MAX_ATTEMPTS) throw;
+            if (m_stop.load(std::memory_order_relaxed)) throw;
+        }
+        std::this_thread::sleep_for(RETRY_DELAY * attempt);
+    }
+}
+
+size_t HttpReader::NextMissing(size_t block) const {
+    for (size_t i = 0; i < m_blocks; i++) {
+        size_t candidate = (block + i) % m_blocks;
+        if (!m_ready[candidate].load(std::memory_order_relaxed)) return candidate;
+    }
+    return m_blocks;
+}
+
+void HttpReader::LoadLoop() {
+    size_t cursor = 0;
+    size_t window = MIN_WINDOW;
+    double throughput = 0.0;
+    bool failed = false;
+
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        // A read of data which has not arrived yet moves the download there, such as after a seek
+        uint64_t wanted = m_wanted.exchange(UINT64_MAX, std::memory_order_relaxed);
+        if (wanted < m_length) cursor = wanted / BLOCK_SIZE;
+
+        // Downloading carries on from the cursor, wrapping around to whatever a seek skipped over
+        size_t first = NextMissing(cursor);
+        if (first == m_blocks) break;
+        size_t last = first + 1;
+        while (last < m_blocks && (last - first) * BLOCK_SIZE < window &&
+               !m_ready[last].load(std::memory_order_relaxed)) {
+            last++;
+        }
+
+        // What came with the head is not fetched again, it may already be being read
+        size_t begin = std::max(first * BLOCK_SIZE, m_from_head);
+        size_t end = std::min(last * BLOCK_SIZE, m_length);
+        auto start = std::chrono::steady_clock::now();
+        size_t received = 0;
+        uint64_t file_size = 0;
+        try {
+            received = Fetch(m_offset + begin, end - begin, m_buffer + begin, file_size);
+        } catch (const Exception&) {
+            failed = !m_stop.load(std::memory_order_relaxed);
+            break;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // The file is shorter than its headers claim. Silence the rest instead of playing garbage.
+        if (received < end - begin) std::memset(m_buffer + begin + received, 0, end - begin - received);
+        for (size_t block = first; block < last; block++) m_ready[block].store(true, std::memory_order_release);
+        cursor = last;
+
+        // Round trips are part of what a request costs, so they are measured along with the transfer
+        if (seconds > 0.0 && received > 0) {
+            double sample = received / seconds;
+            throughput = throughput == 0.0 ? sample : throughput + (sample - throughput) * THROUGHPUT_SMOOTHING;
+            window = std::clamp(static_cast<size_t>(throughput * WINDOW_SECONDS) / BLOCK_SIZE * BLOCK_SIZE,
+                                MIN_WINDOW, MAX_WINDOW);
+        }
+    }
+
+    if (m_on_finished) m_on_finished(failed);
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,294 @@
+#include "dragonfruit_engine/loudness.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "dragonfruit_engine/cache.hpp"
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/sound.hpp"
+#include "dragonfruit_engine/thread_pool.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+constexpr double ABSOLUTE_GATE_LUFS = -70.0;
+constexpr double RELATIVE_GATE_LU = -10.0;
+constexpr double REFERENCE_LUFS = -18.0;  // ReplayGain 2.0 reference level
+
+constexpr size_t ANALYSIS_FRAMES = 4096;
+
+// Polyphase FIR coefficients for 4x oversampling from ITU-R BS.1770-4 Annex 2
+alignas(16) constexpr float TRUE_PEAK_COEFFS[4][12] = {
+    {0.0017089843750f, 0.0109863281250f, -0.0196533203125f, 0.0332031250000f, -0.0594482421875f, 0.1373291015625f,
+     0.9721679687500f, -0.1022949218750f, 0.0476074218750f, -0.0266113281250f, 0.0148925781250f, -0.0083007812500f},
+    {-0.0291748046875f, 0.0292968750000f, -0.0517578125000f, 0.0891113281250f, -0.1665039062500f, 0.4650878906250f,
+     0.7797851562500f, -0.2003173828125f, 0.1015625000000f, -0.0582275390625f, 0.0330810546875f, -0.0189208984375f},
+    {-0.0189208984375f, 0.0330810546875f, -0.0582275390625f, 0.1015625000000f, -0.2003173828125f, 0.7797851562500f,
+     0.4650878906250f, -0.1665039062500f, 0.0891113281250f, -0.0517578125000f, 0.0292968750000f, -0.0291748046875f},
+    {-0.0083007812500f, 0.0148925781250f, -0.0266113281250f, 0.0476074218750f, -0.1022949218750f, 0.9721679687500f,
+     0.1373291015625f, -0.0594482421875f, 0.0332031250000f, -0.0196533203125f, 0.0109863281250f, 0.0017089843750f}};
+
+inline double PowerToLufs(double power) { return -0.691 + 10.0 * std::log10(power); }
+inline double LufsToPower(double lufs) { return std::pow(10.0, (lufs + 0.691) / 10.0); }
+
+}  // namespace
+
+void LoudnessHistogram::Add(double block_lufs) {
+    if (block_lufs < MIN_LUFS) return;
+    size_t bin = static_cast<size_t>((block_lufs - MIN_LUFS) / STEP);
+    counts[std::min(bin, BINS - 1)]++;
+}
+
+void LoudnessHistogram::Merge(const LoudnessHistogram& other) {
+    for (size_t i = 0; i < BINS; i++) counts[i] += other.counts[i];
+}
+
+double LoudnessHistogram::GatedLoudness() const {
+    auto bin_power = [](size_t bin) { return LufsToPower(MIN_LUFS + (bin + 0.5) * STEP); };
+
+    double power_sum = 0.0;
+    uint64_t block_count = 0;
+    for (size_t i = 0; i < BINS; i++) {
+        power_sum += counts[i] * bin_power(i);
+        block_count += counts[i];
+    }
+    if (block_count == 0) return -HUGE_VAL;
+
+    double relative_gate = PowerToLufs(power_sum / block_count) + RELATIVE_GATE_LU;
+
+    power_sum = 0.0;
+    block_count = 0;
+    for (size_t i = 0; i < BINS; i++) {
+        if (MIN_LUFS + (i + 0.5) * STEP < relative_gate) continue;
+        power_sum += counts[i] * bin_power(i);
+        block_count += counts[i];
+    }
+    return block_count ? PowerToLufs(power_sum / block_count) : -HUGE_VAL;
+}
+
+LoudnessAnalyzer::LoudnessAnalyzer(uint16_t channels, uint32_t sample_rate)
+    : m_channels(channels),
+      m_oversample(sample_rate < 96000),
+      m_pairs((channels + 1) / 2),
+      m_weights(channels, 1.0),
+      m_peak_states(channels),
+      m_sub_block_len(std::max<size_t>(sample_rate / 10, 1)) {
+    // K-weighting filter coefficients, recalculated for the sample rate from the analog prototypes of BS.1770
+    double f0 = 1681.974450955533;
+    double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(M_PI * f0 / sample_rate);
+    double vh = std::pow(10.0, gain / 20.0);
+    double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+
+    Biquad pre_filter;
+    pre_filter.b0 = v2d{1, 1} * ((vh + vb * k / q + k * k) / a0);
+    pre_filter.b1 = v2d{1, 1} * (2.0 * (k * k - vh) / a0);
+    pre_filter.b2 = v2d{1, 1} * ((vh - vb * k / q + k * k) / a0);
+    pre_filter.a1 = v2d{1, 1} * (2.0 * (k * k - 1.0) / a0);
+    pre_filter.a2 = v2d{1, 1} * ((1.0 - k / q + k * k) / a0);
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(M_PI * f0 / sample_rate);
+    a0 = 1.0 + k / q + k * k;
+
+    Biquad rlb_filter;
+    rlb_filter.b0 = v2d{1, 1};
+    rlb_filter.b1 = v2d{-2, -2};
+    rlb_filter.b2 = v2d{1, 1};
+    rlb_filter.a1 = v2d{1, 1} * (2.0 * (k * k - 1.0) / a0);
+    rlb_filter.a2 = v2d{1, 1} * ((1.0 - k / q + k * k) / a0);
+
+    for (auto& pair : m_pairs) {
+        pair.pre_filter = pre_filter;
+        pair.rlb_filter = rlb_filter;
+    }
+
+    // 5.1 and wider follow the WAVE channel order: the LFE is ignored and the surrounds are boosted by 1.5dB
+    if (channels >= 6) {
+        m_weights[3] = 0.0;
+        m_weights[4] = 1.41;
+        m_weights[5] = 1.41;
+    }
+}
+
+void LoudnessAnalyzer::Process(const float* frames, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const float* frame = frames + i * m_channels;
+
+        for (size_t p = 0; p < m_pairs.size(); p++) {
+            size_t left = p * 2;
+            size_t right = left + 1;
+            v2d x = {frame[left], right < m_channels ? frame[right] : 0.0f};
+
+            ChannelPair& pair = m_pairs[p];
+            v2d y = pair.rlb_filter.Process(pair.pre_filter.Process(x));
+            pair.sum += y * y;
+        }
+
+        for (size_t c = 0; c < m_channels; c++) {
+            float peak = m_oversample ? OversampledPeak(m_peak_states[c], frame[c]) : std::fabs(frame[c]);
+            m_true_peak = std::max(m_true_peak, static_cast<double>(peak));
+        }
+
+        if (++m_sub_block_pos == m_sub_block_len) FinishSubBlock();
+    }
+}
+
+double LoudnessAnalyzer::IntegratedLoudness() const {
+    double power_sum = 0.0;
+    size_t block_count = 0;
+    for (double power : m_block_powers) {
+        if (PowerToLufs(power) < ABSOLUTE_GATE_LUFS) continue;
+        power_sum += power;
+        block_count++;
+    }
+    if (block_count == 0) return -HUGE_VAL;
+
+    double relative_gate = PowerToLufs(power_sum / block_count) + RELATIVE_GATE_LU;
+
+    power_sum = 0.0;
+    block_count = 0;
+    for (double power : m_block_powers) {
+        double lufs = PowerToLufs(power);
+        if (lufs < ABSOLUTE_GATE_LUFS || lufs < relative_gate) continue;
+        power_sum += power;
+        block_count++;
+    }
+    return block_count ? PowerToLufs(power_sum / block_count) : -HUGE_VAL;
+}
+
+void LoudnessAnalyzer::FinishSubBlock() {
+    double weighted = 0.0;
+    for (size_t p = 0; p < m_pairs.size(); p++) {
+        size_t left = p * 2;
+        size_t right = left + 1;
+        weighted += m_weights[left] * m_pairs[p].sum[0];
+        if (right < m_channels) weighted += m_weights[right] * m_pairs[p].sum[1];
+        m_pairs[p].sum = v2d{0, 0};
+    }
+
+    m_sub_blocks[m_sub_block_count % 4] = weighted / m_sub_block_len;
+    m_sub_block_count++;
+    m_sub_block_pos = 0;
+
+    // Gating blocks are 400ms long and overlap by 75%, so every sub-block completes a new one
+    if (m_sub_block_count < 4) return;
+
+    double power = (m_sub_blocks[0] + m_sub_blocks[1] + m_sub_blocks[2] + m_sub_blocks[3]) / 4.0;
+    m_block_powers.push_back(power);
+    m_histogram.Add(PowerToLufs(power));
+}
+
+float LoudnessAnalyzer::OversampledPeak(PeakState& state, float sample) {
+    // The history is written newest first, so history[pos + j] holds the sample from j frames ago
+    state.pos = (state.pos + TRUE_PEAK_TAPS - 1) % TRUE_PEAK_TAPS;
+    state.history[state.pos] = sample;
+    state.history[state.pos + TRUE_PEAK_TAPS] = sample;
+
+    v4sf window[3];
+    std::memcpy(window, state.history + state.pos, sizeof(window));
+
+    float peak = std::fabs(sample);
+    for (size_t phase = 0; phase < TRUE_PEAK_PHASES; phase++) {
+        v4sf coeffs[3];
+        std::memcpy(coeffs, TRUE_PEAK_COEFFS[phase], sizeof(coeffs));
+
+        v4sf acc = coeffs[0] * window[0] + coeffs[1] * window[1] + coeffs[2] * window[2];
+        peak = std::max(peak, std::fabs(acc[0] + acc[1] + acc[2] + acc[3]));
+    }
+    return peak;
+}
+
+double ReplayGain(const LoudnessInfo& info, GainMode mode) {
+    if (mode == GainMode::NONE) return 1.0;
+
+    double lufs = mode == GainMode::ALBUM ? info.album_lufs : info.track_lufs;
+    double peak = mode == GainMode::ALBUM ? info.album_peak : info.track_peak;
+    if (lufs <= ABSOLUTE_GATE_LUFS) return 1.0;
+
+    double gain = std::pow(10.0, (REFERENCE_LUFS - lufs) / 20.0);
+    if (peak > 0.0) gain = std::min(gain, 1.0 / peak);
+    return gain;
+}
+
+std::ostream& operator<<(std::ostream& out, const LoudnessInfo& info) {
+    return out << info.track_lufs << '\t' << info.track_peak << '\t' << info.album_lufs << '\t' << info.album_peak;
+}
+
+std::istream& operator>>(std::istream& in, LoudnessInfo& info) {
+    return in >> info.track_lufs >> info.track_peak >> info.album_lufs >> info.album_peak;
+}
+
+std::filesystem::path LoudnessStore::DefaultPath() { return CacheDirectory() / "loudness.tsv"; }
+
+namespace {
+
+struct TrackLoudness {
+    std::string album_key;
+    double lufs;
+    double peak;
+    LoudnessHistogram histogram;
+};
+
+std::optional<TrackLoudness> AnalyzeTrack(const std::filesystem::path& song_path) {
+    try {
+        // Nothing is loaded up front, each worker only ever holds one block of its song
+        Sound sound(song_path.string(), {.headers_only = true});
+        if (sound.FrameSize() == 0) return std::nullopt;
+
+        LoudnessAnalyzer analyzer(sound.Channels(), sound.SampleRate());
+        sound.ReadAllAsFloat(ANALYSIS_FRAMES, [&](const float* samples, size_t frames) {
+            analyzer.Process(samples, frames);
+        });
+
+        return TrackLoudness{
+            .album_key = song_path.parent_path().string() + '\n' + sound.Album(),
+            .lufs = std::max(analyzer.IntegratedLoudness(), ABSOLUTE_GATE_LUFS),
+            .peak = analyzer.TruePeak(),
+            .histogram = analyzer.Histogram(),
+        };
+    } catch (const Exception&) {
+        return std::nullopt;
+    }
+}
+
+}  // namespace
+
+size_t AnalyzeLoudness(const std::vector<std::filesystem::path>& song_paths, LoudnessStore& store, ThreadPool& pool,
+                       const std::function<void(size_t)>& on_progress) {
+    std::vector<std::optional<TrackLoudness>> results = AnalyzeSongs(song_paths, pool, AnalyzeTrack, on_progress);
+
+    struct Album {
+        LoudnessHistogram histogram;
+        double peak = 0.0;
+    };
+    std::unordered_map<std::string, Album> albums;
+    for (const auto& result : results) {
+        if (!result) continue;
+        Album& album = albums[result->album_key];
+        album.histogram.Merge(result->histogram);
+        album.peak = std::max(album.peak, result->peak);
+    }
+
+    size_t analysed = 0;
+    for (size_t i = 0; i < song_paths.size(); i++) {
+        if (!results[i]) continue;
+
+        const Album& album = albums[results[i]->album_key];
+        store.Store(song_paths[i], LoudnessInfo{
+                                       .track_lufs = results[i]->lufs,
+                                       .track_peak = results[i]->peak,
+                                       .album_lufs = std::max(album.histogram.GatedLoudness(), ABSOLUTE_GATE_LUFS),
+                                       .album_peak = album.peak,
+                                   });
+        analysed++;
+    }
+    return analysed;
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,525 @@
+#include "dragonfruit_engine/pulse_engine.hpp"
+
+#include <pulse/error.h>
+#include <pulse/timeval.h>
+#include <pulse/volume.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/trace.hpp"
+
+namespace dragonfruit {
+
+// Callback for context state changes
+void ContextStateCallback(pa_context* context, void* userdata) {
+    (void)context;  // Suppress unused warning
+    pa_threaded_mainloop_signal(reinterpret_cast<pa_threaded_mainloop*>(userdata), 0);
+}
+
+// Callback for stream state changes
+void StreamStateCallback(pa_stream* stream, void* userdata) {
+    (void)stream;  // Suppress unused warning
+    pa_threaded_mainloop_signal(static_cast<pa_threaded_mainloop*>(userdata), 0);
+}
+
+// How long to wait before retrying a write when the sound has not loaded the requested data yet
+static constexpr pa_usec_t STARVED_RETRY_USEC = 5000;
+
+struct PromoteRequest {
+    int priority;
+    pa_threaded_mainloop* mainloop;
+    bool done = false;
+    ThreadScheduling result{};
+};
+
+// Runs on the mainloop thread, which is where the write callback runs
+void PromoteCallback(pa_mainloop_api* api, pa_time_event* event, const struct timeval* tv, void* userdata) {
+    (void)tv;  // Suppress unused warning
+    api->time_free(event);
+    PromoteRequest* request = static_cast<PromoteRequest*>(userdata);
+    request->result = PromoteCurrentThread(request->priority);
+    request->done = true;
+    pa_threaded_mainloop_signal(request->mainloop, 0);
+}
+
+// PulseAudio's position for each speaker, indexed by Speaker
+constexpr pa_channel_position_t PULSE_POSITIONS[] = {
+    PA_CHANNEL_POSITION_FRONT_LEFT,
+    PA_CHANNEL_POSITION_FRONT_RIGHT,
+    PA_CHANNEL_POSITION_FRONT_CENTER,
+    PA_CHANNEL_POSITION_LFE,
+    PA_CHANNEL_POSITION_REAR_LEFT,
+    PA_CHANNEL_POSITION_REAR_RIGHT,
+    PA_CHANNEL_POSITION_FRONT_LEFT_OF_CENTER,
+    PA_CHANNEL_POSITION_FRONT_RIGHT_OF_CENTER,
+    PA_CHANNEL_POSITION_REAR_CENTER,
+    PA_CHANNEL_POSITION_SIDE_LEFT,
+    PA_CHANNEL_POSITION_SIDE_RIGHT,
+    PA_CHANNEL_POSITION_TOP_CENTER,
+    PA_CHANNEL_POSITION_TOP_FRONT_LEFT,
+    PA_CHANNEL_POSITION_TOP_FRONT_CENTER,
+    PA_CHANNEL_POSITION_TOP_FRONT_RIGHT,
+    PA_CHANNEL_POSITION_TOP_REAR_LEFT,
+    PA_CHANNEL_POSITION_TOP_REAR_CENTER,
+    PA_CHANNEL_POSITION_TOP_REAR_RIGHT,
+};
+
+// Channels without a speaker position are sent as auxiliary channels, which the server does not remix
+pa_channel_map ToPulseChannelMap(const ChannelLayout& layout) {
+    pa_channel_map map;
+    pa_channel_map_init(&map);
+    map.channels = layout.Channels();
+
+    int aux = 0;
+    for (size_t c = 0; c < layout.Channels(); c++) {
+        Speaker speaker = layout.At(c);
+        map.map[c] = speaker == Speaker::NONE
+                         ? static_cast<pa_channel_position_t>(PA_CHANNEL_POSITION_AUX0 + aux++)
+                         : PULSE_POSITIONS[static_cast<size_t>(speaker)];
+    }
+    if (layout.Channels() == 1 && layout.At(0) == Speaker::FRONT_CENTER) map.map[0] = PA_CHANNEL_POSITION_MONO;
+    return map;
+}
+
+ChannelLayout FromPulseChannelMap(const pa_channel_map& map) {
+    std::vector<Speaker> speakers(map.channels, Speaker::NONE);
+    for (size_t c = 0; c < map.channels; c++) {
+        if (map.map[c] == PA_CHANNEL_POSITION_MONO) {
+            speakers[c] = Speaker::FRONT_CENTER;
+            continue;
+        }
+
+        auto it = std::find(std::begin(PULSE_POSITIONS), std::end(PULSE_POSITIONS), map.map[c]);
+        if (it != std::end(PULSE_POSITIONS)) speakers[c] = static_cast<Speaker>(it - std::begin(PULSE_POSITIONS));
+    }
+    return ChannelLayout(speakers);
+}
+
+struct SinkQuery {
+    pa_threaded_mainloop* mainloop;
+    bool done = false;
+    std::optional<ChannelLayout> layout = std::nullopt;
+};
+
+// Called once with the sink and once more at the end of the list, or only once if the sink could not be found
+void SinkInfoCallback(pa_context* context, const pa_sink_info* info, int eol, void* userdata) {
+    (void)context;  // Suppress unused warning
+    SinkQuery* query = static_cast<SinkQuery*>(userdata);
+    if (info) query->layout = FromPulseChannelMap(info->channel_map);
+    if (eol) query->done = true;
+    pa_threaded_mainloop_signal(query->mainloop, 0);
+}
+
+void StreamWriteCallback(pa_stream* stream, size_t length, void* userData);
+
+// Timer callback used to resume writing once more sample data has been loaded
+void RetryWriteCallback(pa_mainloop_api* api, pa_time_event* event, const struct timeval* tv, void* userdata) {
+    (void)tv;  // Suppress unused warning
+    PulseWriteState* write = static_cast<PulseWriteState*>(userdata);
+    api->time_free(event);
+    write->retry_event = nullptr;
+
+    size_t writable = pa_stream_writable_size(write->stream);
+    if (writable > 0 && writable != static_cast<size_t>(-1)) StreamWriteCallback(write->stream, writable, write);
+}
+
+// Cancels a pending write retry. Must be called with the mainloop locked.
+void CancelWriteRetry(PulseWriteState& write) {
+    if (write.retry_event) {
+        write.mainloop_api->time_free(write.retry_event);
+        write.retry_event = nullptr;
+    }
+}
+
+// Fills as much of the requested length as has been loaded
+void WriteSamples(pa_stream* stream, size_t length, PulseWriteState* write) {
+    EngineState* audio = write->audio;
+    size_t out_frame_size = audio->out_channels * sizeof(float);
+
+    if (length >= out_frame_size) {
+        // Let PulseAudio hand us its own buffer so the samples are converted straight into it
+        void* buffer = nullptr;
+        size_t bytes = length - length % out_frame_size;
+        if (pa_stream_begin_write(stream, &buffer, &bytes) < 0 || !buffer) return;
+
+        size_t read = RenderOutput(*audio, static_cast<float*>(buffer), bytes / out_frame_size);
+        if (read > 0) {
+            pa_stream_write(stream, buffer, read * out_frame_size, nullptr, 0, PA_SEEK_RELATIVE);
+            return;
+        }
+
+        pa_stream_cancel_write(stream);
+
+        // The data has not arrived from disk yet. PulseAudio will not ask again for data we did not provide, so poll
+        // until the load catches up.
+        if (!audio->sound->IsLoaded()) {
+            if (!write->retry_event) {
+                struct timeval tv;
+                pa_timeval_add(pa_gettimeofday(&tv), STARVED_RETRY_USEC);
+                write->retry_event = write->mainloop_api->time_new(write->mainloop_api, &tv, RetryWriteCallback, write);
+            }
+            return;
+        }
+    }
+
+    // Either everything was played, or loading failed part way and nothing more will become available
+    audio->is_finished = true;
+    pa_stream_cork(stream, true, nullptr, nullptr);
+}
+
+// Counts the pauses and resumes the server has applied
+void CorkCallback(pa_stream* stream, int success, void* userdata) {
+    (void)stream;   // Suppress unused warning
+    (void)success;  // Suppress unused warning
+    EngineState* audio = static_cast<EngineState*>(userdata);
+    audio->cork_acked.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    audio->cork_acks.fetch_add(1, std::memory_order_release);
+}
+
+// Counts the times the server ran out of samples to play
+void UnderflowCallback(pa_stream* stream, void* userdata) {
+    (void)stream;  // Suppress unused warning
+    static_cast<EngineState*>(userdata)->underruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Stream write callback
+void StreamWriteCallback(pa_stream* stream, size_t length, void* userData) {
+    TraceScope trace("StreamWriteCallback");
+    PulseWriteState* write = static_cast<PulseWriteState*>(userData);
+    CallbackScope scope(write->audio->timing);
+    WriteSamples(stream, length, write);
+}
+
+// Blocking call to wait for a stream to disconnect since pa_stream_disconnect is an async call.
+void AwaitStreamDisconnect(pa_threaded_mainloop* mainloop, pa_stream* stream) {
+    TraceScope trace("AwaitStreamDisconnect");
+    if (stream) {
+        pa_stream_disconnect(stream);
+
+        while (true) {
+            pa_stream_state_t state = pa_stream_get_state(stream);
+            if (state == PA_STREAM_TERMINATED || state == PA_STREAM_FAILED) {
+                break;
+            }
+
+            pa_threaded_mainloop_wait(mainloop);
+        }
+
+        pa_stream_unref(stream);
+    }
+}
+
+PulseEngine::PulseEngine(const AudioEngineOptions& options) : AudioEngine(options) {
+    // Initialize threaded mainloop
+    m_mainloop = pa_threaded_mainloop_new();
+    if (!m_mainloop) {
+        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to inqitialize pulse main loop");
+    }
+
+    // Create context for threaded mainloop
+    m_mainloop_api = pa_threaded_mainloop_get_api(m_mainloop);
+    m_context = pa_context_new(m_mainloop_api, "Dragonfruit");
+    if (!m_context) {
+        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to create pulse context");
+    }
+
+    m_write_state.audio = &m_engine_state;
+    m_write_state.mainloop_api = m_mainloop_api;
+    pa_context_set_state_callback(m_context, ContextStateCallback, m_mainloop);
+
+    // Start the main loop
+    if (pa_threaded_mainloop_start(m_mainloop) < 0) {
+        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to start pulse main loop thread");
+    }
+
+    pa_threaded_mainloop_lock(m_mainloop);
+
+    // Connect PulseAudio context to threaded mainloop
+    if (pa_context_connect(m_context, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to connect pulse context");
+    }
+
+    // The connection completes on the mainloop thread while the caller goes on loading songs and drawing the interface
+    pa_threaded_mainloop_unlock(m_mainloop);
+
+    if (m_options.realtime) {
+        m_engine_state.timing = &m_timing;
+        PromoteAudioThread();
+    }
+}
+
+bool PulseEngine::AwaitContextReady() {
+    TraceScope trace("PulseEngine::AwaitContextReady");
+
+    // Wait until context is ready or failed in a blocking manner. The context state change call back should signal to
+    // the mainloop once it has been called.
+    while (true) {
+        pa_context_state_t state = pa_context_get_state(m_context);
+        if (state == PA_CONTEXT_READY) return true;
+        if (state == PA_CONTEXT_FAILED || state == PA_CONTEXT_TERMINATED) return false;
+
+        pa_threaded_mainloop_wait(m_mainloop);
+    }
+}
+
+void PulseEngine::PromoteAudioThread() {
+    // The scheduling change has to be made by the mainloop thread itself, so it is done from a timer which fires
+    // immediately
+    PromoteRequest request{.priority = m_options.realtime_priority, .mainloop = m_mainloop};
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    struct timeval tv;
+    m_mainloop_api->time_new(m_mainloop_api, pa_gettimeofday(&tv), PromoteCallback, &request);
+    while (!request.done) pa_threaded_mainloop_wait(m_mainloop);
+    pa_threaded_mainloop_unlock(m_mainloop);
+
+    m_realtime = request.result.realtime;
+    m_priority = request.result.priority;
+}
+
+std::optional<ChannelLayout> PulseEngine::QueryDeviceLayout() {
+    TraceScope trace("PulseEngine::QueryDeviceLayout");
+    SinkQuery query{.mainloop = m_mainloop};
+    pa_operation* op = pa_context_get_sink_info_by_name(m_context, "@DEFAULT_SINK@", SinkInfoCallback, &query);
+    if (!op) return std::nullopt;
+
+    while (!query.done && pa_operation_get_state(op) == PA_OPERATION_RUNNING) pa_threaded_mainloop_wait(m_mainloop);
+    pa_operation_unref(op);
+    return query.layout;
+}
+
+PulseEngine::~PulseEngine() {
+    pa_threaded_mainloop_lock(m_mainloop);
+
+    // Destroy stream
+    CancelWriteRetry(m_write_state);
+    AwaitStreamDisconnect(m_mainloop, m_stream);
+
+    // Destroy the context (this is a blocking call, no awaiting required)
+    pa_context_disconnect(m_context);
+    pa_context_unref(m_context);
+    pa_threaded_mainloop_unlock(m_mainloop);
+
+    // Destroy the threaded mainloop
+    pa_threaded_mainloop_stop(m_mainloop);
+    pa_threaded_mainloop_free(m_mainloop);
+}
+
+void PulseEngine::PlayAsync(std::shared_ptr<Sound> sound) {
+    TraceScope trace("PulseEngine::PlayAsync");
+    pa_threaded_mainloop_lock(m_mainloop);
+
+    if (!AwaitContextReady()) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        throw Exception(ErrorCode::INTERNAL_ERROR, "Failed to connect pulse context");
+    }
+
+    // If there is already a stream setup, we will have to disconnect and create a new one
+
+    CancelWriteRetry(m_write_state);
+    AwaitStreamDisconnect(m_mainloop, m_stream);
+    m_stream = nullptr;
+
+    if (sound->PcmFormat() == SampleFormat::INVALID) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        throw Exception(ErrorCode::INVALID_FORMAT, "Invalid WAV format");
+    }
+
+    // Songs with speaker positions are mixed to the device's layout here, so the server never has to remix them.
+    // Songs without any are passed through as they are.
+    ChannelLayout layout = sound->Layout();
+    ChannelLayout output = layout;
+    if (layout.Mask() != 0) {
+        std::optional<ChannelLayout> device = QueryDeviceLayout();
+        if (device && device->Mask() != 0) output = *device;
+    }
+
+    // Setup stream. Every source format is converted to float on the way out so gain can be applied uniformly.
+    m_sample_spec.channels = output.Channels();
+    m_sample_spec.format = pa_sample_format::PA_SAMPLE_FLOAT32LE;
+    m_sample_spec.rate = sound->SampleRate();
+    pa_channel_map channel_map = ToPulseChannelMap(output);
+
+    SetupSong(sound, output);
+
+    // Create a new stream connect to the context and hook the state change and write callbacks for async functionality
+    m_stream = pa_stream_new(m_context, "Playback", &m_sample_spec, &channel_map);
+    m_write_state.stream = m_stream;
+    pa_stream_set_write_callback(m_stream, StreamWriteCallback, &m_write_state);
+    pa_stream_set_underflow_callback(m_stream, UnderflowCallback, &m_engine_state);
+    pa_stream_set_state_callback(m_stream, StreamStateCallback, m_mainloop);
+
+    // Connect the stream to the pulse server in playback mode and wait for it to be ready
+    {
+        TraceScope connect_trace("pa_stream_connect_playback");
+        if (pa_stream_connect_playback(
+                m_stream, nullptr, nullptr,
+                static_cast<pa_stream_flags_t>(PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE |
+                                               PA_STREAM_ADJUST_LATENCY),
+                nullptr, nullptr) < 0) {
+            pa_threaded_mainloop_unlock(m_mainloop);
+            throw Exception(ErrorCode::INTERNAL_ERROR, "Unable to connect pulse stream");
+        }
+
+        // Wait for stream to be ready
+        while (true) {
+            pa_stream_state_t state = pa_stream_get_state(m_stream);
+            if (state == PA_STREAM_READY) {
+                break;
+            }
+
+            if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED) {
+                pa_threaded_mainloop_unlock(m_mainloop);
+                throw Exception(ErrorCode::INTERNAL_ERROR, "Stream failed to start");
+            }
+
+            pa_threaded_mainloop_wait(m_mainloop);
+        }
+    }
+
+    m_sink_idx = pa_stream_get_index(m_stream);
+
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseEngine::Stop() {
+    pa_threaded_mainloop_lock(m_mainloop);
+    CancelWriteRetry(m_write_state);
+    AwaitStreamDisconnect(m_mainloop, m_stream);
+    m_stream = nullptr;
+
+    m_write_state.stream = nullptr;
+    m_engine_state.sound.reset();
+    m_engine_state.frame = 0;
+    m_engine_state.is_finished = true;
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseEngine::Pause(bool pause) {
+    pa_threaded_mainloop_lock(m_mainloop);
+    if (m_stream) pa_stream_cork(m_stream, pause, CorkCallback, &m_engine_state);
+    m_timing.last_start_ns = 0;
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+double PulseEngine::GetCurrentSongTime() {
+    pa_threaded_mainloop_lock(m_mainloop);
+
+    if (!m_stream || !m_engine_state.sound) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        return 0.0;
+    }
+
+    pa_stream_update_timing_info(m_stream, nullptr, nullptr);
+
+    // If we haven't received an update from the server yet, it's possible that the timing info is not yet valid. In
+    // this case return 0.0, subsequent calls should work properly.
+    std::optional<double> played_frame = PlayedFrame();
+    double rate = m_sample_spec.rate;
+
+    pa_threaded_mainloop_unlock(m_mainloop);
+
+    return played_frame ? *played_frame / rate : 0.0;
+}
+
+double PulseEngine::GetTotalSongTime() {
+    pa_threaded_mainloop_lock(m_mainloop);
+    double total_song_time =
+        m_engine_state.sound ? static_cast<double>(m_engine_state.sound->TotalFrames()) / m_sample_spec.rate : 0.0;
+    pa_threaded_mainloop_unlock(m_mainloop);
+    return total_song_time;
+}
+
+void PulseEngine::Seek(double seconds) {
+    pa_threaded_mainloop_lock(m_mainloop);
+    if (!m_stream || !m_engine_state.sound) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        return;
+    }
+
+    pa_stream_cork(m_stream, true, nullptr, nullptr);
+
+    // We haven't received a timing update from the server yet, therefore we cannot accurately seek. In this case, we
+    // return early. It is most likely this only occurs during edge cases, but we should check just in case.
+    std::optional<double> current_frame = PlayedFrame();
+    if (!current_frame) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        return;
+    }
+
+    // Seeks are in the song's own time, whatever the playback speed
+    double frames_to_seek = seconds * m_sample_spec.rate;
+    RestartAt(static_cast<size_t>(std::max(*current_frame + frames_to_seek, 0.0)), true);
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseEngine::SetSpeed(double speed) {
+    speed = std::clamp(speed, TimeStretcher::MIN_SPEED, TimeStretcher::MAX_SPEED);
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    if (speed == m_speed) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        return;
+    }
+    m_speed = speed;
+
+    if (!m_stream || !m_engine_state.sound) {
+        pa_threaded_mainloop_unlock(m_mainloop);
+        return;
+    }
+
+    // Restart from what is playing right now, rather than letting what is already buffered play out at the old speed
+    bool paused = pa_stream_is_corked(m_stream) == 1;
+    pa_stream_cork(m_stream, true, nullptr, nullptr);
+    std::optional<double> current_frame = PlayedFrame();
+    ResetStretcher();
+    RestartAt(current_frame ? static_cast<size_t>(*current_frame) : m_engine_state.frame, !paused);
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+// Frame of the song being heard right now, behind what has been written by what is still buffered. Must be called
+// with the mainloop locked.
+std::optional<double> PulseEngine::PlayedFrame() {
+    const pa_timing_info* timing_info = pa_stream_get_timing_info(m_stream);
+    if (!timing_info) return std::nullopt;
+
+    int64_t in_buffer = (timing_info->write_index - timing_info->read_index) / pa_frame_size(&m_sample_spec);
+    return AudioEngine::PlayedFrame(in_buffer);
+}
+
+// Drops what is buffered and continues writing from a frame of the song. The stream must be corked, and is uncorked
+// again if resume is set. Must be called with the mainloop locked.
+void PulseEngine::RestartAt(size_t frame, bool resume) {
+    SetFrame(frame);
+
+    // Flush the current buffer so that we start at our new frame
+    pa_stream_flush(m_stream, nullptr, nullptr);
+    if (resume) pa_stream_cork(m_stream, false, nullptr, nullptr);
+    pa_stream_update_timing_info(m_stream, nullptr, nullptr);
+}
+
+void PulseEngine::SetVolume(double volume) {
+    double volume_clamped = std::clamp(volume, 0.0, 1.0);
+
+    pa_volume_t pa_volume = PA_VOLUME_NORM * volume_clamped;
+    pa_cvolume cvol;
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    pa_cvolume_set(&cvol, m_sample_spec.channels, pa_volume);
+    pa_context_set_sink_input_volume(m_context, m_sink_idx, &cvol, nullptr, nullptr);
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+bool PulseEngine::IsPaused() {
+    pa_threaded_mainloop_lock(m_mainloop);
+    int paused = m_stream ? pa_stream_is_corked(m_stream) : 0;
+    pa_threaded_mainloop_unlock(m_mainloop);
+
+    return paused < 1 ? false : true;
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,196 @@
+#include "dragonfruit_engine/render.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#include "dragonfruit_engine/convert.hpp"
+#include "dragonfruit_engine/dsp_graph.hpp"
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/trace.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+constexpr size_t RENDER_FRAMES = 16384;
+constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 3;
+constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+// KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, the sub format GUID of extensible float files
+constexpr uint8_t SUBTYPE_IEEE_FLOAT[16] = {0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                                            0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+
+// Tags copied from the source song, in the order they are written
+constexpr const char* INFO_TAGS[] = {"INAM", "IART", "IPRD", "ITRK", "ICRD", "IGNR", "ICMT"};
+
+void WriteChunkHeader(std::ofstream& file, const char* id, uint32_t size) {
+    ChunkHeader header;
+    std::memcpy(header.id, id, sizeof(header.id));
+    header.size = size;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+// Builds the LIST INFO chunk body for the tags the song has, padding every value to an even length
+std::string BuildInfoList(const Sound& sound) {
+    std::string list;
+    for (const char* tag : INFO_TAGS) {
+        std::string value = sound.Metadata(tag);
+        if (value.empty()) continue;
+
+        value.push_back('\0');
+        if (value.size() % 2) value.push_back('\0');
+
+        uint32_t size = value.size();
+        list.append(tag, 4);
+        list.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        list += value;
+    }
+    return list.empty() ? list : "INFO" + list;
+}
+
+}  // namespace
+
+size_t RenderPcm(Sound& sound, size_t frame, float* out, size_t frames, float gain, std::vector<uint8_t>& scratch) {
+    size_t frame_size = sound.FrameSize();
+    if (scratch.size() < frames * frame_size) scratch.resize(frames * frame_size);
+
+    size_t read = sound.ReadPcm(frame * frame_size, scratch.data(), frames * frame_size) / frame_size;
+    size_t samples = read * sound.Channels();
+    ConvertToFloat(sound.PcmFormat(), scratch.data(), out, samples);
+    if (gain != 1.0f) ApplyGain(out, samples, gain);
+    return read;
+}
+
+RenderResult RenderToWav(const RenderJob& job) {
+    TraceScope trace("RenderToWav");
+    auto start = std::chrono::steady_clock::now();
+
+    Sound sound(job.song_path.string());
+    if (sound.PcmFormat() == SampleFormat::INVALID) {
+        throw Exception(ErrorCode::INVALID_FORMAT, std::format("Cannot render {}", job.song_path.string()));
+    }
+
+    std::ofstream file(job.output_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw Exception(ErrorCode::IO_ERROR, std::format("Could not open {} for writing", job.output_path.string()));
+    }
+
+    uint16_t channels = sound.Channels();
+    uint32_t frame_size = channels * sizeof(float);
+    uint32_t data_size = sound.TotalFrames() * frame_size;
+    std::string info = BuildInfoList(sound);
+
+    // Files with more than two channels are written as WAVE_FORMAT_EXTENSIBLE so they keep their speaker positions
+    bool extensible = channels > 2;
+    FmtExtendedChunk extended{.valid_bits_per_sample = 32, .channel_mask = sound.Layout().Mask(), .sub_format = {}};
+    std::memcpy(extended.sub_format, SUBTYPE_IEEE_FLOAT, sizeof(extended.sub_format));
+    uint16_t extension_size = extensible ? sizeof(extended) : 0;
+
+    // Everything but the data is known up front, so the header is written once with its final sizes
+    uint32_t riff_size = 4 + (sizeof(ChunkHeader) + sizeof(FmtChunk) + sizeof(uint16_t) + extension_size) +
+                         (sizeof(ChunkHeader) + sizeof(uint32_t)) +
+                         (info.empty() ? 0 : sizeof(ChunkHeader) + info.size()) + sizeof(ChunkHeader) + data_size;
+    WriteChunkHeader(file, "RIFF", riff_size);
+    file.write("WAVE", 4);
+
+    // Non-PCM formats have an extension size field in fmt and need a fact chunk holding the number of frames
+    FmtChunk fmt{.audio_format = extensible ? WAVE_FORMAT_EXTENSIBLE : WAVE_FORMAT_IEEE_FLOAT,
+                 .num_channels = channels,
+                 .frequency = sound.SampleRate(),
+                 .bytes_per_sec = sound.SampleRate() * frame_size,
+                 .bytes_per_bloc = static_cast<uint16_t>(frame_size),
+                 .bits_per_sample = 32};
+    WriteChunkHeader(file, "fmt ", sizeof(fmt) + sizeof(extension_size) + extension_size);
+    file.write(reinterpret_cast<const char*>(&fmt), sizeof(fmt));
+    file.write(reinterpret_cast<const char*>(&extension_size), sizeof(extension_size));
+    if (extensible) file.write(reinterpret_cast<const char*>(&extended), sizeof(extended));
+
+    uint32_t total_frames = sound.TotalFrames();
+    WriteChunkHeader(file, "fact", sizeof(total_frames));
+    file.write(reinterpret_cast<const char*>(&total_frames), sizeof(total_frames));
+
+    if (!info.empty()) {
+        WriteChunkHeader(file, "LIST", info.size());
+        file.write(info.data(), info.size());
+    }
+
+    WriteChunkHeader(file, "data", data_size);
+
+    // Filters run in a graph of the job's own, on the rendering thread since songs are already rendered in parallel
+    std::optional<DspGraph> graph;
+    if (job.impulse_response) {
+        graph.emplace(DspGraphOptions{.workers = 0});
+        graph->Insert(std::make_shared<ConvolverNode>(job.impulse_response, job.convolution_partition));
+        graph->SetFormat(channels, sound.SampleRate());
+    }
+
+    // The first frames out of the graph are its delay, they are dropped and made up for with silence at the end
+    size_t delay = graph ? graph->Latency() : 0;
+    size_t written = 0;
+    auto write = [&](float* block, size_t frames) {
+        if (graph) graph->Process(block, frames);
+        size_t dropped = std::min(delay, frames);
+        delay -= dropped;
+        size_t count = std::min(frames - dropped, total_frames - written);
+        file.write(reinterpret_cast<const char*>(block + dropped * channels), count * frame_size);
+        written += count;
+    };
+
+    std::vector<uint8_t> scratch;
+    std::vector<float> samples(RENDER_FRAMES * channels);
+    size_t frame = 0;
+    while (frame < total_frames) {
+        size_t frames = RenderPcm(sound, frame, samples.data(), std::min(RENDER_FRAMES, total_frames - frame),
+                                  static_cast<float>(job.gain), scratch);
+        if (frames == 0) {
+            // Rendering overtook the load, wait for the rest rather than polling
+            if (sound.IsLoaded()) break;
+            sound.WaitForLoad();
+            continue;
+        }
+
+        write(samples.data(), frames);
+        frame += frames;
+    }
+
+    // The graph is flushed with silence, which also pads a song whose load failed part way so the header stays truthful
+    while (written < total_frames) {
+        std::fill(samples.begin(), samples.end(), 0.0f);
+        write(samples.data(), RENDER_FRAMES);
+    }
+
+    file.close();
+    if (!file) {
+        std::error_code ec;
+        std::filesystem::remove(job.output_path, ec);
+        throw Exception(ErrorCode::IO_ERROR, std::format("Failed to write {}", job.output_path.string()));
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {.frames = total_frames, .sample_rate = sound.SampleRate(), .elapsed = elapsed.count()};
+}
+
+std::vector<std::optional<RenderResult>> RenderSongs(const std::vector<RenderJob>& jobs, ThreadPool& pool,
+                                                     const std::function<void(size_t)>& on_progress) {
+    std::vector<std::optional<RenderResult>> results(jobs.size());
+    std::atomic<size_t> done = 0;
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pool.Submit([&, i] {
+            try {
+                results[i] = RenderToWav(jobs[i]);
+            } catch (const Exception&) {
+            }
+            size_t finished = done.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (on_progress) on_progress(finished);
+        });
+    }
+    pool.Wait();
+
+    return results;
+}
+
+}  // namespace dragonfruit
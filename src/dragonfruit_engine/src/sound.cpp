@@ -1,29 +1,207 @@
 #include "dragonfruit_engine/sound.hpp"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <optional>
+#include <sstream>
+#include <thread>
 
 #include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/trace.hpp"
 
 namespace dragonfruit {
 
-Sound::Sound(const std::string& filepath) {
+namespace {
+
+constexpr std::chrono::milliseconds LOAD_POLL_INTERVAL{10};  // Wait between reads while a streamed song downloads
+
+}  // namespace
+
+Sound::Sound(const std::string& filepath, const SoundLoadOptions& options) {
+    TraceScope trace("Sound::Sound");
+    if (IsHttpUrl(filepath)) {
+        m_http = std::make_unique<HttpReader>(filepath);
+        std::istringstream head(m_http->Head());
+        ParseHeaders(head);
+        if (m_data_offset == 0) {
+            throw Exception(ErrorCode::INVALID_FORMAT, std::format("No data chunk in the first {} KiB of {}",
+                                                                   HttpReader::HEAD_SIZE >> 10, filepath));
+        }
+
+        // Files cut short are common on the web, only what the server has can arrive
+        m_sample_data_size = std::min<uint64_t>(m_sample_data_size, m_http->Size() - m_data_offset);
+        SetupDecoder();
+        StartStreaming(options);
+        return;
+    }
+
     std::ifstream file(filepath.c_str());
+    ParseHeaders(file);
+    file.close();
 
-    // Load RIFF metadata
-    RiffChunk chunk;
-    file.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
-    if (std::string(chunk.wav_id, 4) != "WAVE") {
-        throw Exception(ErrorCode::INVALID_FORMAT, "File does not start with RIFF chunk");
+    if (options.headers_only) {
+        OpenHeadersOnly(filepath);
+        return;
     }
 
-    while (ReadChunk(file));
+    SetupDecoder();
+    StartLoading(filepath, options);
+}
 
-    file.close();
+Sound::~Sound() {
+    // The download thread reports to the load state below, it has to be gone before anything else
+    m_http.reset();
+
+    // Drop any reads that have not started yet and wait for the ones in flight, they still write into our buffer
+    if (m_reader) {
+        m_reader->Cancel(m_read_tag);
+
+        std::unique_lock<std::mutex> lock(m_load_mutex);
+        m_load_cv.wait(lock, [&] { return m_outstanding_reads == 0; });
+    }
+
+    if (m_fd >= 0) close(m_fd);
+}
+
+void Sound::StartLoading(const std::string& filepath, const SoundLoadOptions& options) {
+    constexpr size_t alignment = AsyncReader::ALIGNMENT;
+    constexpr size_t chunk_size = AsyncReader::CHUNK_SIZE;
+
+    m_buffer_offset = m_data_offset & ~static_cast<uint64_t>(alignment - 1);
+    uint64_t buffer_end = (m_data_offset + m_sample_data_size + alignment - 1) & ~static_cast<uint64_t>(alignment - 1);
+    m_buffer_size = std::max<size_t>(buffer_end - m_buffer_offset, alignment);
+
+    // The buffer is intentionally left uninitialized (and may hold a previous song), every byte of it is overwritten by
+    // a read. Pool buffers are page aligned, which satisfies O_DIRECT.
+    BufferPool& pool = options.pool ? *options.pool : BufferPool::Shared();
+    m_sample_buffer = pool.Acquire(m_buffer_size);
+    if (options.lock_memory) m_sample_buffer.Lock();
+    m_sample_data = m_sample_buffer.Data() + (m_data_offset - m_buffer_offset);
+
+    if (m_sample_data_size == 0) {
+        m_load_finished.store(true, std::memory_order_release);
+        return;
+    }
+
+    // Not every filesystem supports O_DIRECT (tmpfs for example), fall back to buffered I/O if opening fails
+    if (options.direct_io) m_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (m_fd < 0) {
+        m_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_fd < 0) {
+            throw Exception(ErrorCode::IO_ERROR, "Unable to open " + filepath);
+        }
+        posix_fadvise(m_fd, m_buffer_offset, m_buffer_size, POSIX_FADV_SEQUENTIAL);
+    }
+
+    size_t num_chunks = (m_buffer_size + chunk_size - 1) / chunk_size;
+    m_chunk_done.assign(num_chunks, false);
+    m_outstanding_reads = num_chunks;
+    m_reader = options.reader ? options.reader : &AsyncReader::Shared();
+    m_read_tag = AsyncReader::NewTag();
+
+    struct stat st;
+    m_file_size = fstat(m_fd, &st) == 0 ? st.st_size : UINT64_MAX;
+
+    for (size_t i = 0; i < num_chunks; i++) SubmitChunkRead(i, 0);
+}
+
+void Sound::OpenHeadersOnly(const std::string& filepath) {
+    m_fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        throw Exception(ErrorCode::IO_ERROR, "Unable to open " + filepath);
+    }
+    posix_fadvise(m_fd, m_data_offset, m_sample_data_size, POSIX_FADV_SEQUENTIAL);
+
+    SetupDecoder();
+    m_loaded_bytes.store(m_sample_data_size, std::memory_order_release);
+    m_load_finished.store(true, std::memory_order_release);
+}
+
+void Sound::SubmitChunkRead(size_t chunk_idx, size_t filled) {
+    constexpr size_t chunk_size = AsyncReader::CHUNK_SIZE;
+    ReadRequest request;
+    request.fd = m_fd;
+    request.offset = m_buffer_offset + chunk_idx * chunk_size + filled;
+    request.buffer = m_sample_buffer.Data() + chunk_idx * chunk_size + filled;
+    request.length = std::min(chunk_size, m_buffer_size - chunk_idx * chunk_size) - filled;
+    request.tag = m_read_tag;
+    request.on_complete = [this, chunk_idx, filled](ssize_t result) { OnChunkRead(chunk_idx, filled, result); };
+    m_reader->Submit(std::move(request));
+}
+
+void Sound::StartStreaming(const SoundLoadOptions& options) {
+    // Nothing is read with O_DIRECT, so the buffer holds exactly the data chunk
+    m_buffer_offset = m_data_offset;
+    m_buffer_size = std::max<size_t>(m_sample_data_size, AsyncReader::ALIGNMENT);
+
+    BufferPool& pool = options.pool ? *options.pool : BufferPool::Shared();
+    m_sample_buffer = pool.Acquire(m_buffer_size);
+    if (options.lock_memory) m_sample_buffer.Lock();
+    m_sample_data = m_sample_buffer.Data();
+
+    m_http->Start(m_data_offset, m_sample_data, m_sample_data_size, [this](bool failed) {
+        std::lock_guard<std::mutex> lock(m_load_mutex);
+        m_load_failed = failed;
+        m_load_finished.store(true, std::memory_order_release);
+        m_load_cv.notify_all();
+    });
 }
 
-Sound::~Sound() {}
+void Sound::OnChunkRead(size_t chunk_idx, size_t filled, ssize_t result) {
+    constexpr size_t chunk_size = AsyncReader::CHUNK_SIZE;
+    size_t chunk_length = std::min(chunk_size, m_buffer_size - chunk_idx * chunk_size);
+
+    // Reads may complete partially (io_uring hands them back as the kernel returned them), the rest is asked for
+    // again unless the file ends there
+    if (result > 0) filled += result;
+    uint64_t end = m_buffer_offset + chunk_idx * chunk_size + filled;
+    if (result > 0 && filled < chunk_length && end < m_file_size) {
+        SubmitChunkRead(chunk_idx, filled);
+        return;
+    }
+
+    // Only a read hitting the end of the file leaves the chunk short, the file is shorter than its data chunk claims.
+    // Silence the rest instead of playing garbage.
+    if (result >= 0 && filled < chunk_length) {
+        std::memset(m_sample_buffer.Data() + chunk_idx * chunk_size + filled, 0, chunk_length - filled);
+    }
+
+    std::lock_guard<std::mutex> lock(m_load_mutex);
+    if (result >= 0) {
+        m_chunk_done[chunk_idx] = true;
+    } else if (result != -ECANCELED) {
+        m_load_failed = true;
+    }
+
+    // Only advance the readable region once everything before it has arrived
+    while (m_chunk_prefix < m_chunk_done.size() && m_chunk_done[m_chunk_prefix]) m_chunk_prefix++;
+    uint64_t loaded_end = m_buffer_offset + std::min(m_chunk_prefix * chunk_size, m_buffer_size);
+    size_t loaded = loaded_end > m_data_offset ? loaded_end - m_data_offset : 0;
+    m_loaded_bytes.store(std::min(loaded, m_sample_data_size), std::memory_order_release);
+
+    if (--m_outstanding_reads == 0) {
+        m_load_finished.store(true, std::memory_order_release);
+        m_load_cv.notify_all();
+    }
+}
+
+void Sound::WaitForLoad() const {
+    std::unique_lock<std::mutex> lock(m_load_mutex);
+    m_load_cv.wait(lock, [&] { return m_load_finished.load(std::memory_order_acquire); });
+}
+
+bool Sound::LoadFailed() const {
+    std::lock_guard<std::mutex> lock(m_load_mutex);
+    return m_load_failed;
+}
 
 ChunkCode GetChunkCode(const std::string& chunkID) {
     static const std::unordered_map<std::string, ChunkCode> idToChunkCode = {
@@ -38,8 +216,16 @@ WavFormatCode GetWavFormatCode(uint16_t code) {
     switch (code) {
         case 0x0001:
             return WavFormatCode::PCM;
+        case 0x0002:
+            return WavFormatCode::MS_ADPCM;
         case 0x0003:
             return WavFormatCode::IEEE_FLOAT;
+        case 0x0006:
+            return WavFormatCode::ALAW;
+        case 0x0007:
+            return WavFormatCode::MULAW;
+        case 0x0011:
+            return WavFormatCode::IMA_ADPCM;
         case 0xFFFE:
             return WavFormatCode::EXTENSIBLE;
         default:
@@ -47,8 +233,8 @@ WavFormatCode GetWavFormatCode(uint16_t code) {
     }
 }
 
-void Sound::HandleFmtChunk(std::ifstream& file, size_t size) {
-    if (size != 16 && size != 18 && size != 40) {
+void Sound::HandleFmtChunk(std::istream& file, size_t size) {
+    if (size < sizeof(FmtChunk)) {
         throw Exception(ErrorCode::INVALID_FORMAT, "Malformed fmt chunk in WAV file");
     }
 
@@ -57,41 +243,62 @@ void Sound::HandleFmtChunk(std::ifstream& file, size_t size) {
     m_channels = chunk.num_channels;
     m_sample_rate = chunk.frequency;
     m_bit_depth = chunk.bits_per_sample;
+    m_block_align = chunk.bytes_per_bloc;
 
     // Determine audio format
     m_format = GetWavFormatCode(chunk.audio_format);
 
     // Check for extension if size is above 16 bytes
-    if (size <= 16) return;
+    size_t bytes_read = sizeof(chunk);
+    if (size < bytes_read + sizeof(uint16_t)) {
+        file.seekg(size - bytes_read, std::ios::cur);
+        return;
+    }
+
     uint16_t extensionSize;
     file.read(reinterpret_cast<char*>(&extensionSize), sizeof(extensionSize));
+    bytes_read += sizeof(extensionSize);
+    extensionSize = std::min<size_t>(extensionSize, size - bytes_read);
+
+    if (m_format == WavFormatCode::EXTENSIBLE && extensionSize >= sizeof(FmtExtendedChunk)) {
+        // Otherwise, we must read the extended fmt data
+        FmtExtendedChunk extendedChunk;
+        file.read(reinterpret_cast<char*>(&extendedChunk), sizeof(extendedChunk));
+        bytes_read += sizeof(extendedChunk);
+
+        m_format = GetWavFormatCode(extendedChunk.sub_format[1] << 8 | extendedChunk.sub_format[0]);
+        m_channel_mask = extendedChunk.channel_mask;
+    } else if (extensionSize > 0) {
+        // Compressed formats keep codec specific data here (samples per block, ADPCM coefficients, etc.)
+        m_fmt_extension.resize(extensionSize);
+        file.read(reinterpret_cast<char*>(m_fmt_extension.data()), extensionSize);
+        bytes_read += extensionSize;
+    }
 
-    if (extensionSize == 0) return;
-
-    // Otherwise, we must read the extended fmt data
-    FmtExtendedChunk extendedChunk;
-    file.read(reinterpret_cast<char*>(&extendedChunk), sizeof(extendedChunk));
-
-    m_format = GetWavFormatCode(extendedChunk.sub_format[1] << 8 | extendedChunk.sub_format[0]);
+    // Skip anything we did not consume so the next chunk header is read from the right place
+    if (bytes_read < size) file.seekg(size - bytes_read, std::ios::cur);
 }
 
-void Sound::HandleDataChunk(std::ifstream& file, size_t size) {
-    m_sample_data.resize(size);
-    file.read(reinterpret_cast<char*>(m_sample_data.data()), size);
+void Sound::HandleDataChunk(std::istream& file, size_t size) {
+    // The sample data itself is read in the background once every chunk header has been parsed
+    m_data_offset = file.tellg();
+    m_sample_data_size = size;
+    file.seekg(size, std::ios::cur);
 }
 
-void Sound::HandleListChunk(std::ifstream& file, size_t size) {
+// Reads the tags of a LIST chunk
+void ReadInfoList(std::istream& file, size_t size, std::unordered_map<std::string, std::string>& tags) {
     InfoChunk chunk;
     file.read(reinterpret_cast<char*>(&chunk), 4);
     uint32_t bytesRead = 4;
 
     while (bytesRead < size) {
         ChunkHeader tag;
-        file.read(reinterpret_cast<char*>(&tag), sizeof(ChunkHeader));
+        if (!file.read(reinterpret_cast<char*>(&tag), sizeof(ChunkHeader)) || tag.size > size - bytesRead) break;
 
         std::string value(tag.size, '\0');
         file.read(&value[0], tag.size);
-        m_info_tags[std::string(tag.id, 4)] = value;
+        tags[std::string(tag.id, 4)] = value;
 
         // Seek past padding if tag.size is odd
         if (tag.size % 2 != 0) {
@@ -103,9 +310,11 @@ void Sound::HandleListChunk(std::ifstream& file, size_t size) {
     }
 }
 
-void Sound::HandleUnknownChunk(std::ifstream& file, size_t size) { file.seekg(size, std::ios::cur); }
+void Sound::HandleListChunk(std::istream& file, size_t size) { ReadInfoList(file, size, m_info_tags); }
+
+void Sound::HandleUnknownChunk(std::istream& file, size_t size) { file.seekg(size, std::ios::cur); }
 
-void Sound::ParseChunk(ChunkHeader header, std::ifstream& file) {
+void Sound::ParseChunk(ChunkHeader header, std::istream& file) {
     ChunkCode code = GetChunkCode(std::string(header.id, 4));
     switch (code) {
         case ChunkCode::DATA: {
@@ -135,7 +344,18 @@ void Sound::ParseChunk(ChunkHeader header, std::ifstream& file) {
     }
 }
 
-bool Sound::ReadChunk(std::ifstream& file) {
+void Sound::ParseHeaders(std::istream& file) {
+    // Load RIFF metadata
+    RiffChunk chunk;
+    file.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
+    if (std::string(chunk.wav_id, 4) != "WAVE") {
+        throw Exception(ErrorCode::INVALID_FORMAT, "File does not start with RIFF chunk");
+    }
+
+    while (ReadChunk(file));
+}
+
+bool Sound::ReadChunk(std::istream& file) {
     // Immediately return false if we're at the end of the file
     if (file.peek() == EOF) {
         return false;
@@ -150,6 +370,198 @@ bool Sound::ReadChunk(std::ifstream& file) {
     return true;
 }
 
+void Sound::SetupDecoder() {
+    m_decoder = CreateDecoder(m_format, {.channels = m_channels,
+                                         .block_align = m_block_align,
+                                         .bits_per_sample = m_bit_depth,
+                                         .fmt_extension = m_fmt_extension});
+
+    m_pcm_data_size = PcmSizeForRawSize(m_sample_data_size);
+    if (m_decoder) m_block_cache.samples.resize(m_decoder->FramesInBlock(m_decoder->BlockSize()) * m_channels);
+}
+
+size_t Sound::PcmSizeForRawSize(size_t raw_size) const {
+    if (!m_decoder) return raw_size;
+
+    // Only the final block may be short, every other block decodes to the same number of frames
+    size_t block_size = m_decoder->BlockSize();
+    size_t frames = raw_size / block_size * m_decoder->FramesInBlock(block_size) +
+                    m_decoder->FramesInBlock(raw_size % block_size);
+    return frames * m_channels * sizeof(int16_t);
+}
+
+size_t Sound::AvailablePcmSize() const {
+    if (m_http) return StreamedPcmSize(0, m_pcm_data_size);
+
+    size_t loaded = m_loaded_bytes.load(std::memory_order_acquire);
+    if (loaded == m_sample_data_size) return m_pcm_data_size;
+
+    // A partially loaded block can not be decoded yet
+    if (m_decoder) loaded -= loaded % m_decoder->BlockSize();
+    return PcmSizeForRawSize(loaded);
+}
+
+size_t Sound::RawOffsetForPcmOffset(size_t offset) const {
+    if (!m_decoder) return offset;
+    size_t block_pcm_size = m_decoder->FramesInBlock(m_decoder->BlockSize()) * m_channels * sizeof(int16_t);
+    return offset / block_pcm_size * m_decoder->BlockSize();
+}
+
+size_t Sound::StreamedPcmSize(size_t offset, size_t length) const {
+    // Downloads arrive out of order, so only the run of data which has arrived from offset onwards is readable
+    size_t raw_offset = RawOffsetForPcmOffset(offset);
+    size_t raw_length = RawOffsetForPcmOffset(offset + length) - raw_offset;
+    if (m_decoder) raw_length += m_decoder->BlockSize();
+    size_t loaded = raw_offset + m_http->Readable(raw_offset, raw_length);
+    if (loaded >= m_sample_data_size) return m_pcm_data_size;
+
+    // A partially loaded block can not be decoded yet
+    if (m_decoder) loaded -= loaded % m_decoder->BlockSize();
+    return PcmSizeForRawSize(loaded);
+}
+
+// Reads bytes of the data chunk of a song opened with headers_only. Like a background load, whatever lies past the end
+// of a cut short file reads as zeros.
+size_t Sound::ReadFile(size_t offset, uint8_t* dst, size_t length) const {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = pread(m_fd, dst + total, length - total, m_data_offset + offset + total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            throw Exception(ErrorCode::IO_ERROR, std::format("Reading sample data failed: {}", strerror(errno)));
+        }
+        if (n == 0) break;
+        total += n;
+    }
+
+    std::memset(dst + total, 0, length - total);
+    return length;
+}
+
+// Returns the encoded bytes of a block, read into the cache for songs opened with headers_only
+const uint8_t* Sound::RawBlock(size_t src_offset, size_t src_size, PcmBlockCache& cache) const {
+    if (m_sample_data) return m_sample_data + src_offset;
+
+    cache.raw.resize(src_size);
+    ReadFile(src_offset, cache.raw.data(), src_size);
+    return cache.raw.data();
+}
+
+const int16_t* Sound::DecodeBlock(size_t block_idx, PcmBlockCache& cache) const {
+    if (block_idx != cache.block) {
+        size_t src_offset = block_idx * m_decoder->BlockSize();
+        size_t src_size = std::min(m_decoder->BlockSize(), m_sample_data_size - src_offset);
+        const uint8_t* src = RawBlock(src_offset, src_size, cache);
+        cache.samples.resize(m_decoder->FramesInBlock(m_decoder->BlockSize()) * m_channels);
+        m_decoder->DecodeBlock(src, src_size, cache.samples.data());
+        cache.block = block_idx;
+    }
+
+    return cache.samples.data();
+}
+
+size_t Sound::ReadPcm(size_t offset, uint8_t* dst, size_t length) {
+    size_t available = m_http ? StreamedPcmSize(offset, length) : AvailablePcmSize();
+    if (offset >= available) {
+        // Streamed songs download what is read next first, such as the new position after a seek
+        if (m_http && offset < m_pcm_data_size) m_http->Want(RawOffsetForPcmOffset(offset));
+        return 0;
+    }
+    return CopyPcm(offset, dst, std::min(length, available - offset), m_block_cache);
+}
+
+size_t Sound::ReadPcm(size_t offset, uint8_t* dst, size_t length, PcmBlockCache& cache) const {
+    size_t available = m_http ? StreamedPcmSize(offset, length) : AvailablePcmSize();
+    if (offset >= available) return 0;
+    return CopyPcm(offset, dst, std::min(length, available - offset), cache);
+}
+
+void Sound::ReadAllAsFloat(size_t block_frames, const std::function<void(const float*, size_t)>& process) {
+    size_t frame_size = FrameSize();
+    if (frame_size == 0) return;
+
+    std::vector<uint8_t> pcm(block_frames * frame_size);
+    std::vector<float> samples(block_frames * m_channels);
+    size_t offset = 0;
+    while (offset < m_pcm_data_size) {
+        // Checked before reading, so data which arrived just before the load finished is still read
+        bool loaded = IsLoaded();
+        size_t frames = ReadPcm(offset, pcm.data(), pcm.size()) / frame_size;
+        if (frames == 0) {
+            if (loaded) break;
+            std::this_thread::sleep_for(LOAD_POLL_INTERVAL);
+            continue;
+        }
+
+        ConvertToFloat(PcmFormat(), pcm.data(), samples.data(), frames * m_channels);
+        process(samples.data(), frames);
+        offset += frames * frame_size;
+    }
+}
+
+// Copies length bytes of decoded PCM, all of which have to be available
+size_t Sound::CopyPcm(size_t offset, uint8_t* dst, size_t length, PcmBlockCache& cache) const {
+    if (!m_decoder) {
+        if (!m_sample_data) return ReadFile(offset, dst, length);
+        std::memcpy(dst, m_sample_data + offset, length);
+        return length;
+    }
+
+    const size_t frame_size = m_channels * sizeof(int16_t);
+    const size_t block_pcm_size = m_decoder->FramesInBlock(m_decoder->BlockSize()) * frame_size;
+
+    size_t written = 0;
+    while (written < length) {
+        size_t block_idx = (offset + written) / block_pcm_size;
+        size_t block_offset = (offset + written) % block_pcm_size;
+        size_t src_offset = block_idx * m_decoder->BlockSize();
+        size_t src_size = std::min(m_decoder->BlockSize(), m_sample_data_size - src_offset);
+        size_t decoded_size = m_decoder->FramesInBlock(src_size) * frame_size;
+        size_t count = std::min(decoded_size - block_offset, length - written);
+        if (count == 0) break;
+        uint8_t* out = dst + written;
+
+        bool aligned = reinterpret_cast<uintptr_t>(out) % alignof(int16_t) == 0;
+        if (block_offset == 0 && count == decoded_size && aligned && block_idx != cache.block) {
+            // The whole block is wanted, decode it straight into the destination and skip the cache
+            const uint8_t* src = RawBlock(src_offset, src_size, cache);
+            m_decoder->DecodeBlock(src, src_size, reinterpret_cast<int16_t*>(out));
+        } else {
+            const int16_t* block = DecodeBlock(block_idx, cache);
+            std::memcpy(out, reinterpret_cast<const uint8_t*>(block) + block_offset, count);
+        }
+
+        written += count;
+    }
+
+    return written;
+}
+
+std::unordered_map<std::string, std::string> Sound::ReadInfoTags(const std::string& filepath) {
+    std::unordered_map<std::string, std::string> tags;
+    std::ifstream file(filepath.c_str(), std::ios::binary);
+
+    RiffChunk chunk;
+    if (!file.read(reinterpret_cast<char*>(&chunk), sizeof(chunk)) || std::string(chunk.wav_id, 4) != "WAVE") {
+        return tags;
+    }
+
+    // Seek from chunk header to chunk header, the sample data is never read
+    ChunkHeader header;
+    while (file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        if (GetChunkCode(std::string(header.id, 4)) == ChunkCode::LIST) {
+            std::streampos end = file.tellg() + static_cast<std::streamoff>(header.size);
+            ReadInfoList(file, header.size, tags);
+            file.seekg(end);
+        } else {
+            file.seekg(header.size, std::ios::cur);
+        }
+
+        if (header.size % 2 != 0) file.seekg(1, std::ios::cur);
+    }
+    return tags;
+}
+
 std::string Sound::Metadata(std::string tag) const {
     if (!m_info_tags.contains(tag)) {
         return "";
@@ -0,0 +1,142 @@
+#include "dragonfruit_engine/spectrum.hpp"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace dragonfruit {
+
+namespace {
+
+constexpr float RANGE_DB = 72.0f;
+constexpr float MIN_FREQUENCY = 30.0f;
+constexpr float MAX_FREQUENCY = 16000.0f;
+
+// How far bars and peaks fall per analysed frame, in normalized units
+constexpr float BAND_DECAY = 0.04f;
+constexpr float PEAK_DECAY = 0.01f;
+
+// Lower priority than the rest of the process, so the analysis never competes with playback for the CPU
+constexpr int ANALYSIS_NICE = 10;
+
+inline float Normalize(float amplitude) {
+    float db = 20.0f * std::log10(std::max(amplitude, 1e-9f));
+    return std::clamp((db + RANGE_DB) / RANGE_DB, 0.0f, 1.0f);
+}
+
+}  // namespace
+
+SpectrumAnalyzer::SpectrumAnalyzer(const AudioTap& tap, size_t num_bands)
+    : m_tap(tap),
+      m_num_bands(num_bands),
+      m_fft(FFT_SIZE),
+      m_window(FFT_SIZE),
+      m_samples(AudioTap::CAPACITY),
+      m_mono(FFT_SIZE),
+      m_spectrum(FFT_SIZE / 2 + 1) {
+    for (size_t i = 0; i < FFT_SIZE; i++) m_window[i] = 0.5f - 0.5f * std::cos(2.0 * M_PI * i / FFT_SIZE);
+
+    m_frame.bands.resize(num_bands);
+    m_thread = std::thread(&SpectrumAnalyzer::AnalysisLoop, this);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+SpectrumFrame SpectrumAnalyzer::Snapshot() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool was_idle = std::chrono::steady_clock::now() - m_last_request >= IDLE_TIMEOUT;
+    m_last_request = std::chrono::steady_clock::now();
+    if (was_idle) m_cv.notify_all();
+    return m_frame;
+}
+
+void SpectrumAnalyzer::AnalysisLoop() {
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), ANALYSIS_NICE);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv.wait(lock, [&] {
+            return m_shutdown || std::chrono::steady_clock::now() - m_last_request < IDLE_TIMEOUT;
+        });
+        if (m_shutdown) return;
+
+        lock.unlock();
+        auto start = std::chrono::steady_clock::now();
+        Analyze();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        lock.lock();
+
+        double elapsed_ms = std::chrono::duration<double, std::milli>(elapsed).count();
+        m_frame.analysis_ms = m_frame.analysis_ms * 0.9 + elapsed_ms * 0.1;
+        m_frame.load = m_frame.analysis_ms / INTERVAL.count();
+
+        m_cv.wait_for(lock, INTERVAL - elapsed, [&] { return m_shutdown; });
+    }
+}
+
+void SpectrumAnalyzer::Analyze() {
+    std::vector<float> bands(m_num_bands, 0.0f);
+    float level[2] = {};
+
+    // Nothing new was played (paused, stopped or between songs), let the display fall back to silence
+    uint16_t channels = 0;
+    uint32_t sample_rate = 0;
+    uint64_t write_pos = m_tap.WritePosition();
+    bool fresh = write_pos != m_last_write_pos && m_tap.ReadLatest(m_samples.data(), FFT_SIZE, channels, sample_rate);
+    m_last_write_pos = write_pos;
+
+    if (fresh) {
+        size_t right = std::min<size_t>(1, channels - 1);
+        double sum_squares[2] = {};
+        for (size_t i = 0; i < FFT_SIZE; i++) {
+            const float* frame = &m_samples[i * channels];
+            float mono = 0.0f;
+            for (size_t c = 0; c < channels; c++) mono += frame[c];
+            m_mono[i] = mono / channels * m_window[i];
+
+            sum_squares[0] += frame[0] * frame[0];
+            sum_squares[1] += frame[right] * frame[right];
+        }
+        level[0] = Normalize(std::sqrt(sum_squares[0] / FFT_SIZE));
+        level[1] = Normalize(std::sqrt(sum_squares[1] / FFT_SIZE));
+
+        m_fft.Forward(m_mono.data(), m_spectrum.data());
+
+        // Bands are log spaced. Low bands narrower than a bin still take the nearest bin so none are left empty.
+        float bin_width = static_cast<float>(sample_rate) / FFT_SIZE;
+        float ratio = std::min(MAX_FREQUENCY, sample_rate / 2.0f) / MIN_FREQUENCY;
+        for (size_t b = 0; b < m_num_bands; b++) {
+            float low = MIN_FREQUENCY * std::pow(ratio, static_cast<float>(b) / m_num_bands);
+            float high = MIN_FREQUENCY * std::pow(ratio, static_cast<float>(b + 1) / m_num_bands);
+            size_t first_bin = std::min(static_cast<size_t>(low / bin_width), FFT_SIZE / 2);
+            size_t last_bin =
+                std::clamp(static_cast<size_t>(std::ceil(high / bin_width)), first_bin + 1, FFT_SIZE / 2 + 1);
+
+            // Scaled so that a full scale sine reads as 0dB, the Hann window halves the amplitude
+            float magnitude = 0.0f;
+            for (size_t k = first_bin; k < last_bin; k++) magnitude = std::max(magnitude, std::abs(m_spectrum[k]));
+            bands[b] = Normalize(magnitude * 4.0f / FFT_SIZE);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t b = 0; b < m_num_bands; b++) {
+        m_frame.bands[b] = std::max(bands[b], m_frame.bands[b] - BAND_DECAY);
+    }
+    for (size_t c = 0; c < 2; c++) {
+        m_frame.level[c] = std::max(level[c], m_frame.level[c] - BAND_DECAY);
+        m_frame.peak[c] = std::max(level[c], m_frame.peak[c] - PEAK_DECAY);
+    }
+}
+
+}  // namespace dragonfruit
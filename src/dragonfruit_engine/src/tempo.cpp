@@ -0,0 +1,323 @@
+#include "dragonfruit_engine/tempo.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/sound.hpp"
+#include "dragonfruit_engine/thread_pool.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+inline v4sf Load(const float* src) {
+    v4sf v;
+    std::memcpy(&v, src, sizeof(v));
+    return v;
+}
+
+constexpr size_t ANALYSIS_FRAMES = 4096;
+
+// Onset frames per second aimed for. The hop is rounded up to a power of two, so this is an upper bound.
+constexpr uint32_t ENVELOPE_RATE = 100;
+
+// Magnitudes are log compressed before the flux is taken, so that quiet onsets count as well as loud ones
+constexpr float COMPRESSION = 1000.0f;
+
+// Chroma frames are this many times longer than onset frames, long enough to tell semitones apart from A2 upwards
+constexpr size_t CHROMA_FACTOR = 8;
+constexpr double MIN_CHROMA_HZ = 110.0;
+constexpr double MAX_CHROMA_HZ = 3520.0;
+
+// Tempos are weighted by a log-normal prior around the tempo listeners most often tap along to, which decides between a
+// tempo and its double or half. Songs with both strongly present can still come out an octave off.
+constexpr double PRIOR_BPM = 120.0;
+constexpr double PRIOR_OCTAVES = 1.0;
+
+// Songs shorter than this have too few beats for a tempo
+constexpr double MIN_TEMPO_SECONDS = 5.0;
+
+// The tempo is refined on the autocorrelation this many beats apart
+constexpr size_t REFINE_BEATS = 8;
+
+// The local mean subtracted from the onset envelope is taken over this long on each side
+constexpr double DETREND_SECONDS = 0.5;
+
+// Krumhansl-Kessler key profiles, from the tonic upwards
+constexpr double MAJOR_PROFILE[12] = {6.35, 2.23, 3.48, 2.33, 4.38, 4.09, 2.52, 5.19, 2.39, 3.66, 2.29, 2.88};
+constexpr double MINOR_PROFILE[12] = {6.33, 2.68, 3.52, 5.38, 2.60, 3.53, 2.54, 4.75, 3.98, 2.69, 3.34, 3.17};
+constexpr const char* PITCH_NAMES[12] = {"C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B"};
+
+constexpr uint8_t NO_PITCH_CLASS = 12;
+
+// Hann window scaled so a full scale sine peaks at about the same magnitude whatever the frame size
+std::vector<float> Hann(size_t size) {
+    std::vector<float> window(size);
+    for (size_t i = 0; i < size; i++) {
+        window[i] = static_cast<float>((1.0 - std::cos(2.0 * M_PI * i / size)) / size);
+    }
+    return window;
+}
+
+// Sum of how much every bin grew since the previous frame, four bins at a time
+float PositiveFlux(const float* current, const float* previous, size_t bins) {
+    v4sf sum = {0, 0, 0, 0};
+    v4sf zero = {0, 0, 0, 0};
+    for (size_t k = 0; k < bins; k += 4) {
+        v4sf growth = Load(current + k) - Load(previous + k);
+        sum += growth > zero ? growth : zero;
+    }
+    return sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+double Correlation(const double* a, const double* b, size_t count) {
+    double mean_a = std::accumulate(a, a + count, 0.0) / count;
+    double mean_b = std::accumulate(b, b + count, 0.0) / count;
+    double covariance = 0.0;
+    double variance_a = 0.0;
+    double variance_b = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        covariance += (a[i] - mean_a) * (b[i] - mean_b);
+        variance_a += (a[i] - mean_a) * (a[i] - mean_a);
+        variance_b += (b[i] - mean_b) * (b[i] - mean_b);
+    }
+    if (variance_a <= 0.0 || variance_b <= 0.0) return 0.0;
+    return covariance / std::sqrt(variance_a * variance_b);
+}
+
+}  // namespace
+
+std::string KeyName(int key) {
+    if (key < 0 || key >= 24) return "";
+    return std::string(PITCH_NAMES[key % 12]) + (key >= 12 ? "m" : "");
+}
+
+TempoAnalyzer::TempoAnalyzer(uint16_t channels, uint32_t sample_rate)
+    : m_channels(channels),
+      m_sample_rate(sample_rate),
+      m_hop(std::bit_ceil(std::max<size_t>(sample_rate / ENVELOPE_RATE, 64))),
+      m_window(m_hop * 2),
+      m_chroma_size(m_window * CHROMA_FACTOR),
+      m_chroma_every(CHROMA_FACTOR),
+      m_onset_fft(m_window),
+      m_chroma_fft(m_chroma_size) {
+    m_history.assign(m_chroma_size, 0.0f);
+    m_pending.resize(m_hop);
+
+    // The window has hop + 1 bins, padded with zeros which never contribute to the flux
+    m_onset_hann = Hann(m_window);
+    m_frame.resize(m_window);
+    m_spectrum.resize(m_hop + 1);
+    m_magnitudes.assign(m_hop + 4, 0.0f);
+    m_previous.assign(m_hop + 4, 0.0f);
+
+    m_chroma_hann = Hann(m_chroma_size);
+    m_chroma_frame.resize(m_chroma_size);
+    m_chroma_spectrum.resize(m_chroma_size / 2 + 1);
+    m_pitch_classes.assign(m_chroma_size / 2 + 1, NO_PITCH_CLASS);
+    for (size_t k = 1; k < m_pitch_classes.size(); k++) {
+        double frequency = static_cast<double>(k) * sample_rate / m_chroma_size;
+        if (frequency < MIN_CHROMA_HZ || frequency > MAX_CHROMA_HZ) continue;
+        long note = std::lround(69.0 + 12.0 * std::log2(frequency / 440.0));
+        m_pitch_classes[k] = static_cast<uint8_t>(note % 12);
+    }
+}
+
+void TempoAnalyzer::Process(const float* frames, size_t count) {
+    float scale = 1.0f / m_channels;
+    for (size_t i = 0; i < count; i++) {
+        float sum = 0.0f;
+        for (size_t c = 0; c < m_channels; c++) sum += frames[i * m_channels + c];
+        m_pending[m_pending_fill++] = sum * scale;
+
+        if (m_pending_fill == m_hop) {
+            ProcessHop();
+            m_pending_fill = 0;
+        }
+    }
+}
+
+void TempoAnalyzer::ProcessHop() {
+    std::memmove(m_history.data(), m_history.data() + m_hop, (m_chroma_size - m_hop) * sizeof(float));
+    std::copy(m_pending.begin(), m_pending.end(), m_history.end() - m_hop);
+
+    const float* window = &m_history[m_chroma_size - m_window];
+    for (size_t i = 0; i < m_window; i++) m_frame[i] = window[i] * m_onset_hann[i];
+    m_onset_fft.Forward(m_frame.data(), m_spectrum.data());
+    for (size_t k = 0; k <= m_hop; k++) m_magnitudes[k] = std::log1p(COMPRESSION * std::abs(m_spectrum[k]));
+
+    // The first frame has nothing to grow from
+    float flux = m_hops > 0 ? PositiveFlux(m_magnitudes.data(), m_previous.data(), m_magnitudes.size()) : 0.0f;
+    m_envelope.push_back(flux);
+    std::swap(m_magnitudes, m_previous);
+
+    m_hops++;
+    if (m_hops % m_chroma_every == 0 && m_hops * m_hop >= m_chroma_size) ProcessChroma();
+}
+
+void TempoAnalyzer::ProcessChroma() {
+    for (size_t i = 0; i < m_chroma_size; i++) m_chroma_frame[i] = m_history[i] * m_chroma_hann[i];
+    m_chroma_fft.Forward(m_chroma_frame.data(), m_chroma_spectrum.data());
+    for (size_t k = 0; k < m_pitch_classes.size(); k++) {
+        uint8_t pitch_class = m_pitch_classes[k];
+        if (pitch_class != NO_PITCH_CLASS) {
+            m_chroma[pitch_class] += std::log1p(COMPRESSION * std::abs(m_chroma_spectrum[k]));
+        }
+    }
+}
+
+TempoInfo TempoAnalyzer::Estimate() const {
+    TempoInfo info;
+    info.bpm = EstimateBpm(info.tempo_confidence);
+    info.key = EstimateKey(info.key_confidence);
+    return info;
+}
+
+double TempoAnalyzer::EstimateBpm(double& confidence) const {
+    double rate = static_cast<double>(m_sample_rate) / m_hop;
+    size_t min_lag = std::max<size_t>(2, static_cast<size_t>(std::floor(60.0 * rate / MAX_BPM)));
+    size_t max_lag = static_cast<size_t>(std::ceil(60.0 * rate / MIN_BPM));
+    size_t count = m_envelope.size();
+    if (count < MIN_TEMPO_SECONDS * rate || count <= max_lag * 2) return 0.0;
+
+    // Only the onsets standing out from their surroundings matter, not how busy a passage is overall
+    std::vector<double> prefix(count + 1, 0.0);
+    for (size_t i = 0; i < count; i++) prefix[i + 1] = prefix[i] + m_envelope[i];
+    size_t radius = static_cast<size_t>(DETREND_SECONDS * rate);
+    std::vector<float> onsets(count);
+    for (size_t i = 0; i < count; i++) {
+        size_t begin = i > radius ? i - radius : 0;
+        size_t end = std::min(count, i + radius + 1);
+        onsets[i] = static_cast<float>(m_envelope[i] - (prefix[end] - prefix[begin]) / (end - begin));
+    }
+
+    auto autocorrelation = [&](size_t lag) {
+        double sum = 0.0;
+        for (size_t i = lag; i < count; i++) sum += onsets[i] * onsets[i - lag];
+        return sum / (count - lag);
+    };
+    std::vector<double> acf(max_lag + 2, 0.0);
+    acf[0] = autocorrelation(0);
+    for (size_t lag = min_lag - 1; lag <= max_lag + 1; lag++) acf[lag] = autocorrelation(lag);
+    if (acf[0] <= 0.0) return 0.0;
+
+    size_t best = 0;
+    double best_score = 0.0;
+    for (size_t lag = min_lag; lag <= max_lag; lag++) {
+        double octaves = std::log2(60.0 * rate / lag / PRIOR_BPM) / PRIOR_OCTAVES;
+        double score = acf[lag] * std::exp(-0.5 * octaves * octaves);
+        if (score > best_score) {
+            best = lag;
+            best_score = score;
+        }
+    }
+    if (best == 0) return 0.0;
+
+    // The peak falls between lags. It is located on the autocorrelation at a few beats' lag rather than one, where
+    // the same error in frames is a fraction of a beat.
+    auto peak = [&](size_t center, double at) {
+        double before = autocorrelation(center - 1);
+        double after = autocorrelation(center + 1);
+        double curvature = before - 2.0 * at + after;
+        return center + (curvature < 0.0 ? std::clamp(0.5 * (before - after) / curvature, -0.5, 0.5) : 0.0);
+    };
+    double lag = peak(best, acf[best]);
+    size_t beats = REFINE_BEATS;
+    while (beats > 1 && static_cast<size_t>(lag * beats) + beats + 1 >= count / 2) beats--;
+    if (beats > 1) {
+        size_t center = static_cast<size_t>(std::lround(lag * beats));
+        size_t refined = center;
+        double refined_acf = autocorrelation(center);
+        for (size_t candidate = center - beats / 2; candidate <= center + beats / 2; candidate++) {
+            double value = autocorrelation(candidate);
+            if (value > refined_acf) {
+                refined = candidate;
+                refined_acf = value;
+            }
+        }
+        lag = peak(refined, refined_acf) / beats;
+    }
+
+    confidence = std::clamp(acf[best] / acf[0], 0.0, 1.0);
+    return 60.0 * rate / lag;
+}
+
+int TempoAnalyzer::EstimateKey(double& confidence) const {
+    if (std::accumulate(m_chroma, m_chroma + 12, 0.0) <= 0.0) return -1;
+
+    int best = -1;
+    double best_correlation = -1.0;
+    for (int tonic = 0; tonic < 12; tonic++) {
+        double major[12];
+        double minor[12];
+        for (int pitch_class = 0; pitch_class < 12; pitch_class++) {
+            major[pitch_class] = MAJOR_PROFILE[(pitch_class - tonic + 12) % 12];
+            minor[pitch_class] = MINOR_PROFILE[(pitch_class - tonic + 12) % 12];
+        }
+
+        double correlation = Correlation(m_chroma, major, 12);
+        if (correlation > best_correlation) {
+            best = tonic;
+            best_correlation = correlation;
+        }
+        correlation = Correlation(m_chroma, minor, 12);
+        if (correlation > best_correlation) {
+            best = tonic + 12;
+            best_correlation = correlation;
+        }
+    }
+
+    confidence = best_correlation;
+    return best;
+}
+
+std::ostream& operator<<(std::ostream& out, const TempoInfo& info) {
+    return out << info.bpm << '\t' << info.tempo_confidence << '\t' << info.key << '\t' << info.key_confidence;
+}
+
+std::istream& operator>>(std::istream& in, TempoInfo& info) {
+    return in >> info.bpm >> info.tempo_confidence >> info.key >> info.key_confidence;
+}
+
+std::filesystem::path TempoStore::DefaultPath() { return CacheDirectory() / "tempo.tsv"; }
+
+namespace {
+
+std::optional<TempoInfo> AnalyzeTrack(const std::filesystem::path& song_path) {
+    try {
+        // Local files are read from disk a block at a time, only songs given as URLs are buffered while they download
+        Sound sound(song_path.string(), {.headers_only = true});
+        if (sound.FrameSize() == 0) return std::nullopt;
+
+        TempoAnalyzer analyzer(sound.Channels(), sound.SampleRate());
+        sound.ReadAllAsFloat(ANALYSIS_FRAMES, [&](const float* samples, size_t frames) {
+            analyzer.Process(samples, frames);
+        });
+        return analyzer.Estimate();
+    } catch (const Exception&) {
+        return std::nullopt;
+    }
+}
+
+}  // namespace
+
+size_t AnalyzeTempo(const std::vector<std::filesystem::path>& song_paths, TempoStore& store, ThreadPool& pool,
+                    const std::function<void(size_t)>& on_progress) {
+    std::vector<std::optional<TempoInfo>> results = AnalyzeSongs(song_paths, pool, AnalyzeTrack, on_progress);
+
+    size_t analysed = 0;
+    for (size_t i = 0; i < song_paths.size(); i++) {
+        if (!results[i]) continue;
+        store.Store(song_paths[i], *results[i]);
+        analysed++;
+    }
+    return analysed;
+}
+
+}  // namespace dragonfruit
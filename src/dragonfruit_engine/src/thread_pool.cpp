@@ -0,0 +1,59 @@
+#include "dragonfruit_engine/thread_pool.hpp"
+
+#include <algorithm>
+
+namespace dragonfruit {
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    for (unsigned i = 0; i < std::max(num_threads, 1u); i++) {
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_job_cv.notify_all();
+
+    for (auto& worker : m_workers) worker.join();
+}
+
+void ThreadPool::Submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_job_cv.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_cv.wait(lock, [&] { return m_jobs.empty() && m_running == 0; });
+}
+
+void ThreadPool::WorkerLoop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_job_cv.wait(lock, [&] { return m_shutdown || !m_jobs.empty(); });
+            if (m_jobs.empty()) return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_running++;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running--;
+            if (m_jobs.empty() && m_running == 0) m_idle_cv.notify_all();
+        }
+    }
+}
+
+}  // namespace dragonfruit
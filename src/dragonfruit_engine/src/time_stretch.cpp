@@ -0,0 +1,204 @@
+#include "dragonfruit_engine/time_stretch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+#include "dragonfruit_engine/render.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+typedef float v8sf __attribute__((vector_size(32)));
+
+constexpr size_t VECTOR_WIDTH = 8;
+
+// Long enough to hold a pitch period of speech or music, short enough that the overlaps are not heard as echoes
+constexpr double WINDOW_SECONDS = 0.02;
+constexpr double SEARCH_SECONDS = 0.005;
+
+float Dot(const float* a, const float* b, size_t count) {
+    v8sf acc0 = {};
+    v8sf acc1 = {};
+    size_t i = 0;
+    for (; i + 2 * VECTOR_WIDTH <= count; i += 2 * VECTOR_WIDTH) {
+        v8sf a0, a1, b0, b1;
+        std::memcpy(&a0, a + i, sizeof(a0));
+        std::memcpy(&a1, a + i + VECTOR_WIDTH, sizeof(a1));
+        std::memcpy(&b0, b + i, sizeof(b0));
+        std::memcpy(&b1, b + i + VECTOR_WIDTH, sizeof(b1));
+        acc0 += a0 * b0;
+        acc1 += a1 * b1;
+    }
+    acc0 += acc1;
+
+    float sum = 0.0f;
+    for (size_t lane = 0; lane < VECTOR_WIDTH; lane++) sum += acc0[lane];
+    for (; i < count; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+size_t HopFrames(uint32_t sample_rate) {
+    return std::max<size_t>(1, std::lround(sample_rate * WINDOW_SECONDS / 2));
+}
+
+size_t SearchFrames(uint32_t sample_rate) { return std::lround(sample_rate * SEARCH_SECONDS); }
+
+}  // namespace
+
+TimeStretcher::TimeStretcher(uint16_t channels, uint32_t sample_rate, double speed)
+    : m_channels(channels), m_speed(std::clamp(speed, MIN_SPEED, MAX_SPEED)) {
+    m_hop = HopFrames(sample_rate);
+    m_window = 2 * m_hop;
+    m_search = SearchFrames(sample_rate);
+
+    // A periodic Hann window, whose halves sum to exactly one when overlapped by half a window
+    m_window_fn.resize(m_window);
+    for (size_t i = 0; i < m_window; i++) {
+        m_window_fn[i] = 0.5f - 0.5f * std::cos(2.0 * std::numbers::pi * i / m_window);
+    }
+
+    m_input.resize(MaxInputFrames(sample_rate) * m_channels);
+    m_overlap.resize(m_hop * m_channels);
+    m_hop_out.resize(m_hop * m_channels);
+    Reset(0);
+}
+
+size_t TimeStretcher::MaxInputFrames(uint32_t sample_rate) {
+    // Enough for the previous segment's continuation, the whole search range and the next segment at full speed
+    size_t hop = HopFrames(sample_rate);
+    return 2 * hop + 2 * SearchFrames(sample_rate) + static_cast<size_t>(std::ceil(hop * (MAX_SPEED + 1.0)));
+}
+
+void TimeStretcher::Reset(size_t frame) {
+    m_input_start = frame;
+    m_input_frames = 0;
+    m_hop_pos = m_hop;
+    m_start = static_cast<double>(frame);
+    m_hops = 0;
+    m_output_frames = 0;
+}
+
+size_t TimeStretcher::Process(Sound& sound, float* out, size_t frames, float gain, std::vector<uint8_t>& scratch) {
+    size_t written = 0;
+    while (written < frames) {
+        if (m_hop_pos == m_hop) {
+            if (!ComputeHop(sound, gain, scratch)) break;
+            m_hop_pos = 0;
+        }
+
+        size_t count = std::min(frames - written, m_hop - m_hop_pos);
+        std::memcpy(out + written * m_channels, m_hop_out.data() + m_hop_pos * m_channels,
+                    count * m_channels * sizeof(float));
+        m_hop_pos += count;
+        written += count;
+    }
+
+    m_output_frames += written;
+    return written;
+}
+
+bool TimeStretcher::ComputeHop(Sound& sound, float gain, std::vector<uint8_t>& scratch) {
+    // Segments are spaced evenly through the song at the playback speed, then moved to where they fit best
+    double nominal = m_start + static_cast<double>(m_hops) * m_hop * m_speed;
+    if (nominal >= sound.TotalFrames()) return false;
+    size_t target = static_cast<size_t>(std::llround(nominal));
+
+    size_t segment = target;
+    if (m_hops == 0) {
+        if (!FillInput(sound, target, target + m_window, gain, scratch)) return false;
+
+        // The first segment plays unwindowed, as if the one before it had been taken from right before it
+        const float* in = InputAt(segment);
+        for (size_t i = 0; i < m_hop; i++) {
+            for (size_t c = 0; c < m_channels; c++) {
+                m_overlap[i * m_channels + c] = m_window_fn[m_hop + i] * in[i * m_channels + c];
+            }
+        }
+    } else {
+        size_t lo = target > m_search ? target - m_search : 0;
+        size_t hi = target + m_search;
+        size_t keep_from = std::min(lo, m_prev_segment + m_hop);
+        if (!FillInput(sound, keep_from, hi + m_window, gain, scratch)) return false;
+        segment = FindBestSegment(lo, hi);
+    }
+
+    const float* in = InputAt(segment);
+    for (size_t i = 0; i < m_hop; i++) {
+        for (size_t c = 0; c < m_channels; c++) {
+            size_t s = i * m_channels + c;
+            m_hop_out[s] = m_overlap[s] + m_window_fn[i] * in[s];
+            m_overlap[s] = m_window_fn[m_hop + i] * in[m_hop * m_channels + s];
+        }
+    }
+
+    m_prev_segment = segment;
+    m_hops++;
+    return true;
+}
+
+// Makes the input hold the frames [keep_from, end). Frames past the end of the song are silence.
+bool TimeStretcher::FillInput(Sound& sound, size_t keep_from, size_t end, float gain, std::vector<uint8_t>& scratch) {
+    size_t input_end = m_input_start + m_input_frames;
+    if (keep_from >= input_end) {
+        // Nothing held is needed any more, start over at keep_from
+        m_input_start = keep_from;
+        m_input_frames = 0;
+        input_end = keep_from;
+    } else if (keep_from > m_input_start) {
+        size_t drop = keep_from - m_input_start;
+        std::memmove(m_input.data(), m_input.data() + drop * m_channels,
+                     (m_input_frames - drop) * m_channels * sizeof(float));
+        m_input_start = keep_from;
+        m_input_frames -= drop;
+    }
+
+    while (input_end < end) {
+        size_t wanted = end - input_end;
+        float* dst = InputAt(input_end);
+        if (input_end >= sound.TotalFrames()) {
+            std::fill(dst, dst + wanted * m_channels, 0.0f);
+            m_input_frames += wanted;
+            return true;
+        }
+
+        size_t available = std::min(wanted, sound.TotalFrames() - input_end);
+        size_t read = RenderPcm(sound, input_end, dst, available, gain, scratch);
+        if (read == 0) return false;
+        m_input_frames += read;
+        input_end += read;
+    }
+    return true;
+}
+
+// Finds the segment start in [lo, hi] which best continues the previous segment, whose natural continuation is the
+// audio right after its first half
+size_t TimeStretcher::FindBestSegment(size_t lo, size_t hi) const {
+    const float* continuation = InputAt(m_prev_segment + m_hop);
+    size_t length = m_hop * m_channels;
+
+    // Correlations are normalized by the energy of each candidate so louder candidates are not favoured. The energy
+    // is kept up to date as the candidate slides along, one frame at a time.
+    const float* first = InputAt(lo);
+    double energy = Dot(first, first, length);
+
+    size_t best = lo;
+    double best_score = -INFINITY;
+    for (size_t candidate = lo; candidate <= hi; candidate++) {
+        const float* in = InputAt(candidate);
+        double score = Dot(continuation, in, length) / std::sqrt(std::max(energy, 0.0) + 1e-9);
+        if (score > best_score) {
+            best_score = score;
+            best = candidate;
+        }
+
+        for (size_t c = 0; c < m_channels; c++) {
+            energy += static_cast<double>(in[length + c]) * in[length + c] - static_cast<double>(in[c]) * in[c];
+        }
+    }
+    return best;
+}
+
+}  // namespace dragonfruit
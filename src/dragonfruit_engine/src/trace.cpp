@@ -0,0 +1,146 @@
+#include "dragonfruit_engine/trace.hpp"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "dragonfruit_engine/exception.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+struct Span {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+// Spans of one thread. Only that thread writes, the exporter reads concurrently and detects overwritten spans the same
+// way AudioTap readers do.
+struct ThreadRing {
+    pid_t tid;
+    char thread_name[16] = {};
+    size_t mask;
+    std::unique_ptr<Span[]> spans;
+    std::atomic<uint64_t> written = 0;
+};
+
+std::mutex g_rings_mutex;
+std::vector<std::unique_ptr<ThreadRing>> g_rings;  // Rings outlive their threads so spans of finished threads are kept
+size_t g_capacity = Trace::DEFAULT_CAPACITY;
+
+thread_local ThreadRing* t_ring = nullptr;
+
+ThreadRing* RegisterThread() {
+    std::lock_guard<std::mutex> lock(g_rings_mutex);
+    auto ring = std::make_unique<ThreadRing>();
+    ring->tid = gettid();
+    pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name));
+    ring->mask = g_capacity - 1;
+    ring->spans = std::make_unique<Span[]>(g_capacity);
+    g_rings.push_back(std::move(ring));
+    return g_rings.back().get();
+}
+
+// Span names are string literals from our own code, but thread names come from anywhere
+std::string EscapeJson(const char* text) {
+    std::string escaped;
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            escaped.push_back('\\');
+            escaped.push_back(*c);
+        } else if (static_cast<unsigned char>(*c) < 0x20) {
+            escaped += std::format("\\u{:04x}", static_cast<int>(*c));
+        } else {
+            escaped.push_back(*c);
+        }
+    }
+    return escaped;
+}
+
+// Copies the spans of a ring which were not overwritten while being copied
+std::vector<Span> Snapshot(const ThreadRing& ring) {
+    uint64_t end = ring.written.load(std::memory_order_acquire);
+    uint64_t capacity = ring.mask + 1;
+    uint64_t begin = end > capacity ? end - capacity : 0;
+
+    std::vector<Span> spans;
+    spans.reserve(end - begin);
+    for (uint64_t i = begin; i < end; i++) spans.push_back(ring.spans[i & ring.mask]);
+
+    // The span after the last one finished may be half written over the oldest slot
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t written = ring.written.load(std::memory_order_relaxed);
+    uint64_t first_valid = written + 1 > capacity ? written + 1 - capacity : 0;
+    if (first_valid > begin) spans.erase(spans.begin(), spans.begin() + std::min(first_valid - begin, end - begin));
+    return spans;
+}
+
+}  // namespace
+
+std::atomic<bool> Trace::s_enabled = false;
+
+void Trace::Enable(size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(g_rings_mutex);
+        g_capacity = std::bit_ceil(std::max<size_t>(capacity, 1));
+    }
+    s_enabled.store(true, std::memory_order_relaxed);
+}
+
+void Trace::Record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    if (!t_ring) t_ring = RegisterThread();
+
+    uint64_t index = t_ring->written.load(std::memory_order_relaxed);
+    t_ring->spans[index & t_ring->mask] = {.name = name, .start_ns = start_ns, .end_ns = end_ns};
+    t_ring->written.store(index + 1, std::memory_order_release);
+}
+
+uint64_t Trace::Now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+void Trace::WriteChromeJson(const std::filesystem::path& path) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        throw Exception(ErrorCode::IO_ERROR, std::format("Could not open {} for writing", path.string()));
+    }
+
+    pid_t pid = getpid();
+    std::lock_guard<std::mutex> lock(g_rings_mutex);
+
+    // Complete ("X") events with microsecond timestamps, preceded by the name of each thread
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto& ring : g_rings) {
+        file << (first ? "" : ",")
+             << std::format("\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},"
+                            "\"args\":{{\"name\":\"{}\"}}}}",
+                            pid, ring->tid, EscapeJson(ring->thread_name));
+        first = false;
+
+        for (const Span& span : Snapshot(*ring)) {
+            file << std::format(
+                ",\n{{\"name\":\"{}\",\"cat\":\"dragonfruit\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},"
+                "\"tid\":{}}}",
+                EscapeJson(span.name), span.start_ns / 1e3, (span.end_ns - span.start_ns) / 1e3, pid, ring->tid);
+        }
+    }
+    file << "\n]}\n";
+
+    file.close();
+    if (!file) throw Exception(ErrorCode::IO_ERROR, std::format("Failed to write {}", path.string()));
+}
+
+}  // namespace dragonfruit
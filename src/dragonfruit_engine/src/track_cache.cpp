@@ -0,0 +1,137 @@
+#include "dragonfruit_engine/track_cache.hpp"
+
+#include <vector>
+
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/trace.hpp"
+
+namespace dragonfruit {
+
+TrackCache::TrackCache(const TrackCacheOptions& options) : m_options(options) {}
+
+std::shared_ptr<Sound> TrackCache::Get(const std::filesystem::path& path) {
+    TraceScope trace("TrackCache::Get");
+    std::string key = CacheKey(path);
+    std::optional<FileStamp> stamp = GetFileStamp(path);
+
+    std::shared_ptr<Sound> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (stamp && m_options.budget_bytes > 0) {
+            auto it = m_index.find(key);
+            if (it != m_index.end()) {
+                Entry& entry = *it->second;
+                if (entry.stamp == *stamp && !entry.sound->LoadFailed()) {
+                    m_entries.splice(m_entries.begin(), m_entries, it->second);
+                    m_stats.hits++;
+                    return entry.sound;
+                }
+
+                // The file changed since it was cached, or reading it failed. Load it again.
+                dropped = Erase(it->second);
+                m_stats.evictions++;
+            }
+        }
+        m_stats.misses++;
+    }
+
+    // Loaded without holding the lock, only the headers are read here
+    auto sound = std::make_shared<Sound>(path.string(), m_options.load);
+    if (!stamp) return sound;
+    return Insert({.key = std::move(key), .stamp = *stamp, .sound = std::move(sound), .bytes = 0});
+}
+
+void TrackCache::Prefetch(const std::filesystem::path& path) {
+    TraceScope trace("TrackCache::Prefetch");
+    if (m_options.budget_bytes == 0) return;
+    std::string key = CacheKey(path);
+    std::optional<FileStamp> stamp = GetFileStamp(path);
+    if (!stamp) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it != m_index.end() && it->second->stamp == *stamp) {
+            // About to be played, so it is the last song which should be dropped
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return;
+        }
+    }
+
+    std::shared_ptr<Sound> sound;
+    try {
+        sound = std::make_shared<Sound>(path.string(), m_options.load);
+    } catch (const Exception&) {
+        return;
+    }
+    Insert({.key = std::move(key), .stamp = *stamp, .sound = std::move(sound), .bytes = 0});
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.prefetches++;
+}
+
+void TrackCache::Forget(const std::filesystem::path& path) {
+    std::shared_ptr<Sound> dropped;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(CacheKey(path));
+    if (it != m_index.end()) dropped = Erase(it->second);
+}
+
+void TrackCache::Clear() {
+    EntryList entries;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entries.swap(m_entries);
+        m_index.clear();
+        m_stats.tracks = 0;
+        m_stats.bytes = 0;
+    }
+    // The songs are released here, outside the lock, their destructors wait for reads still in flight
+}
+
+TrackCacheStats TrackCache::Stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::shared_ptr<Sound> TrackCache::Insert(Entry entry) {
+    entry.bytes = entry.sound->SampleDataSize();
+    std::vector<std::shared_ptr<Sound>> dropped;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(entry.key);
+    if (it != m_index.end()) {
+        // Someone else loaded the same song meanwhile, keep whichever copy matches the file
+        if (it->second->stamp == entry.stamp) {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return it->second->sound;
+        }
+        dropped.push_back(Erase(it->second));
+        m_stats.evictions++;
+    }
+
+    // Songs larger than the whole budget are played without being cached
+    if (entry.bytes > m_options.budget_bytes) return entry.sound;
+
+    m_stats.bytes += entry.bytes;
+    m_stats.tracks++;
+    m_entries.push_front(std::move(entry));
+    m_index[m_entries.front().key] = m_entries.begin();
+
+    while (m_stats.bytes > m_options.budget_bytes) {
+        dropped.push_back(Erase(std::prev(m_entries.end())));
+        m_stats.evictions++;
+    }
+    return m_entries.front().sound;
+}
+
+std::shared_ptr<Sound> TrackCache::Erase(EntryList::iterator it) {
+    std::shared_ptr<Sound> sound = std::move(it->sound);
+    m_stats.bytes -= it->bytes;
+    m_stats.tracks--;
+    m_index.erase(it->key);
+    m_entries.erase(it);
+    return sound;
+}
+
+}  // namespace dragonfruit
@@ -0,0 +1,256 @@
+#include "dragonfruit_engine/waveform.hpp"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "dragonfruit_engine/cache.hpp"
+#include "dragonfruit_engine/convert.hpp"
+#include "dragonfruit_engine/sound.hpp"
+
+namespace dragonfruit {
+
+namespace {
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+constexpr char CACHE_MAGIC[4] = {'D', 'F', 'W', 'F'};
+constexpr uint32_t CACHE_VERSION = 1;
+
+// How often a song which is still loading is checked for more samples
+constexpr std::chrono::milliseconds LOAD_POLL_INTERVAL{10};
+
+// Buckets are quantized to a byte per value in the cache, which is far finer than a terminal can show
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t mtime;
+    uint64_t size;
+    uint32_t base_frames;
+    uint32_t levels;
+    uint32_t key_length;  // The song's cache key follows the header, guarding against hash collisions
+};
+
+struct CachedBucket {
+    int8_t min;
+    int8_t max;
+    uint8_t rms;
+};
+
+WaveformBucket Summarize(const float* samples, size_t count) {
+    v4sf min = {1.0f, 1.0f, 1.0f, 1.0f};
+    v4sf max = -min;
+    v4sf sum_squares = {};
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        v4sf x;
+        std::memcpy(&x, samples + i, sizeof(x));
+        min = x < min ? x : min;
+        max = x > max ? x : max;
+        sum_squares += x * x;
+    }
+
+    float scalar_min = std::min({min[0], min[1], min[2], min[3]});
+    float scalar_max = std::max({max[0], max[1], max[2], max[3]});
+    double scalar_sum = sum_squares[0] + sum_squares[1] + sum_squares[2] + sum_squares[3];
+    for (; i < count; i++) {
+        scalar_min = std::min(scalar_min, samples[i]);
+        scalar_max = std::max(scalar_max, samples[i]);
+        scalar_sum += samples[i] * samples[i];
+    }
+
+    if (count == 0) return {};
+    return {.min = scalar_min, .max = scalar_max, .rms = static_cast<float>(std::sqrt(scalar_sum / count))};
+}
+
+WaveformBucket Merge(const WaveformBucket& a, const WaveformBucket& b) {
+    return {.min = std::min(a.min, b.min),
+            .max = std::max(a.max, b.max),
+            .rms = std::sqrt((a.rms * a.rms + b.rms * b.rms) / 2.0f)};
+}
+
+}  // namespace
+
+std::optional<Waveform> Waveform::Compute(const Sound& sound, const std::function<bool()>& cancelled) {
+    Waveform waveform;
+    size_t frame_size = sound.FrameSize();
+    size_t channels = sound.Channels();
+    if (frame_size == 0) return waveform;
+
+    // Chunks hold a whole number of buckets so no bucket straddles two reads
+    constexpr size_t CHUNK_FRAMES = BASE_FRAMES * 64;
+    std::vector<uint8_t> pcm(CHUNK_FRAMES * frame_size);
+    std::vector<float> samples(CHUNK_FRAMES * channels);
+    PcmBlockCache cache;
+
+    std::vector<WaveformBucket> base;
+    base.reserve(sound.TotalFrames() / BASE_FRAMES + 1);
+
+    size_t offset = 0;
+    while (offset < sound.PcmDataSize()) {
+        if (cancelled && cancelled()) return std::nullopt;
+
+        // Only whole chunks are taken while the song is still loading, so buckets stay BASE_FRAMES long
+        size_t wanted = std::min(pcm.size(), sound.PcmDataSize() - offset);
+        bool loaded = sound.IsLoaded();
+        if (!loaded && sound.AvailablePcmSize() < offset + wanted) {
+            std::this_thread::sleep_for(LOAD_POLL_INTERVAL);
+            continue;
+        }
+
+        size_t frames = sound.ReadPcm(offset, pcm.data(), wanted, cache) / frame_size;
+        if (frames == 0) break;
+
+        ConvertToFloat(sound.PcmFormat(), pcm.data(), samples.data(), frames * channels);
+        for (size_t start = 0; start < frames; start += BASE_FRAMES) {
+            size_t bucket_frames = std::min(BASE_FRAMES, frames - start);
+            base.push_back(Summarize(&samples[start * channels], bucket_frames * channels));
+        }
+        offset += frames * frame_size;
+    }
+
+    waveform.m_levels.push_back(std::move(base));
+    waveform.BuildLevels();
+    return waveform;
+}
+
+void Waveform::BuildLevels() {
+    while (m_levels.back().size() > MIN_LEVEL_SIZE) {
+        const std::vector<WaveformBucket>& finer = m_levels.back();
+        std::vector<WaveformBucket> coarser((finer.size() + 1) / 2);
+        for (size_t i = 0; i < coarser.size(); i++) {
+            coarser[i] = i * 2 + 1 < finer.size() ? Merge(finer[i * 2], finer[i * 2 + 1]) : finer[i * 2];
+        }
+        m_levels.push_back(std::move(coarser));
+    }
+}
+
+std::vector<WaveformBucket> Waveform::Resample(size_t width) const {
+    if (m_levels.empty() || m_levels[0].empty() || width == 0) return {};
+
+    // Start from the coarsest level which still has at least one bucket per output bucket
+    size_t level = 0;
+    while (level + 1 < m_levels.size() && m_levels[level + 1].size() >= width) level++;
+    const std::vector<WaveformBucket>& source = m_levels[level];
+
+    std::vector<WaveformBucket> result(width);
+    for (size_t i = 0; i < width; i++) {
+        size_t first = i * source.size() / width;
+        size_t last = std::max((i + 1) * source.size() / width, first + 1);
+
+        WaveformBucket bucket = source[first];
+        float sum_squares = bucket.rms * bucket.rms;
+        for (size_t j = first + 1; j < last; j++) {
+            bucket.min = std::min(bucket.min, source[j].min);
+            bucket.max = std::max(bucket.max, source[j].max);
+            sum_squares += source[j].rms * source[j].rms;
+        }
+        bucket.rms = std::sqrt(sum_squares / (last - first));
+        result[i] = bucket;
+    }
+    return result;
+}
+
+std::filesystem::path Waveform::CachePath(const std::filesystem::path& song_path) {
+    size_t hash = std::hash<std::string>{}(CacheKey(song_path));
+    return CacheDirectory() / "waveforms" / std::format("{:016x}.wf", hash);
+}
+
+std::optional<Waveform> Waveform::LoadCached(const std::filesystem::path& song_path) {
+    std::optional<FileStamp> stamp = GetFileStamp(song_path);
+    if (!stamp) return std::nullopt;
+
+    std::ifstream file(CachePath(song_path), std::ios::binary);
+    if (!file.is_open()) return std::nullopt;
+
+    CacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return std::nullopt;
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+        header.base_frames != BASE_FRAMES || header.mtime != stamp->mtime || header.size != stamp->size ||
+        header.levels == 0) {
+        return std::nullopt;
+    }
+
+    std::string key(header.key_length, '\0');
+    if (!file.read(key.data(), key.size()) || key != CacheKey(song_path)) return std::nullopt;
+
+    std::vector<uint32_t> sizes(header.levels);
+    if (!file.read(reinterpret_cast<char*>(sizes.data()), sizes.size() * sizeof(uint32_t))) return std::nullopt;
+
+    Waveform waveform;
+    std::vector<CachedBucket> cached;
+    for (uint32_t size : sizes) {
+        cached.resize(size);
+        if (!file.read(reinterpret_cast<char*>(cached.data()), size * sizeof(CachedBucket))) return std::nullopt;
+
+        std::vector<WaveformBucket>& level = waveform.m_levels.emplace_back(size);
+        for (size_t i = 0; i < size; i++) {
+            level[i] = {.min = cached[i].min / 127.0f, .max = cached[i].max / 127.0f, .rms = cached[i].rms / 255.0f};
+        }
+    }
+    return waveform;
+}
+
+void Waveform::SaveCached(const std::filesystem::path& song_path) const {
+    std::optional<FileStamp> stamp = GetFileStamp(song_path);
+    if (!stamp || m_levels.empty()) return;
+
+    std::filesystem::path cache_path = CachePath(song_path);
+    std::error_code ec;
+    std::filesystem::create_directories(cache_path.parent_path(), ec);
+
+    // Written to a temporary file first so a concurrent reader never sees a partial waveform
+    std::filesystem::path tmp_path = cache_path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+
+        std::string key = CacheKey(song_path);
+        CacheHeader header{.magic = {},
+                           .version = CACHE_VERSION,
+                           .mtime = stamp->mtime,
+                           .size = stamp->size,
+                           .base_frames = BASE_FRAMES,
+                           .levels = static_cast<uint32_t>(m_levels.size()),
+                           .key_length = static_cast<uint32_t>(key.size())};
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(key.data(), key.size());
+
+        for (const auto& level : m_levels) {
+            uint32_t size = level.size();
+            file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        }
+
+        auto quantize = [](float value, float scale) { return std::lround(std::clamp(value, -1.0f, 1.0f) * scale); };
+        std::vector<CachedBucket> cached;
+        for (const auto& level : m_levels) {
+            cached.resize(level.size());
+            for (size_t i = 0; i < level.size(); i++) {
+                cached[i] = {.min = static_cast<int8_t>(quantize(level[i].min, 127.0f)),
+                             .max = static_cast<int8_t>(quantize(level[i].max, 127.0f)),
+                             .rms = static_cast<uint8_t>(quantize(level[i].rms, 255.0f))};
+            }
+            file.write(reinterpret_cast<const char*>(cached.data()), cached.size() * sizeof(CachedBucket));
+        }
+
+        if (!file) {
+            file.close();
+            std::filesystem::remove(tmp_path, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, cache_path, ec);
+}
+
+}  // namespace dragonfruit
@@ -15,6 +15,8 @@ class EqualizerBase : public ComponentBase {
     Element OnRender() override;
 
    private:
+    static constexpr int SPECTRUM_HEIGHT = 10;
+
     Player& m_player;
     Component m_volume_slider;
     double m_volume_slider_val = 0;
@@ -15,7 +15,10 @@ class MiniPlayerBase : public ComponentBase {
     Element OnRender() override;
 
    private:
+    Element RenderProgressBar(double progress);
+
     Player& m_player;
+    Box m_progress_box;  // Where the progress bar was drawn last frame, to size the waveform to it
     Component m_play_indicator_1;
     Component m_play_indicator_2;
     Component m_play_indicator_3;
@@ -3,6 +3,8 @@
 #include <filesystem>
 #include <ftxui/component/component.hpp>
 #include <ftxui/dom/elements.hpp>
+#include <string>
+#include <vector>
 
 #include "components/playing_indicator.hpp"
 #include "player.hpp"
@@ -15,9 +17,30 @@ class SongQueueBase : public ComponentBase {
 
     Element OnRender() override;
 
+    /**
+     * @brief Handle the keys of the search box. '/' opens it, typing searches as you go, the arrow keys pick a match,
+     * Enter plays it and Escape closes the search.
+     *
+     * @param event The event to handle.
+     * @return true if the event was used by the search, which is every event while it is open.
+     */
+    bool HandleSearchEvent(Event event);
+
    private:
+    static constexpr size_t VISIBLE_RADIUS = 100;
+    static constexpr size_t SEARCH_LIMIT = 20;
+
+    void RunSearch();
+    Element RenderSearch();
+
     Player& m_player;
     Component playing_indicator_;
+
+    bool m_searching = false;
+    std::string m_query;
+    std::vector<SearchIndex::Match> m_results;
+    size_t m_selected = 0;
+    double m_search_us = 0.0;  // Time taken by the last search
 };
 
-inline Component SongQueue(Player& player) { return Make<SongQueueBase>(player); }
\ No newline at end of file
+inline std::shared_ptr<SongQueueBase> SongQueue(Player& player) { return Make<SongQueueBase>(player); }
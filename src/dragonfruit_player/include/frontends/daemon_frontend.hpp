@@ -0,0 +1,92 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "frontends/frontend.hpp"
+
+/**
+ * @brief Headless frontend which is controlled over a Unix domain socket instead of a terminal.
+ *
+ * Clients send newline terminated text commands and receive one "OK ..." or "ERR ..." line per command. Clients which
+ * send "subscribe" are also sent "EVENT ..." lines whenever the song, playback state, volume or queue changes. All
+ * clients are served from a single epoll loop. Status is answered from a snapshot refreshed a few times a second, so
+ * queries never wait on the audio engine.
+ *
+ * Commands:
+ *   status                  OK <playing|paused> <idx> <time> <total> <volume> <queue size> <path>
+ *   play <idx>              Play the song at a queue index
+ *   next / prev             Play the next/previous song
+ *   pause / resume / toggle Change the playback state
+ *   seek <seconds>          Seek relative to the current position
+ *   volume <0.0-1.0>        Set the volume
+ *   enqueue <idx>           Play the song at a queue index again after the current one
+ *   remove <idx>            Remove a song from the queue
+ *   move <from> <to>        Move a song within the queue
+ *   shuffle / unshuffle     Shuffle or restore the queue
+ *   sort-tempo              Sort the queue by tempo, see --analyze-tempo
+ *   queue [start] [count]   OK <n>, followed by n lines of "<idx>\t<path>"
+ *   subscribe               Start receiving events
+ *   quit                    Stop the daemon
+ *
+ */
+class DaemonFrontend : public Frontend {
+   public:
+    DaemonFrontend(Player& player, const std::filesystem::path& socket_path)
+        : Frontend(player), m_socket_path(socket_path) {}
+
+    void Start() override;
+
+    /**
+     * @brief Returns the default location of the control socket, inside $XDG_RUNTIME_DIR (or /tmp).
+     *
+     * @return Default socket path.
+     */
+    static std::filesystem::path DefaultSocketPath();
+
+   private:
+    // Clients which stop reading are disconnected once this much output has piled up
+    static constexpr size_t MAX_PENDING_OUTPUT = 1 << 20;
+    static constexpr size_t MAX_LINE_LENGTH = 4096;
+    static constexpr int TICK_MS = 100;
+
+    struct Client {
+        std::string input;
+        std::string output;
+        bool subscribed = false;
+        bool writable_armed = false;  // Whether EPOLLOUT is currently requested
+        bool finishing = false;       // The client hung up, it is closed once its replies have been sent
+    };
+
+    struct Status {
+        bool paused = false;
+        size_t idx = 0;
+        double time = 0.0;
+        double total = 0.0;
+        double volume = 0.0;
+        size_t queue_size = 0;
+        std::string path;
+    };
+
+    void Accept();
+    void ReadClient(int fd);
+    void FlushClient(int fd);
+    void FinishClient(int fd);
+    void CloseClient(int fd);
+    void Send(int fd, const std::string& data);
+    void Broadcast(const std::string& event);
+
+    void HandleCommand(int fd, const std::string& line);
+    void RefreshStatus();
+
+    std::filesystem::path m_socket_path;
+    int m_epoll_fd = -1;
+    int m_listen_fd = -1;
+    bool m_running = true;
+    bool m_queue_changed = false;
+
+    std::unordered_map<int, Client> m_clients;
+    Status m_status;
+};
@@ -11,4 +11,7 @@ class DefaultFrontend : public Frontend {
     DefaultFrontend(Player& player) : Frontend(player) {}
 
     void Start() override;
+
+   private:
+    static constexpr double SPEED_STEP = 0.25;
 };
\ No newline at end of file
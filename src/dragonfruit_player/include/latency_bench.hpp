@@ -0,0 +1,30 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+#include "player.hpp"
+
+/**
+ * @brief Options for a control latency benchmark.
+ *
+ */
+struct LatencyBenchOptions {
+    size_t iterations = 30;                           // Times every control is measured
+    std::optional<std::filesystem::path> baseline{};  // Percentiles to compare against, recorded if missing
+    double tolerance = 0.25;                          // Share a percentile may exceed its baseline by
+};
+
+/**
+ * @brief Measures how long it takes from a control call to its effect reaching the audio server: starting a song
+ * until its first samples are written, skipping to the next song, seeking until samples from the new position are
+ * written, and pausing and resuming until the server has applied them. Drives the player the way a frontend would.
+ *
+ * Running against a null sink (for example a private PulseAudio server with module-null-sink) keeps the results
+ * independent of the sound card.
+ *
+ * @param player Player with songs queued. Must be called from the thread that would run the frontend.
+ * @param options Options for the benchmark.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if a control timed out or a percentile regressed past the baseline.
+ */
+int RunLatencyBench(Player& player, const LatencyBenchOptions& options);
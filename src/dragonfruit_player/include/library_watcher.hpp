@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Changes to the songs in a watched library since they were last taken.
+ *
+ */
+struct LibraryChanges {
+    std::vector<std::filesystem::path> updated;  // Songs which were added, rewritten or moved in, in path order
+    std::vector<std::filesystem::path> removed;  // Songs which were deleted or moved out, in path order
+
+    inline bool Empty() const { return updated.empty() && removed.empty(); }
+};
+
+/**
+ * @brief Watches the directories songs were collected from with inotify, so songs added to or replaced in them while
+ * the player runs reach the queue without a rescan.
+ *
+ * Events are collected on a thread of the watcher's own and debounced: a batch is only probed once the directories
+ * have been quiet for a moment, so copying an album in is handled once rather than for every file. Only the files
+ * named by the events are probed, nothing is listed again unless the kernel's event queue overflowed. Like the initial
+ * scan, only the songs directly inside each directory are watched.
+ *
+ */
+class LibraryWatcher {
+   public:
+    /**
+     * @brief Start watching a set of directories. Directories which cannot be watched are skipped. Throws an exception
+     * if inotify is unavailable.
+     *
+     * @param directories Directories to watch.
+     * @param is_song Filter for the songs the player can play.
+     */
+    LibraryWatcher(const std::vector<std::filesystem::path>& directories,
+                   std::function<bool(const std::filesystem::path&)> is_song);
+    ~LibraryWatcher();
+
+    LibraryWatcher(const LibraryWatcher&) = delete;
+    LibraryWatcher& operator=(const LibraryWatcher&) = delete;
+
+    /**
+     * @brief Take the changes probed since the last call, without blocking.
+     *
+     * @return The changes. Empty if there are none.
+     */
+    LibraryChanges Take();
+
+   private:
+    // A batch is probed once no event has arrived for this long, or once its first event is this old
+    static constexpr std::chrono::milliseconds QUIET_PERIOD{500};
+    static constexpr std::chrono::milliseconds MAX_BATCH_DELAY{3000};
+
+    void WatchLoop();
+    void ReadEvents();
+    void Probe();
+
+    std::function<bool(const std::filesystem::path&)> m_is_song;
+
+    int m_inotify_fd = -1;
+    int m_stop_fd = -1;  // Written to stop the watch thread
+
+    // Only used by the watch thread
+    std::unordered_map<int, std::filesystem::path> m_directories;  // Directory of each watch descriptor
+    std::set<std::filesystem::path> m_touched;  // Files named by events of the current batch
+    bool m_overflowed = false;                  // Events were lost, the batch has to list every directory
+
+    std::mutex m_mutex;
+    LibraryChanges m_changes;  // Probed, not taken yet
+
+    std::thread m_thread;
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief The song queue of a player. Paths are interned into a single contiguous arena and referred to by 32-bit track
+ * IDs. The play order is a doubly linked list of entries over those IDs, so enqueueing, removing and moving songs are
+ * all O(1) and never touch the path strings. Entries stay valid across edits, which lets the current song be tracked
+ * through any reordering.
+ *
+ * Positional access (EntryAt, IndexOf) goes through a snapshot of the play order which is rebuilt lazily after edits.
+ *
+ */
+class PlayQueue {
+   public:
+    using TrackId = uint32_t;
+    using EntryId = uint32_t;
+
+    static constexpr EntryId NONE = UINT32_MAX;
+
+    PlayQueue() = default;
+    explicit PlayQueue(const std::vector<std::filesystem::path>& paths);
+
+    /**
+     * @brief Intern a path and append it to the end of the play order.
+     *
+     * @param path Filepath of the song.
+     * @return The entry of the new song.
+     */
+    EntryId Append(const std::filesystem::path& path);
+
+    /**
+     * @brief Add another entry for an existing track right after the current song. O(1).
+     *
+     * @param track The track to enqueue.
+     * @return The new entry, or NONE if the queue is empty.
+     */
+    EntryId EnqueueNext(TrackId track);
+
+    /**
+     * @brief Remove an entry from the play order. O(1). If it is the current song, the following song becomes current.
+     *
+     * @param entry The entry to remove.
+     */
+    void Remove(EntryId entry);
+
+    /**
+     * @brief Move an entry so that it plays right after another one. O(1).
+     *
+     * @param entry The entry to move.
+     * @param after The entry to place it after, or NONE to move it to the front.
+     */
+    void MoveAfter(EntryId entry, EntryId after);
+
+    /**
+     * @brief Shuffle the play order. The current entry stays current, wherever it ends up.
+     *
+     * @param rng Random number generator.
+     */
+    void Shuffle(std::mt19937& rng);
+
+    /**
+     * @brief Restore the play order to the order songs were added in. The current entry stays current.
+     *
+     */
+    void Unshuffle();
+
+    /**
+     * @brief Stably sort the play order by track. The current entry stays current, wherever it ends up.
+     *
+     * @param less Returns whether the first track goes before the second.
+     */
+    void Sort(const std::function<bool(TrackId, TrackId)>& less);
+
+    /**
+     * @brief Returns the number of entries in the play order.
+     *
+     * @return Number of entries.
+     */
+    inline size_t Size() const { return m_size; }
+
+    /**
+     * @brief Returns the number of tracks, including those no longer in the play order.
+     *
+     * @return Number of tracks.
+     */
+    inline size_t TrackCount() const { return m_offsets.size() - 1; }
+
+    /**
+     * @brief Returns the entry after a given one, wrapping around to the front.
+     *
+     * @param entry An entry in the play order.
+     * @return The following entry.
+     */
+    EntryId Next(EntryId entry) const;
+
+    /**
+     * @brief Returns the entry before a given one, wrapping around to the back.
+     *
+     * @param entry An entry in the play order.
+     * @return The preceding entry.
+     */
+    EntryId Prev(EntryId entry) const;
+
+    /**
+     * @brief Returns the entry at a position in the play order.
+     *
+     * @param index Position, less than Size().
+     * @return The entry at that position.
+     */
+    EntryId EntryAt(size_t index) const;
+
+    /**
+     * @brief Returns the position of an entry in the play order.
+     *
+     * @param entry An entry in the play order.
+     * @return Its position.
+     */
+    size_t IndexOf(EntryId entry) const;
+
+    /**
+     * @brief Returns the track an entry plays.
+     *
+     * @param entry An entry in the play order.
+     * @return Its track.
+     */
+    inline TrackId TrackOf(EntryId entry) const { return m_entries[entry].track; }
+
+    /**
+     * @brief Find an entry which plays a track. O(n).
+     *
+     * @param track The track.
+     * @return The earliest added entry of the track still in the play order, or NONE if there is none.
+     */
+    EntryId FindEntry(TrackId track) const;
+
+    /**
+     * @brief Returns the interned path of a track.
+     *
+     * @param track The track.
+     * @return Its path, valid until the next track is added.
+     */
+    std::string_view PathView(TrackId track) const;
+
+    /**
+     * @brief Returns the path of a track.
+     *
+     * @param track The track.
+     * @return Its path.
+     */
+    inline std::filesystem::path Path(TrackId track) const { return std::filesystem::path(PathView(track)); }
+
+    /**
+     * @brief Returns the entry of the current song.
+     *
+     * @return The current entry, or NONE if the queue is empty.
+     */
+    inline EntryId Current() const { return m_current; }
+
+    /**
+     * @brief Make an entry the current song.
+     *
+     * @param entry An entry in the play order.
+     */
+    inline void SetCurrent(EntryId entry) { m_current = entry; }
+
+   private:
+    struct Entry {
+        TrackId track;
+        EntryId prev = NONE;
+        EntryId next = NONE;
+        bool removed = false;
+    };
+
+    void Link(EntryId entry, EntryId after);
+    void Unlink(EntryId entry);
+    void Relink(const std::vector<EntryId>& order);
+    const std::vector<EntryId>& Order() const;
+
+    // Path arena: track i's path is m_chars[m_offsets[i], m_offsets[i + 1])
+    std::string m_chars;
+    std::vector<uint64_t> m_offsets = {0};
+
+    // Entries are never reused, so entry IDs also record the order songs were added in
+    std::vector<Entry> m_entries;
+    EntryId m_head = NONE;
+    EntryId m_tail = NONE;
+    EntryId m_current = NONE;
+    size_t m_size = 0;
+
+    // Lazily rebuilt snapshot of the play order for positional access
+    mutable std::vector<EntryId> m_order;
+    mutable std::vector<uint32_t> m_positions;  // Position of each entry in m_order
+    mutable bool m_order_dirty = true;
+};
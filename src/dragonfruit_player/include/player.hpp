@@ -1,22 +1,83 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <dragonfruit_engine/audio_engine.hpp>
+#include <dragonfruit_engine/buffer_pool.hpp>
+#include <dragonfruit_engine/loudness.hpp>
+#include <dragonfruit_engine/mpsc_queue.hpp>
+#include <dragonfruit_engine/spectrum.hpp>
+#include <dragonfruit_engine/tempo.hpp>
+#include <dragonfruit_engine/thread_pool.hpp>
+#include <dragonfruit_engine/track_cache.hpp>
+#include <dragonfruit_engine/waveform.hpp>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "library_watcher.hpp"
+#include "play_queue.hpp"
+#include "search_index.hpp"
+#include "song_source.hpp"
+
+/**
+ * @brief Options for configuring a Player.
+ *
+ */
+struct PlayerOptions {
+    bool direct_io = false;  // Read songs with O_DIRECT, bypassing the page cache
+    dragonfruit::HugePageMode huge_pages = dragonfruit::HugePageMode::NONE;  // Back sample buffers with huge pages
+    dragonfruit::GainMode normalization = dragonfruit::GainMode::NONE;      // Apply stored ReplayGain measurements
+    bool realtime = false;  // Lock the playing and cached songs into RAM and run the audio thread with real-time priority
+    size_t track_cache_bytes = 256 << 20;  // Sample data of recently played songs kept loaded, zero disables it
+    bool prefetch = true;                  // Load the songs before and after the current one ahead of time
+    dragonfruit::AudioBackend backend = dragonfruit::AudioBackend::PULSE;  // Where the engine sends its output
+    std::string alsa_device = "default";                                   // ALSA: device to play to
+    unsigned alsa_period_us = 10000;                                       // ALSA: length of a device period
+    unsigned alsa_periods = 4;                                             // ALSA: periods in the device buffer
+    std::shared_ptr<const dragonfruit::ImpulseResponse> impulse_response;  // Filter to convolve the output with
+    size_t convolution_partition = 512;  // Frames per convolution partition, the latency the filter adds
+};
+
+/**
+ * @brief A control request queued for the player's engine thread.
+ *
+ */
+struct PlayerCommand {
+    enum class Type { PLAY, SEEK, SET_VOLUME, SET_SPEED, PAUSE, QUIT };
+
+    Type type = Type::QUIT;
+    std::filesystem::path path{};  // PLAY: path of the song, resolved when the command was issued
+    std::vector<std::filesystem::path> neighbors{};  // PLAY: paths of the songs around it in the queue, to prefetch
+    double value = 0.0;            // SEEK: delta in seconds, SET_VOLUME: volume, SET_SPEED: speed
+    bool pause = false;            // PAUSE: whether to pause or resume
+    uint64_t generation = 0;       // PLAY: song change generation it was issued as
+};
 
 /**
  * @brief Defines the main interface for interacting with the underlying dragonfruit audio engine. Frontends should use
  * this to play music and keep track of its current state.
  *
+ * Control calls (Play, Seek, Pause, SetVolume, ...) never touch the engine directly. They are queued and return
+ * immediately, and an engine thread applies them. Bursts of commands are coalesced before they reach the engine:
+ * consecutive seeks are merged, only the latest volume is applied, and song changes during rapid skipping are
+ * debounced so that only the song the user lands on is loaded.
+ *
  */
 class Player {
    public:
     /**
      * @brief Construct a new Player object with a predefined queue of songs. This will also initialize the underlying
-     * audio engine.
+     * audio engine, whose connection to the audio server completes in the background.
      *
      * @param song_filenames A list of filepaths to valid song files to initialize the internal song queue.
+     * @param options Options for configuring the player.
      */
-    Player(const std::vector<std::filesystem::path>& song_filenames);
+    Player(const std::vector<std::filesystem::path>& song_filenames, const PlayerOptions& options = {});
     ~Player();
 
     /**
@@ -32,7 +93,7 @@ class Player {
      * @return true if the song is paused.
      * @return false otherwise.
      */
-    inline bool IsPaused() { return m_engine.IsPaused(); };
+    inline bool IsPaused() { return m_paused.load(std::memory_order_relaxed); };
 
     /**
      * @brief Start playing the song at a given index into the song queue. In the case of an overflow (the index being
@@ -51,6 +112,37 @@ class Player {
      */
     void PlayRelative(int delta);
 
+    /**
+     * @brief Start playing a track, such as a search result. Plays its entry in the queue, or if it was removed from
+     * the queue, enqueues it again right after the current song.
+     *
+     * @param track The track to play.
+     */
+    void PlayTrack(PlayQueue::TrackId track);
+
+    /**
+     * @brief Queue another play of the song at a given index to play right after the current song.
+     *
+     * @param idx The index in the queue of the song to enqueue.
+     */
+    void EnqueueNext(size_t idx);
+
+    /**
+     * @brief Remove the song at a given index from the queue. Removing the current song starts the next one. The last
+     * remaining song cannot be removed.
+     *
+     * @param idx The index in the queue of the song to remove.
+     */
+    void Remove(size_t idx);
+
+    /**
+     * @brief Move the song at a given index to another position in the queue. The current song keeps playing.
+     *
+     * @param from The index in the queue of the song to move.
+     * @param to The index it should end up at.
+     */
+    void Move(size_t from, size_t to);
+
     /**
      * @brief Seek by a given delta in seconds relative to the current song's current position. This will safely clamp
      * to either the beginning of the song (in case of an underflow) or the end of the song (in case of an overflow).
@@ -77,37 +169,122 @@ class Player {
      * @brief Check if the currently playing song has finished playing.
      *
      * @return true if the currently playing song has finished playing.
-     * @return false if the currently playing song has not finished playing.
+     * @return false if the currently playing song has not finished playing, or a new song has been requested but not
+     * started yet.
      */
-    inline bool IsFinished() { return m_engine.IsFinished(); }
+    inline bool IsFinished() {
+        return m_started_generation.load(std::memory_order_acquire) ==
+                   m_requested_generation.load(std::memory_order_acquire) &&
+               m_engine->IsFinished();
+    }
 
     /**
-     * @brief Get a list of the songs. This queue contains the filepaths of each song which is in this player's queue.
+     * @brief Get the song queue. Like every queue operation, this must only be used from the frontend's thread.
      *
-     * @return A list filepaths for queued songs.
+     * @return The song queue.
      */
-    inline std::vector<std::filesystem::path>& GetSongQueue() { return m_song_paths; }
+    inline const PlayQueue& GetSongQueue() const { return m_queue; }
 
     /**
      * @brief Get the index of the currently playing song in the queue.
      *
      * @return The index of the currently playing song in the queue.
      */
-    inline int GetCurrentSongIdx() { return m_cur_song_idx; }
+    inline size_t GetCurrentSongIdx() const { return m_queue.IndexOf(m_queue.Current()); }
+
+    /**
+     * @brief Get the filepath of the currently playing song.
+     *
+     * @return The filepath of the currently playing song.
+     */
+    inline std::filesystem::path GetCurrentSongPath() const {
+        return m_queue.Path(m_queue.TrackOf(m_queue.Current()));
+    }
 
     /**
      * @brief Get the currently playing song. This pointer will be empty if no song has been played yet.
      *
      * @return A shared pointer to the currently playing song.
      */
-    inline std::shared_ptr<dragonfruit::Sound> GetCurrentSong() { return m_cur_sound; }
+    inline std::shared_ptr<dragonfruit::Sound> GetCurrentSong() {
+        std::lock_guard<std::mutex> lock(m_sound_mutex);
+        return m_cur_sound;
+    }
+
+    /**
+     * @brief Get the waveform of the currently playing song. Waveforms are loaded from the cache, or computed, in the
+     * background after a song starts, so this is empty until then.
+     *
+     * @return A shared pointer to the current song's waveform.
+     */
+    inline std::shared_ptr<const dragonfruit::Waveform> GetWaveform() {
+        std::lock_guard<std::mutex> lock(m_waveform_mutex);
+        return m_waveform;
+    }
+
+    /**
+     * @brief Keep appending the songs a source finds to the end of the queue. They are added by SyncQueue, after the
+     * songs of every source streamed before.
+     *
+     * @param source The source to take songs from.
+     */
+    inline void StreamSongs(std::shared_ptr<SongSource> source) { m_song_sources.push_back(std::move(source)); }
+
+    /**
+     * @brief Keep the queue in sync with the songs a watcher sees change on disk. New songs are appended, rewritten
+     * ones have their tags read again and deleted ones leave the queue, except for the current song. Changes are
+     * applied by SyncQueue, once the streamed sources are done.
+     *
+     * @param watcher The watcher to take changes from.
+     */
+    inline void WatchLibrary(std::shared_ptr<LibraryWatcher> watcher) { m_library = std::move(watcher); }
+
+    /**
+     * @brief Block until the queue has a song, taking songs from the streamed sources. Must be called from the
+     * frontend's thread.
+     *
+     * @return false if the queue is empty and the sources found nothing.
+     */
+    bool WaitForSongs();
+
+    /**
+     * @brief Append any songs which have been found since the last call to the queue, and apply changes to the watched
+     * library. Frontends should call this regularly from their thread.
+     *
+     * @return true if the queue changed.
+     */
+    bool SyncQueue();
+
+    /**
+     * @brief Fuzzy search the songs in the queue by filename and by their title, artist and album tags. Filenames are
+     * searchable as soon as songs are added, tags once they have been read in the background. Must be called from the
+     * frontend's thread.
+     *
+     * @param query Words to search for, typos are tolerated.
+     * @param limit Maximum number of matches.
+     * @return Matching tracks, best first.
+     */
+    std::vector<SearchIndex::Match> Search(std::string_view query, size_t limit);
 
     /**
-     * @brief Shuffles the queue and restarts playback at the first song.
+     * @brief Shuffles the queue. The current song keeps playing and is moved to the front.
      *
      */
     void Shuffle();
 
+    /**
+     * @brief Restores the queue to the order songs were added in. The current song keeps playing.
+     *
+     */
+    void Unshuffle();
+
+    /**
+     * @brief Sorts the queue from the slowest to the fastest song, using the tempos measured by --analyze-tempo. Songs
+     * which have not been analysed go last, in their current order. The current song keeps playing.
+     *
+     */
+    void SortByTempo();
+
     /**
      * @brief Set the volume of the player.
      *
@@ -120,14 +297,133 @@ class Player {
      *
      * @return The current volume of the player.
      */
-    inline double GetVolume() { return m_cur_volume; }
+    inline double GetVolume() { return m_cur_volume.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Set the playback speed. The pitch is kept, and song times and seeking stay in the song's own time.
+     *
+     * @param speed The speed from 0.5 to 3.0, 1.0 being normal speed.
+     */
+    void SetSpeed(double speed);
+
+    /**
+     * @brief Get the current playback speed of the player.
+     *
+     * @return The current playback speed.
+     */
+    inline double GetSpeed() { return m_cur_speed.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the spectrum and levels of the audio currently being output. Analysis runs in the background only
+     * while this is being polled.
+     *
+     * @return The latest spectrum frame.
+     */
+    inline dragonfruit::SpectrumFrame GetSpectrum() { return m_spectrum.Snapshot(); }
+
+    /**
+     * @brief Get the scheduling and callback measurements of the audio thread.
+     *
+     * @return Audio thread statistics.
+     */
+    inline dragonfruit::EngineStats GetEngineStats() const { return m_engine->Stats(); }
+
+    /**
+     * @brief Get the usage statistics of the sample buffer pool, including how much of it is locked into RAM.
+     *
+     * @return Buffer pool statistics.
+     */
+    inline dragonfruit::BufferPoolStats GetBufferPoolStats() const { return m_buffer_pool.Stats(); }
+
+    /**
+     * @brief Get the hit, miss and eviction counts of the cache of recently played songs.
+     *
+     * @return Track cache statistics.
+     */
+    inline dragonfruit::TrackCacheStats GetTrackCacheStats() const { return m_tracks.Stats(); }
+
+    /**
+     * @brief Get the CPU time spent in each node of the engine's DSP graph, such as the room correction convolver.
+     *
+     * @return Stats of every node, in processing order.
+     */
+    inline std::vector<dragonfruit::DspNodeStats> GetDspStats() const { return m_engine->Graph().Stats(); }
+
+    /**
+     * @brief Get when audio was first sent to the audio server, for measuring the time to first audio.
+     *
+     * @return Time of the first write, or nothing if nothing has been played yet.
+     */
+    inline std::optional<std::chrono::steady_clock::time_point> GetFirstAudioTime() const {
+        return m_engine->FirstWriteTime();
+    }
+
+    /**
+     * @brief Get how far song starts, seeks, pauses and resumes have made it to the audio server, for measuring how
+     * long control calls take to be heard.
+     *
+     * @return Control progress counters.
+     */
+    inline dragonfruit::ControlProgress GetControlProgress() const { return m_engine->Progress(); }
 
    private:
-    dragonfruit::AudioEngine m_engine;
-    std::vector<std::filesystem::path> m_song_paths;
+    // Song changes closer together than this are merged into one, so holding down skip does not load every song
+    static constexpr std::chrono::milliseconds PLAY_DEBOUNCE{100};
+
+    // Number of songs whose tags are read per background job
+    static constexpr size_t TAG_PROBE_BATCH = 256;
+
+    struct ProbedTags {
+        PlayQueue::TrackId track;
+        std::string text;  // Title, artist and album
+    };
+
+    void CommandLoop();
+    void PlayEntry(PlayQueue::EntryId entry);
+    void StartSong(const PlayerCommand& command);
+    void LoadWaveform(const std::filesystem::path& path, uint64_t generation);
+    void PrefetchNeighbors(const std::vector<std::filesystem::path>& paths, uint64_t generation);
+    void AppendSongs(const std::vector<std::filesystem::path>& songs);
+    bool ApplyLibraryChanges(const LibraryChanges& changes);
+    void IndexSongs(PlayQueue::TrackId first, const std::vector<std::filesystem::path>& songs);
 
-    int m_cur_song_idx = 0;
+    PlayerOptions m_options;
+
+    // Declared before anything holding a Sound so that it outlives every buffer borrowed from it
+    dragonfruit::BufferPool m_buffer_pool;
+    dragonfruit::TrackCache m_tracks;
+    std::unique_ptr<dragonfruit::AudioEngine> m_engine;
+    dragonfruit::SpectrumAnalyzer m_spectrum{m_engine->Tap()};
+    PlayQueue m_queue;
+    std::deque<std::shared_ptr<SongSource>> m_song_sources;  // Still producing songs for the queue, in order
+    std::shared_ptr<LibraryWatcher> m_library;
+    SearchIndex m_search_index;
+    dragonfruit::LoudnessStore m_loudness;
+    dragonfruit::TempoStore m_tempo;
+
+    // State as requested by the caller. These are updated immediately, the engine thread catches up asynchronously.
+    std::atomic<double> m_cur_volume = 1.0;
+    std::atomic<double> m_cur_speed = 1.0;
+    std::atomic<bool> m_paused = false;
+    std::atomic<uint64_t> m_requested_generation = 0;  // Bumped for every requested song change
+    std::atomic<uint64_t> m_started_generation = 0;    // Generation of the last song change the engine applied
+
+    std::mutex m_sound_mutex;
     std::shared_ptr<dragonfruit::Sound> m_cur_sound;
 
-    double m_cur_volume = 1.0;
+    std::mutex m_waveform_mutex;
+    std::shared_ptr<const dragonfruit::Waveform> m_waveform;
+
+    // Tags read in the background which have not been added to the search index yet
+    std::mutex m_probed_mutex;
+    std::vector<ProbedTags> m_probed;
+    std::atomic<bool> m_stopping = false;
+
+    dragonfruit::MpscQueue<PlayerCommand> m_commands;
+    std::thread m_command_thread;
+
+    // Run tag probing, waveform and prefetch jobs. Declared last so that they are stopped before anything their jobs
+    // use is destroyed.
+    dragonfruit::ThreadPool m_tag_probe{1};
+    dragonfruit::ThreadPool m_background{1};
 };
\ No newline at end of file
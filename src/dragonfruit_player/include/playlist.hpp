@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <dragonfruit_engine/thread_pool.hpp>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "song_source.hpp"
+
+/**
+ * @brief Check whether a file is a playlist (M3U, M3U8 or PLS) by its extension.
+ *
+ * @param path Filepath to check.
+ * @return true if the file is a playlist.
+ */
+bool IsPlaylistFile(const std::filesystem::path& path);
+
+/**
+ * @brief Parse a playlist held in memory in a single pass. Comments, blank lines and PLS keys other than FileN are
+ * skipped, nothing is allocated.
+ *
+ * @param data Contents of the playlist.
+ * @param pls Whether the playlist is in PLS format rather than M3U.
+ * @param on_entry Called with each location in the playlist, exactly as written.
+ */
+void ParsePlaylist(std::string_view data, bool pls, const std::function<void(std::string_view)>& on_entry);
+
+/**
+ * @brief Reads playlists in the background and hands out the songs in them as they are found.
+ *
+ * Playlists are memory mapped and parsed on a reader thread. Entries are resolved against the playlist's directory and
+ * collected into batches, and whether each song exists is checked on a thread pool, so a playlist on a slow disk is not
+ * stat'ed one file at a time. Batches are handed out in playlist order as soon as they are checked, which lets
+ * playback start while the rest of a large playlist is still being read.
+ *
+ */
+class PlaylistLoader : public SongSource {
+   public:
+    /**
+     * @brief Open a set of playlists and start reading them. Throws an exception if a playlist cannot be opened.
+     *
+     * @param playlists Filepaths of the playlists, read in order.
+     * @param is_song Filter for the songs the player can play.
+     */
+    PlaylistLoader(const std::vector<std::filesystem::path>& playlists,
+                   std::function<bool(const std::filesystem::path&)> is_song);
+    ~PlaylistLoader() override;
+
+    PlaylistLoader(const PlaylistLoader&) = delete;
+    PlaylistLoader& operator=(const PlaylistLoader&) = delete;
+
+    std::vector<std::filesystem::path> Take() override;
+    std::vector<std::filesystem::path> WaitAndTake() override;
+    bool IsDone() override;
+
+   private:
+    // The first batch is kept small so the first song can start as soon as possible
+    static constexpr size_t FIRST_BATCH_SIZE = 16;
+    static constexpr size_t BATCH_SIZE = 2048;
+
+    struct MappedPlaylist {
+        std::filesystem::path directory;
+        const char* data = nullptr;
+        size_t size = 0;
+        bool pls = false;
+    };
+
+    void ReadLoop();
+    void SubmitBatch(std::vector<std::filesystem::path> batch);
+    std::vector<std::filesystem::path> TakeLocked();
+
+    std::vector<MappedPlaylist> m_playlists;
+    std::function<bool(const std::filesystem::path&)> m_is_song;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready_cv;
+    std::map<size_t, std::vector<std::filesystem::path>> m_checked;  // Checked batches by sequence number
+    size_t m_next_submit = 0;  // Only used by the reader thread
+    size_t m_next_take = 0;
+    bool m_read_done = false;
+    std::atomic<bool> m_stopping = false;
+
+    dragonfruit::ThreadPool m_pool;
+    std::thread m_reader;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief In-memory fuzzy search over the text of the songs in a queue, such as their filenames and tags.
+ *
+ * Text is lowercased and split into words, and every word is indexed by its trigrams, with a leading space so the
+ * first trigram of a word also matches prefixes. A query ranks songs by the share of its trigrams they contain, which
+ * tolerates typos and missing letters, with bonuses for words found whole or as prefixes. Only the posting lists of
+ * the query's trigrams are visited, so queries stay fast on very large queues.
+ *
+ * Songs can be added to, and have text added, at any time, so the index can be built up while songs are probed. Songs
+ * can also be removed, only the posting lists of their own trigrams are touched.
+ *
+ */
+class SearchIndex {
+   public:
+    using DocumentId = uint32_t;
+
+    struct Match {
+        DocumentId document;
+        float score;  // Higher is better
+    };
+
+    /**
+     * @brief Index text for a document. Can be called repeatedly for the same document to add more text.
+     *
+     * @param document ID of the document, such as a track ID. IDs should be dense.
+     * @param text Text to index.
+     */
+    void Add(DocumentId document, std::string_view text);
+
+    /**
+     * @brief Remove all text of a document, so it no longer matches anything. It can be indexed again with Add.
+     *
+     * @param document ID of the document.
+     */
+    void Remove(DocumentId document);
+
+    /**
+     * @brief Find the documents best matching a query.
+     *
+     * @param query Words to search for.
+     * @param limit Maximum number of matches.
+     * @return Matches, best first.
+     */
+    std::vector<Match> Search(std::string_view query, size_t limit) const;
+
+    /**
+     * @brief Returns the number of documents with text.
+     *
+     * @return Number of documents.
+     */
+    inline size_t Size() const { return m_document_count; }
+
+   private:
+    // Matches must contain at least this share of the query's trigrams
+    static constexpr float MIN_TRIGRAM_SHARE = 0.5f;
+
+    // Added to the share of trigrams for query words found whole, and again when they start a word
+    static constexpr float WORD_BONUS = 0.5f;
+    static constexpr float PREFIX_BONUS = 0.25f;
+    static constexpr float MAX_BONUS = WORD_BONUS + PREFIX_BONUS;
+
+    std::vector<std::string> m_documents;  // Normalized text of each document, words separated by single spaces
+    std::vector<uint16_t> m_lengths;       // Length of each document's text, kept apart for cheap tie breaks
+    std::unordered_map<uint32_t, std::vector<DocumentId>> m_postings;  // Documents containing each trigram
+    size_t m_document_count = 0;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <dragonfruit_engine/thread_pool.hpp>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "song_source.hpp"
+
+/**
+ * @brief Finds the songs named on the command line in the background. Each path is either a song or a directory
+ * whose songs are collected, and every path is checked on a thread pool, so slow disks and large directories are
+ * listed in parallel. Songs are handed out in the order of the paths as soon as the paths before them are done.
+ *
+ */
+class SongScanner : public SongSource {
+   public:
+    /**
+     * @brief Start scanning a set of paths.
+     *
+     * @param paths Songs and directories, in queue order.
+     * @param is_song Filter for the songs the player can play.
+     */
+    SongScanner(const std::vector<std::filesystem::path>& paths,
+                std::function<bool(const std::filesystem::path&)> is_song);
+    ~SongScanner() override;
+
+    SongScanner(const SongScanner&) = delete;
+    SongScanner& operator=(const SongScanner&) = delete;
+
+    std::vector<std::filesystem::path> Take() override;
+    std::vector<std::filesystem::path> WaitAndTake() override;
+    bool IsDone() override;
+
+   private:
+    std::vector<std::filesystem::path> Scan(const std::filesystem::path& path) const;
+    std::vector<std::filesystem::path> TakeLocked();
+
+    std::function<bool(const std::filesystem::path&)> m_is_song;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready_cv;
+    std::vector<std::optional<std::vector<std::filesystem::path>>> m_results;  // Songs of each path, once scanned
+    size_t m_next_take = 0;
+    std::atomic<bool> m_stopping = false;
+
+    dragonfruit::ThreadPool m_pool;
+};
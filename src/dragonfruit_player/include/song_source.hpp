@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+/**
+ * @brief Something finding songs in the background, such as a directory scan or a playlist being read. Songs are
+ * handed out in the order they should be queued in.
+ *
+ */
+class SongSource {
+   public:
+    virtual ~SongSource() = default;
+
+    /**
+     * @brief Take the songs which have been found since the last call, without blocking.
+     *
+     * @return Songs in queue order. Empty if none are ready.
+     */
+    virtual std::vector<std::filesystem::path> Take() = 0;
+
+    /**
+     * @brief Block until songs are ready or the source is exhausted, then take them.
+     *
+     * @return Songs in queue order. Empty only if nothing else will be found.
+     */
+    virtual std::vector<std::filesystem::path> WaitAndTake() = 0;
+
+    /**
+     * @brief Check whether the source is exhausted and every song found has been taken.
+     *
+     * @return true if nothing else will be found.
+     */
+    virtual bool IsDone() = 0;
+};
@@ -16,11 +16,35 @@ EqualizerBase::EqualizerBase(Player& player) : m_player(player) {
 }
 
 Element EqualizerBase::OnRender() {
+    dragonfruit::SpectrumFrame spectrum = m_player.GetSpectrum();
+
+    Elements bars;
+    for (float band : spectrum.bands) {
+        bars.push_back(gaugeUp(band) | color(LinearGradient(90, Color::CornflowerBlue, Color::BlueViolet)) |
+                       size(HEIGHT, EQUAL, SPECTRUM_HEIGHT) | flex);
+    }
+
+    // Levels are normalized over a 72dB range, convert the peaks back for display
+    auto level_meter = [&](const std::string& label, int channel) {
+        return hbox({
+            text(label + " ["),
+            gauge(spectrum.level[channel]) | color(Color::Green) | bgcolor(Color::GrayDark) | flex,
+            text(std::format("] {:>4.0f} dB", (spectrum.peak[channel] - 1.0f) * 72.0f)),
+        });
+    };
+
     return vbox({
         hbox({
             text(std::format("Volume ({:.2f}) [", m_volume_slider_val)),
             m_volume_slider->Render() | bgcolor(Color::GrayDark),
             text("]"),
         }),
+        separatorEmpty(),
+        hbox(std::move(bars)),
+        separatorEmpty(),
+        level_meter("L", 0),
+        level_meter("R", 1),
+        text(std::format("Analysis: {:.2f} ms/frame ({:.1f}% load)", spectrum.analysis_ms, spectrum.load * 100.0)) |
+            dim,
     });
 }
\ No newline at end of file
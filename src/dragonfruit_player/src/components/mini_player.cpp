@@ -1,5 +1,8 @@
 #include "components/mini_player.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 #include "components/playing_indicator.hpp"
 #include "components/progress_animations.hpp"
 
@@ -21,20 +24,24 @@ Element MiniPlayerBase::OnRender() {
     double total_song_time = m_player.GetTotalSongTime();
     bool paused = m_player.IsPaused();
     std::shared_ptr<dragonfruit::Sound> song = m_player.GetCurrentSong();
-    size_t total_songs = m_player.GetSongQueue().size();
+    size_t total_songs = m_player.GetSongQueue().Size();
     size_t song_idx = m_player.GetCurrentSongIdx();
 
-    std::string song_name = song->Name().empty() ? m_player.GetSongQueue()[song_idx].filename().string() : song->Name();
-
-    Decorator progress_bar_decorator = color(LinearGradient(Color::CornflowerBlue, Color::BlueViolet));
+    // The song may still be loading right after a song change, fall back to the file name until it is ready
+    std::string song_name =
+        !song || song->Name().empty() ? m_player.GetCurrentSongPath().filename().string() : song->Name();
 
     Element play_indicator =
         paused ? text("▁▁▁") | color(Color::Green)
                : hbox({m_play_indicator_1->Render(), m_play_indicator_2->Render(), m_play_indicator_3->Render()});
 
+    // Times stay in the song's own time at any speed, the speed is shown next to them instead
+    double speed = m_player.GetSpeed();
+    std::string speed_label = speed != 1.0 ? std::format(" {:g}x", speed) : "";
+
     return vbox({
         hbox({
-            text(FormatSeconds(song_time) + "/" + FormatSeconds(total_song_time)),
+            text(FormatSeconds(song_time) + "/" + FormatSeconds(total_song_time) + speed_label),
             separatorEmpty(),
             text(std::format("{} [{}/{}]", song_name, song_idx + 1, total_songs)) | flex_shrink,
             filler(),
@@ -43,8 +50,35 @@ Element MiniPlayerBase::OnRender() {
         }),
         hbox({
             text("["),
-            gauge(song_time / total_song_time) | progress_bar_decorator | bgcolor(Color::GrayDark),
+            RenderProgressBar(total_song_time > 0.0 ? song_time / total_song_time : 0.0) | flex |
+                reflect(m_progress_box),
             text("]"),
         }),
     });
+}
+
+Element MiniPlayerBase::RenderProgressBar(double progress) {
+    Decorator progress_bar_decorator = color(LinearGradient(Color::CornflowerBlue, Color::BlueViolet));
+
+    // Fall back to a plain gauge until the waveform has been loaded
+    std::shared_ptr<const dragonfruit::Waveform> waveform = m_player.GetWaveform();
+    int width = m_progress_box.x_max - m_progress_box.x_min + 1;
+    if (!waveform || width <= 1) return gauge(progress) | progress_bar_decorator | bgcolor(Color::GrayDark);
+
+    static const std::string levels[] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+    std::vector<dragonfruit::WaveformBucket> buckets = waveform->Resample(width);
+    size_t played_columns = static_cast<size_t>(std::clamp(progress, 0.0, 1.0) * buckets.size());
+
+    std::string played;
+    std::string remaining;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        float peak = std::max(std::fabs(buckets[i].min), std::fabs(buckets[i].max));
+        (i < played_columns ? played : remaining) += levels[std::clamp(static_cast<int>(peak * 8.0f), 0, 7)];
+    }
+
+    return hbox({
+               text(played) | progress_bar_decorator,
+               text(remaining) | color(Color::GrayLight),
+           }) |
+           bgcolor(Color::GrayDark);
 }
\ No newline at end of file
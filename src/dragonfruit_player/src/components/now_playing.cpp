@@ -6,6 +6,14 @@ std::string FmtCodeToString(dragonfruit::WavFormatCode code) {
             return "IEEE Float";
         case dragonfruit::WavFormatCode::PCM:
             return "PCM";
+        case dragonfruit::WavFormatCode::MS_ADPCM:
+            return "MS ADPCM";
+        case dragonfruit::WavFormatCode::IMA_ADPCM:
+            return "IMA ADPCM";
+        case dragonfruit::WavFormatCode::MULAW:
+            return "mu-law";
+        case dragonfruit::WavFormatCode::ALAW:
+            return "A-law";
         default:
             return "---";
     };
@@ -14,9 +22,17 @@ std::string FmtCodeToString(dragonfruit::WavFormatCode code) {
 Element NowPlayingBase::OnRender() {
     std::shared_ptr<dragonfruit::Sound> song = m_player.GetCurrentSong();
 
+    // Song changes are applied asynchronously, there is briefly no song right after one
+    if (!song) {
+        return vbox({
+            filler(),
+            paragraph(m_player.GetCurrentSongPath().filename().string()) | hcenter,
+            filler(),
+        });
+    }
+
     // If the song doesn't have a name (metadata not found) revert to the file name
-    std::string song_name =
-        song->Name().empty() ? m_player.GetSongQueue()[m_player.GetCurrentSongIdx()].filename().string() : song->Name();
+    std::string song_name = song->Name().empty() ? m_player.GetCurrentSongPath().filename().string() : song->Name();
     return vbox({
         filler(),
         paragraph(song_name) | hcenter,
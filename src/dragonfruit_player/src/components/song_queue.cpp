@@ -1,19 +1,85 @@
 #include "components/song_queue.hpp"
 
+#include <algorithm>
+#include <chrono>
+
 #include "components/progress_animations.hpp"
 
 SongQueueBase::SongQueueBase(Player& player) : m_player(player) {
     playing_indicator_ = PlayingIndicator(ProgressAnimations::DOTS1, 80);
 }
 
+bool SongQueueBase::HandleSearchEvent(Event event) {
+    if (!m_searching) {
+        if (event != Event::Character('/')) return false;
+        m_searching = true;
+        m_query.clear();
+        RunSearch();
+        return true;
+    }
+
+    if (event == Event::Escape) {
+        m_searching = false;
+    } else if (event == Event::Return) {
+        if (m_selected < m_results.size()) m_player.PlayTrack(m_results[m_selected].document);
+        m_searching = false;
+    } else if (event == Event::ArrowUp) {
+        if (m_selected > 0) m_selected--;
+    } else if (event == Event::ArrowDown) {
+        if (m_selected + 1 < m_results.size()) m_selected++;
+    } else if (event == Event::Backspace) {
+        // Drop a whole UTF-8 character, not just its last byte
+        while (!m_query.empty() && (static_cast<unsigned char>(m_query.back()) & 0xC0) == 0x80) m_query.pop_back();
+        if (!m_query.empty()) m_query.pop_back();
+        RunSearch();
+    } else if (event.is_character()) {
+        m_query += event.character();
+        RunSearch();
+    }
+
+    // Keys must not reach the player's own bindings while typing
+    return true;
+}
+
+void SongQueueBase::RunSearch() {
+    auto start = std::chrono::steady_clock::now();
+    m_results = m_player.Search(m_query, SEARCH_LIMIT);
+    m_search_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    m_selected = 0;
+}
+
+Element SongQueueBase::RenderSearch() {
+    std::vector<Element> elements;
+    elements.push_back(hbox({text("Search: ") | bold, text(m_query + "_")}));
+
+    const PlayQueue& queue = m_player.GetSongQueue();
+    for (size_t i = 0; i < m_results.size(); i++) {
+        std::filesystem::path path = queue.Path(m_results[i].document);
+        Element result = text(path.filename().string());
+        elements.push_back(i == m_selected ? result | inverted : result | color(Color::LightSlateGrey));
+    }
+
+    if (!m_query.empty()) {
+        elements.push_back(text(std::format("{} matches in {:.0f} us", m_results.size(), m_search_us)) | dim);
+    }
+    return vbox(std::move(elements));
+}
+
 Element SongQueueBase::OnRender() {
+    if (m_searching) return RenderSearch();
+
     std::vector<Element> elements;
 
-    std::vector<std::filesystem::path>& queue = m_player.GetSongQueue();
+    const PlayQueue& queue = m_player.GetSongQueue();
     size_t cur_idx = m_player.GetCurrentSongIdx();
 
-    for (size_t i = 0; i < queue.size(); i++) {
-        Element song_entry = text(std::format("{}. {}", i + 1, queue[i].filename().string()));
+    // Only the songs around the current one are rendered, queues can hold far more songs than fit on screen
+    size_t first = cur_idx > VISIBLE_RADIUS ? cur_idx - VISIBLE_RADIUS : 0;
+    size_t last = std::min(queue.Size(), cur_idx + VISIBLE_RADIUS + 1);
+
+    for (size_t i = first; i < last; i++) {
+        std::filesystem::path path = queue.Path(queue.TrackOf(queue.EntryAt(i)));
+        Element song_entry = text(std::format("{}. {}", i + 1, path.filename().string()));
 
         // Add additional decorators if this is the currently playing song
         if (i == cur_idx) {
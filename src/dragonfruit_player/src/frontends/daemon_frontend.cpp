@@ -0,0 +1,440 @@
+#include "frontends/daemon_frontend.hpp"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dragonfruit_engine/exception.hpp>
+#include <format>
+#include <sstream>
+
+namespace {
+
+// Tags stored in the epoll data of the fds which are not clients
+constexpr uint64_t LISTEN_TAG = UINT64_MAX;
+constexpr uint64_t SIGNAL_TAG = UINT64_MAX - 1;
+constexpr uint64_t TIMER_TAG = UINT64_MAX - 2;
+
+constexpr size_t DEFAULT_QUEUE_COUNT = 100;
+constexpr size_t MAX_QUEUE_COUNT = 10000;
+constexpr size_t SEARCH_LIMIT = 20;
+
+void AddToEpoll(int epoll_fd, int fd, uint32_t events, uint64_t tag) {
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        throw dragonfruit::Exception(dragonfruit::ErrorCode::IO_ERROR,
+                                     std::format("epoll_ctl failed: {}", std::strerror(errno)));
+    }
+}
+
+// Parses an unsigned index argument, returns false if it is missing or malformed
+bool ParseIndex(std::istringstream& args, size_t& value) {
+    long long parsed;
+    if (!(args >> parsed) || parsed < 0) return false;
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+
+}  // namespace
+
+std::filesystem::path DaemonFrontend::DefaultSocketPath() {
+    if (const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR"); runtime_dir && *runtime_dir) {
+        return std::filesystem::path(runtime_dir) / "dragonfruit.sock";
+    }
+    return std::filesystem::temp_directory_path() / std::format("dragonfruit-{}.sock", getuid());
+}
+
+void DaemonFrontend::Start() {
+    using dragonfruit::ErrorCode;
+    using dragonfruit::Exception;
+
+    // Termination signals are handled in the loop so the socket is cleaned up on the way out
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0) throw Exception(ErrorCode::IO_ERROR, std::format("socket failed: {}", std::strerror(errno)));
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (m_socket_path.native().size() >= sizeof(addr.sun_path)) {
+        throw Exception(ErrorCode::IO_ERROR, std::format("Socket path {} is too long", m_socket_path.string()));
+    }
+    std::strcpy(addr.sun_path, m_socket_path.c_str());
+
+    // A socket left behind by a daemon which did not shut down cleanly would make bind fail
+    unlink(m_socket_path.c_str());
+    mode_t old_umask = umask(0077);
+    int bind_result = bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    umask(old_umask);
+    if (bind_result < 0 || listen(m_listen_fd, SOMAXCONN) < 0) {
+        throw Exception(ErrorCode::IO_ERROR,
+                        std::format("Could not listen on {}: {}", m_socket_path.string(), std::strerror(errno)));
+    }
+
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec tick{};
+    tick.it_interval.tv_nsec = TICK_MS * 1000000L;
+    tick.it_value = tick.it_interval;
+    timerfd_settime(timer_fd, 0, &tick, nullptr);
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    AddToEpoll(m_epoll_fd, m_listen_fd, EPOLLIN, LISTEN_TAG);
+    AddToEpoll(m_epoll_fd, signal_fd, EPOLLIN, SIGNAL_TAG);
+    AddToEpoll(m_epoll_fd, timer_fd, EPOLLIN, TIMER_TAG);
+
+    // Immediately begin playing the first song
+    m_player.Play(0);
+    m_player.SetVolume(1.0);
+    RefreshStatus();
+
+    epoll_event events[64];
+    while (m_running) {
+        int count = epoll_wait(m_epoll_fd, events, 64, -1);
+        if (count < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < count; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == LISTEN_TAG) {
+                Accept();
+            } else if (tag == SIGNAL_TAG) {
+                m_running = false;
+            } else if (tag == TIMER_TAG) {
+                uint64_t expirations;
+                [[maybe_unused]] ssize_t result = read(timer_fd, &expirations, sizeof(expirations));
+
+                if (m_player.SyncQueue()) m_queue_changed = true;
+                if (m_player.IsFinished()) m_player.PlayRelative(1);
+                RefreshStatus();
+            } else {
+                // A client which sent its commands and hung up still has them read, ReadClient closes it afterwards
+                int fd = static_cast<int>(tag);
+                if (events[i].events & EPOLLERR || (events[i].events & EPOLLHUP && !(events[i].events & EPOLLIN))) {
+                    CloseClient(fd);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) FlushClient(fd);
+                if (events[i].events & EPOLLIN && m_clients.count(fd)) ReadClient(fd);
+            }
+        }
+    }
+
+    while (!m_clients.empty()) CloseClient(m_clients.begin()->first);
+    close(timer_fd);
+    close(signal_fd);
+    close(m_listen_fd);
+    close(m_epoll_fd);
+    unlink(m_socket_path.c_str());
+}
+
+void DaemonFrontend::Accept() {
+    while (true) {
+        int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+
+        m_clients.emplace(fd, Client{});
+        AddToEpoll(m_epoll_fd, fd, EPOLLIN | EPOLLRDHUP, static_cast<uint64_t>(fd));
+    }
+}
+
+void DaemonFrontend::ReadClient(int fd) {
+    char buffer[4096];
+    bool eof = false;
+    while (true) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno != EAGAIN && errno != EINTR) {
+            CloseClient(fd);
+            return;
+        }
+        if (received < 0) break;
+
+        // Clients such as `echo status | socat - UNIX-CONNECT:...` send their last command and hang up in one go, so
+        // what was sent before the end is still handled and answered
+        if (received == 0) {
+            eof = true;
+            break;
+        }
+
+        m_clients[fd].input.append(buffer, received);
+    }
+
+    // Handle every complete line. A command can disconnect its own client (too much pending output, quit), so the
+    // client is looked up again for each line.
+    size_t start = 0;
+    while (true) {
+        auto it = m_clients.find(fd);
+        if (it == m_clients.end()) return;
+
+        std::string& input = it->second.input;
+        size_t end = input.find('\n', start);
+        if (end == std::string::npos && eof && start < input.size()) end = input.size();
+        if (end == std::string::npos) {
+            input.erase(0, start);
+            if (input.size() > MAX_LINE_LENGTH) {
+                Send(fd, "ERR line too long\n");
+                CloseClient(fd);
+            } else if (eof) {
+                FinishClient(fd);
+            }
+            return;
+        }
+
+        std::string line = input.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        start = std::min(end + 1, input.size());
+        HandleCommand(fd, line);
+    }
+}
+
+void DaemonFrontend::FlushClient(int fd) {
+    auto it = m_clients.find(fd);
+    if (it == m_clients.end()) return;
+    Client& client = it->second;
+
+    while (!client.output.empty()) {
+        ssize_t sent = send(fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EINTR) break;
+            CloseClient(fd);
+            return;
+        }
+        client.output.erase(0, sent);
+    }
+
+    if (client.finishing && client.output.empty()) {
+        CloseClient(fd);
+        return;
+    }
+
+    // Only ask for writability while there is something left to write
+    bool want_writable = !client.output.empty();
+    if (want_writable != client.writable_armed) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (want_writable ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        event.data.u64 = static_cast<uint64_t>(fd);
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+        client.writable_armed = want_writable;
+    }
+}
+
+void DaemonFrontend::FinishClient(int fd) {
+    auto it = m_clients.find(fd);
+    if (it == m_clients.end()) return;
+    Client& client = it->second;
+
+    // Nothing more can be read, only the replies still queued are waited for. The hung up end would otherwise keep
+    // the client readable and spin the loop.
+    client.finishing = true;
+    epoll_event event{};
+    event.events = EPOLLOUT;
+    event.data.u64 = static_cast<uint64_t>(fd);
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    client.writable_armed = true;
+
+    FlushClient(fd);
+}
+
+void DaemonFrontend::CloseClient(int fd) {
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    m_clients.erase(fd);
+}
+
+void DaemonFrontend::Send(int fd, const std::string& data) {
+    auto it = m_clients.find(fd);
+    if (it == m_clients.end()) return;
+
+    if (it->second.output.size() + data.size() > MAX_PENDING_OUTPUT) {
+        CloseClient(fd);
+        return;
+    }
+
+    it->second.output += data;
+    FlushClient(fd);
+}
+
+void DaemonFrontend::Broadcast(const std::string& event) {
+    std::vector<int> subscribers;
+    for (const auto& [fd, client] : m_clients) {
+        if (client.subscribed) subscribers.push_back(fd);
+    }
+    for (int fd : subscribers) Send(fd, event);
+}
+
+void DaemonFrontend::HandleCommand(int fd, const std::string& line) {
+    std::istringstream args(line);
+    std::string command;
+    args >> command;
+
+    size_t idx = 0;
+    size_t queue_size = m_player.GetSongQueue().Size();
+    std::string reply = "OK\n";
+
+    if (command.empty()) {
+        return;
+    } else if (command == "status") {
+        // Answered from the snapshot, so status polling never reaches the audio engine
+        const Status& s = m_status;
+        reply = std::format("OK {} {} {:.3f} {:.3f} {:.2f} {} {}\n", s.paused ? "paused" : "playing", s.idx, s.time,
+                            s.total, s.volume, s.queue_size, s.path);
+    } else if (command == "play") {
+        if (ParseIndex(args, idx) && idx < queue_size) {
+            m_player.Play(static_cast<int>(idx));
+        } else {
+            reply = "ERR usage: play <idx>\n";
+        }
+    } else if (command == "next" || command == "prev") {
+        m_player.PlayRelative(command == "next" ? 1 : -1);
+    } else if (command == "pause" || command == "resume" || command == "toggle") {
+        m_player.Pause(command == "toggle" ? !m_player.IsPaused() : command == "pause");
+    } else if (command == "seek") {
+        double seconds;
+        if (args >> seconds) {
+            m_player.Seek(seconds);
+        } else {
+            reply = "ERR usage: seek <seconds>\n";
+        }
+    } else if (command == "volume") {
+        double volume;
+        if (args >> volume) {
+            m_player.SetVolume(volume);
+        } else {
+            reply = "ERR usage: volume <0.0-1.0>\n";
+        }
+    } else if (command == "speed") {
+        double speed;
+        if (args >> speed) {
+            m_player.SetSpeed(speed);
+        } else {
+            reply = "ERR usage: speed <0.5-3.0>\n";
+        }
+    } else if (command == "enqueue") {
+        if (ParseIndex(args, idx) && idx < queue_size) {
+            m_player.EnqueueNext(idx);
+            m_queue_changed = true;
+        } else {
+            reply = "ERR usage: enqueue <idx>\n";
+        }
+    } else if (command == "remove") {
+        if (ParseIndex(args, idx) && idx < queue_size) {
+            m_player.Remove(idx);
+            m_queue_changed = true;
+        } else {
+            reply = "ERR usage: remove <idx>\n";
+        }
+    } else if (command == "move") {
+        size_t to = 0;
+        if (ParseIndex(args, idx) && ParseIndex(args, to) && idx < queue_size && to < queue_size) {
+            m_player.Move(idx, to);
+            m_queue_changed = true;
+        } else {
+            reply = "ERR usage: move <from> <to>\n";
+        }
+    } else if (command == "shuffle" || command == "unshuffle") {
+        command == "shuffle" ? m_player.Shuffle() : m_player.Unshuffle();
+        m_queue_changed = true;
+    } else if (command == "sort-tempo") {
+        m_player.SortByTempo();
+        m_queue_changed = true;
+    } else if (command == "queue") {
+        size_t start = 0;
+        size_t count = DEFAULT_QUEUE_COUNT;
+        if (!args.eof() && !ParseIndex(args, start)) start = 0;
+        if (!args.eof() && !ParseIndex(args, count)) count = DEFAULT_QUEUE_COUNT;
+        start = std::min(start, queue_size);
+        count = std::min({count, MAX_QUEUE_COUNT, queue_size - start});
+
+        const PlayQueue& queue = m_player.GetSongQueue();
+        reply = std::format("OK {}\n", count);
+        for (size_t i = start; i < start + count; i++) {
+            reply += std::format("{}\t{}\n", i, queue.PathView(queue.TrackOf(queue.EntryAt(i))));
+        }
+    } else if (command == "search") {
+        std::string query;
+        std::getline(args, query);
+        std::vector<SearchIndex::Match> matches = m_player.Search(query, SEARCH_LIMIT);
+
+        const PlayQueue& queue = m_player.GetSongQueue();
+        reply = std::format("OK {}\n", matches.size());
+        for (const SearchIndex::Match& match : matches) {
+            reply += std::format("{}\t{}\n", match.document, queue.PathView(match.document));
+        }
+    } else if (command == "playtrack") {
+        if (ParseIndex(args, idx) && idx < m_player.GetSongQueue().TrackCount()) {
+            m_player.PlayTrack(static_cast<PlayQueue::TrackId>(idx));
+            m_queue_changed = true;
+        } else {
+            reply = "ERR usage: playtrack <track>\n";
+        }
+    } else if (command == "subscribe") {
+        m_clients[fd].subscribed = true;
+    } else if (command == "quit") {
+        m_running = false;
+    } else {
+        reply = std::format("ERR unknown command: {}\n", command);
+    }
+
+    Send(fd, reply);
+
+    // Everything but the song times comes from the frontend's own state, so it is cheap to refresh straight away and
+    // lets events for the change go out before the next tick
+    if (command != "status" && command != "queue" && command != "search") {
+        const PlayQueue& queue = m_player.GetSongQueue();
+        Status& s = m_status;
+        bool song_changed = s.idx != m_player.GetCurrentSongIdx() || s.path != m_player.GetCurrentSongPath().string();
+        s.idx = m_player.GetCurrentSongIdx();
+        s.path = m_player.GetCurrentSongPath().string();
+        s.queue_size = queue.Size();
+        if (song_changed) Broadcast(std::format("EVENT song {} {}\n", s.idx, s.path));
+        if (m_queue_changed) Broadcast(std::format("EVENT queue {}\n", s.queue_size));
+        if (s.paused != m_player.IsPaused()) {
+            s.paused = m_player.IsPaused();
+            Broadcast(std::format("EVENT state {}\n", s.paused ? "paused" : "playing"));
+        }
+        if (s.volume != m_player.GetVolume()) {
+            s.volume = m_player.GetVolume();
+            Broadcast(std::format("EVENT volume {:.2f}\n", s.volume));
+        }
+        m_queue_changed = false;
+    }
+}
+
+void DaemonFrontend::RefreshStatus() {
+    Status& s = m_status;
+    std::string path = m_player.GetCurrentSongPath().string();
+    size_t idx = m_player.GetCurrentSongIdx();
+    if (idx != s.idx || path != s.path) {
+        s.idx = idx;
+        s.path = path;
+        Broadcast(std::format("EVENT song {} {}\n", s.idx, s.path));
+    }
+    if (m_player.IsPaused() != s.paused) {
+        s.paused = m_player.IsPaused();
+        Broadcast(std::format("EVENT state {}\n", s.paused ? "paused" : "playing"));
+    }
+
+    if (m_queue_changed) {
+        s.queue_size = m_player.GetSongQueue().Size();
+        Broadcast(std::format("EVENT queue {}\n", s.queue_size));
+        m_queue_changed = false;
+    }
+
+    s.volume = m_player.GetVolume();
+    s.time = m_player.GetCurrentSongTime();
+    s.total = m_player.GetTotalSongTime();
+}
@@ -1,5 +1,6 @@
 #include "frontends/default_frontend.hpp"
 
+#include <dragonfruit_engine/trace.hpp>
 #include <ftxui/component/component.hpp>
 #include <ftxui/component/loop.hpp>
 #include <ftxui/component/screen_interactive.hpp>
@@ -43,6 +44,7 @@ void DefaultFrontend::Start() {
 
     // Define the FTXUI renderer, which is responsible for rendering all of the components and the main interface
     auto component = Renderer(layout, [&] {
+        dragonfruit::TraceScope trace("DefaultFrontend::Render");
         return window(text("DragonfruitPlayer"), vbox({
                                                      menu->Render(),
                                                      //   filler(),
@@ -54,7 +56,10 @@ void DefaultFrontend::Start() {
     });
 
     component |= CatchEvent([&](Event event) -> bool {
-        if (event == Event::Character(' ')) {
+        // The queue's search box takes every key while it is open
+        if (main_menu_idx == 1 && song_queue->HandleSearchEvent(event)) {
+            return true;
+        } else if (event == Event::Character(' ')) {
             m_player.Pause(!m_player.IsPaused());
             return true;
         } else if (event == Event::Escape || event == Event::Character('q')) {
@@ -75,6 +80,18 @@ void DefaultFrontend::Start() {
         } else if (event == Event::Character("s")) {
             m_player.Shuffle();
             return true;
+        } else if (event == Event::Character("u")) {
+            m_player.Unshuffle();
+            return true;
+        } else if (event == Event::Character("t")) {
+            m_player.SortByTempo();
+            return true;
+        } else if (event == Event::Character("[")) {
+            m_player.SetSpeed(m_player.GetSpeed() - SPEED_STEP);
+            return true;
+        } else if (event == Event::Character("]")) {
+            m_player.SetSpeed(m_player.GetSpeed() + SPEED_STEP);
+            return true;
         }
         return false;
     });
@@ -83,10 +100,15 @@ void DefaultFrontend::Start() {
 
     // Begin main frontend loop
     while (!loop.HasQuitted()) {
-        loop.RunOnce();
+        {
+            // Input handling and drawing of one frame
+            dragonfruit::TraceScope trace("DefaultFrontend::Frame");
+            loop.RunOnce();
+        }
         screen.RequestAnimationFrame();
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
 
+        m_player.SyncQueue();
         if (m_player.IsFinished()) {
             m_player.PlayRelative(1);
         }
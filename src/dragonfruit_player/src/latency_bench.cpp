@@ -0,0 +1,209 @@
+#include "latency_bench.hpp"
+
+#include <stdio.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Controls that have not taken effect after this long count as failures
+constexpr std::chrono::milliseconds TIMEOUT{2000};
+
+// Time left between controls, longer than the player's debounce of song changes so every start is measured alone
+constexpr std::chrono::milliseconds SETTLE{150};
+
+// Baselines below this are compared as if they were this long, so scheduling noise on tiny latencies is not a failure
+constexpr double MIN_BASELINE_MS = 1.0;
+
+constexpr double PERCENTILES[] = {50.0, 90.0, 99.0};
+
+struct Metric {
+    const char* name;
+    std::vector<double> samples_ms{};
+    size_t timeouts = 0;
+};
+
+// Nearest-rank percentile
+double Percentile(std::vector<double> samples, double percentile) {
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0 * samples.size()));
+    return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+}
+
+// Runs a control and waits for the counter it moves to go up. Latency is measured to the time the engine recorded
+// for the change, so how often this polls does not matter.
+template <typename Control>
+void Measure(Player& player, Metric& metric, bool stream_change, Control control) {
+    auto changes = [&](const dragonfruit::ControlProgress& progress) {
+        return stream_change ? progress.stream_changes : progress.cork_changes;
+    };
+
+    uint64_t before = changes(player.GetControlProgress());
+    Clock::time_point start = Clock::now();
+    control();
+
+    while (Clock::now() - start < TIMEOUT) {
+        dragonfruit::ControlProgress progress = player.GetControlProgress();
+        if (changes(progress) > before) {
+            Clock::time_point changed = stream_change ? progress.stream_changed : progress.cork_changed;
+            metric.samples_ms.push_back(std::chrono::duration<double, std::milli>(changed - start).count());
+            std::this_thread::sleep_for(SETTLE);
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    metric.timeouts++;
+}
+
+// Describes the machine a baseline is recorded on, since its numbers only mean something on the same hardware
+std::string MachineDescription() {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+
+    std::string system = "unknown system";
+    utsname name;
+    if (uname(&name) == 0) system = std::string(name.sysname) + ' ' + name.release + ' ' + name.machine;
+
+    std::string cpu = "unknown CPU";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.starts_with("model name") && line.find(':') != std::string::npos) {
+            cpu = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+
+    char date[32] = "";
+    time_t now = time(nullptr);
+    tm local;
+    if (localtime_r(&now, &local)) strftime(date, sizeof(date), "%Y-%m-%d", &local);
+
+    return std::string(host) + ", " + system + ", " + cpu + ", " + std::to_string(std::thread::hardware_concurrency()) +
+           " threads, " + date;
+}
+
+// A line starting with # notes the machine the baseline was recorded on. Every other line is: metric name, then its
+// percentiles in milliseconds.
+std::map<std::string, std::vector<double>> LoadBaseline(const std::filesystem::path& path, std::string& machine) {
+    std::map<std::string, std::vector<double>> baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.starts_with("# Recorded on ")) machine = line.substr(14);
+        if (line.starts_with("#")) continue;
+
+        std::istringstream fields(line);
+        std::string name;
+        std::vector<double> values(std::size(PERCENTILES));
+        fields >> name;
+        for (double& value : values) fields >> value;
+        if (fields) baseline[name] = values;
+    }
+    return baseline;
+}
+
+bool SaveBaseline(const std::filesystem::path& path, const std::vector<Metric>& metrics) {
+    std::ofstream file(path, std::ios::trunc);
+    file << "# Recorded on " << MachineDescription() << '\n';
+    for (const Metric& metric : metrics) {
+        file << metric.name;
+        for (double percentile : PERCENTILES) file << '\t' << Percentile(metric.samples_ms, percentile);
+        file << '\n';
+    }
+    file.close();
+    return static_cast<bool>(file);
+}
+
+}  // namespace
+
+int RunLatencyBench(Player& player, const LatencyBenchOptions& options) {
+    std::vector<Metric> metrics = {{.name = "start"}, {.name = "skip"}, {.name = "seek"}, {.name = "pause"},
+                                   {.name = "resume"}};
+    Metric& start = metrics[0];
+    Metric& skip = metrics[1];
+    Metric& seek = metrics[2];
+    Metric& pause = metrics[3];
+    Metric& resume = metrics[4];
+
+    // The first song also waits for the connection to the audio server, which is startup cost rather than latency
+    Metric warm_up{.name = "warm up"};
+    Measure(player, warm_up, true, [&] { player.Play(0); });
+    if (warm_up.timeouts > 0) {
+        fprintf(stderr, "Nothing was played within %lld ms, is the audio server running?\n",
+                static_cast<long long>(TIMEOUT.count()));
+        return EXIT_FAILURE;
+    }
+
+    printf("Measuring control latency over %zu iterations...\n", options.iterations);
+    for (size_t i = 0; i < options.iterations; i++) {
+        player.SyncQueue();
+        size_t queue_size = player.GetSongQueue().Size();
+
+        Measure(player, start, true, [&] { player.Play(static_cast<int>(i % queue_size)); });
+        // Seeking back always lands inside the song, however short it is
+        Measure(player, seek, true, [&] { player.Seek(-1.0); });
+        Measure(player, pause, false, [&] { player.Pause(true); });
+        Measure(player, resume, false, [&] { player.Pause(false); });
+        Measure(player, skip, true, [&] { player.PlayRelative(1); });
+
+        printf("\r%zu/%zu", i + 1, options.iterations);
+        fflush(stdout);
+    }
+    printf("\n\n");
+
+    std::map<std::string, std::vector<double>> baseline;
+    std::string baseline_machine = "an unknown machine";
+    if (options.baseline) baseline = LoadBaseline(*options.baseline, baseline_machine);
+    if (!baseline.empty()) printf("Comparing against the baseline recorded on %s\n\n", baseline_machine.c_str());
+
+    bool regressed_any = false;
+    bool timed_out = false;
+    printf("%-8s %9s %9s %9s %9s\n", "(ms)", "p50", "p90", "p99", "timeouts");
+    for (const Metric& metric : metrics) {
+        printf("%-8s", metric.name);
+        auto base = baseline.find(metric.name);
+        for (size_t p = 0; p < std::size(PERCENTILES); p++) {
+            double value = Percentile(metric.samples_ms, PERCENTILES[p]);
+            bool regressed = false;
+            if (base != baseline.end()) {
+                regressed = value > std::max(base->second[p], MIN_BASELINE_MS) * (1.0 + options.tolerance);
+            }
+            printf(" %8.2f%s", value, regressed ? "!" : " ");
+            regressed_any |= regressed;
+        }
+        printf(" %9zu\n", metric.timeouts);
+        timed_out |= metric.timeouts > 0;
+    }
+
+    if (options.baseline) {
+        if (baseline.empty()) {
+            if (!SaveBaseline(*options.baseline, metrics)) {
+                fprintf(stderr, "Could not write baseline %s\n", options.baseline->c_str());
+                return EXIT_FAILURE;
+            }
+            printf("\nRecorded baseline %s\n", options.baseline->c_str());
+        } else if (regressed_any) {
+            printf("\nRegressed past baseline %s (marked with !), by more than %.0f%%\n", options.baseline->c_str(),
+                   options.tolerance * 100.0);
+        }
+    }
+    if (timed_out) {
+        printf("\nSome controls did not take effect within %lld ms\n", static_cast<long long>(TIMEOUT.count()));
+    }
+    return regressed_any || timed_out ? EXIT_FAILURE : EXIT_SUCCESS;
+}
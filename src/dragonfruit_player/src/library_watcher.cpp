@@ -0,0 +1,163 @@
+#include "library_watcher.hpp"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dragonfruit_engine/exception.hpp>
+#include <dragonfruit_engine/trace.hpp>
+#include <format>
+#include <utility>
+
+namespace {
+
+// Files which finished being written, were moved in or out, or were deleted. Files are only probed once they are
+// closed, so songs still being copied in are not read half written.
+constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR;
+
+// Adds a path to one list of changes and takes it off the other, so the latest change to a file wins
+void Record(std::vector<std::filesystem::path>& add_to, std::vector<std::filesystem::path>& remove_from,
+            const std::filesystem::path& path) {
+    std::erase(remove_from, path);
+    if (std::find(add_to.begin(), add_to.end(), path) == add_to.end()) add_to.push_back(path);
+}
+
+}  // namespace
+
+LibraryWatcher::LibraryWatcher(const std::vector<std::filesystem::path>& directories,
+                               std::function<bool(const std::filesystem::path&)> is_song)
+    : m_is_song(std::move(is_song)) {
+    using dragonfruit::ErrorCode;
+    using dragonfruit::Exception;
+
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd < 0) {
+        throw Exception(ErrorCode::IO_ERROR, std::format("inotify_init1 failed: {}", std::strerror(errno)));
+    }
+    m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_stop_fd < 0) {
+        close(m_inotify_fd);
+        throw Exception(ErrorCode::IO_ERROR, std::format("eventfd failed: {}", std::strerror(errno)));
+    }
+
+    // The same directory named twice gets the same watch descriptor, and is only watched once
+    for (const std::filesystem::path& directory : directories) {
+        int wd = inotify_add_watch(m_inotify_fd, directory.c_str(), WATCH_EVENTS);
+        if (wd >= 0) m_directories.emplace(wd, directory);
+    }
+
+    m_thread = std::thread(&LibraryWatcher::WatchLoop, this);
+}
+
+LibraryWatcher::~LibraryWatcher() {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(m_stop_fd, &one, sizeof(one));
+    m_thread.join();
+    close(m_stop_fd);
+    close(m_inotify_fd);
+}
+
+LibraryChanges LibraryWatcher::Take() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::exchange(m_changes, {});
+}
+
+void LibraryWatcher::WatchLoop() {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point batch_start;
+    Clock::time_point last_event;
+
+    while (true) {
+        bool pending = !m_touched.empty() || m_overflowed;
+        int timeout_ms = -1;
+        if (pending) {
+            Clock::time_point due = std::min(last_event + QUIET_PERIOD, batch_start + MAX_BATCH_DELAY);
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(due - Clock::now());
+            timeout_ms = std::max<int>(0, remaining.count());
+        }
+
+        pollfd fds[2] = {{.fd = m_inotify_fd, .events = POLLIN, .revents = 0},
+                         {.fd = m_stop_fd, .events = POLLIN, .revents = 0}};
+        if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR) return;
+        if (fds[1].revents & POLLIN) return;
+
+        if (fds[0].revents & POLLIN) {
+            ReadEvents();
+            last_event = Clock::now();
+            if (!pending) batch_start = last_event;
+        }
+
+        // A steady stream of events still gets probed every MAX_BATCH_DELAY
+        pending = !m_touched.empty() || m_overflowed;
+        if (pending && Clock::now() >= std::min(last_event + QUIET_PERIOD, batch_start + MAX_BATCH_DELAY)) Probe();
+    }
+}
+
+void LibraryWatcher::ReadEvents() {
+    alignas(inotify_event) char buffer[16384];
+    while (true) {
+        ssize_t length = read(m_inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) return;
+
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                m_overflowed = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The directory was deleted or unmounted
+                m_directories.erase(event->wd);
+                continue;
+            }
+            if ((event->mask & IN_ISDIR) || event->len == 0) continue;
+
+            auto it = m_directories.find(event->wd);
+            if (it != m_directories.end()) m_touched.insert(it->second / event->name);
+        }
+    }
+}
+
+void LibraryWatcher::Probe() {
+    dragonfruit::TraceScope trace("LibraryWatcher::Probe");
+
+    // Lost events could have been about any file, so every directory is listed. Deletions among them cannot be told
+    // apart anymore and are missed.
+    if (m_overflowed) {
+        for (const auto& [wd, directory] : m_directories) {
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+                m_touched.insert(entry.path());
+            }
+        }
+        m_overflowed = false;
+    }
+
+    LibraryChanges changes;
+    for (const std::filesystem::path& path : m_touched) {
+        if (!m_is_song(path)) continue;
+
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(path, ec)) {
+            changes.updated.push_back(path);
+        } else if (!std::filesystem::exists(path, ec) && !ec) {
+            changes.removed.push_back(path);
+        }
+    }
+    m_touched.clear();
+    if (changes.Empty()) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_changes.Empty()) {
+        m_changes = std::move(changes);
+        return;
+    }
+    for (const std::filesystem::path& path : changes.updated) Record(m_changes.updated, m_changes.removed, path);
+    for (const std::filesystem::path& path : changes.removed) Record(m_changes.removed, m_changes.updated, path);
+}
@@ -1,19 +1,37 @@
 #include <stdio.h>
 
+#include <charconv>
+#include <chrono>
+#include <dragonfruit_engine/convolver.hpp>
+#include <dragonfruit_engine/exception.hpp>
+#include <dragonfruit_engine/loudness.hpp>
+#include <dragonfruit_engine/render.hpp>
+#include <dragonfruit_engine/tempo.hpp>
+#include <dragonfruit_engine/thread_pool.hpp>
+#include <dragonfruit_engine/trace.hpp>
+#include <optional>
+#include <random>
+#include <unordered_map>
+
+#include "frontends/daemon_frontend.hpp"
 #include "frontends/default_frontend.hpp"
+#include "latency_bench.hpp"
+#include "library_watcher.hpp"
 #include "player.hpp"
+#include "playlist.hpp"
+#include "song_scanner.hpp"
 #include "version.hpp"
 
 bool IsWavFile(const std::filesystem::path& path) { return path.extension() == ".wav"; }
 
-void CollectFiles(const std::filesystem::path& path, std::vector<std::filesystem::path>& files) {
-    if (std::filesystem::is_regular_file(path) && IsWavFile(path)) {
-        files.push_back(path);
-    } else if (std::filesystem::is_directory(path)) {
-        for (const auto& entry : std::filesystem::directory_iterator(path)) {
-            if (entry.is_regular_file() && IsWavFile(entry.path())) files.push_back(entry.path());
-        }
+// Blocks until a source has found every song
+std::vector<std::filesystem::path> TakeAllSongs(SongSource& source) {
+    std::vector<std::filesystem::path> songs;
+    while (!source.IsDone()) {
+        std::vector<std::filesystem::path> found = source.WaitAndTake();
+        songs.insert(songs.end(), found.begin(), found.end());
     }
+    return songs;
 }
 
 void DisplayUsageMessage(char** argv) {
@@ -27,20 +45,315 @@ void DisplayHelpMessage(char** argv) {
     printf("Arguments:\n");
     printf("  <path>:           One or more files/directories containing music to play.\n");
     printf("                    Playing a directory will collect all valid song files in\n");
-    printf("                    that directory and add them to the song queue.\n\n");
+    printf("                    that directory and add them to the song queue. Songs in\n");
+    printf("                    M3U/M3U8/PLS playlists are added after all other songs.\n");
+    printf("                    http:// URLs of songs are streamed.\n\n");
     printf("Options:\n");
     printf("  -h, --help:       Displays this help message and exits.\n");
+    printf("  --direct-io:      Read songs with O_DIRECT, bypassing the page cache.\n");
+    printf("  --huge-pages[=explicit]:\n");
+    printf("                    Back sample buffers with transparent huge pages, or with\n");
+    printf("                    explicit (hugetlbfs) huge pages when set to explicit.\n");
+    printf("  --analyze:        Measures the loudness of every song in parallel, stores the\n");
+    printf("                    results for --normalize and exits.\n");
+    printf("  --analyze-tempo:  Estimates the tempo and key of every song in parallel, stores\n");
+    printf("                    the results for sorting the queue by tempo and exits.\n");
+    printf("  --render <out>:   Renders every song through the playback pipeline, including\n");
+    printf("                    the --convolve filter, as fast as possible, in parallel,\n");
+    printf("                    to 32-bit float WAV files in the directory <out> (or to\n");
+    printf("                    <out> itself for a single song and an output ending in\n");
+    printf("                    .wav), then exits.\n");
+    printf("  --normalize[=album]:\n");
+    printf("                    Normalizes analysed songs to -18 LUFS using their track\n");
+    printf("                    loudness, or their album loudness when set to album.\n");
+    printf("  --realtime:       Locks the playing and cached songs into RAM and runs the\n");
+    printf("                    audio thread with real-time priority (needs RLIMIT_RTPRIO\n");
+    printf("                    and RLIMIT_MEMLOCK). Page faults and callback jitter are\n");
+    printf("                    reported on exit.\n");
+    printf("  --cache-mb <n>:   Keeps up to <n> MiB of recently played songs loaded, so\n");
+    printf("                    skipping back to them is instant (default 256, 0 disables).\n");
+    printf("  --no-prefetch:    Does not load the songs before and after the current one\n");
+    printf("                    into the cache ahead of time.\n");
+    printf("  --alsa[=<device>]:\n");
+    printf("                    Plays straight to an ALSA device (default: default)\n");
+    printf("                    rather than through the sound server, such as hw:0 or\n");
+    printf("                    plughw:0. null discards the audio as fast as it is made.\n");
+    printf("  --alsa-period-us <n>:\n");
+    printf("                    Length of an ALSA period in microseconds (default 10000).\n");
+    printf("  --alsa-periods <n>:\n");
+    printf("                    Periods in the ALSA buffer (default 4). The buffer length\n");
+    printf("                    is the output latency.\n");
+    printf("  --convolve <ir>:  Convolves the output with the impulse response in the WAV\n");
+    printf("                    file <ir>, such as a room correction filter.\n");
+    printf("  --convolve-partition <n>:\n");
+    printf("                    Frames per convolution partition (default 512), which is\n");
+    printf("                    the latency the filter adds. Smaller costs more CPU.\n");
+    printf("  --bench-convolution:\n");
+    printf("                    With --convolve, measures the CPU cost per channel of\n");
+    printf("                    each partition size and exits.\n");
+    printf("  --watch:          Watches the directories given for songs being added,\n");
+    printf("                    replaced or deleted, and updates the queue to match.\n");
+    printf("  --daemon[=<socket>]:\n");
+    printf("                    Runs without a terminal interface, controlled over a Unix\n");
+    printf("                    socket (default: $XDG_RUNTIME_DIR/dragonfruit.sock).\n");
+    printf("  --trace <file>:   Records the time spent loading songs, starting streams,\n");
+    printf("                    writing audio and drawing the interface, and writes it to\n");
+    printf("                    <file> as Chrome trace JSON on exit (see ui.perfetto.dev).\n");
+    printf("  --bench-latency[=<n>]:\n");
+    printf("                    Measures start, skip, seek, pause and resume latency over\n");
+    printf("                    <n> iterations (default 30), prints percentiles and exits.\n");
+    printf("  --baseline <file>:\n");
+    printf("                    With --bench-latency, fails if a percentile is more than\n");
+    printf("                    25%% above the one in <file>. Records <file> if missing.\n");
+    printf("  --verbose:        Reports how long startup took, up to the first audio, and\n");
+    printf("                    how often the track cache was hit on exit.\n");
     printf("  -v, --version:    Displays the version number and exits.\n\n");
     printf("Usage Examples:\n");
     printf("  Playing a single song:\n    %s song.wav\n", argv[0]);
     printf("  Playing songs from a directory:\n    %s dir\n", argv[0]);
     printf("  Playing multiple songs/directories:\n    %s song.wav dir\n", argv[0]);
+    printf("  Playing a playlist:\n    %s playlist.m3u\n", argv[0]);
+    printf("  Controlling a daemon:\n    %s --daemon dir &\n", argv[0]);
+    printf("    echo status | socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/dragonfruit.sock\n");
 }
 
+// Writes the trace when main returns, after the player and its threads are gone
+class TraceWriter {
+   public:
+    explicit TraceWriter(const std::optional<std::filesystem::path>& path) : m_path(path) {
+        if (m_path) dragonfruit::Trace::Enable();
+    }
+
+    ~TraceWriter() {
+        if (!m_path) return;
+        try {
+            dragonfruit::Trace::WriteChromeJson(*m_path);
+        } catch (const dragonfruit::Exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+        }
+    }
+
+   private:
+    std::optional<std::filesystem::path> m_path;
+};
+
 void DisplayVersion() { printf("Dragonfruit v%s\n", DRAGONFRUIT_VERSION); }
 
+void DisplayRealtimeReport(const Player& player) {
+    dragonfruit::EngineStats engine = player.GetEngineStats();
+    dragonfruit::BufferPoolStats pool = player.GetBufferPoolStats();
+
+    if (engine.realtime) {
+        printf("Audio thread: SCHED_FIFO priority %d\n", engine.priority);
+    } else {
+        printf("Audio thread: real-time scheduling refused, running at nice %d\n", engine.priority);
+    }
+    printf("Sample buffers: %zu lock failures\n", pool.lock_failures);
+    printf("Write callbacks: %lu, %lu minor / %lu major page faults, longest %.0f us\n", engine.callbacks,
+           engine.minor_faults, engine.major_faults, engine.max_callback_us);
+    printf("Callback interval: %.2f ms mean, %.3f ms jitter\n", engine.mean_interval_ms, engine.jitter_ms);
+    printf("Underruns: %lu\n", engine.underruns);
+}
+
+void DisplayStartupReport(const Player& player, std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point songs_found) {
+    auto since_start = [&](std::chrono::steady_clock::time_point time) {
+        return std::chrono::duration<double, std::milli>(time - start).count();
+    };
+
+    printf("First songs found: %.1f ms\n", since_start(songs_found));
+    std::optional<std::chrono::steady_clock::time_point> first_audio = player.GetFirstAudioTime();
+    if (first_audio) {
+        printf("Time to first audio: %.1f ms\n", since_start(*first_audio));
+    } else {
+        printf("Time to first audio: nothing was played\n");
+    }
+}
+
+void DisplayTrackCacheReport(const Player& player) {
+    dragonfruit::TrackCacheStats cache = player.GetTrackCacheStats();
+    printf("Track cache: %zu hits, %zu misses, %zu evictions, %zu prefetched\n", cache.hits, cache.misses,
+           cache.evictions, cache.prefetches);
+    printf("Track cache size: %zu songs, %.1f MiB\n", cache.tracks, cache.bytes / (1024.0 * 1024.0));
+}
+
+void DisplayDspReport(const Player& player) {
+    for (const dragonfruit::DspNodeStats& node : player.GetDspStats()) {
+        printf("DSP %s: %lu blocks, %.1f ms CPU, %.2f%% of a core, longest %.0f us\n", node.name.c_str(), node.blocks,
+               node.cpu_ms, node.load * 100.0, node.max_call_us);
+    }
+}
+
+void DisplayNoSongsMessage(char** argv) {
+    fprintf(stderr, "No valid song files found, quitting.\n");
+    DisplayUsageMessage(argv);
+}
+
+int RenderSongs(const std::vector<std::filesystem::path>& song_paths, const std::filesystem::path& out,
+                const PlayerOptions& options) {
+    // Songs keep their file names in the output directory, clashing names are numbered
+    std::vector<dragonfruit::RenderJob> jobs;
+    if (song_paths.size() == 1 && out.extension() == ".wav") {
+        jobs.push_back({.song_path = song_paths[0], .output_path = out});
+    } else {
+        std::error_code ec;
+        std::filesystem::create_directories(out, ec);
+        if (!std::filesystem::is_directory(out)) {
+            fprintf(stderr, "Could not create output directory %s\n", out.c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::unordered_map<std::string, size_t> name_counts;
+        for (const auto& song_path : song_paths) {
+            std::string stem = song_path.stem().string();
+            size_t count = ++name_counts[stem];
+            std::string name = count == 1 ? stem + ".wav" : stem + "-" + std::to_string(count) + ".wav";
+            jobs.push_back({.song_path = song_path, .output_path = out / name});
+        }
+    }
+
+    // Songs which have not been analysed are rendered unchanged, the same as when they are played
+    if (options.normalization != dragonfruit::GainMode::NONE) {
+        dragonfruit::LoudnessStore store;
+        for (auto& job : jobs) {
+            auto loudness = store.Find(job.song_path);
+            if (loudness) job.gain = dragonfruit::ReplayGain(*loudness, options.normalization);
+        }
+    }
+    for (auto& job : jobs) {
+        job.impulse_response = options.impulse_response;
+        job.convolution_partition = options.convolution_partition;
+    }
+
+    dragonfruit::ThreadPool pool;
+    printf("Rendering %zu songs on %zu threads...\n", jobs.size(), pool.Size());
+    auto start = std::chrono::steady_clock::now();
+    auto results = dragonfruit::RenderSongs(jobs, pool, [&](size_t done) {
+        printf("\r%zu/%zu", done, jobs.size());
+        fflush(stdout);
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("\n");
+
+    size_t rendered = 0;
+    double audio_seconds = 0.0;
+    double cpu_seconds = 0.0;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (!results[i]) {
+            fprintf(stderr, "Failed to render %s\n", jobs[i].song_path.c_str());
+            continue;
+        }
+        rendered++;
+        audio_seconds += results[i]->Duration();
+        cpu_seconds += results[i]->elapsed;
+    }
+
+    printf("Rendered %zu of %zu songs, %.1f s of audio in %.2f s\n", rendered, jobs.size(), audio_seconds,
+           elapsed.count());
+    if (elapsed.count() > 0.0 && cpu_seconds > 0.0) {
+        printf("Throughput: %.0fx realtime overall, %.0fx realtime per thread\n", audio_seconds / elapsed.count(),
+               audio_seconds / cpu_seconds);
+    }
+    return rendered == jobs.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int AnalyzeSongs(const std::vector<std::filesystem::path>& song_paths) {
+    dragonfruit::LoudnessStore store;
+    dragonfruit::ThreadPool pool;
+
+    printf("Analysing %zu songs on %zu threads...\n", song_paths.size(), pool.Size());
+    size_t analysed = dragonfruit::AnalyzeLoudness(song_paths, store, pool, [&](size_t done) {
+        printf("\r%zu/%zu", done, song_paths.size());
+        fflush(stdout);
+    });
+    printf("\n");
+
+    try {
+        store.Save();
+    } catch (const dragonfruit::Exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    printf("Analysed %zu of %zu songs.\n", analysed, song_paths.size());
+    return analysed == song_paths.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int AnalyzeSongTempo(const std::vector<std::filesystem::path>& song_paths) {
+    dragonfruit::TempoStore store;
+    dragonfruit::ThreadPool pool;
+
+    printf("Analysing %zu songs on %zu threads...\n", song_paths.size(), pool.Size());
+    size_t analysed = dragonfruit::AnalyzeTempo(song_paths, store, pool, [&](size_t done) {
+        printf("\r%zu/%zu", done, song_paths.size());
+        fflush(stdout);
+    });
+    printf("\n");
+
+    try {
+        store.Save();
+    } catch (const dragonfruit::Exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    printf("Analysed %zu of %zu songs.\n", analysed, song_paths.size());
+    return analysed == song_paths.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Measures the CPU cost of convolving one channel of noise with a filter, for every partition size. Each size runs for
+// up to BENCH_SECONDS of wall time, so the smallest partitions of long filters do not take forever.
+int BenchConvolution(const dragonfruit::ImpulseResponse& response) {
+    using dragonfruit::Convolver;
+    constexpr double AUDIO_SECONDS = 10.0;
+    constexpr double BENCH_SECONDS = 2.0;
+    constexpr size_t CHUNK_FRAMES = 1024;
+
+    uint32_t sample_rate = response.SampleRate();
+    std::vector<float> noise(static_cast<size_t>(sample_rate * AUDIO_SECONDS));
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    for (float& sample : noise) sample = distribution(generator);
+
+    printf("Impulse response: %zu frames at %u Hz\n", response.Frames(), sample_rate);
+    printf("%10s %12s %11s %16s\n", "Partition", "Latency", "Partitions", "CPU per channel");
+    for (size_t partition = Convolver::MIN_PARTITION; partition <= Convolver::MAX_PARTITION; partition *= 2) {
+        Convolver convolver(response, 1, sample_rate, partition);
+        std::vector<float> samples = noise;
+
+        auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed{};
+        size_t processed = 0;
+        while (processed < samples.size() && elapsed.count() < BENCH_SECONDS) {
+            size_t frames = std::min(CHUNK_FRAMES, samples.size() - processed);
+            convolver.Process(samples.data() + processed, frames);
+            processed += frames;
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+
+        double audio_seconds = static_cast<double>(processed) / sample_rate;
+        printf("%10zu %9.2f ms %11zu %15.2f%%\n", convolver.Latency(), convolver.Latency() * 1000.0 / sample_rate,
+               convolver.Partitions(), elapsed.count() / audio_seconds * 100.0);
+    }
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char** argv) {
-    std::vector<std::filesystem::path> song_paths;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::filesystem::path> scan_paths;
+    std::vector<std::filesystem::path> playlist_paths;
+    PlayerOptions options;
+    bool analyze = false;
+    bool analyze_tempo = false;
+    bool verbose = false;
+    bool watch = false;
+    bool bench_convolution = false;
+    std::optional<std::filesystem::path> impulse_response;
+    std::optional<std::filesystem::path> render_out;
+    std::optional<std::filesystem::path> daemon_socket;
+    std::optional<std::filesystem::path> trace_out;
+    std::optional<LatencyBenchOptions> bench;
+    std::optional<std::filesystem::path> bench_baseline;
 
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -51,24 +364,221 @@ int main(int argc, char** argv) {
         } else if (arg == "-v" || arg == "--version") {
             DisplayVersion();
             return EXIT_SUCCESS;
+        } else if (arg == "--direct-io") {
+            options.direct_io = true;
+        } else if (arg == "--huge-pages") {
+            options.huge_pages = dragonfruit::HugePageMode::TRANSPARENT;
+        } else if (arg == "--huge-pages=explicit") {
+            options.huge_pages = dragonfruit::HugePageMode::EXPLICIT;
+        } else if (arg == "--analyze") {
+            analyze = true;
+        } else if (arg == "--analyze-tempo") {
+            analyze_tempo = true;
+        } else if (arg == "--render") {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--render needs an output path\n");
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+            render_out = argv[++i];
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else if (arg == "--trace") {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--trace needs an output path\n");
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+            trace_out = argv[++i];
+        } else if (arg == "--bench-latency") {
+            bench = LatencyBenchOptions{};
+        } else if (arg.starts_with("--bench-latency=")) {
+            bench = LatencyBenchOptions{};
+            std::string_view count = std::string_view(arg).substr(16);
+            auto [end, ec] = std::from_chars(count.data(), count.data() + count.size(), bench->iterations);
+            if (ec != std::errc() || end != count.data() + count.size() || bench->iterations == 0) {
+                fprintf(stderr, "--bench-latency needs a positive number of iterations\n");
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--baseline") {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--baseline needs a file path\n");
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+            bench_baseline = argv[++i];
+        } else if (arg == "--normalize") {
+            options.normalization = dragonfruit::GainMode::TRACK;
+        } else if (arg == "--normalize=album") {
+            options.normalization = dragonfruit::GainMode::ALBUM;
+        } else if (arg == "--realtime") {
+            options.realtime = true;
+        } else if (arg == "--cache-mb") {
+            size_t megabytes = 0;
+            std::string_view count = i + 1 < argc ? std::string_view(argv[++i]) : std::string_view();
+            auto [end, ec] = std::from_chars(count.data(), count.data() + count.size(), megabytes);
+            if (count.empty() || ec != std::errc() || end != count.data() + count.size()) {
+                fprintf(stderr, "--cache-mb needs a size in MiB\n");
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+            options.track_cache_bytes = megabytes << 20;
+        } else if (arg == "--no-prefetch") {
+            options.prefetch = false;
+        } else if (arg == "--alsa") {
+            options.backend = dragonfruit::AudioBackend::ALSA;
+        } else if (arg.starts_with("--alsa=")) {
+            options.backend = dragonfruit::AudioBackend::ALSA;
+            options.alsa_device = arg.substr(7);
+        } else if (arg == "--alsa-period-us" || arg == "--alsa-periods") {
+            unsigned value = 0;
+            std::string_view number = i + 1 < argc ? std::string_view(argv[++i]) : std::string_view();
+            auto [end, ec] = std::from_chars(number.data(), number.data() + number.size(), value);
+            if (number.empty() || ec != std::errc() || end != number.data() + number.size() || value == 0) {
+                fprintf(stderr, "%s needs a positive number\n", arg.c_str());
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+            (arg == "--alsa-periods" ? options.alsa_periods : options.alsa_period_us) = value;
+        } else if (arg == "--convolve") {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "--convolve needs an impulse response WAV file\n");
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+            impulse_response = argv[++i];
+        } else if (arg == "--convolve-partition") {
+            std::string_view count = i + 1 < argc ? std::string_view(argv[++i]) : std::string_view();
+            auto [end, ec] = std::from_chars(count.data(), count.data() + count.size(), options.convolution_partition);
+            if (count.empty() || ec != std::errc() || end != count.data() + count.size()) {
+                fprintf(stderr, "--convolve-partition needs a number of frames\n");
+                DisplayUsageMessage(argv);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--bench-convolution") {
+            bench_convolution = true;
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--daemon") {
+            daemon_socket = DaemonFrontend::DefaultSocketPath();
+        } else if (arg.starts_with("--daemon=")) {
+            daemon_socket = arg.substr(9);
         } else if (arg.empty() || arg[0] == '-') {
             fprintf(stderr, "Unknown option: %s\n", arg.c_str());
             DisplayUsageMessage(argv);
             return EXIT_FAILURE;
+        } else if (IsPlaylistFile(arg)) {
+            playlist_paths.push_back(arg);
         } else {
-            CollectFiles(argv[i], song_paths);
+            scan_paths.push_back(arg);
+        }
+    }
+
+    TraceWriter trace_writer(trace_out);
+
+    if (impulse_response) {
+        try {
+            options.impulse_response =
+                std::make_shared<dragonfruit::ImpulseResponse>(dragonfruit::ImpulseResponse::Load(*impulse_response));
+        } catch (const dragonfruit::Exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+    if (bench_convolution) {
+        if (!options.impulse_response) {
+            fprintf(stderr, "--bench-convolution needs an impulse response to be given with --convolve\n");
+            DisplayUsageMessage(argv);
+            return EXIT_FAILURE;
         }
+        return BenchConvolution(*options.impulse_response);
     }
 
-    if (song_paths.empty()) {
-        fprintf(stderr, "No valid song files found, quitting.\n");
-        DisplayUsageMessage(argv);
+    // The watch starts before the scan, so songs added while the directories are being scanned are not missed
+    std::shared_ptr<LibraryWatcher> watcher;
+    if (watch && !analyze && !analyze_tempo && !render_out) {
+        std::vector<std::filesystem::path> directories;
+        for (const std::filesystem::path& path : scan_paths) {
+            std::error_code ec;
+            if (std::filesystem::is_directory(path, ec)) directories.push_back(path);
+        }
+
+        try {
+            watcher = std::make_shared<LibraryWatcher>(directories, IsWavFile);
+        } catch (const dragonfruit::Exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Songs and directories are scanned in parallel and playlists are read in the background. Songs in playlists are
+    // queued after all other songs.
+    auto scanner = std::make_shared<SongScanner>(scan_paths, IsWavFile);
+    std::shared_ptr<PlaylistLoader> playlist_loader;
+    if (!playlist_paths.empty()) {
+        try {
+            playlist_loader = std::make_shared<PlaylistLoader>(playlist_paths, IsWavFile);
+        } catch (const dragonfruit::Exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Analysis and rendering need every song
+    if (analyze || analyze_tempo || render_out) {
+        std::vector<std::filesystem::path> song_paths = TakeAllSongs(*scanner);
+        if (playlist_loader) {
+            std::vector<std::filesystem::path> playlist_songs = TakeAllSongs(*playlist_loader);
+            song_paths.insert(song_paths.end(), playlist_songs.begin(), playlist_songs.end());
+        }
+
+        if (song_paths.empty()) {
+            DisplayNoSongsMessage(argv);
+            return EXIT_FAILURE;
+        }
+        if (analyze) return AnalyzeSongs(song_paths);
+        if (analyze_tempo) return AnalyzeSongTempo(song_paths);
+        return RenderSongs(song_paths, *render_out, options);
+    }
+
+    // The player starts connecting to the audio server right away. Playback only waits for the first songs to be
+    // found, the first one loads while the connection completes and the interface comes up.
+    Player player({}, options);
+    player.StreamSongs(scanner);
+    if (playlist_loader) player.StreamSongs(playlist_loader);
+    if (watcher) player.WatchLibrary(watcher);
+    if (!player.WaitForSongs()) {
+        DisplayNoSongsMessage(argv);
+        return EXIT_FAILURE;
+    }
+    auto songs_found = std::chrono::steady_clock::now();
+
+    if (bench) {
+        bench->baseline = bench_baseline;
+        return RunLatencyBench(player, *bench);
+    }
+
+    std::unique_ptr<Frontend> frontend;
+    if (daemon_socket) {
+        frontend.reset(new DaemonFrontend(player, *daemon_socket));
+    } else {
+        frontend.reset(new DefaultFrontend(player));
+    }
+
+    try {
+        frontend->Start();
+    } catch (const dragonfruit::Exception& e) {
+        fprintf(stderr, "%s\n", e.what());
         return EXIT_FAILURE;
     }
 
-    Player player(song_paths);
-    std::unique_ptr<Frontend> frontend(new DefaultFrontend(player));
-    frontend->Start();
+    if (options.realtime) DisplayRealtimeReport(player);
+    if (verbose) {
+        DisplayStartupReport(player, start, songs_found);
+        DisplayTrackCacheReport(player);
+        DisplayDspReport(player);
+    }
 
     return 0;
 }
\ No newline at end of file
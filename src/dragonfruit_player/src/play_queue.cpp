@@ -0,0 +1,168 @@
+#include "play_queue.hpp"
+
+#include <algorithm>
+
+PlayQueue::PlayQueue(const std::vector<std::filesystem::path>& paths) {
+    size_t total_length = 0;
+    for (const auto& path : paths) total_length += path.native().size();
+    m_chars.reserve(total_length);
+    m_offsets.reserve(paths.size() + 1);
+    m_entries.reserve(paths.size());
+
+    for (const auto& path : paths) Append(path);
+}
+
+PlayQueue::EntryId PlayQueue::Append(const std::filesystem::path& path) {
+    TrackId track = static_cast<TrackId>(m_offsets.size() - 1);
+    m_chars.append(path.native());
+    m_offsets.push_back(m_chars.size());
+
+    EntryId entry = static_cast<EntryId>(m_entries.size());
+    m_entries.push_back({.track = track});
+    Link(entry, m_tail);
+    if (m_current == NONE) m_current = entry;
+    return entry;
+}
+
+PlayQueue::EntryId PlayQueue::EnqueueNext(TrackId track) {
+    if (m_current == NONE) return NONE;
+
+    EntryId entry = static_cast<EntryId>(m_entries.size());
+    m_entries.push_back({.track = track});
+    Link(entry, m_current);
+    return entry;
+}
+
+void PlayQueue::Remove(EntryId entry) {
+    if (m_entries[entry].removed) return;
+
+    if (entry == m_current) m_current = m_size > 1 ? Next(entry) : NONE;
+    Unlink(entry);
+    m_entries[entry].removed = true;
+}
+
+void PlayQueue::MoveAfter(EntryId entry, EntryId after) {
+    if (entry == after || m_entries[entry].removed) return;
+
+    Unlink(entry);
+    Link(entry, after);
+}
+
+void PlayQueue::Shuffle(std::mt19937& rng) {
+    std::vector<EntryId> order = Order();
+    std::shuffle(order.begin(), order.end(), rng);
+    Relink(order);
+}
+
+void PlayQueue::Unshuffle() {
+    std::vector<EntryId> order;
+    order.reserve(m_size);
+    for (EntryId entry = 0; entry < m_entries.size(); entry++) {
+        if (!m_entries[entry].removed) order.push_back(entry);
+    }
+    Relink(order);
+}
+
+void PlayQueue::Sort(const std::function<bool(TrackId, TrackId)>& less) {
+    std::vector<EntryId> order = Order();
+    std::stable_sort(order.begin(), order.end(),
+                     [&](EntryId a, EntryId b) { return less(m_entries[a].track, m_entries[b].track); });
+    Relink(order);
+}
+
+PlayQueue::EntryId PlayQueue::Next(EntryId entry) const {
+    EntryId next = m_entries[entry].next;
+    return next == NONE ? m_head : next;
+}
+
+PlayQueue::EntryId PlayQueue::Prev(EntryId entry) const {
+    EntryId prev = m_entries[entry].prev;
+    return prev == NONE ? m_tail : prev;
+}
+
+PlayQueue::EntryId PlayQueue::EntryAt(size_t index) const { return Order()[index]; }
+
+size_t PlayQueue::IndexOf(EntryId entry) const {
+    Order();
+    return m_positions[entry];
+}
+
+PlayQueue::EntryId PlayQueue::FindEntry(TrackId track) const {
+    for (EntryId entry = 0; entry < m_entries.size(); entry++) {
+        if (m_entries[entry].track == track && !m_entries[entry].removed) return entry;
+    }
+    return NONE;
+}
+
+std::string_view PlayQueue::PathView(TrackId track) const {
+    return std::string_view(m_chars).substr(m_offsets[track], m_offsets[track + 1] - m_offsets[track]);
+}
+
+void PlayQueue::Link(EntryId entry, EntryId after) {
+    Entry& e = m_entries[entry];
+    e.prev = after;
+    e.next = after == NONE ? m_head : m_entries[after].next;
+
+    if (e.prev == NONE) {
+        m_head = entry;
+    } else {
+        m_entries[e.prev].next = entry;
+    }
+    if (e.next == NONE) {
+        m_tail = entry;
+    } else {
+        m_entries[e.next].prev = entry;
+    }
+
+    m_size++;
+    m_order_dirty = true;
+}
+
+void PlayQueue::Unlink(EntryId entry) {
+    Entry& e = m_entries[entry];
+    if (e.prev == NONE) {
+        m_head = e.next;
+    } else {
+        m_entries[e.prev].next = e.next;
+    }
+    if (e.next == NONE) {
+        m_tail = e.prev;
+    } else {
+        m_entries[e.next].prev = e.prev;
+    }
+
+    e.prev = NONE;
+    e.next = NONE;
+    m_size--;
+    m_order_dirty = true;
+}
+
+void PlayQueue::Relink(const std::vector<EntryId>& order) {
+    for (size_t i = 0; i < order.size(); i++) {
+        Entry& e = m_entries[order[i]];
+        e.prev = i > 0 ? order[i - 1] : NONE;
+        e.next = i + 1 < order.size() ? order[i + 1] : NONE;
+    }
+    m_head = order.empty() ? NONE : order.front();
+    m_tail = order.empty() ? NONE : order.back();
+
+    // The new order is already known, so the snapshot can be refreshed without walking the list
+    m_order = order;
+    m_positions.resize(m_entries.size());
+    for (size_t i = 0; i < m_order.size(); i++) m_positions[m_order[i]] = static_cast<uint32_t>(i);
+    m_order_dirty = false;
+}
+
+const std::vector<PlayQueue::EntryId>& PlayQueue::Order() const {
+    if (!m_order_dirty) return m_order;
+
+    m_order.clear();
+    m_order.reserve(m_size);
+    for (EntryId entry = m_head; entry != NONE; entry = m_entries[entry].next) m_order.push_back(entry);
+
+    m_positions.resize(m_entries.size());
+    for (size_t i = 0; i < m_order.size(); i++) m_positions[m_order[i]] = static_cast<uint32_t>(i);
+
+    m_order_dirty = false;
+    return m_order;
+}
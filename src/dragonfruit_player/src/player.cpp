@@ -1,50 +1,444 @@
 #include "player.hpp"
 
 #include <algorithm>
+#include <dragonfruit_engine/http_reader.hpp>
+#include <dragonfruit_engine/trace.hpp>
 #include <iostream>
+#include <map>
 #include <random>
+#include <unordered_set>
 
-Player::Player(const std::vector<std::filesystem::path>& song_files) : m_song_paths(song_files) {}
+Player::Player(const std::vector<std::filesystem::path>& song_files, const PlayerOptions& options)
+    : m_options(options),
+      m_buffer_pool({.huge_pages = options.huge_pages}),
+      // Cached songs are locked in real-time mode too, so songs played again from the cache never page fault either
+      m_tracks({.budget_bytes = options.track_cache_bytes,
+                .load = {.direct_io = options.direct_io, .pool = &m_buffer_pool, .lock_memory = options.realtime}}),
+      m_engine(dragonfruit::AudioEngine::Create({.realtime = options.realtime,
+                                                 .backend = options.backend,
+                                                 .alsa_device = options.alsa_device,
+                                                 .alsa_period_us = options.alsa_period_us,
+                                                 .alsa_periods = options.alsa_periods,
+                                                 .impulse_response = options.impulse_response,
+                                                 .convolution_partition = options.convolution_partition})),
+      m_queue(song_files) {
+    IndexSongs(0, song_files);
+    m_command_thread = std::thread(&Player::CommandLoop, this);
+}
 
-Player::~Player() {}
+Player::~Player() {
+    m_stopping.store(true, std::memory_order_relaxed);
+    m_commands.Push({.type = PlayerCommand::Type::QUIT});
+    m_command_thread.join();
+}
 
-void Player::Pause(bool pause) { m_engine.Pause(pause); }
+void Player::Pause(bool pause) {
+    m_paused.store(pause, std::memory_order_relaxed);
+    m_commands.Push({.type = PlayerCommand::Type::PAUSE, .pause = pause});
+}
 
 void Player::Play(int idx) {
-    int clamped_idx = std::clamp(idx, 0, static_cast<int>(m_song_paths.size()) - 1);
-    m_cur_song_idx = clamped_idx;
+    if (m_queue.Size() == 0) return;
 
-    // Load in the new song
-    std::shared_ptr<dragonfruit::Sound> tmp_song(new dragonfruit::Sound(m_song_paths[m_cur_song_idx]));
-    m_engine.PlayAsync(tmp_song);
-
-    // Once the old sound has finished, we swap it out with the temp one. This ensures proper freeing of the sound.
-    std::swap(tmp_song, m_cur_sound);
+    int clamped_idx = std::clamp(idx, 0, static_cast<int>(m_queue.Size()) - 1);
+    PlayEntry(m_queue.EntryAt(clamped_idx));
 }
 
 void Player::PlayRelative(int delta) {
-    int total_songs = m_song_paths.size();
-    int wrapped_idx = ((m_cur_song_idx + delta) % total_songs + total_songs) % total_songs;
-    Play(wrapped_idx);
+    PlayQueue::EntryId entry = m_queue.Current();
+    if (entry == PlayQueue::NONE) return;
+
+    for (; delta > 0; delta--) entry = m_queue.Next(entry);
+    for (; delta < 0; delta++) entry = m_queue.Prev(entry);
+    PlayEntry(entry);
 }
 
-double Player::GetCurrentSongTime() { return m_engine.GetCurrentSongTime(); }
+void Player::PlayEntry(PlayQueue::EntryId entry) {
+    m_queue.SetCurrent(entry);
+    uint64_t generation = m_requested_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
 
-double Player::GetTotalSongTime() { return m_engine.GetTotalSongTime(); }
+    // Paths are copied now, the queue may be edited before the engine thread gets to them
+    PlayerCommand command{.type = PlayerCommand::Type::PLAY,
+                          .path = m_queue.Path(m_queue.TrackOf(entry)),
+                          .generation = generation};
+    if (m_options.prefetch && m_options.track_cache_bytes > 0) {
+        for (PlayQueue::EntryId neighbor : {m_queue.Next(entry), m_queue.Prev(entry)}) {
+            if (neighbor != PlayQueue::NONE && neighbor != entry) {
+                command.neighbors.push_back(m_queue.Path(m_queue.TrackOf(neighbor)));
+            }
+        }
+    }
+    m_commands.Push(std::move(command));
+}
+
+void Player::PlayTrack(PlayQueue::TrackId track) {
+    PlayQueue::EntryId entry = m_queue.FindEntry(track);
+    if (entry == PlayQueue::NONE) entry = m_queue.EnqueueNext(track);
+    if (entry != PlayQueue::NONE) PlayEntry(entry);
+}
+
+void Player::EnqueueNext(size_t idx) {
+    if (idx < m_queue.Size()) m_queue.EnqueueNext(m_queue.TrackOf(m_queue.EntryAt(idx)));
+}
 
-void Player::Seek(double seconds) { m_engine.Seek(seconds); }
+void Player::Remove(size_t idx) {
+    // The last song is kept, the rest of the player assumes there is always a current song
+    if (idx >= m_queue.Size() || m_queue.Size() == 1) return;
+
+    PlayQueue::EntryId entry = m_queue.EntryAt(idx);
+    bool was_current = entry == m_queue.Current();
+    m_queue.Remove(entry);
+    if (was_current) PlayEntry(m_queue.Current());
+}
+
+void Player::Move(size_t from, size_t to) {
+    if (from >= m_queue.Size() || to >= m_queue.Size() || from == to) return;
+
+    // Moving down the queue shifts everything in between up by one, so the song lands after the one currently at `to`
+    PlayQueue::EntryId entry = m_queue.EntryAt(from);
+    PlayQueue::EntryId after = to == 0 ? PlayQueue::NONE : m_queue.EntryAt(from < to ? to : to - 1);
+    m_queue.MoveAfter(entry, after);
+}
+
+double Player::GetCurrentSongTime() { return m_engine->GetCurrentSongTime(); }
+
+double Player::GetTotalSongTime() { return m_engine->GetTotalSongTime(); }
+
+void Player::Seek(double seconds) { m_commands.Push({.type = PlayerCommand::Type::SEEK, .value = seconds}); }
 
 void Player::Shuffle() {
+    if (m_queue.Size() == 0) return;
+
     std::random_device rd;
     std::mt19937 generator(rd());
 
-    std::shuffle(m_song_paths.begin(), m_song_paths.end(), generator);
+    m_queue.Shuffle(generator);
+    m_queue.MoveAfter(m_queue.Current(), PlayQueue::NONE);
+}
+
+void Player::Unshuffle() { m_queue.Unshuffle(); }
+
+void Player::SortByTempo() {
+    if (m_queue.Size() == 0) return;
+
+    // Looked up once per track rather than once per comparison
+    std::vector<double> bpm(m_queue.TrackCount(), 0.0);
+    for (PlayQueue::TrackId track = 0; track < bpm.size(); track++) {
+        auto tempo = m_tempo.Find(m_queue.Path(track));
+        if (tempo) bpm[track] = tempo->bpm;
+    }
+    m_queue.Sort([&](PlayQueue::TrackId a, PlayQueue::TrackId b) {
+        if (bpm[b] == 0.0) return bpm[a] != 0.0;
+        return bpm[a] != 0.0 && bpm[a] < bpm[b];
+    });
+}
+
+bool Player::SyncQueue() {
+    bool changed = false;
+    while (!m_song_sources.empty()) {
+        std::vector<std::filesystem::path> songs = m_song_sources.front()->Take();
+        AppendSongs(songs);
+        changed |= !songs.empty();
+
+        // Later sources have to wait for this one so the queue keeps their order
+        if (!m_song_sources.front()->IsDone()) break;
+        m_song_sources.pop_front();
+    }
+
+    // Songs which changed while the sources were still scanning wait for them, so the scan and the watcher never both
+    // add the same song
+    if (m_library && m_song_sources.empty()) changed |= ApplyLibraryChanges(m_library->Take());
+
+    std::vector<ProbedTags> probed;
+    {
+        std::lock_guard<std::mutex> lock(m_probed_mutex);
+        probed.swap(m_probed);
+    }
+    for (const ProbedTags& tags : probed) m_search_index.Add(tags.track, tags.text);
+
+    return changed;
+}
+
+bool Player::WaitForSongs() {
+    while (m_queue.Size() == 0 && !m_song_sources.empty()) {
+        AppendSongs(m_song_sources.front()->WaitAndTake());
+        if (m_song_sources.front()->IsDone()) m_song_sources.pop_front();
+    }
+    return m_queue.Size() > 0;
+}
+
+std::vector<SearchIndex::Match> Player::Search(std::string_view query, size_t limit) {
+    dragonfruit::TraceScope trace("Player::Search");
+    return m_search_index.Search(query, limit);
+}
+
+void Player::AppendSongs(const std::vector<std::filesystem::path>& songs) {
+    if (songs.empty()) return;
+
+    PlayQueue::TrackId first = m_queue.TrackOf(m_queue.Append(songs.front()));
+    for (size_t i = 1; i < songs.size(); i++) m_queue.Append(songs[i]);
+    IndexSongs(first, songs);
+}
+
+bool Player::ApplyLibraryChanges(const LibraryChanges& changes) {
+    if (changes.Empty()) return false;
+    dragonfruit::TraceScope trace("Player::ApplyLibraryChanges");
+
+    // Find the tracks of the changed songs in a single pass over the queue's paths. A song can have several tracks if
+    // it was added more than once, such as from a directory and from a playlist.
+    std::map<std::string, std::vector<PlayQueue::TrackId>, std::less<>> tracks;
+    for (const std::filesystem::path& path : changes.updated) tracks.try_emplace(path.native());
+    for (const std::filesystem::path& path : changes.removed) tracks.try_emplace(path.native());
+    for (PlayQueue::TrackId track = 0; track < m_queue.TrackCount(); track++) {
+        auto it = tracks.find(m_queue.PathView(track));
+        if (it != tracks.end()) it->second.push_back(track);
+    }
+
+    // Songs already in the queue are rewritten ones, their tags are read again
+    std::vector<std::filesystem::path> added;
+    for (const std::filesystem::path& path : changes.updated) {
+        m_tracks.Forget(path);
+        const std::vector<PlayQueue::TrackId>& song_tracks = tracks.find(path.native())->second;
+        if (song_tracks.empty()) added.push_back(path);
+        for (PlayQueue::TrackId track : song_tracks) {
+            m_search_index.Remove(track);
+            IndexSongs(track, {path});
+        }
+    }
+
+    std::unordered_set<PlayQueue::TrackId> removed;
+    for (const std::filesystem::path& path : changes.removed) {
+        m_tracks.Forget(path);
+        for (PlayQueue::TrackId track : tracks.find(path.native())->second) {
+            m_search_index.Remove(track);
+            removed.insert(track);
+        }
+    }
+
+    // The current song keeps playing from memory, it is left in the queue so playback is not interrupted
+    std::vector<PlayQueue::EntryId> entries;
+    for (size_t i = 0; i < m_queue.Size() && !removed.empty(); i++) {
+        PlayQueue::EntryId entry = m_queue.EntryAt(i);
+        if (entry != m_queue.Current() && removed.contains(m_queue.TrackOf(entry))) entries.push_back(entry);
+    }
+    for (PlayQueue::EntryId entry : entries) m_queue.Remove(entry);
+
+    AppendSongs(added);
+    return !added.empty() || !entries.empty();
+}
+
+void Player::IndexSongs(PlayQueue::TrackId first, const std::vector<std::filesystem::path>& songs) {
+    // Filenames are indexed straight away, tags are read in the background and indexed by SyncQueue. Tracks are
+    // numbered in the order they were appended, so the songs are tracks first onwards.
+    for (size_t i = 0; i < songs.size(); i++) m_search_index.Add(first + i, songs[i].filename().string());
+
+    for (size_t begin = 0; begin < songs.size(); begin += TAG_PROBE_BATCH) {
+        size_t end = std::min(songs.size(), begin + TAG_PROBE_BATCH);
+        std::vector<std::filesystem::path> batch(songs.begin() + begin, songs.begin() + end);
+        m_tag_probe.Submit([this, track = static_cast<PlayQueue::TrackId>(first + begin), batch = std::move(batch)] {
+            std::vector<ProbedTags> probed;
+            for (size_t i = 0; i < batch.size(); i++) {
+                // Queued jobs still run when the pool is destroyed
+                if (m_stopping.load(std::memory_order_relaxed)) return;
+
+                std::unordered_map<std::string, std::string> tags = dragonfruit::Sound::ReadInfoTags(batch[i]);
+                std::string text;
+                for (const char* id : {"INAM", "IART", "IPRD"}) {
+                    auto it = tags.find(id);
+                    if (it != tags.end()) text += it->second + ' ';
+                }
+                if (text.empty()) continue;
+                probed.push_back({.track = static_cast<PlayQueue::TrackId>(track + i), .text = std::move(text)});
+            }
 
-    Play(0);
+            std::lock_guard<std::mutex> lock(m_probed_mutex);
+            m_probed.insert(m_probed.end(), std::make_move_iterator(probed.begin()),
+                            std::make_move_iterator(probed.end()));
+        });
+    }
 }
 
 void Player::SetVolume(double volume) {
     double volume_clamped = std::clamp(volume, 0.0, 1.0);
-    m_engine.SetVolume(volume_clamped);
     m_cur_volume = volume_clamped;
-}
\ No newline at end of file
+    m_commands.Push({.type = PlayerCommand::Type::SET_VOLUME, .value = volume_clamped});
+}
+
+void Player::SetSpeed(double speed) {
+    using dragonfruit::TimeStretcher;
+    double speed_clamped = std::clamp(speed, TimeStretcher::MIN_SPEED, TimeStretcher::MAX_SPEED);
+    m_cur_speed = speed_clamped;
+    m_commands.Push({.type = PlayerCommand::Type::SET_SPEED, .value = speed_clamped});
+}
+
+void Player::StartSong(const PlayerCommand& command) {
+    dragonfruit::TraceScope trace("Player::StartSong");
+    // Stop and release the old song before loading the new one. It stays in the track cache, unless the cache is full,
+    // in which case its sample buffer goes back to the pool and is reused for the new song.
+    m_engine->Stop();
+    {
+        std::lock_guard<std::mutex> lock(m_sound_mutex);
+        m_cur_sound.reset();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_waveform_mutex);
+        m_waveform.reset();
+    }
+
+    // Load in the new song, unless it is cached. Only the headers are read here, the sample data streams in while the
+    // song starts playing.
+    try {
+        std::shared_ptr<dragonfruit::Sound> sound = m_tracks.Get(command.path);
+
+        // Songs which have not been analysed yet play unchanged
+        double gain = 1.0;
+        if (m_options.normalization != dragonfruit::GainMode::NONE) {
+            auto loudness = m_loudness.Find(command.path);
+            if (loudness) gain = dragonfruit::ReplayGain(*loudness, m_options.normalization);
+        }
+        m_engine->SetGain(gain);
+        m_engine->PlayAsync(sound);
+
+        std::lock_guard<std::mutex> lock(m_sound_mutex);
+        m_cur_sound = sound;
+    } catch (const dragonfruit::Exception&) {
+        // The song could not be played. The engine stays finished, so the frontend moves on to the next song.
+    }
+
+    // A new stream starts playing at the default volume, carry the player's state over to it
+    m_engine->SetVolume(m_cur_volume);
+    if (m_paused) m_engine->Pause(true);
+}
+
+void Player::LoadWaveform(const std::filesystem::path& path, uint64_t generation) {
+    m_background.Submit([this, path, generation] {
+        // Skip songs which were already skipped past while this job was queued, or once the player is shutting down
+        if (m_stopping.load(std::memory_order_relaxed)) return;
+        if (m_requested_generation.load(std::memory_order_acquire) != generation) return;
+
+        // Streamed songs would have to be downloaded a second time, which a slow link can not afford
+        if (dragonfruit::IsHttpUrl(path.native())) return;
+
+        // The waveform is computed from the same Sound the engine plays, which the track cache already holds, as its
+        // samples arrive. Computing stops once the song is skipped or the player shuts down.
+        std::optional<dragonfruit::Waveform> waveform = dragonfruit::Waveform::LoadCached(path);
+        if (!waveform) {
+            auto cancelled = [this, generation] {
+                return m_stopping.load(std::memory_order_relaxed) ||
+                       m_requested_generation.load(std::memory_order_acquire) != generation;
+            };
+            try {
+                waveform = dragonfruit::Waveform::Compute(*m_tracks.Get(path), cancelled);
+            } catch (const dragonfruit::Exception&) {
+                return;
+            }
+            if (!waveform) return;
+            waveform->SaveCached(path);
+        }
+
+        std::lock_guard<std::mutex> lock(m_waveform_mutex);
+        if (m_requested_generation.load(std::memory_order_acquire) == generation) {
+            m_waveform = std::make_shared<const dragonfruit::Waveform>(std::move(*waveform));
+        }
+    });
+}
+
+void Player::PrefetchNeighbors(const std::vector<std::filesystem::path>& paths, uint64_t generation) {
+    for (const std::filesystem::path& path : paths) {
+        m_background.Submit([this, path, generation] {
+            // Nothing is prefetched for songs which were already skipped past, or once the player is shutting down
+            if (m_stopping.load(std::memory_order_relaxed)) return;
+            if (m_requested_generation.load(std::memory_order_acquire) != generation) return;
+            m_tracks.Prefetch(path);
+        });
+    }
+}
+
+void Player::CommandLoop() {
+    using Clock = std::chrono::steady_clock;
+
+    // Commands which have been received but not applied yet
+    std::optional<PlayerCommand> pending_play;
+    double pending_seek = 0.0;
+    bool has_volume = false;
+    double pending_volume = 0.0;
+    bool has_speed = false;
+    double pending_speed = 0.0;
+    bool has_pause = false;
+    bool pending_pause = false;
+    Clock::time_point last_play;
+
+    while (true) {
+        int timeout_ms = -1;
+        if (pending_play) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(last_play + PLAY_DEBOUNCE - Clock::now());
+            timeout_ms = std::max<int>(0, remaining.count());
+        }
+        m_commands.Wait(timeout_ms);
+
+        // Fold everything queued so far into a single set of engine operations
+        PlayerCommand command;
+        while (m_commands.TryPop(command)) {
+            switch (command.type) {
+                case PlayerCommand::Type::PLAY:
+                    pending_play = std::move(command);
+                    pending_seek = 0.0;  // Seeks queued before a song change no longer apply
+                    break;
+                case PlayerCommand::Type::SEEK:
+                    pending_seek += command.value;
+                    break;
+                case PlayerCommand::Type::SET_VOLUME:
+                    has_volume = true;
+                    pending_volume = command.value;
+                    break;
+                case PlayerCommand::Type::SET_SPEED:
+                    has_speed = true;
+                    pending_speed = command.value;
+                    break;
+                case PlayerCommand::Type::PAUSE:
+                    has_pause = true;
+                    pending_pause = command.pause;
+                    break;
+                case PlayerCommand::Type::QUIT:
+                    return;
+            }
+        }
+
+        // Song changes are applied straight away unless one was applied very recently, in which case the latest
+        // request is held back until the debounce window has passed
+        if (pending_play && Clock::now() - last_play >= PLAY_DEBOUNCE) {
+            StartSong(*pending_play);
+            m_started_generation.store(pending_play->generation, std::memory_order_release);
+            LoadWaveform(pending_play->path, pending_play->generation);
+            PrefetchNeighbors(pending_play->neighbors, pending_play->generation);
+            last_play = Clock::now();
+            pending_play.reset();
+
+            // Starting a song applies the current volume and pause state itself
+            has_volume = false;
+            has_pause = false;
+        }
+
+        if (has_volume) {
+            m_engine->SetVolume(pending_volume);
+            has_volume = false;
+        }
+
+        if (has_pause) {
+            m_engine->Pause(pending_pause);
+            has_pause = false;
+        }
+
+        // The engine keeps its speed across songs, so a speed change is applied even while a song change is held back
+        if (has_speed) {
+            m_engine->SetSpeed(pending_speed);
+            has_speed = false;
+        }
+
+        // Seeks are held back along with a deferred song change since they are meant for the new song
+        if (!pending_play && pending_seek != 0.0) {
+            m_engine->Seek(pending_seek);
+            pending_seek = 0.0;
+        }
+    }
+}
@@ -0,0 +1,243 @@
+#include "playlist.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <dragonfruit_engine/exception.hpp>
+#include <dragonfruit_engine/http_reader.hpp>
+#include <format>
+
+namespace {
+
+std::string LowercaseExtension(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return extension;
+}
+
+std::string_view Trim(std::string_view text) {
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) return {};
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(start, end - start + 1);
+}
+
+// Matches the "FileN=" keys of a PLS playlist, returning the value
+bool ParsePlsFileKey(std::string_view line, std::string_view& value) {
+    if (line.size() < 5 || std::tolower(line[0]) != 'f' || std::tolower(line[1]) != 'i' ||
+        std::tolower(line[2]) != 'l' || std::tolower(line[3]) != 'e') {
+        return false;
+    }
+
+    size_t i = 4;
+    while (i < line.size() && std::isdigit(static_cast<unsigned char>(line[i]))) i++;
+    if (i == 4 || i >= line.size() || line[i] != '=') return false;
+
+    value = Trim(line.substr(i + 1));
+    return true;
+}
+
+int HexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Turns a file:// URL into a local path, decoding %XX escapes. Only URLs of this machine are accepted, which have
+// either no host (file:///music/a.wav) or localhost (file://localhost/music/a.wav).
+bool ParseFileUrl(std::string_view url, std::string& path) {
+    url.remove_prefix(7);
+    size_t slash = url.find('/');
+    if (slash == std::string_view::npos) return false;
+
+    std::string_view host = url.substr(0, slash);
+    auto same_letter = [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; };
+    if (!host.empty() && !std::ranges::equal(host, std::string_view("localhost"), same_letter)) return false;
+
+    std::string_view encoded = url.substr(slash);
+    path.clear();
+    path.reserve(encoded.size());
+    for (size_t i = 0; i < encoded.size(); i++) {
+        int high = encoded[i] == '%' && i + 2 < encoded.size() ? HexDigit(encoded[i + 1]) : -1;
+        int low = high >= 0 ? HexDigit(encoded[i + 2]) : -1;
+        if (low >= 0) {
+            path.push_back(static_cast<char>(high << 4 | low));
+            i += 2;
+        } else {
+            path.push_back(encoded[i]);
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool IsPlaylistFile(const std::filesystem::path& path) {
+    std::string extension = LowercaseExtension(path);
+    return extension == ".m3u" || extension == ".m3u8" || extension == ".pls";
+}
+
+void ParsePlaylist(std::string_view data, bool pls, const std::function<void(std::string_view)>& on_entry) {
+    // Skip a UTF-8 byte order mark, which some tools write at the start of M3U8 files
+    if (data.starts_with("\xEF\xBB\xBF")) data.remove_prefix(3);
+
+    const char* cursor = data.data();
+    const char* end = data.data() + data.size();
+    while (cursor < end) {
+        const char* newline = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+        const char* line_end = newline ? newline : end;
+        std::string_view line = Trim(std::string_view(cursor, line_end - cursor));
+        cursor = line_end + 1;
+
+        if (line.empty()) continue;
+        if (pls) {
+            std::string_view value;
+            if (ParsePlsFileKey(line, value) && !value.empty()) on_entry(value);
+        } else if (line[0] != '#') {
+            on_entry(line);
+        }
+    }
+}
+
+PlaylistLoader::PlaylistLoader(const std::vector<std::filesystem::path>& playlists,
+                               std::function<bool(const std::filesystem::path&)> is_song)
+    : m_is_song(std::move(is_song)) {
+    // Every playlist is opened up front so that a bad path is reported straight away, only the parsing is deferred
+    for (const auto& playlist : playlists) {
+        MappedPlaylist mapped{.directory = std::filesystem::absolute(playlist).parent_path(),
+                              .pls = LowercaseExtension(playlist) == ".pls"};
+
+        int fd = open(playlist.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0) close(fd);
+            for (auto& other : m_playlists) munmap(const_cast<char*>(other.data), other.size);
+            throw dragonfruit::Exception(dragonfruit::ErrorCode::IO_ERROR,
+                                         std::format("Could not open playlist {}", playlist.string()));
+        }
+
+        if (st.st_size > 0) {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, st.st_size, MADV_SEQUENTIAL);
+                mapped.data = static_cast<const char*>(data);
+                mapped.size = st.st_size;
+            }
+        }
+        close(fd);
+        m_playlists.push_back(std::move(mapped));
+    }
+
+    m_reader = std::thread(&PlaylistLoader::ReadLoop, this);
+}
+
+PlaylistLoader::~PlaylistLoader() {
+    m_stopping = true;
+    m_reader.join();
+    for (auto& playlist : m_playlists) {
+        if (playlist.data) munmap(const_cast<char*>(playlist.data), playlist.size);
+    }
+}
+
+std::vector<std::filesystem::path> PlaylistLoader::Take() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return TakeLocked();
+}
+
+std::vector<std::filesystem::path> PlaylistLoader::WaitAndTake() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        std::vector<std::filesystem::path> songs = TakeLocked();
+        if (!songs.empty() || m_read_done) return songs;
+        m_ready_cv.wait(lock);
+    }
+}
+
+bool PlaylistLoader::IsDone() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_read_done && m_checked.empty();
+}
+
+std::vector<std::filesystem::path> PlaylistLoader::TakeLocked() {
+    // Batches can finish checking out of order, only the run which continues from the last one taken is handed out
+    std::vector<std::filesystem::path> songs;
+    for (auto it = m_checked.begin(); it != m_checked.end() && it->first == m_next_take; it = m_checked.erase(it)) {
+        if (songs.empty()) {
+            songs = std::move(it->second);
+        } else {
+            songs.insert(songs.end(), std::make_move_iterator(it->second.begin()),
+                         std::make_move_iterator(it->second.end()));
+        }
+        m_next_take++;
+    }
+    return songs;
+}
+
+void PlaylistLoader::ReadLoop() {
+    std::vector<std::filesystem::path> batch;
+    size_t batch_size = FIRST_BATCH_SIZE;
+    batch.reserve(batch_size);
+
+    std::string decoded;  // Path of the last file:// URL
+
+    for (const auto& playlist : m_playlists) {
+        if (!playlist.data) continue;
+
+        ParsePlaylist(std::string_view(playlist.data, playlist.size), playlist.pls, [&](std::string_view location) {
+            if (m_stopping) return;
+
+            // Local files may also be written as file:// URLs and songs on HTTP servers are streamed, anything else is
+            // a stream the player cannot open
+            bool remote = dragonfruit::IsHttpUrl(location);
+            if (location.starts_with("file://")) {
+                if (!ParseFileUrl(location, decoded)) return;
+                location = decoded;
+            } else if (location.find("://") != std::string_view::npos && !remote) {
+                return;
+            }
+
+            std::filesystem::path path(location);
+            batch.push_back(path.is_absolute() || remote ? std::move(path) : playlist.directory / path);
+            if (batch.size() >= batch_size) {
+                SubmitBatch(std::move(batch));
+                batch_size = BATCH_SIZE;
+                batch = {};
+                batch.reserve(batch_size);
+            }
+        });
+    }
+    if (!batch.empty()) SubmitBatch(std::move(batch));
+
+    m_pool.Wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_read_done = true;
+    }
+    m_ready_cv.notify_all();
+}
+
+void PlaylistLoader::SubmitBatch(std::vector<std::filesystem::path> batch) {
+    size_t sequence = m_next_submit++;
+    m_pool.Submit([this, sequence, batch = std::move(batch)]() mutable {
+        if (m_stopping) return;
+
+        std::erase_if(batch, [&](const std::filesystem::path& path) {
+            std::error_code ec;
+            if (dragonfruit::IsHttpUrl(path.native())) return false;
+            return !m_is_song(path) || !std::filesystem::is_regular_file(path, ec);
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_checked.emplace(sequence, std::move(batch));
+        }
+        m_ready_cv.notify_all();
+    });
+}
@@ -0,0 +1,185 @@
+#include "search_index.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+namespace {
+
+// Lowercases ASCII letters and turns everything else ASCII but digits into word breaks. Bytes of multi-byte UTF-8
+// characters are kept as they are, so words in other scripts can still be found by exact trigrams.
+std::string Normalize(std::string_view text) {
+    std::string normalized;
+    normalized.reserve(text.size());
+    bool in_word = false;
+    for (char c : text) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (std::isalnum(byte) || byte >= 0x80) {
+            if (!in_word && !normalized.empty()) normalized.push_back(' ');
+            normalized.push_back(static_cast<char>(std::tolower(byte)));
+            in_word = true;
+        } else {
+            in_word = false;
+        }
+    }
+    return normalized;
+}
+
+constexpr uint32_t Key(char a, char b, char c) {
+    return static_cast<uint32_t>(static_cast<unsigned char>(a)) << 16 |
+           static_cast<uint32_t>(static_cast<unsigned char>(b)) << 8 | static_cast<unsigned char>(c);
+}
+
+// Trigrams of every word with a leading space, plus the word's first letter alone so single letters match prefixes.
+// Queries only need the first letter for words of a single letter. Sorted without duplicates.
+std::vector<uint32_t> Keys(std::string_view normalized, bool query) {
+    std::vector<uint32_t> keys;
+    size_t start = 0;
+    while (start < normalized.size()) {
+        size_t end = normalized.find(' ', start);
+        if (end == std::string_view::npos) end = normalized.size();
+
+        std::string_view word = normalized.substr(start, end - start);
+        if (!query || word.size() == 1) keys.push_back(Key(' ', word[0], '\0'));
+        if (word.size() >= 2) keys.push_back(Key(' ', word[0], word[1]));
+        for (size_t i = 0; i + 2 < word.size(); i++) keys.push_back(Key(word[i], word[i + 1], word[i + 2]));
+        start = end + 1;
+    }
+
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+std::vector<std::string_view> Words(std::string_view normalized) {
+    std::vector<std::string_view> words;
+    size_t start = 0;
+    while (start < normalized.size()) {
+        size_t end = normalized.find(' ', start);
+        if (end == std::string_view::npos) end = normalized.size();
+        words.push_back(normalized.substr(start, end - start));
+        start = end + 1;
+    }
+    return words;
+}
+
+}  // namespace
+
+void SearchIndex::Add(DocumentId document, std::string_view text) {
+    std::string normalized = Normalize(text);
+    if (normalized.empty()) return;
+
+    if (document >= m_documents.size()) {
+        m_documents.resize(document + 1);
+        m_lengths.resize(document + 1);
+    }
+    std::string& stored = m_documents[document];
+
+    // A document gaining more text is only added to the posting lists of trigrams it did not have yet
+    std::vector<uint32_t> old_keys = Keys(stored, false);
+    if (stored.empty()) {
+        m_document_count++;
+    } else {
+        stored.push_back(' ');
+    }
+    stored += normalized;
+    m_lengths[document] = std::min<size_t>(stored.size(), UINT16_MAX);
+
+    for (uint32_t key : Keys(normalized, false)) {
+        if (!std::binary_search(old_keys.begin(), old_keys.end(), key)) m_postings[key].push_back(document);
+    }
+}
+
+void SearchIndex::Remove(DocumentId document) {
+    if (document >= m_documents.size() || m_documents[document].empty()) return;
+
+    for (uint32_t key : Keys(m_documents[document], false)) {
+        auto it = m_postings.find(key);
+        if (it == m_postings.end()) continue;
+        std::erase(it->second, document);
+        if (it->second.empty()) m_postings.erase(it);
+    }
+    m_documents[document].clear();
+    m_lengths[document] = 0;
+    m_document_count--;
+}
+
+std::vector<SearchIndex::Match> SearchIndex::Search(std::string_view query, size_t limit) const {
+    std::string normalized = Normalize(query);
+    std::vector<uint32_t> keys = Keys(normalized, true);
+    if (keys.empty() || limit == 0) return {};
+
+    // Count the query trigrams each document shares, visiting only their posting lists
+    std::vector<uint16_t> counts(m_documents.size(), 0);
+    std::vector<DocumentId> touched;
+    touched.reserve(m_document_count);
+    for (uint32_t key : keys) {
+        auto it = m_postings.find(key);
+        if (it == m_postings.end()) continue;
+        for (DocumentId document : it->second) {
+            if (counts[document]++ == 0) touched.push_back(document);
+        }
+    }
+
+    // Group the candidates by how many trigrams they share, so the bonuses below are only computed for as many
+    // groups as could still make it into the results. Groups are laid out back to back, best first.
+    uint16_t needed = std::max<uint16_t>(1, std::ceil(keys.size() * MIN_TRIGRAM_SHARE));
+    std::vector<size_t> group_end(keys.size() + 2, 0);
+    for (DocumentId document : touched) {
+        if (counts[document] >= needed) group_end[keys.size() - counts[document] + 1]++;
+    }
+    for (size_t i = 1; i < group_end.size(); i++) group_end[i] += group_end[i - 1];
+
+    std::vector<DocumentId> grouped(group_end.back());
+    std::vector<size_t> fill(group_end.begin(), group_end.end() - 1);
+    for (DocumentId document : touched) {
+        if (counts[document] >= needed) grouped[fill[keys.size() - counts[document]]++] = document;
+    }
+
+    std::vector<std::string_view> words = Words(normalized);
+    std::vector<Match> matches;
+    float cutoff = -1.0f;  // Score of the worst match which would currently be returned
+    for (size_t count = keys.size(); count >= needed; count--) {
+        float share = static_cast<float>(count) / keys.size();
+        if (matches.size() >= limit && share + MAX_BONUS <= cutoff) break;
+
+        // When a group holds far more documents than can be returned, only its shortest ones are worth scoring
+        auto begin = grouped.begin() + group_end[keys.size() - count];
+        auto end = grouped.begin() + group_end[keys.size() - count + 1];
+        if (static_cast<size_t>(end - begin) > limit * 4) {
+            std::nth_element(begin, begin + limit * 4, end,
+                             [&](DocumentId a, DocumentId b) { return m_lengths[a] < m_lengths[b]; });
+            end = begin + limit * 4;
+        }
+
+        for (auto it = begin; it != end; it++) {
+            // Whole words and word prefixes rank above scattered trigrams
+            const std::string& text = m_documents[*it];
+            float score = share;
+            for (std::string_view word : words) {
+                size_t pos = text.find(word);
+                if (pos == std::string::npos) continue;
+                score += WORD_BONUS / words.size();
+                if (pos == 0 || text[pos - 1] == ' ') score += PREFIX_BONUS / words.size();
+            }
+            matches.push_back({.document = *it, .score = score});
+        }
+
+        if (matches.size() >= limit) {
+            std::nth_element(matches.begin(), matches.begin() + (limit - 1), matches.end(),
+                             [](const Match& a, const Match& b) { return a.score > b.score; });
+            cutoff = matches[limit - 1].score;
+        }
+    }
+
+    // Ties go to shorter texts, which match the query more closely, and then to earlier documents
+    auto better = [&](const Match& a, const Match& b) {
+        if (a.score != b.score) return a.score > b.score;
+        if (m_lengths[a.document] != m_lengths[b.document]) return m_lengths[a.document] < m_lengths[b.document];
+        return a.document < b.document;
+    };
+    size_t count = std::min(limit, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), better);
+    matches.resize(count);
+    return matches;
+}
@@ -0,0 +1,71 @@
+#include "song_scanner.hpp"
+
+#include <dragonfruit_engine/http_reader.hpp>
+
+SongScanner::SongScanner(const std::vector<std::filesystem::path>& paths,
+                         std::function<bool(const std::filesystem::path&)> is_song)
+    : m_is_song(std::move(is_song)), m_results(paths.size()) {
+    for (size_t i = 0; i < paths.size(); i++) {
+        m_pool.Submit([this, i, path = paths[i]] {
+            std::vector<std::filesystem::path> songs;
+            if (!m_stopping) songs = Scan(path);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_results[i] = std::move(songs);
+            }
+            m_ready_cv.notify_all();
+        });
+    }
+}
+
+SongScanner::~SongScanner() {
+    // The pool finishes its queued jobs when it is destroyed, they skip scanning once this is set
+    m_stopping = true;
+}
+
+std::vector<std::filesystem::path> SongScanner::Take() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return TakeLocked();
+}
+
+std::vector<std::filesystem::path> SongScanner::WaitAndTake() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        std::vector<std::filesystem::path> songs = TakeLocked();
+        if (!songs.empty() || m_next_take == m_results.size()) return songs;
+        m_ready_cv.wait(lock);
+    }
+}
+
+bool SongScanner::IsDone() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_next_take == m_results.size();
+}
+
+std::vector<std::filesystem::path> SongScanner::Scan(const std::filesystem::path& path) const {
+    std::vector<std::filesystem::path> songs;
+    std::error_code ec;
+    if (dragonfruit::IsHttpUrl(path.native())) {
+        // Nothing can be checked about a URL without downloading it, it fails to play if it is not a song
+        songs.push_back(path);
+    } else if (std::filesystem::is_regular_file(path, ec)) {
+        if (m_is_song(path)) songs.push_back(path);
+    } else if (std::filesystem::is_directory(path, ec)) {
+        for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+            if (entry.is_regular_file(ec) && m_is_song(entry.path())) songs.push_back(entry.path());
+        }
+    }
+    return songs;
+}
+
+std::vector<std::filesystem::path> SongScanner::TakeLocked() {
+    // Paths can finish scanning out of order, only the run which continues from the last one taken is handed out
+    std::vector<std::filesystem::path> songs;
+    for (; m_next_take < m_results.size() && m_results[m_next_take]; m_next_take++) {
+        std::vector<std::filesystem::path>& scanned = *m_results[m_next_take];
+        songs.insert(songs.end(), std::make_move_iterator(scanned.begin()), std::make_move_iterator(scanned.end()));
+        scanned = {};
+    }
+    return songs;
+}
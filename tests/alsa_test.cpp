@@ -0,0 +1,102 @@
+// Plays a WAV file through AlsaEngine into ALSA's file plugin, which passes it on to the null device and records every
+// frame written, and checks that the recording holds exactly the song's frames. Run by run_alsa_test.sh.
+//
+// Usage: alsa_test <song> <recording>
+//
+// Exits with 77, which CTest reports as skipped, if the file PCM cannot be opened, such as without an ALSA
+// configuration.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dragonfruit_engine/alsa_engine.hpp"
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/sound.hpp"
+
+using namespace dragonfruit;
+
+namespace {
+
+constexpr std::chrono::milliseconds POLL_INTERVAL{10};
+constexpr std::chrono::seconds TIMEOUT{60};
+constexpr float TOLERANCE = 1e-6f;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::printf("Usage: %s <song> <recording>\n", argv[0]);
+        return 2;
+    }
+    std::string recording = argv[2];
+
+    try {
+        auto sound = std::make_shared<Sound>(argv[1]);
+        sound->WaitForLoad();
+
+        {
+            // The engine asks for float samples first, which the null device takes, so the recording is the song's
+            // samples as the engine rendered them
+            AudioEngineOptions options;
+            options.alsa_device = "file:FILE=" + recording + ",FORMAT=raw";
+            AlsaEngine engine(options);
+            try {
+                engine.PlayAsync(sound);
+            } catch (const Exception& e) {
+                std::printf("%s, skipping\n", e.what());
+                return 77;
+            }
+
+            auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+            while (!engine.IsFinished()) {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    std::printf("Timed out waiting for the song to finish\n");
+                    return 1;
+                }
+                std::this_thread::sleep_for(POLL_INTERVAL);
+            }
+
+            // Closing the device flushes what the file plugin still buffers
+            engine.Stop();
+        }
+
+        size_t frame_bytes = sound->Channels() * sizeof(float);
+        size_t recorded_bytes = std::filesystem::file_size(recording);
+        if (recorded_bytes != sound->TotalFrames() * frame_bytes) {
+            std::printf("Recorded %zu bytes, %.2f frames, the song has %zu frames\n", recorded_bytes,
+                        static_cast<double>(recorded_bytes) / frame_bytes, sound->TotalFrames());
+            return 1;
+        }
+
+        std::vector<float> recorded(recorded_bytes / sizeof(float));
+        std::ifstream(recording, std::ios::binary).read(reinterpret_cast<char*>(recorded.data()), recorded_bytes);
+
+        size_t offset = 0;
+        bool matches = true;
+        sound->ReadAllAsFloat(4096, [&](const float* samples, size_t frames) {
+            for (size_t i = 0; matches && i < frames * sound->Channels(); i++) {
+                if (std::fabs(samples[i] - recorded[offset + i]) > TOLERANCE) {
+                    std::printf("Recorded sample %zu is %f, the song's is %f\n", offset + i, recorded[offset + i],
+                                samples[i]);
+                    matches = false;
+                }
+            }
+            offset += frames * sound->Channels();
+        });
+        if (!matches) return 1;
+
+        std::printf("Recorded all %zu frames of the song\n", sound->TotalFrames());
+    } catch (const std::exception& e) {
+        std::printf("%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
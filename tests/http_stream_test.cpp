@@ -0,0 +1,93 @@
+// Streams a WAV file from an HTTP server through HttpReader and checks that every byte played matches the local copy
+// of the file. Run by run_http_stream_test.sh against range_server.py, which throttles and drops connections.
+//
+// Usage: http_stream_test <url> <file>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "dragonfruit_engine/exception.hpp"
+#include "dragonfruit_engine/sound.hpp"
+
+using namespace dragonfruit;
+
+namespace {
+
+constexpr size_t READ_FRAMES = 4096;
+constexpr std::chrono::milliseconds POLL_INTERVAL{5};
+constexpr std::chrono::seconds TIMEOUT{120};
+
+// Reads from a streamed song until the data at offset arrives, and checks it against the local file
+bool ReadAndCompare(Sound& remote, Sound& local, size_t offset, size_t& read) {
+    std::vector<uint8_t> streamed(READ_FRAMES * remote.FrameSize());
+    std::vector<uint8_t> expected(streamed.size());
+    auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+
+    while ((read = remote.ReadPcm(offset, streamed.data(), streamed.size())) == 0) {
+        if (remote.IsLoaded() && remote.ReadPcm(offset, streamed.data(), streamed.size()) == 0) {
+            std::printf("Download finished without the data at %zu, failed: %d\n", offset, remote.LoadFailed());
+            return false;
+        }
+        if (std::chrono::steady_clock::now() > deadline) {
+            std::printf("Timed out waiting for the data at %zu\n", offset);
+            return false;
+        }
+        std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+
+    local.ReadPcm(offset, expected.data(), read);
+    if (std::memcmp(streamed.data(), expected.data(), read) != 0) {
+        std::printf("Streamed data differs from the file in the %zu bytes at %zu\n", read, offset);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::printf("Usage: %s <url> <file>\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        Sound local(argv[2], {.headers_only = true});
+        auto start = std::chrono::steady_clock::now();
+        Sound remote(argv[1]);
+
+        if (remote.PcmDataSize() != local.PcmDataSize() || remote.FrameSize() != local.FrameSize()) {
+            std::printf("Streamed song has %zu bytes of %zu byte frames, the file %zu bytes of %zu byte frames\n",
+                        remote.PcmDataSize(), remote.FrameSize(), local.PcmDataSize(), local.FrameSize());
+            return 1;
+        }
+
+        // Seek ahead first, which moves the download there, then play from the start what was skipped over
+        size_t read = 0;
+        size_t middle = remote.TotalFrames() / 2 * remote.FrameSize();
+        if (!ReadAndCompare(remote, local, middle, read)) return 1;
+
+        size_t offset = 0;
+        while (offset < remote.PcmDataSize()) {
+            if (!ReadAndCompare(remote, local, offset, read)) return 1;
+            offset += read;
+        }
+
+        remote.WaitForLoad();
+        if (remote.LoadFailed()) {
+            std::printf("Download reported a failure after all of the data arrived\n");
+            return 1;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("Streamed %zu bytes in %.2f s, all matching the file\n", offset, seconds);
+    } catch (const Exception& e) {
+        std::printf("%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+"""Writes a 16-bit PCM WAV file of a tone sweeping up through the audible range, for tests.
+
+Usage: make_wav.py <out> <seconds> [sample rate] [channels]
+"""
+
+import math
+import struct
+import sys
+import wave
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__.strip())
+
+    path = sys.argv[1]
+    seconds = float(sys.argv[2])
+    rate = int(sys.argv[3]) if len(sys.argv) > 3 else 44100
+    channels = int(sys.argv[4]) if len(sys.argv) > 4 else 2
+
+    frames = int(seconds * rate)
+    phase = 0.0
+    samples = bytearray()
+    for i in range(frames):
+        frequency = 100.0 + 10000.0 * i / max(frames, 1)
+        phase += 2.0 * math.pi * frequency / rate
+        value = int(16000 * math.sin(phase))
+        # Each channel is offset a little so that swapped channels show up
+        samples += b"".join(struct.pack("<h", value // (c + 1)) for c in range(channels))
+
+    with wave.open(path, "wb") as out:
+        out.setnchannels(channels)
+        out.setsampwidth(2)
+        out.setframerate(rate)
+        out.writeframes(bytes(samples))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Serves the files of a directory over HTTP with byte range requests, like a slow and unreliable web server.
+
+Responses are sent in small steps at a jittery rate, and some are cut off part way by closing the connection, which
+is what HttpReader has to cope with when streaming songs from the web.
+
+Usage: range_server.py <root> <port file> [--rate BYTES_PER_SECOND] [--drop PROBABILITY] [--seed SEED]
+
+The server listens on a free port of 127.0.0.1, which it writes to the port file once it is ready.
+"""
+
+import argparse
+import http.server
+import os
+import random
+import re
+import socketserver
+import time
+
+STEP = 8192  # Bytes sent at a time
+
+
+class RangeHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def send_empty(self, status, content_range=None):
+        self.send_response(status)
+        if content_range:
+            self.send_header("Content-Range", content_range)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def do_GET(self):
+        path = os.path.join(self.server.root, self.path.lstrip("/").split("?")[0])
+        if not os.path.isfile(path):
+            self.send_empty(404)
+            return
+
+        size = os.path.getsize(path)
+        match = re.fullmatch(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+        if match:
+            first = int(match.group(1))
+            last = min(int(match.group(2)) if match.group(2) else size - 1, size - 1)
+            if first >= size:
+                self.send_empty(416, f"bytes */{size}")
+                return
+        else:
+            first, last = 0, size - 1
+
+        with open(path, "rb") as file:
+            file.seek(first)
+            data = file.read(last - first + 1)
+
+        self.send_response(206 if match else 200)
+        if match:
+            self.send_header("Content-Range", f"bytes {first}-{last}/{size}")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+
+        # A dropped response stops at a random point, sometimes before any of the body was sent
+        rng = self.server.rng
+        drop_at = rng.randrange(len(data) + 1) if rng.random() < self.server.drop else None
+        for offset in range(0, len(data), STEP):
+            if drop_at is not None and offset + STEP > drop_at:
+                self.wfile.write(data[offset:drop_at])
+                self.close_connection = True
+                return
+            self.wfile.write(data[offset:offset + STEP])
+            if self.server.rate:
+                self.wfile.flush()
+                time.sleep(STEP / self.server.rate * rng.uniform(0.3, 1.7))
+
+
+class RangeServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("root", help="directory to serve")
+    parser.add_argument("port_file", help="file to write the port to once listening")
+    parser.add_argument("--rate", type=float, default=0, help="bytes per second to send at, 0 for unlimited")
+    parser.add_argument("--drop", type=float, default=0, help="probability of cutting a response off")
+    parser.add_argument("--seed", type=int, default=None, help="seed for the jitter and drops")
+    args = parser.parse_args()
+
+    server = RangeServer(("127.0.0.1", 0), RangeHandler)
+    server.root = args.root
+    server.rate = args.rate
+    server.drop = args.drop
+    server.rng = random.Random(args.seed)
+
+    # Written in one go, so whoever waits for the file never reads half a port number
+    tmp_path = args.port_file + ".tmp"
+    with open(tmp_path, "w") as port_file:
+        port_file.write(f"{server.server_address[1]}\n")
+    os.rename(tmp_path, args.port_file)
+
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
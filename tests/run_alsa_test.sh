@@ -0,0 +1,22 @@
+#!/bin/sh
+# Plays a generated song through the ALSA engine into ALSA's file plugin and checks that every frame was written.
+#
+# Usage: run_alsa_test.sh <alsa_test>
+#
+# Exits with 77, which CTest reports as skipped, if Python 3 is not installed or ALSA has no file plugin to play into.
+
+set -u
+
+test_binary=$1
+tests_dir=$(dirname "$0")
+
+if ! command -v python3 >/dev/null 2>&1; then
+    echo "python3 is not installed, skipping"
+    exit 77
+fi
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT INT TERM
+
+python3 "$tests_dir/make_wav.py" "$work/song.wav" 2 || exit 1
+"$test_binary" "$work/song.wav" "$work/recording.raw"
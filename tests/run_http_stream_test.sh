@@ -0,0 +1,47 @@
+#!/bin/sh
+# Streams a generated song from range_server.py, throttled and dropping connections, and checks that what arrives
+# matches the file.
+#
+# Usage: run_http_stream_test.sh <http_stream_test> [rate] [drop probability]
+#
+# Exits with 77, which CTest reports as skipped, if Python 3 is not installed.
+
+set -u
+
+test_binary=$1
+rate=${2:-2000000}
+drop=${3:-0.15}
+tests_dir=$(dirname "$0")
+
+if ! command -v python3 >/dev/null 2>&1; then
+    echo "python3 is not installed, skipping"
+    exit 77
+fi
+
+work=$(mktemp -d)
+server_pid=
+cleanup() {
+    if [ -n "$server_pid" ]; then kill "$server_pid" 2>/dev/null; wait "$server_pid" 2>/dev/null; fi
+    rm -rf "$work"
+}
+trap cleanup EXIT INT TERM
+
+python3 "$tests_dir/make_wav.py" "$work/song.wav" 10 || exit 1
+
+# The seed keeps the jitter and drops the same from run to run
+python3 "$tests_dir/range_server.py" "$work" "$work/port" --rate "$rate" --drop "$drop" --seed 1 \
+    >"$work/server.log" 2>&1 &
+server_pid=$!
+
+tries=0
+while [ ! -f "$work/port" ]; do
+    tries=$((tries + 1))
+    if [ "$tries" -gt 50 ] || ! kill -0 "$server_pid" 2>/dev/null; then
+        echo "range_server.py did not start:"
+        cat "$work/server.log"
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$test_binary" "http://127.0.0.1:$(cat "$work/port")/song.wav" "$work/song.wav"
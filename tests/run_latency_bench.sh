@@ -0,0 +1,57 @@
+#!/bin/sh
+# Runs the control latency benchmark against a private PulseAudio server with a null sink, so the result does not
+# depend on the sound card, and compares it to a baseline. If the baseline does not exist yet, this run records it,
+# noting the machine it was measured on.
+#
+# Usage: run_latency_bench.sh <player> <baseline> [iterations]
+#
+# Exits with 77, which CTest reports as skipped, if PulseAudio or Python 3 is not installed.
+
+set -u
+
+player=$1
+baseline=$2
+iterations=${3:-10}
+tests_dir=$(dirname "$0")
+
+if ! command -v pulseaudio >/dev/null 2>&1; then
+    echo "pulseaudio is not installed, skipping"
+    exit 77
+fi
+if ! command -v python3 >/dev/null 2>&1 || [ ! -f "$tests_dir/make_wav.py" ]; then
+    echo "python3 or make_wav.py is missing, skipping"
+    exit 77
+fi
+
+work=$(mktemp -d)
+server_pid=
+cleanup() {
+    if [ -n "$server_pid" ]; then kill "$server_pid" 2>/dev/null; wait "$server_pid" 2>/dev/null; fi
+    rm -rf "$work"
+}
+trap cleanup EXIT INT TERM
+
+mkdir "$work/songs" "$work/runtime"
+for i in 1 2 3; do
+    python3 "$tests_dir/make_wav.py" "$work/songs/song$i.wav" 5 || exit 1
+done
+
+# The server gets a home of its own, so it neither touches nor depends on the user's PulseAudio setup
+HOME=$work XDG_RUNTIME_DIR=$work/runtime pulseaudio -n --daemonize=no --exit-idle-time=-1 --use-pid-file=no \
+    -L module-null-sink -L "module-native-protocol-unix auth-anonymous=1 socket=$work/pulse.sock" \
+    >"$work/pulse.log" 2>&1 &
+server_pid=$!
+
+tries=0
+while [ ! -S "$work/pulse.sock" ]; do
+    tries=$((tries + 1))
+    if [ "$tries" -gt 50 ] || ! kill -0 "$server_pid" 2>/dev/null; then
+        echo "PulseAudio did not start:"
+        cat "$work/pulse.log"
+        exit 1
+    fi
+    sleep 0.1
+done
+
+PULSE_SERVER=unix:$work/pulse.sock HOME=$work "$player" --bench-latency="$iterations" --baseline "$baseline" \
+    "$work/songs"